@@ -8,6 +8,7 @@
 
 #include "caw.pb.h"
 #include "caw/caw_client.h"
+#include "common/tracing.h"
 
 using std::cout;
 using std::endl;
@@ -31,6 +32,10 @@ DEFINE_string(read, "", "Reads the caw thread starting at the given id");
 DEFINE_bool(profile, false, "Gets the user’s profile of following and followers");
 DEFINE_bool(hook_all, false, "Hooks all Caw functions to the Faz layer.");
 DEFINE_bool(unhook_all, false, "Unhooks all Caw functions from the Faz layer.");
+DEFINE_double(trace_sample_rate, 0, "Fraction (0 to 1) of commands to trace "
+              "through the Faz and kvstore servers.");
+DEFINE_string(trace_file, "", "File to export the spans of traced commands "
+              "to, in the Chrome trace event format.");
 DEFINE_validator(port, &ValidatePort);
 
 // Outputs a ProfileReply message to an output stream.
@@ -70,6 +75,12 @@ ostream& operator<<(ostream& os, const caw::Caw& caw) {
 int main(int argc, char *argv[]) {
   gflags::SetUsageMessage("Caw command-line tool Usage");
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  Tracer::Get().SetSampleRate(FLAGS_trace_sample_rate);
+  if (!FLAGS_trace_file.empty() &&
+      !Tracer::Get().StartExport(FLAGS_trace_file)) {
+    cout << "Failed to open the trace file " << FLAGS_trace_file << endl;
+    return 1;
+  }
 
   // Instantiate the client. It requires a channel, out of which the actual RPCs
   // are created. This channel models a connection to an endpoint (in this case,
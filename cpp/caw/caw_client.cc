@@ -1,5 +1,6 @@
 #include "caw/caw_client.h"
 
+#include <algorithm>
 #include <iostream>
 #include <optional>
 #include <string>
@@ -9,13 +10,18 @@
 #include <grpcpp/grpcpp.h>
 
 #include "caw.grpc.pb.h"
+#include "common/tracing.h"
 #include "faz.grpc.pb.h"
 
 using faz::EventReply;
 using faz::EventRequest;
+using faz::EventResult;
+using faz::EventsReply;
+using faz::EventsRequest;
 using google::protobuf::Any;
 using grpc::ClientContext;
 using grpc::Status;
+using grpc::StatusCode;
 using std::cout;
 using std::endl;
 using std::string;
@@ -72,7 +78,9 @@ bool CawClient::RegisterUser(const string& username) {
   caw::RegisteruserRequest inner_request;
   inner_request.set_username(username);
   // Make the generic request.
+  ScopedSpan span("caw_client.RegisterUser", CurrentTraceContext());
   ClientContext context;
+  InjectTraceContext(&context);
   EventRequest request;
   EventReply response;
   request.set_event_type(EventType::kRegisterUser);
@@ -93,7 +101,9 @@ bool CawClient::Follow(const string& username, const string& to_follow) {
   inner_request.set_username(username);
   inner_request.set_to_follow(to_follow);
   // Make the generic request.
+  ScopedSpan span("caw_client.Follow", CurrentTraceContext());
   ClientContext context;
+  InjectTraceContext(&context);
   EventRequest request;
   EventReply response;
   request.set_event_type(EventType::kFollow);
@@ -114,7 +124,9 @@ std::optional<caw::ProfileReply> CawClient::Profile(
   caw::ProfileRequest inner_request;
   inner_request.set_username(username);
   // Make the generic request.
+  ScopedSpan span("caw_client.Profile", CurrentTraceContext());
   ClientContext context;
+  InjectTraceContext(&context);
   EventRequest request;
   EventReply response;
   request.set_event_type(EventType::kProfile);
@@ -141,7 +153,9 @@ std::optional<caw::Caw> CawClient::Caw(
   inner_request.set_text(text);
   inner_request.set_parent_id(parent_id);
   // Make the generic request.
+  ScopedSpan span("caw_client.Caw", CurrentTraceContext());
   ClientContext context;
+  InjectTraceContext(&context);
   EventRequest request;
   EventReply response;
   request.set_event_type(EventType::kCaw);
@@ -165,7 +179,9 @@ vector<caw::Caw> CawClient::Read(const string &caw_id) {
   caw::ReadRequest inner_request;
   inner_request.set_caw_id(caw_id);
   // Make the generic request.
+  ScopedSpan span("caw_client.Read", CurrentTraceContext());
   ClientContext context;
+  InjectTraceContext(&context);
   EventRequest request;
   EventReply response;
   request.set_event_type(EventType::kRead);
@@ -183,3 +199,117 @@ vector<caw::Caw> CawClient::Read(const string &caw_id) {
   auto& caws = inner_response.caws();
   return vector<caw::Caw>(caws.begin(), caws.end());
 }
+
+vector<bool> CawClient::RegisterUsers(const vector<string>& usernames) {
+  vector<EventRequest> events(usernames.size());
+  for (size_t i = 0; i < usernames.size(); ++i) {
+    caw::RegisteruserRequest inner_request;
+    inner_request.set_username(usernames[i]);
+    events[i].set_event_type(EventType::kRegisterUser);
+    events[i].mutable_payload()->PackFrom(inner_request);
+  }
+  vector<bool> registered;
+  for (const EventResult& result : SendEvents(events)) {
+    registered.push_back(result.code() == StatusCode::OK);
+  }
+  return registered;
+}
+
+vector<bool> CawClient::FollowAll(const string& username,
+                                  const vector<string>& to_follow) {
+  vector<EventRequest> events(to_follow.size());
+  for (size_t i = 0; i < to_follow.size(); ++i) {
+    caw::FollowRequest inner_request;
+    inner_request.set_username(username);
+    inner_request.set_to_follow(to_follow[i]);
+    events[i].set_event_type(EventType::kFollow);
+    events[i].mutable_payload()->PackFrom(inner_request);
+  }
+  vector<bool> followed;
+  for (const EventResult& result : SendEvents(events)) {
+    followed.push_back(result.code() == StatusCode::OK);
+  }
+  return followed;
+}
+
+vector<std::optional<caw::ProfileReply>> CawClient::Profiles(
+    const vector<string>& usernames) {
+  vector<EventRequest> events(usernames.size());
+  for (size_t i = 0; i < usernames.size(); ++i) {
+    caw::ProfileRequest inner_request;
+    inner_request.set_username(usernames[i]);
+    events[i].set_event_type(EventType::kProfile);
+    events[i].mutable_payload()->PackFrom(inner_request);
+  }
+  vector<std::optional<caw::ProfileReply>> profiles;
+  for (const EventResult& result : SendEvents(events)) {
+    caw::ProfileReply inner_response;
+    if (result.code() != StatusCode::OK || !result.has_payload() ||
+        !result.payload().UnpackTo(&inner_response)) {
+      profiles.emplace_back();
+      continue;
+    }
+    profiles.push_back(std::move(inner_response));
+  }
+  return profiles;
+}
+
+vector<std::optional<caw::Caw>> CawClient::Caws(
+    const string& username, const vector<string>& texts) {
+  vector<EventRequest> events(texts.size());
+  for (size_t i = 0; i < texts.size(); ++i) {
+    caw::CawRequest inner_request;
+    inner_request.set_username(username);
+    inner_request.set_text(texts[i]);
+    events[i].set_event_type(EventType::kCaw);
+    events[i].mutable_payload()->PackFrom(inner_request);
+  }
+  vector<std::optional<caw::Caw>> caws;
+  for (const EventResult& result : SendEvents(events)) {
+    caw::CawReply inner_response;
+    if (result.code() != StatusCode::OK || !result.has_payload() ||
+        !result.payload().UnpackTo(&inner_response) ||
+        !inner_response.has_caw()) {
+      caws.emplace_back();
+      continue;
+    }
+    caws.push_back(inner_response.caw());
+  }
+  return caws;
+}
+
+vector<EventResult> CawClient::SendEvents(const vector<EventRequest>& events) {
+  vector<EventResult> results;
+  for (size_t start = 0; start < events.size(); start += kMaxBatchSize) {
+    size_t end = std::min(start + kMaxBatchSize, events.size());
+    ScopedSpan span("caw_client.events", CurrentTraceContext());
+    ClientContext context;
+    InjectTraceContext(&context);
+    EventsRequest request;
+    EventsReply response;
+    for (size_t i = start; i < end; ++i) {
+      *request.add_events() = events[i];
+    }
+    // Make RPC to the Faz service.
+    Status status = stub_->events(&context, request, &response);
+    if (status.ok() &&
+        response.results_size() != static_cast<int>(end - start)) {
+      status = Status(StatusCode::INTERNAL, "Wrong number of results.");
+    }
+    if (!status.ok()) {
+      cout << status.error_message() << endl;
+      EventResult failed;
+      failed.set_code(status.error_code());
+      failed.set_message(status.error_message());
+      results.insert(results.end(), end - start, failed);
+      continue;
+    }
+    for (EventResult& result : *response.mutable_results()) {
+      if (result.code() != StatusCode::OK) {
+        cout << result.message() << endl;
+      }
+      results.push_back(std::move(result));
+    }
+  }
+  return results;
+}
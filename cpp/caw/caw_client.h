@@ -5,6 +5,7 @@
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <grpcpp/grpcpp.h>
 
@@ -17,6 +18,8 @@ class CawClient {
  public:
   // Caw event types to register with the corresponding functions.
   enum EventType { kRegisterUser, kFollow, kProfile, kCaw, kRead };
+  // Maximum number of events sent in a single call by the batch methods.
+  static const size_t kMaxBatchSize = 500;
 
   CawClient(std::shared_ptr<grpc::Channel> channel)
       : stub_(faz::FazService::NewStub(channel)) {}
@@ -49,7 +52,34 @@ class CawClient {
   // messages of all threads read.
   std::vector<caw::Caw> Read(const std::string& caw_id);
 
+  // Batch versions of the methods above, which send one event per item
+  // in as few calls as possible, and return the outcome of each item in
+  // the order given. Events of a batch may be executed concurrently.
+
+  // Registers all the users, and returns true for each user registered.
+  std::vector<bool> RegisterUsers(const std::vector<std::string>& usernames);
+
+  // Makes the user follow all the others, and returns true for each
+  // user followed.
+  std::vector<bool> FollowAll(const std::string& username,
+                              const std::vector<std::string>& to_follow);
+
+  // Returns the profile of each user, if found.
+  std::vector<std::optional<caw::ProfileReply>> Profiles(
+      const std::vector<std::string>& usernames);
+
+  // Posts a caw of the user for each text, and returns each Caw message
+  // posted. Caws posted concurrently may be timestamped out of order.
+  std::vector<std::optional<caw::Caw>> Caws(
+      const std::string& username, const std::vector<std::string>& texts);
+
  private:
+  // Sends the events in batches of at most `kMaxBatchSize`, and returns
+  // their results in order. Events of a batch failed as a whole get the
+  // status of the batch.
+  std::vector<faz::EventResult> SendEvents(
+      const std::vector<faz::EventRequest>& events);
+
   // Table that maps a Caw event type to the predefined function
   // name known by the Faz service.
   static const std::unordered_map<EventType, std::string> kFuncs;
@@ -2,16 +2,20 @@
 
 #include <chrono>
 #include <cstdlib>
-#include <deque>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 
 #include "caw.pb.h"
 
 using google::protobuf::Any;
+using google::protobuf::Arena;
 using grpc::Status;
 using grpc::StatusCode;
 using std::endl;
@@ -26,6 +30,28 @@ const string kFollowingPairPrefix = "following_pair.";
 const string kCawPrefix = "caw.";
 const string kReplyPrefix = "caw_reply.";
 
+// The arena the messages of a call of a handler are allocated on, so
+// that they are freed all at once: the one of the reply payload, which
+// Faz sets up for each call, or else (e.g. when called directly) one of
+// its own.
+class CallArena {
+ public:
+  explicit CallArena(Any* out) : own_(), arena_(out->GetArena()) {
+    if (!arena_) {
+      own_.reset(new Arena);
+      arena_ = own_.get();
+    }
+  }
+
+  // Returns a new message on the arena.
+  template <typename Message>
+  Message* New() { return Arena::CreateMessage<Message>(arena_); }
+
+ private:
+  std::unique_ptr<Arena> own_;
+  Arena* arena_;
+};
+
 // Returns true if the user exists in the KVStore.
 bool UserExists(const string& username, KVStoreInterface* kvstore){
   string key = kUserPrefix + username;
@@ -58,9 +84,10 @@ string GenerateRandomID(int length) {
 Status caw::handler::RegisterUser(const Any* in, Any* out,
                                   KVStoreInterface* kvstore) {
   // Unpack the request message.
-  caw::RegisteruserRequest request;
-  in->UnpackTo(&request);
-  string username = request.username();
+  CallArena arena(out);
+  auto request = arena.New<caw::RegisteruserRequest>();
+  in->UnpackTo(request);
+  const string& username = request->username();
   // Check the existence of the user.
   if (UserExists(username, kvstore)) {
     return Status(StatusCode::ALREADY_EXISTS, "User already exists.");
@@ -72,18 +99,18 @@ Status caw::handler::RegisterUser(const Any* in, Any* out,
                   "Failed to add user to the kvstore.");
   }
   // Pack the response message.
-  caw::RegisteruserReply response;
-  out->PackFrom(response);
+  out->PackFrom(*arena.New<caw::RegisteruserReply>());
   return Status::OK;
 }
 
 Status caw::handler::Follow(const Any* in, Any* out,
                             KVStoreInterface* kvstore) {
   // Unpack the request message.
-  caw::FollowRequest request;
-  in->UnpackTo(&request);
-  string username = request.username();
-  string to_follow = request.to_follow();
+  CallArena arena(out);
+  auto request = arena.New<caw::FollowRequest>();
+  in->UnpackTo(request);
+  const string& username = request->username();
+  const string& to_follow = request->to_follow();
   // Check the existence of both users.
   if (!UserExists(username, kvstore) || !UserExists(to_follow, kvstore)) {
     return Status(StatusCode::NOT_FOUND, "User not found.");
@@ -119,44 +146,44 @@ Status caw::handler::Follow(const Any* in, Any* out,
                   "Failed to add following to the kvstore.");
   }
   // Pack the response message.
-  caw::FollowReply response;
-  out->PackFrom(response);
+  out->PackFrom(*arena.New<caw::FollowReply>());
   return Status::OK;
 }
 
 Status caw::handler::Profile(const Any *in, Any *out,
                              KVStoreInterface *kvstore) {
   // Unpack the request message.
-  caw::ProfileRequest request;
-  in->UnpackTo(&request);
-  string username = request.username();
+  CallArena arena(out);
+  auto request = arena.New<caw::ProfileRequest>();
+  in->UnpackTo(request);
+  const string& username = request->username();
   // Check the existence of the user.
   if (!UserExists(username, kvstore)) {
     return Status(StatusCode::NOT_FOUND, "User not found.");
   }
   // Get followings and followers from the KVStore and
   // put them into the response message.
-  ProfileReply response;
+  auto response = arena.New<ProfileReply>();
   string key = kUserFollowingsPrefix + username;
   for (string& other : kvstore->Get(key)) {
-    response.add_following(other);
+    response->add_following(std::move(other));
   }
   key = kUserFollowersPrefix + username;
   for (string& other : kvstore->Get(key)) {
-    response.add_followers(other);
+    response->add_followers(std::move(other));
   }
-  out->PackFrom(response);
+  out->PackFrom(*response);
   return Status::OK;
 }
 
 Status caw::handler::Caw(const Any *in, Any *out,
                          KVStoreInterface *kvstore) {
   // Unpack the request message.
-  caw::CawRequest request;
-  in->UnpackTo(&request);
-  string username = request.username();
-  string text = request.text();
-  string parent_id = request.parent_id();
+  CallArena arena(out);
+  auto request = arena.New<caw::CawRequest>();
+  in->UnpackTo(request);
+  const string& username = request->username();
+  const string& parent_id = request->parent_id();
   // Check the existence of the user.
   if (!UserExists(username, kvstore)) {
     return Status(StatusCode::NOT_FOUND, "User not found.");
@@ -165,18 +192,19 @@ Status caw::handler::Caw(const Any *in, Any *out,
   if (!parent_id.empty() && !CawExists(parent_id, kvstore)) {
     return Status(StatusCode::NOT_FOUND, "Caw to reply not found.");
   }
-  // Generate required information and make the Caw message.
+  // Generate required information and make the Caw message, right
+  // in the response message.
+  auto response = arena.New<caw::CawReply>();
+  caw::Caw* caw = response->mutable_caw();
   int64_t us = GetMicrosecondsSinceEpoch();
-  Timestamp* timestamp = new Timestamp();
+  Timestamp* timestamp = caw->mutable_timestamp();
   timestamp->set_seconds(us / 1000000);
   timestamp->set_useconds(us);
   string id = to_string(us) + "-" + GenerateRandomID(4);  // caw id.
-  caw::Caw* caw = new caw::Caw();
   caw->set_username(username);
-  caw->set_text(text);
+  caw->set_text(request->text());
   caw->set_id(id);
   caw->set_parent_id(parent_id);
-  caw->set_allocated_timestamp(timestamp);
   // Store the caw to the KVStore.
   string key = kCawPrefix + id;
   if (!kvstore->Put(key, caw->SerializeAsString())) {
@@ -191,59 +219,72 @@ Status caw::handler::Caw(const Any *in, Any *out,
     }
   }
   // Pack the response message.
-  caw::CawReply response;
-  response.set_allocated_caw(caw);
-  out->PackFrom(response);
+  out->PackFrom(*response);
   return Status::OK;
 }
 
 Status caw::handler::Read(const Any *in, Any *out,
                           KVStoreInterface *kvstore) {
   // Unpack the request message.
-  caw::ReadRequest request;
-  in->UnpackTo(&request);
-  string caw_id = request.caw_id();
+  CallArena arena(out);
+  auto request = arena.New<caw::ReadRequest>();
+  in->UnpackTo(request);
+  const string& caw_id = request->caw_id();
   // Check the existence of the caw.
   if (!CawExists(caw_id, kvstore)) {
     return Status(StatusCode::NOT_FOUND,
                   "Caw " + caw_id + " not found.");
   }
   // Find all threads starting at the given caw and put them
-  // into the caw::ReadReply message in a BFS approach.
-  caw::ReadReply response;
-  std::deque<string> q;  // Queue of threads to read.
-  q.push_back(caw_id);
-  while (!q.empty()) {
-    bool current_caw_success = false;
-    string current_caw_id = q.front();
-    q.pop_front();
-    string key = kCawPrefix + current_caw_id;
-    vector<string> values = kvstore->Get(key);
-    if (values.size() == 1) {
-      // Add the Caw message and populate it with the
-      // information retrieved from the KVStore.
-      caw::Caw* caw = response.add_caws();
-      string caw_str = values[0];
-      if (caw->ParseFromString(caw_str)) {
-        // Get reply ids and add into the queue.
-        key = kReplyPrefix + current_caw_id;
-        vector<string> reply_caw_ids = kvstore->Get(key);
-        q.insert(q.end(), reply_caw_ids.begin(), reply_caw_ids.end());
-        current_caw_success = true;
+  // into the caw::ReadReply message in a BFS approach, one level at a
+  // time: the caws and reply ids of a level are all fetched in a single
+  // multi-get (which the KVStore given, e.g. a Faz context, may split),
+  // and the next level is made of their replies, in the order of the
+  // level.
+  auto response = arena.New<caw::ReadReply>();
+  vector<string> level = {caw_id};  // Threads to read.
+  vector<string> next_level;
+  vector<string> keys;
+  while (!level.empty()) {
+    keys.clear();
+    for (const string& id : level) {
+      keys.push_back(kCawPrefix + id);
+      keys.push_back(kReplyPrefix + id);
+    }
+    vector<vector<string>> values = kvstore->MultiGet(keys);
+    for (size_t i = 0; i < level.size(); ++i) {
+      bool current_caw_success = false;
+      const string& current_caw_id = level[i];
+      vector<string>& caw_values = values[2 * i];
+      if (caw_values.size() == 1) {
+        // Add the Caw message and populate it with the
+        // information retrieved from the KVStore.
+        caw::Caw* caw = response->add_caws();
+        if (caw->ParseFromString(caw_values[0])) {
+          // Add reply ids into the next level.
+          vector<string>& reply_caw_ids = values[2 * i + 1];
+          next_level.insert(
+              next_level.end(),
+              std::make_move_iterator(reply_caw_ids.begin()),
+              std::make_move_iterator(reply_caw_ids.end()));
+          current_caw_success = true;
+        } else {
+          LOG(ERROR) << "Error decoding caw " << current_caw_id;
+        }
       } else {
-        LOG(ERROR) << "Error decoding caw " << current_caw_id;
+        LOG(ERROR) << "Error finding caw " << current_caw_id << ": "
+                   << caw_values.size() << " records found, expected 1.";
+      }
+      // Notify failure.
+      if (!current_caw_success) {
+        return Status(StatusCode::UNAVAILABLE,
+                      "Error reading caw " + current_caw_id + ".");
       }
-    } else {
-      LOG(ERROR) << "Error finding caw " << current_caw_id << ": "
-                 << values.size() << " records found, expected 1.";
-    }
-    // Notify failure.
-    if (!current_caw_success) {
-      return Status(StatusCode::UNAVAILABLE,
-                    "Error reading caw " + current_caw_id + ".");
     }
+    level.swap(next_level);
+    next_level.clear();
   }
   // Pack the response message.
-  out->PackFrom(response);
+  out->PackFrom(*response);
   return Status::OK;
 }
@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+
+#include "caw.pb.h"
+#include "caw/caw_client.h"
+#include "common/histogram.h"
+#include "faz.grpc.pb.h"
+
+using google::protobuf::Any;
+using google::protobuf::Message;
+using grpc::ClientContext;
+using grpc::Status;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+using Clock = std::chrono::steady_clock;
+
+// Returns true if the port specified by the flag is valid.
+static bool ValidatePort(const char* flagname, int32_t value) {
+  if (value > 0 && value < 65536) { return true; }
+  cout << "Invalid value for --" << string(flagname)
+       << ": " << value << endl;
+  return false;
+}
+
+DEFINE_int32(port, 50000, "Port number for the Faz GRPC interface to use.");
+DEFINE_bool(hook_all, true, "Hooks all Caw functions to the Faz layer "
+            "before generating the load.");
+DEFINE_string(prefix, "", "Prefix of the generated usernames. A fresh one "
+              "is made up if empty, so that runs against the same kvstore "
+              "do not collide.");
+DEFINE_int32(users, 1000, "Number of users of the generated social graph.");
+DEFINE_int32(follows_per_user, 10, "Number of distinct users each user of "
+             "the graph follows.");
+DEFINE_int32(seed_caws, 200, "Number of caws posted before the load, each "
+             "replying to an earlier one with probability "
+             "--reply_fraction.");
+DEFINE_double(reply_fraction, 0.5, "Fraction (0 to 1) of the caws posted "
+              "which reply to an existing caw.");
+DEFINE_double(zipf_exponent, 1.0, "Exponent of the power law by which users "
+              "are followed and looked up, and caws replied to and read, "
+              "0 for uniform.");
+DEFINE_string(mix, "RegisterUser:1,Follow:5,Caw:10,Profile:40,Read:44",
+              "Comma-separated <function>:<weight> pairs giving the share "
+              "of each type of event sent.");
+DEFINE_double(rate, 0, "Number of events per second to send at Poisson "
+              "arrival times whether or not earlier ones are done (open "
+              "loop), or 0 to have each thread send its next event once its "
+              "previous one is done (closed loop).");
+DEFINE_int32(threads, 16, "Number of threads sending events, which bounds "
+             "the events in flight.");
+DEFINE_int32(duration_s, 10, "Number of seconds to generate the load for.");
+DEFINE_uint64(seed, 1, "Seed of the random graph and load.");
+DEFINE_validator(port, &ValidatePort);
+
+// Number of Caw event types, and their names in reports.
+constexpr size_t kNumEventTypes = 5;
+const std::array<string, kNumEventTypes> kEventNames = {
+    "RegisterUser", "Follow", "Profile", "Caw", "Read"};
+
+// Draws ranks in [0, n) with a probability proportional to
+// 1 / (rank + 1)^exponent, so that a few low ranks are drawn most of the
+// time.
+class ZipfDistribution {
+ public:
+  ZipfDistribution(size_t n, double exponent) : cdf_(std::max<size_t>(n, 1)) {
+    double sum = 0;
+    for (size_t i = 0; i < cdf_.size(); ++i) {
+      sum += 1 / std::pow(i + 1, exponent);
+      cdf_[i] = sum;
+    }
+  }
+
+  template <class Rng>
+  size_t operator()(Rng& rng) const {
+    double u = std::uniform_real_distribution<double>(0, cdf_.back())(rng);
+    auto iter = std::upper_bound(cdf_.begin(), cdf_.end(), u);
+    return std::min<size_t>(iter - cdf_.begin(), cdf_.size() - 1);
+  }
+
+ private:
+  // Cumulative weights of the ranks.
+  vector<double> cdf_;
+};
+
+// The synthetic social graph the load runs against, immutable once built.
+struct Graph {
+  // Users and seeded caws, ranked by popularity.
+  vector<string> usernames;
+  vector<string> caw_ids;
+  ZipfDistribution user_rank;
+  ZipfDistribution caw_rank;
+};
+
+// Outcomes of the events of each type sent during the load.
+struct LoadStats {
+  // Latency of completed events in nanoseconds, from the time each was
+  // due to be sent.
+  std::array<Histogram, kNumEventTypes> latency;
+  // Number of failed events by type and status code.
+  std::array<std::array<std::atomic<uint64_t>, 17>, kNumEventTypes> failed{};
+};
+
+// Hands out Poisson arrival times at a given rate to the threads
+// sending events.
+class ArrivalSchedule {
+ public:
+  ArrivalSchedule(double rate, Clock::time_point start, uint64_t seed)
+      : mutex_(), next_(start), rng_(seed), gap_s_(rate) {}
+
+  // Returns the time the next event is due to be sent.
+  Clock::time_point Next() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clock::time_point next = next_;
+    next_ += std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(gap_s_(rng_)));
+    return next;
+  }
+
+ private:
+  std::mutex mutex_;
+  Clock::time_point next_;
+  std::mt19937_64 rng_;
+  std::exponential_distribution<double> gap_s_;
+};
+
+// Sends an event of the type with the payload to Faz, and returns its
+// status, with the reply payload in `out` if given.
+Status SendEvent(faz::FazService::Stub* stub, CawClient::EventType type,
+                 const Message& payload, Any* out = nullptr) {
+  ClientContext context;
+  faz::EventRequest request;
+  request.set_event_type(type);
+  request.mutable_payload()->PackFrom(payload);
+  faz::EventReply reply;
+  Status status = stub->event(&context, request, &reply);
+  if (out) {
+    *out = reply.payload();
+  }
+  return status;
+}
+
+// Parses the event mix from `FLAGS_mix` into a weight per event type,
+// and returns false if it is invalid.
+bool ParseMix(std::array<double, kNumEventTypes>* weights) {
+  weights->fill(0);
+  std::stringstream mix(FLAGS_mix);
+  string item;
+  while (std::getline(mix, item, ',')) {
+    size_t colon = item.find(':');
+    auto name = std::find(kEventNames.begin(), kEventNames.end(),
+                          item.substr(0, colon));
+    if (colon == string::npos || name == kEventNames.end()) {
+      return false;
+    }
+    char* end;
+    double weight = std::strtod(item.c_str() + colon + 1, &end);
+    if (*end != '\0' || !(weight >= 0)) {
+      return false;
+    }
+    (*weights)[name - kEventNames.begin()] = weight;
+  }
+  return std::any_of(weights->begin(), weights->end(),
+                     [](double weight) { return weight > 0; });
+}
+
+// Registers the users of the graph, makes each follow
+// `FLAGS_follows_per_user` others drawn by popularity, and posts the
+// seed caws, replying to caws drawn by popularity.
+Graph BuildGraph(CawClient& client, faz::FazService::Stub* stub,
+                 const string& prefix) {
+  int num_users = std::max(FLAGS_users, 1);
+  Graph graph{{}, {}, ZipfDistribution(num_users, FLAGS_zipf_exponent),
+              ZipfDistribution(std::max(FLAGS_seed_caws, 1),
+                               FLAGS_zipf_exponent)};
+  for (int i = 0; i < num_users; ++i) {
+    graph.usernames.push_back(prefix + "user" + std::to_string(i));
+  }
+  vector<bool> registered = client.RegisterUsers(graph.usernames);
+  if (std::count(registered.begin(), registered.end(), true) != num_users) {
+    LOG(FATAL) << "Failed to register the users of the graph.";
+  }
+
+  std::mt19937_64 rng(FLAGS_seed);
+  size_t num_follows = 0;
+  size_t max_follows =
+      std::max(std::min(FLAGS_follows_per_user, num_users - 1), 0);
+  for (const string& username : graph.usernames) {
+    std::unordered_set<size_t> ranks;
+    vector<string> to_follow;
+    // Popular users are drawn again and again, so give up on drawing
+    // distinct ones after a while.
+    for (size_t draws = 0;
+         to_follow.size() < max_follows && draws < 20 * max_follows;
+         ++draws) {
+      size_t rank = graph.user_rank(rng);
+      if (graph.usernames[rank] != username && ranks.insert(rank).second) {
+        to_follow.push_back(graph.usernames[rank]);
+      }
+    }
+    vector<bool> followed = client.FollowAll(username, to_follow);
+    num_follows += std::count(followed.begin(), followed.end(), true);
+  }
+
+  std::bernoulli_distribution reply(FLAGS_reply_fraction);
+  for (int i = 0; i < FLAGS_seed_caws; ++i) {
+    caw::CawRequest request;
+    request.set_username(graph.usernames[graph.user_rank(rng)]);
+    request.set_text("Seed caw " + std::to_string(i));
+    if (i > 0 && reply(rng)) {
+      // Reply to one of the caws posted so far, by popularity.
+      request.set_parent_id(graph.caw_ids[std::min<size_t>(
+          graph.caw_rank(rng), graph.caw_ids.size() - 1)]);
+    }
+    Any out;
+    caw::CawReply caw_reply;
+    if (!SendEvent(stub, CawClient::kCaw, request, &out).ok() ||
+        !out.UnpackTo(&caw_reply)) {
+      LOG(FATAL) << "Failed to post the seed caws.";
+    }
+    graph.caw_ids.push_back(caw_reply.caw().id());
+  }
+  cout << "Graph: " << num_users << " users, " << num_follows
+       << " follows, " << graph.caw_ids.size() << " caws" << endl;
+  return graph;
+}
+
+// Sends an event of the type, made up from the graph, and returns its
+// status. Users registered during the load are numbered by
+// `num_new_users`.
+Status SendRandomEvent(faz::FazService::Stub* stub, const Graph& graph,
+                       const string& prefix, CawClient::EventType type,
+                       std::atomic<uint64_t>& num_new_users,
+                       std::mt19937_64& rng) {
+  std::uniform_int_distribution<size_t> any_user(
+      0, graph.usernames.size() - 1);
+  switch (type) {
+    case CawClient::kRegisterUser: {
+      caw::RegisteruserRequest request;
+      request.set_username(prefix + "new" + std::to_string(num_new_users++));
+      return SendEvent(stub, type, request);
+    }
+    case CawClient::kFollow: {
+      caw::FollowRequest request;
+      request.set_username(graph.usernames[any_user(rng)]);
+      request.set_to_follow(graph.usernames[graph.user_rank(rng)]);
+      return SendEvent(stub, type, request);
+    }
+    case CawClient::kProfile: {
+      caw::ProfileRequest request;
+      request.set_username(graph.usernames[graph.user_rank(rng)]);
+      return SendEvent(stub, type, request);
+    }
+    case CawClient::kCaw: {
+      caw::CawRequest request;
+      request.set_username(graph.usernames[any_user(rng)]);
+      request.set_text("A caw");
+      if (!graph.caw_ids.empty() &&
+          std::bernoulli_distribution(FLAGS_reply_fraction)(rng)) {
+        request.set_parent_id(graph.caw_ids[graph.caw_rank(rng)]);
+      }
+      return SendEvent(stub, type, request);
+    }
+    case CawClient::kRead: {
+      caw::ReadRequest request;
+      if (!graph.caw_ids.empty()) {
+        request.set_caw_id(graph.caw_ids[graph.caw_rank(rng)]);
+      }
+      return SendEvent(stub, type, request);
+    }
+  }
+  return Status(grpc::StatusCode::INVALID_ARGUMENT, "Unknown event type.");
+}
+
+// Prints the throughput and latency percentiles of each event type and
+// of all events, over the load of the given number of seconds.
+void PrintStats(const LoadStats& stats, double seconds) {
+  cout << std::left << std::setw(14) << "event"
+       << std::setw(10) << "events" << std::setw(10) << "failed"
+       << std::setw(12) << "events/s" << std::setw(12) << "p50 (us)"
+       << std::setw(12) << "p90 (us)" << std::setw(12) << "p99 (us)"
+       << std::setw(12) << "max (us)" << endl;
+  auto print = [seconds](const string& name, const HistogramSnapshot& latency,
+                         uint64_t failed) {
+    cout << std::left << std::setw(14) << name
+         << std::setw(10) << latency.count << std::setw(10) << failed
+         << std::setw(12) << std::fixed << std::setprecision(1)
+         << latency.count / seconds << std::defaultfloat
+         << std::setw(12) << latency.Percentile(50) / 1000
+         << std::setw(12) << latency.Percentile(90) / 1000
+         << std::setw(12) << latency.Percentile(99) / 1000
+         << std::setw(12) << latency.max / 1000 << endl;
+  };
+  HistogramSnapshot total;
+  total.buckets.assign(Histogram::kNumBuckets, 0);
+  uint64_t total_failed = 0;
+  std::ostringstream failures;
+  for (size_t type = 0; type < kNumEventTypes; ++type) {
+    HistogramSnapshot latency = stats.latency[type].Snapshot();
+    uint64_t failed = 0;
+    for (size_t code = 0; code < stats.failed[type].size(); ++code) {
+      uint64_t count = stats.failed[type][code];
+      if (count > 0) {
+        failures << " " << kEventNames[type] << "/"
+                 << "code(" << code << ")=" << count;
+      }
+      failed += count;
+    }
+    if (latency.count > 0) {
+      print(kEventNames[type], latency, failed);
+    }
+    total.count += latency.count;
+    total.sum += latency.sum;
+    total.max = std::max(total.max, latency.max);
+    for (size_t i = 0; i < Histogram::kNumBuckets; ++i) {
+      total.buckets[i] += latency.buckets[i];
+    }
+    total_failed += failed;
+  }
+  print("all", total, total_failed);
+  if (total_failed > 0) {
+    cout << "Failures:" << failures.str() << endl;
+  }
+}
+
+// Generates a synthetic power-law social graph on Faz, then sends a mix
+// of Caw events drawn from it for a while, either open or closed loop,
+// and reports the throughput and latency of each event type.
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage("Caw load generator Usage");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  std::array<double, kNumEventTypes> weights;
+  if (!ParseMix(&weights)) {
+    cout << "Invalid value for --mix: " << FLAGS_mix << endl;
+    return 1;
+  }
+  string prefix = FLAGS_prefix;
+  if (prefix.empty()) {
+    prefix = "load" + std::to_string(std::chrono::duration_cast<
+        std::chrono::seconds>(std::chrono::system_clock::now()
+                                  .time_since_epoch()).count()) + ".";
+  }
+
+  auto channel = grpc::CreateChannel(
+      "localhost:" + std::to_string(FLAGS_port),
+      grpc::InsecureChannelCredentials());
+  CawClient client(channel);
+  std::unique_ptr<faz::FazService::Stub> stub =
+      faz::FazService::NewStub(channel);
+  if (FLAGS_hook_all && !client.HookAll()) {
+    LOG(FATAL) << "Failed to hook the Caw functions.";
+  }
+  auto setup_start = Clock::now();
+  Graph graph = BuildGraph(client, stub.get(), prefix);
+  cout << "Built the graph in "
+       << std::chrono::duration<double>(Clock::now() - setup_start).count()
+       << " s" << endl;
+
+  LoadStats stats;
+  std::atomic<uint64_t> num_new_users(0);
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + std::chrono::seconds(FLAGS_duration_s);
+  std::unique_ptr<ArrivalSchedule> schedule;
+  if (FLAGS_rate > 0) {
+    schedule.reset(new ArrivalSchedule(FLAGS_rate, start, FLAGS_seed));
+  }
+  vector<std::thread> threads;
+  for (int t = 0; t < std::max(FLAGS_threads, 1); ++t) {
+    threads.emplace_back([&, t]() {
+      std::mt19937_64 rng(FLAGS_seed + 1 + t);
+      std::discrete_distribution<size_t> mix(weights.begin(), weights.end());
+      while (true) {
+        // An open loop measures the latency from the time an event was
+        // due, so that events held back by slow ones are not missed.
+        Clock::time_point due = schedule ? schedule->Next() : Clock::now();
+        if (due >= end) {
+          break;
+        }
+        std::this_thread::sleep_until(due);
+        auto type = static_cast<CawClient::EventType>(mix(rng));
+        Status status = SendRandomEvent(stub.get(), graph, prefix, type,
+                                        num_new_users, rng);
+        if (status.ok()) {
+          stats.latency[type].RecordSince(due);
+        } else {
+          ++stats.failed[type][std::min<size_t>(status.error_code(), 16)];
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  if (schedule) {
+    cout << "Open loop at " << FLAGS_rate << " events/s";
+  } else {
+    cout << "Closed loop";
+  }
+  cout << " with " << FLAGS_threads << " threads for " << seconds << " s:"
+       << endl;
+  PrintStats(stats, seconds);
+  return 0;
+}
@@ -0,0 +1,208 @@
+#include "common/admission_controller.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+using grpc::Status;
+using grpc::StatusCode;
+using std::string;
+using std::vector;
+
+const double AdmissionController::kQueueDelayWeight = 0.2;
+
+void AdmissionController::SetOptions(const Options& options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  options_ = options;
+}
+
+size_t AdmissionController::AddMethod(const string& name,
+                                      Class request_class,
+                                      const MethodOptions& options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  methods_.push_back({name, request_class, options, 0, 0, 0, 0, 0,
+                      virtual_time_, std::unique_ptr<Histogram>(
+                          new Histogram)});
+  methods_.back().options.weight = std::max<uint32_t>(options.weight, 1);
+  return methods_.size() - 1;
+}
+
+void AdmissionController::SetMethodOptions(size_t index, Class request_class,
+                                           const MethodOptions& options) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Method& method = methods_[index];
+    method.request_class = request_class;
+    method.options = options;
+    method.options.weight = std::max<uint32_t>(options.weight, 1);
+  }
+  // Waiting requests may be able to go under the new limits.
+  cv_.notify_all();
+}
+
+bool AdmissionController::HasSlot(const Method& method) const {
+  size_t max_in_flight = method.options.max_in_flight > 0 ?
+      method.options.max_in_flight : options_.max_in_flight_per_method;
+  return (options_.max_in_flight == 0 ||
+          in_flight_ < options_.max_in_flight) &&
+      (max_in_flight == 0 || method.in_flight < max_in_flight);
+}
+
+bool AdmissionController::GoesFirst(const Method& other,
+                                    const Method& method) const {
+  Class first;
+  switch (options_.priority) {
+    case kReadsFirst: first = kRead; break;
+    case kWritesFirst: first = kWrite; break;
+    default: return false;
+  }
+  return other.request_class == first && method.request_class != first;
+}
+
+bool AdmissionController::MayGo(const Method& method) const {
+  if (!HasSlot(method)) {
+    return false;
+  }
+  if (waiting_ == 0) {
+    return true;
+  }
+  // Leave the slot to a waiting request of a method of the prioritized
+  // class, or else of a method further behind its fair share, unless
+  // it could not take the slot anyway.
+  for (const Method& other : methods_) {
+    if (&other == &method || other.waiting == 0 || !HasSlot(other)) {
+      continue;
+    }
+    if (GoesFirst(other, method) ||
+        (!GoesFirst(method, other) && other.pass < method.pass)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AdmissionController::UpdateQueueDelay(Class request_class,
+                                           double delay_ms) {
+  double& average = queue_delay_ms_[request_class];
+  average += kQueueDelayWeight * (delay_ms - average);
+}
+
+Status AdmissionController::Admit(size_t index,
+                                  const grpc::ServerContext* context,
+                                  Ticket* ticket) {
+  return Admit(index, context, true, ticket);
+}
+
+void AdmissionController::AdmitAccepted(size_t index, Ticket* ticket) {
+  Admit(index, nullptr, false, ticket);
+}
+
+Status AdmissionController::Admit(size_t index,
+                                  const grpc::ServerContext* context,
+                                  bool may_shed, Ticket* ticket) {
+  using Clock = std::chrono::steady_clock;
+  std::unique_lock<std::mutex> lock(mutex_);
+  Method& method = methods_[index];
+  Class request_class = method.request_class;
+  if (method.waiting == 0) {
+    // A method with no backlog competes from the current virtual time.
+    method.pass = std::max(method.pass, virtual_time_);
+  }
+  auto start = Clock::now();
+  if (!MayGo(method)) {
+    if (may_shed && options_.shed_queue_delay.count() > 0 &&
+        queue_delay_ms_[request_class] > options_.shed_queue_delay.count()) {
+      ++method.shed_overloaded;
+      return Status(StatusCode::RESOURCE_EXHAUSTED,
+                    "The server is overloaded, try again later.");
+    }
+    // Wait for a slot until the budget or the deadline of the request
+    // runs out, whichever comes first, or else for as long as it takes.
+    auto budget = std::chrono::duration_cast<Clock::duration>(
+        options_.queue_budget);
+    if (context != nullptr) {
+      auto remaining = context->deadline() - std::chrono::system_clock::now();
+      if (remaining < budget) {
+        budget = std::chrono::duration_cast<Clock::duration>(remaining);
+      }
+    }
+    auto deadline = start + budget;
+    ++method.waiting;
+    ++waiting_;
+    bool admitted = true;
+    if (may_shed) {
+      admitted = cv_.wait_until(lock, deadline,
+                                [&]() { return MayGo(method); });
+    } else {
+      cv_.wait(lock, [&]() { return MayGo(method); });
+    }
+    --method.waiting;
+    --waiting_;
+    UpdateQueueDelay(request_class, std::chrono::duration<double, std::milli>(
+        Clock::now() - start).count());
+    if (!admitted) {
+      ++method.shed_timed_out;
+      // Whoever is next in line may be able to go now.
+      cv_.notify_all();
+      return Status(StatusCode::RESOURCE_EXHAUSTED,
+                    "Timed out waiting for the server, try again later.");
+    }
+  } else {
+    UpdateQueueDelay(request_class, 0);
+  }
+  ++method.admitted;
+  ++method.in_flight;
+  ++in_flight_;
+  virtual_time_ = std::max(virtual_time_, method.pass);
+  method.pass += 1.0 / method.options.weight;
+  method.queue_wait->RecordSince(start);
+  ticket->controller_ = this;
+  ticket->method_ = index;
+  if (waiting_ > 0) {
+    // Requests of other methods may be next in line now, and take the
+    // slots left if any.
+    lock.unlock();
+    cv_.notify_all();
+  }
+  return Status::OK;
+}
+
+void AdmissionController::Release(size_t index) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --methods_[index].in_flight;
+    --in_flight_;
+  }
+  cv_.notify_all();
+}
+
+vector<AdmissionController::MethodStats> AdmissionController::GetStats()
+    const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  vector<MethodStats> stats;
+  for (const Method& method : methods_) {
+    stats.push_back({method.name, method.options, method.admitted,
+                     method.shed_overloaded, method.shed_timed_out,
+                     method.in_flight, method.waiting,
+                     method.queue_wait->Snapshot()});
+  }
+  return stats;
+}
+
+bool AdmissionController::ParsePriority(const string& name,
+                                        Priority* priority) {
+  if (name == "none") {
+    *priority = kNoPriority;
+  } else if (name == "reads") {
+    *priority = kReadsFirst;
+  } else if (name == "writes") {
+    *priority = kWritesFirst;
+  } else {
+    return false;
+  }
+  return true;
+}
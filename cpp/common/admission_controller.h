@@ -0,0 +1,209 @@
+#ifndef CSCI499_CHENGTSU_ADMISSION_CONTROLLER_H
+#define CSCI499_CHENGTSU_ADMISSION_CONTROLLER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "common/histogram.h"
+
+// Decides whether a request may be served now, should wait for other
+// requests to finish first, or should be rejected because the server is
+// overloaded, so that a traffic spike turns into fast RESOURCE_EXHAUSTED
+// replies instead of requests queued until their callers give up.
+//
+// Requests are grouped by method (usually an RPC method), and each method
+// serves either reads or writes. The controller limits the requests being
+// served at once, over all methods and per method. A request that finds
+// no free slot waits for one for at most a queue budget (or until its
+// deadline), and is rejected early if requests of its class recently had
+// to wait longer than a threshold on average. Either reads or writes can
+// be given priority: they take freed slots before the other class.
+//
+// Each method is a lane of its own, with its own limit and a weight:
+// when requests of several methods wait for slots, freed slots are
+// shared among the methods in proportion to their weights (by stride
+// scheduling), so that a burst of one method only delays the others by
+// their fair share, and a full method never holds the others back.
+class AdmissionController {
+ public:
+  // Class of requests a method serves.
+  enum Class { kRead = 0, kWrite = 1 };
+
+  // Class of requests taking freed slots first.
+  enum Priority { kNoPriority, kReadsFirst, kWritesFirst };
+
+  struct Options {
+    // Maximum number of requests served at once, 0 for no limit.
+    size_t max_in_flight = 0;
+    // Maximum number of requests of a method served at once,
+    // 0 for no limit.
+    size_t max_in_flight_per_method = 0;
+    // Maximum time a request waits for a slot before it is rejected.
+    std::chrono::milliseconds queue_budget{100};
+    // Requests that find no free slot are rejected right away while the
+    // average time requests of their class waited exceeds this,
+    // 0 to always let them wait.
+    std::chrono::milliseconds shed_queue_delay{0};
+    Priority priority = kNoPriority;
+  };
+
+  // Limits of a method.
+  struct MethodOptions {
+    // Maximum number of requests of the method served at once,
+    // 0 for the `max_in_flight_per_method` of the controller.
+    size_t max_in_flight = 0;
+    // Share of the freed slots the method gets while requests of
+    // several methods wait, relative to the others. At least 1.
+    uint32_t weight = 1;
+  };
+
+  // Counters of a method.
+  struct MethodStats {
+    std::string name;
+    MethodOptions options;
+    // Number of requests admitted so far.
+    uint64_t admitted;
+    // Number of requests rejected right away because of queueing delay.
+    uint64_t shed_overloaded;
+    // Number of requests rejected after waiting out their budget.
+    uint64_t shed_timed_out;
+    // Number of requests being served.
+    size_t in_flight;
+    // Number of requests waiting for a slot.
+    size_t waiting;
+    // Time admitted requests waited for a slot, in nanoseconds.
+    HistogramSnapshot queue_wait;
+  };
+
+  // A slot held by an admitted request, released upon destruction.
+  class Ticket {
+   public:
+    Ticket() : controller_(nullptr), method_(0) {}
+    Ticket(const Ticket&) = delete;
+    Ticket& operator=(const Ticket&) = delete;
+
+    ~Ticket() {
+      if (controller_ != nullptr) {
+        controller_->Release(method_);
+      }
+    }
+
+   private:
+    friend class AdmissionController;
+
+    AdmissionController* controller_;
+    size_t method_;
+  };
+
+  AdmissionController()
+      : mutex_(), cv_(), options_(), methods_(), in_flight_(0),
+        waiting_(0), queue_delay_ms_{0, 0}, virtual_time_(0) {}
+
+  // Replaces the options. Expected to be called before serving requests.
+  void SetOptions(const Options& options);
+
+  // Adds a method serving requests of the given class, and returns
+  // the index to admit its requests with. May be called while serving
+  // requests of the other methods.
+  size_t AddMethod(const std::string& name, Class request_class,
+                   const MethodOptions& options);
+  size_t AddMethod(const std::string& name, Class request_class) {
+    return AddMethod(name, request_class, MethodOptions());
+  }
+
+  // Replaces the class and limits of a method, e.g. when an event type
+  // is hooked with another function. Requests already admitted keep
+  // their slots.
+  void SetMethodOptions(size_t method, Class request_class,
+                        const MethodOptions& options);
+
+  // Admits a request of the given method, waiting for a slot if needed,
+  // and returns OK with the slot held by `ticket`, or RESOURCE_EXHAUSTED
+  // if the request is rejected. `context` may be null, otherwise the
+  // request waits no longer than its deadline.
+  grpc::Status Admit(size_t method, const grpc::ServerContext* context,
+                     Ticket* ticket);
+
+  // Admits a request of the given method that must not be rejected
+  // (e.g. work already accepted), waiting for a slot for as long as it
+  // takes, with the slot held by `ticket`.
+  void AdmitAccepted(size_t method, Ticket* ticket);
+
+  // Returns the counters of each method, in the order they were added.
+  std::vector<MethodStats> GetStats() const;
+
+  // Parses "none", "reads" or "writes" into `priority`, and returns true
+  // on success.
+  static bool ParsePriority(const std::string& name, Priority* priority);
+
+ private:
+  // Admits a request as `Admit()` does, or as `AdmitAccepted()` does
+  // unless `may_shed`.
+  grpc::Status Admit(size_t method, const grpc::ServerContext* context,
+                     bool may_shed, Ticket* ticket);
+
+  struct Method {
+    std::string name;
+    Class request_class;
+    MethodOptions options;
+    size_t in_flight;
+    size_t waiting;
+    uint64_t admitted;
+    uint64_t shed_overloaded;
+    uint64_t shed_timed_out;
+    // Virtual time of the next request of the method: the lowest goes
+    // first, and each admission moves it forward by 1 / weight.
+    double pass;
+    std::unique_ptr<Histogram> queue_wait;
+  };
+
+  // Returns true if a request of the method may take a slot now. Assume
+  // the caller always holds `mutex_`.
+  bool MayGo(const Method& method) const;
+
+  // Returns true if the method has a slot for one more request, ignoring
+  // other waiting requests. Assume the caller always holds `mutex_`.
+  bool HasSlot(const Method& method) const;
+
+  // Returns true if requests of `other` take freed slots before those
+  // of the method under the priority. Assume the caller always holds
+  // `mutex_`.
+  bool GoesFirst(const Method& other, const Method& method) const;
+
+  // Adds a measured queueing delay to the moving average of the class.
+  // Assume the caller always holds `mutex_`.
+  void UpdateQueueDelay(Class request_class, double delay_ms);
+
+  // Releases a slot held by a request of the method.
+  void Release(size_t method);
+
+  // Weight of the latest queueing delay in the moving average.
+  static const double kQueueDelayWeight;
+
+  mutable std::mutex mutex_;
+  // Signaled whenever a slot is released.
+  std::condition_variable cv_;
+  Options options_;
+  // Methods, in a deque so that waiting requests keep theirs while
+  // methods are added.
+  std::deque<Method> methods_;
+  // Number of requests being served over all methods.
+  size_t in_flight_;
+  // Number of requests waiting for a slot over all methods.
+  size_t waiting_;
+  // Moving average of the time requests waited for a slot, per class.
+  double queue_delay_ms_[2];
+  // Pass of the latest admitted request, from which methods that were
+  // idle start again, so that idling earns them no extra share.
+  double virtual_time_;
+};
+
+#endif //CSCI499_CHENGTSU_ADMISSION_CONTROLLER_H
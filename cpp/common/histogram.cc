@@ -0,0 +1,91 @@
+#include "common/histogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+size_t MetricShardIndex() {
+  // Assign shards to threads in a round-robin manner
+  // the first time each thread records something.
+  static std::atomic<size_t> next_index(0);
+  thread_local size_t index = next_index++ % kNumMetricShards;
+  return index;
+}
+
+double HistogramSnapshot::Mean() const {
+  return count == 0 ? 0 : static_cast<double>(sum) / count;
+}
+
+uint64_t HistogramSnapshot::Percentile(double percentile) const {
+  if (count == 0) {
+    return 0;
+  }
+  // Find the bucket holding the value of the given rank.
+  uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(percentile / 100 * count)));
+  if (rank >= count) {
+    return max;
+  }
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+    seen += buckets[bucket];
+    if (seen >= rank) {
+      // Report the middle of the bucket, but never more than the maximum.
+      uint64_t lower = Histogram::BucketLowerBound(bucket);
+      uint64_t upper = bucket + 1 < Histogram::kNumBuckets ?
+          Histogram::BucketLowerBound(bucket + 1) : lower + 1;
+      return std::min(max, lower + (upper - lower) / 2);
+    }
+  }
+  return max;
+}
+
+size_t Histogram::BucketFor(uint64_t value) {
+  constexpr uint64_t kMaxValue = (uint64_t{1} << kMaxValueBits) - 1;
+  value = std::min(value, kMaxValue);
+  // Values below 2^kSubBucketBits have a bucket each. Above that, each
+  // power of two [2^e, 2^(e+1)) is split into 2^kSubBucketBits buckets
+  // by the kSubBucketBits bits following the highest set bit.
+  if (value < (uint64_t{1} << kSubBucketBits)) {
+    return value;
+  }
+  int highest_bit = 63 - __builtin_clzll(value);
+  int shift = highest_bit - kSubBucketBits;
+  size_t sub_bucket = (value >> shift) & ((1 << kSubBucketBits) - 1);
+  return ((shift + 1) << kSubBucketBits) + sub_bucket;
+}
+
+uint64_t Histogram::BucketLowerBound(size_t bucket) {
+  if (bucket < (size_t{1} << kSubBucketBits)) {
+    return bucket;
+  }
+  int shift = (bucket >> kSubBucketBits) - 1;
+  uint64_t sub_bucket = bucket & ((1 << kSubBucketBits) - 1);
+  return ((uint64_t{1} << kSubBucketBits) | sub_bucket) << shift;
+}
+
+void Histogram::Record(uint64_t value) {
+  Shard& shard = shards_[MetricShardIndex()];
+  shard.count.fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(value, std::memory_order_relaxed);
+  shard.buckets[BucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+  uint64_t max = shard.max.load(std::memory_order_relaxed);
+  while (value > max && !shard.max.compare_exchange_weak(
+      max, value, std::memory_order_relaxed)) {}
+}
+
+HistogramSnapshot Histogram::Snapshot() const {
+  HistogramSnapshot snapshot;
+  snapshot.buckets.assign(kNumBuckets, 0);
+  for (const Shard& shard : shards_) {
+    snapshot.count += shard.count.load(std::memory_order_relaxed);
+    snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+    snapshot.max = std::max(snapshot.max,
+                            shard.max.load(std::memory_order_relaxed));
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+      snapshot.buckets[bucket] +=
+          shard.buckets[bucket].load(std::memory_order_relaxed);
+    }
+  }
+  return snapshot;
+}
@@ -0,0 +1,99 @@
+#ifndef CSCI499_CHENGTSU_HISTOGRAM_H
+#define CSCI499_CHENGTSU_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Number of shards each Histogram is split into. Each thread
+// always records into the same shard, so threads rarely contend on the
+// same cache lines, and recording stays lock-free.
+constexpr size_t kNumMetricShards = 16;
+
+// Returns the index of the metric shard the calling thread records into.
+size_t MetricShardIndex();
+
+// A point-in-time copy of a Histogram, merged across all shards.
+struct HistogramSnapshot {
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+  // Number of recorded values per bucket, see `Histogram`.
+  std::vector<uint64_t> buckets;
+
+  // Returns the mean of the recorded values, or 0 if there are none.
+  double Mean() const;
+
+  // Returns an estimate of the value at the given percentile (0-100) of
+  // the recorded values, which is off by at most 1/16 of the value.
+  uint64_t Percentile(double percentile) const;
+};
+
+// A lock-free histogram of non-negative integer values (e.g. latencies in
+// nanoseconds) in the spirit of HdrHistogram: values are counted in
+// log-linear buckets, 16 per power of two, so that every recorded value
+// is known with a relative error of at most 1/16 while using a fixed
+// amount of memory. Values of 2^40 or more are counted as 2^40 - 1.
+class Histogram {
+ public:
+  Histogram() = default;
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  // Records a value. Safe to call from any number of threads.
+  void Record(uint64_t value);
+
+  // Records the time passed since `start` in nanoseconds.
+  void RecordSince(std::chrono::steady_clock::time_point start) {
+    Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+  }
+
+  // Returns a copy of the histogram. Values recorded concurrently
+  // may or may not be included.
+  HistogramSnapshot Snapshot() const;
+
+  // Number of bits of a value that are kept exactly in its bucket.
+  static constexpr int kSubBucketBits = 4;
+  // Values are clamped to less than 2^kMaxValueBits.
+  static constexpr int kMaxValueBits = 40;
+  static constexpr size_t kNumBuckets =
+      (kMaxValueBits - kSubBucketBits + 1) << kSubBucketBits;
+
+  // Returns the index of the bucket counting the value.
+  static size_t BucketFor(uint64_t value);
+
+  // Returns the smallest value counted by the bucket.
+  static uint64_t BucketLowerBound(size_t bucket);
+
+ private:
+  // Counts recorded by the threads of one shard, aligned to keep shards
+  // on separate cache lines.
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+    std::array<std::atomic<uint64_t>, kNumBuckets> buckets{};
+  };
+
+  std::array<Shard, kNumMetricShards> shards_;
+};
+
+// Records the lifetime of the timer into a Histogram in nanoseconds.
+class ScopedLatencyTimer {
+ public:
+  explicit ScopedLatencyTimer(Histogram& histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ScopedLatencyTimer(const ScopedLatencyTimer&) = delete;
+  ScopedLatencyTimer& operator=(const ScopedLatencyTimer&) = delete;
+
+  ~ScopedLatencyTimer() { histogram_.RecordSince(start_); }
+
+ private:
+  Histogram& histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif //CSCI499_CHENGTSU_HISTOGRAM_H
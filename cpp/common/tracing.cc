@@ -0,0 +1,326 @@
+#include "common/tracing.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+using std::string;
+using std::vector;
+
+const char kTraceparentKey[] = "traceparent";
+
+namespace {
+
+// The context of the span running on the thread.
+thread_local TraceContext current_context;
+
+// Returns a random number, never 0, from a generator of the thread.
+uint64_t RandomId() {
+  thread_local std::mt19937_64 generator(
+      (uint64_t{std::random_device()()} << 32) | std::random_device()());
+  uint64_t id;
+  do {
+    id = generator();
+  } while (id == 0);
+  return id;
+}
+
+// Returns a small number identifying the calling thread.
+uint32_t ThreadId() {
+  static std::atomic<uint32_t> next_thread_id(1);
+  thread_local uint32_t thread_id = next_thread_id++;
+  return thread_id;
+}
+
+// Parses exactly `length` hex digits at `pos` of `text`.
+bool ParseHex(const string& text, size_t pos, size_t length, uint64_t& value) {
+  value = 0;
+  for (size_t i = pos; i < pos + length; ++i) {
+    char c = text[i];
+    int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      return false;
+    }
+    value = (value << 4) | digit;
+  }
+  return true;
+}
+
+// Writes the string as the contents of a JSON string.
+void WriteJsonString(FILE* file, const char* text) {
+  for (const char* c = text; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(file, "\\%c", *c);
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      fprintf(file, "\\u%04x", *c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+}
+
+}  // namespace
+
+string TraceContext::ToTraceparent() const {
+  char traceparent[56];
+  snprintf(traceparent, sizeof(traceparent),
+           "00-%016" PRIx64 "%016" PRIx64 "-%016" PRIx64 "-%02x",
+           trace_id_high, trace_id_low, span_id, sampled ? 1 : 0);
+  return traceparent;
+}
+
+bool TraceContext::Parse(const string& traceparent, TraceContext& context) {
+  // "00-" + 32 + "-" + 16 + "-" + 2 characters.
+  if (traceparent.size() != 55 || traceparent.compare(0, 3, "00-") != 0 ||
+      traceparent[35] != '-' || traceparent[52] != '-') {
+    return false;
+  }
+  TraceContext parsed;
+  uint64_t flags;
+  if (!ParseHex(traceparent, 3, 16, parsed.trace_id_high) ||
+      !ParseHex(traceparent, 19, 16, parsed.trace_id_low) ||
+      !ParseHex(traceparent, 36, 16, parsed.span_id) ||
+      !ParseHex(traceparent, 53, 2, flags) ||
+      !parsed.IsValid() || parsed.span_id == 0) {
+    return false;
+  }
+  parsed.sampled = flags & 1;
+  context = parsed;
+  return true;
+}
+
+TraceBuffer::TraceBuffer(size_t capacity)
+    : slots_(), mask_([capacity]() {
+        uint64_t size = 1;
+        while (size < capacity) {
+          size <<= 1;
+        }
+        return size - 1;
+      }()),
+      write_position_(0), read_position_(0), dropped_(0) {
+  slots_.reset(new Slot[mask_ + 1]);
+  for (uint64_t i = 0; i <= mask_; ++i) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool TraceBuffer::Add(const SpanRecord& record) {
+  uint64_t position = write_position_.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &slots_[position & mask_];
+    uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      // The slot is free, try to claim it.
+      if (write_position_.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // The slot still holds a span not read yet.
+      ++dropped_;
+      return false;
+    } else {
+      // Another thread claimed the slot first.
+      position = write_position_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->record = record;
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+void TraceBuffer::Drain(vector<SpanRecord>& records) {
+  while (true) {
+    Slot& slot = slots_[read_position_ & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != read_position_ + 1) {
+      return;
+    }
+    records.push_back(slot.record);
+    // Free the slot for the span a whole buffer later.
+    slot.sequence.store(read_position_ + mask_ + 1, std::memory_order_release);
+    ++read_position_;
+  }
+}
+
+Tracer& Tracer::Get() {
+  static Tracer tracer;
+  return tracer;
+}
+
+Tracer::Tracer()
+    : sample_threshold_(0), buffer_(1 << 16), mutex_(), cv_(),
+      file_(nullptr), exporting_(false), export_thread_() {}
+
+Tracer::~Tracer() {
+  StopExport();
+}
+
+void Tracer::SetSampleRate(double rate) {
+  rate = std::min(std::max(rate, 0.0), 1.0);
+  sample_threshold_ = static_cast<uint64_t>(rate * (uint64_t{1} << 32));
+}
+
+bool Tracer::ShouldSample() const {
+  uint64_t threshold = sample_threshold_.load(std::memory_order_relaxed);
+  return threshold != 0 && (RandomId() & 0xffffffff) < threshold;
+}
+
+bool Tracer::StartExport(const string& path,
+                         std::chrono::milliseconds interval) {
+  StopExport();
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_ = fopen(path.c_str(), "w");
+  if (!file_) {
+    return false;
+  }
+  // The closing bracket of the array is optional in the format, so that
+  // a file cut short (e.g. by a crash) can still be read.
+  fprintf(file_, "[\n");
+  exporting_ = true;
+  export_thread_ = std::thread(&Tracer::ExportPeriodically, this, interval);
+  return true;
+}
+
+void Tracer::StopExport() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exporting_ = false;
+  }
+  cv_.notify_all();
+  if (export_thread_.joinable()) {
+    export_thread_.join();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_) {
+    Export();
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+vector<SpanRecord> Tracer::Drain() {
+  vector<SpanRecord> records;
+  std::lock_guard<std::mutex> lock(mutex_);
+  buffer_.Drain(records);
+  return records;
+}
+
+void Tracer::ExportPeriodically(std::chrono::milliseconds interval) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (exporting_) {
+    cv_.wait_for(lock, interval, [this]() { return !exporting_; });
+    Export();
+  }
+}
+
+void Tracer::Export() {
+  vector<SpanRecord> records;
+  buffer_.Drain(records);
+  int pid = getpid();
+  for (const SpanRecord& record : records) {
+    fprintf(file_, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" PRId64
+            ",\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{"
+            "\"trace_id\":\"%016" PRIx64 "%016" PRIx64 "\","
+            "\"span_id\":\"%016" PRIx64 "\","
+            "\"parent_span_id\":\"%016" PRIx64 "\",\"detail\":\"",
+            record.name, record.start_us, record.duration_ns / 1000.0, pid,
+            record.thread_id, record.trace_id_high, record.trace_id_low,
+            record.span_id, record.parent_span_id);
+    WriteJsonString(file_, record.detail);
+    fprintf(file_, "\"}},\n");
+  }
+  fflush(file_);
+}
+
+TraceContext CurrentTraceContext() {
+  return current_context;
+}
+
+ScopedTraceContext::ScopedTraceContext(const TraceContext& context)
+    : previous_(current_context) {
+  current_context = context;
+}
+
+ScopedTraceContext::~ScopedTraceContext() {
+  current_context = previous_;
+}
+
+ScopedSpan::ScopedSpan(const char* name, const string& detail)
+    : context_(), previous_(current_context) {
+  if (previous_.sampled) {
+    Start(name, previous_, detail);
+  }
+}
+
+ScopedSpan::ScopedSpan(const char* name, const TraceContext& parent,
+                       const string& detail)
+    : context_(), previous_(current_context) {
+  if (parent.IsValid()) {
+    if (parent.sampled) {
+      Start(name, parent, detail);
+    }
+    return;
+  }
+  if (Tracer::Get().ShouldSample()) {
+    TraceContext root;
+    root.trace_id_high = RandomId();
+    root.trace_id_low = RandomId();
+    root.sampled = true;
+    Start(name, root, detail);
+  }
+}
+
+ScopedSpan::~ScopedSpan() {
+  if (!context_.sampled) {
+    return;
+  }
+  record_.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start_).count();
+  Tracer::Get().Record(record_);
+  current_context = previous_;
+}
+
+void ScopedSpan::Start(const char* name, const TraceContext& parent,
+                       const string& detail) {
+  context_ = parent;
+  context_.span_id = RandomId();
+  record_.trace_id_high = parent.trace_id_high;
+  record_.trace_id_low = parent.trace_id_low;
+  record_.span_id = context_.span_id;
+  record_.parent_span_id = parent.span_id;
+  record_.name = name;
+  size_t length = std::min(detail.size(), sizeof(record_.detail) - 1);
+  memcpy(record_.detail, detail.data(), length);
+  record_.detail[length] = '\0';
+  record_.start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  record_.thread_id = ThreadId();
+  start_ = std::chrono::steady_clock::now();
+  current_context = context_;
+}
+
+void InjectTraceContext(grpc::ClientContext* context) {
+  if (current_context.sampled) {
+    context->AddMetadata(kTraceparentKey, current_context.ToTraceparent());
+  }
+}
+
+TraceContext ExtractTraceContext(const grpc::ServerContext* context) {
+  TraceContext trace_context;
+  const auto& metadata = context->client_metadata();
+  auto iter = metadata.find(kTraceparentKey);
+  if (iter != metadata.end()) {
+    TraceContext::Parse(string(iter->second.data(), iter->second.size()),
+                        trace_context);
+  }
+  return trace_context;
+}
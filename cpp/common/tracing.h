@@ -0,0 +1,216 @@
+#ifndef CSCI499_CHENGTSU_TRACING_H
+#define CSCI499_CHENGTSU_TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+// Lightweight request tracing. A trace is a tree of spans, each timing
+// one operation (a Faz event, a KVStore call, ...) of a request, and
+// identified by the ID of the trace and its own ID. The context of the
+// current span is kept per thread, so that spans started while another
+// is running become its children, and travels to other processes in
+// the `traceparent` gRPC metadata (as in W3C Trace Context). Whether a
+// trace is recorded is decided once at its root. Finished spans go
+// into a lock-free buffer, from which a background thread exports them
+// to a file in the Chrome trace event format (readable by Perfetto and
+// chrome://tracing).
+
+// Identifies a span of a trace.
+struct TraceContext {
+  uint64_t trace_id_high = 0;
+  uint64_t trace_id_low = 0;
+  uint64_t span_id = 0;
+  // Whether the spans of the trace are recorded.
+  bool sampled = false;
+
+  // Returns true if this is the context of a span, not an empty one.
+  bool IsValid() const { return trace_id_high != 0 || trace_id_low != 0; }
+
+  // Returns the context in the `traceparent` format, e.g.
+  // "00-<32 hex digits of trace ID>-<16 of span ID>-01".
+  std::string ToTraceparent() const;
+
+  // Parses a context in the `traceparent` format, and returns false
+  // (leaving `context` alone) if it is malformed.
+  static bool Parse(const std::string& traceparent, TraceContext& context);
+};
+
+// A finished span.
+struct SpanRecord {
+  uint64_t trace_id_high;
+  uint64_t trace_id_low;
+  uint64_t span_id;
+  uint64_t parent_span_id;
+  // Name of the operation, which must be a string literal.
+  const char* name;
+  // What the operation was about (e.g. a key), truncated.
+  char detail[48];
+  // Start time in microseconds since the epoch, and duration in
+  // nanoseconds.
+  int64_t start_us;
+  int64_t duration_ns;
+  uint32_t thread_id;
+};
+
+// A fixed-size buffer of spans, into which any number of threads add
+// spans without locks, and which a single thread drains. Spans added
+// while the buffer is full are dropped rather than waited for.
+class TraceBuffer {
+ public:
+  // Creates a buffer holding `capacity` spans, rounded up to a power
+  // of two.
+  explicit TraceBuffer(size_t capacity);
+
+  TraceBuffer(const TraceBuffer&) = delete;
+  TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+  // Adds the span, and returns false if it is dropped.
+  bool Add(const SpanRecord& record);
+
+  // Appends the spans added since the last call to `records`. Must not
+  // be called from two threads at once.
+  void Drain(std::vector<SpanRecord>& records);
+
+  // Returns the number of spans dropped so far.
+  uint64_t Dropped() const { return dropped_; }
+
+ private:
+  // A slot of the buffer. Its sequence tells whose turn it is: equal to
+  // the position of the next span to be written into it, or one past it
+  // once written and until read.
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    SpanRecord record;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  const uint64_t mask_;
+  // Position of the next span to write, and of the next span to read.
+  std::atomic<uint64_t> write_position_;
+  uint64_t read_position_;
+  std::atomic<uint64_t> dropped_;
+};
+
+// Records spans of this process, and exports them.
+class Tracer {
+ public:
+  // Returns the tracer of the process.
+  static Tracer& Get();
+
+  // Sets the fraction (0 to 1) of traces rooted in this process to
+  // record. Traces started elsewhere follow the decision of their root.
+  // Nothing is recorded by default.
+  void SetSampleRate(double rate);
+
+  // Returns true if a new trace should be recorded.
+  bool ShouldSample() const;
+
+  // Adds a finished span to the buffer.
+  void Record(const SpanRecord& record) { buffer_.Add(record); }
+
+  // Starts appending the recorded spans to the file every `interval`,
+  // and returns false if it cannot be opened.
+  bool StartExport(const std::string& path,
+                   std::chrono::milliseconds interval =
+                       std::chrono::seconds(1));
+
+  // Exports the spans recorded so far and stops exporting.
+  void StopExport();
+
+  // Moves the spans recorded so far out of the buffer, e.g. for tests.
+  std::vector<SpanRecord> Drain();
+
+  // Returns the number of spans dropped because the buffer was full.
+  uint64_t Dropped() const { return buffer_.Dropped(); }
+
+ private:
+  Tracer();
+  ~Tracer();
+
+  // Writes the spans in the buffer to the file.
+  void Export();
+
+  // Exports every `interval` until stopped.
+  void ExportPeriodically(std::chrono::milliseconds interval);
+
+  // Probability of sampling new traces, scaled to [0, 2^32].
+  std::atomic<uint64_t> sample_threshold_;
+  TraceBuffer buffer_;
+  // Guards draining the buffer, the file, and stopping the export.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  FILE* file_;
+  bool exporting_;
+  std::thread export_thread_;
+};
+
+// Returns the context of the span running on the calling thread, which
+// is invalid if none.
+TraceContext CurrentTraceContext();
+
+// Makes a context current on the calling thread (e.g. one handed over
+// from another thread), until destroyed.
+class ScopedTraceContext {
+ public:
+  explicit ScopedTraceContext(const TraceContext& context);
+  ~ScopedTraceContext();
+
+  ScopedTraceContext(const ScopedTraceContext&) = delete;
+  ScopedTraceContext& operator=(const ScopedTraceContext&) = delete;
+
+ private:
+  TraceContext previous_;
+};
+
+// Times an operation as a span, which is current on the calling thread
+// from construction to destruction, when it is recorded. A span that is
+// not sampled costs next to nothing.
+class ScopedSpan {
+ public:
+  // Starts a child span of the current span, if it is sampled.
+  explicit ScopedSpan(const char* name, const std::string& detail = "");
+
+  // Starts a child span of `parent` (e.g. from another process), or the
+  // root span of a new trace, sampled or not by the tracer, if `parent`
+  // is invalid.
+  ScopedSpan(const char* name, const TraceContext& parent,
+             const std::string& detail = "");
+
+  ~ScopedSpan();
+
+  ScopedSpan(const ScopedSpan&) = delete;
+  ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+  // Returns the context of the span.
+  const TraceContext& context() const { return context_; }
+
+ private:
+  // Starts the span as a child of `parent`, if sampled.
+  void Start(const char* name, const TraceContext& parent,
+             const std::string& detail);
+
+  TraceContext context_;
+  TraceContext previous_;
+  SpanRecord record_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Name of the gRPC metadata carrying trace contexts.
+extern const char kTraceparentKey[];
+
+// Passes the current span, if sampled, on to the callee of the call.
+void InjectTraceContext(grpc::ClientContext* context);
+
+// Returns the span of the caller of the call, which is invalid if none.
+TraceContext ExtractTraceContext(const grpc::ServerContext* context);
+
+#endif //CSCI499_CHENGTSU_TRACING_H
@@ -0,0 +1,89 @@
+#include "common/work_stealing_pool.h"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+namespace {
+
+// The pool whose thread is the calling thread, and the index of its
+// queue, if any.
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(size_t num_threads)
+    : queues_(), next_queue_(0), queue_depth_(0), mutex_(), cv_(),
+      stopped_(false), threads_() {
+  num_threads = std::max<size_t>(num_threads, 1);
+  for (size_t i = 0; i < num_threads; ++i) {
+    queues_.emplace_back(new Queue);
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&WorkStealingPool::Run, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::Submit(std::function<void()> task) {
+  size_t index = current_pool == this ?
+      current_queue : next_queue_++ % queues_.size();
+  // Counted first, so that the depth never goes below zero.
+  ++queue_depth_;
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(std::move(task));
+  }
+  // Taking the lock makes sure a thread about to wait sees the task.
+  std::lock_guard<std::mutex> lock(mutex_);
+  cv_.notify_one();
+}
+
+bool WorkStealingPool::Take(size_t index, std::function<void()>& task) {
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    Queue& queue = *queues_[(index + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    } else {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    --queue_depth_;
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::Run(size_t index) {
+  current_pool = this;
+  current_queue = index;
+  std::function<void()> task;
+  while (true) {
+    if (Take(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return stopped_ || queue_depth_ > 0; });
+    if (stopped_ && queue_depth_ == 0) {
+      return;
+    }
+  }
+}
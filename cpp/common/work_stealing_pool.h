@@ -0,0 +1,67 @@
+#ifndef CSCI499_CHENGTSU_WORK_STEALING_POOL_H
+#define CSCI499_CHENGTSU_WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed pool of threads running submitted tasks. Each thread has its
+// own queue, which tasks submitted from outside the pool are spread over
+// in a round-robin manner, and tasks submitted by a task of the pool go
+// to the queue of its thread. A thread runs the tasks of its own queue
+// in order, and once it is empty, steals the newest task of another
+// queue, so a thread stuck in a long task does not hold others back.
+class WorkStealingPool {
+ public:
+  // Starts `num_threads` threads (at least one).
+  explicit WorkStealingPool(size_t num_threads);
+
+  // Runs the tasks still queued, then stops the threads.
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  // Queues the task to be run by one of the threads.
+  void Submit(std::function<void()> task);
+
+  // Returns the number of tasks queued but not started yet.
+  size_t QueueDepth() const { return queue_depth_; }
+
+  // Returns the number of threads.
+  size_t NumThreads() const { return threads_.size(); }
+
+ private:
+  // A queue of tasks, owned by one thread but open to others.
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // Runs tasks on the thread owning the queue of the given index until
+  // the pool stops.
+  void Run(size_t index);
+
+  // Takes the oldest task of the queue of the given index, or the
+  // newest task of another queue if it is empty, and returns false if
+  // all queues are empty.
+  bool Take(size_t index, std::function<void()>& task);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  // Index (modulo the number of queues) of the queue to submit to next
+  // from outside the pool.
+  std::atomic<size_t> next_queue_;
+  std::atomic<size_t> queue_depth_;
+  // Guards `stopped_`, and lets idle threads wait for tasks.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopped_;
+  std::vector<std::thread> threads_;
+};
+
+#endif //CSCI499_CHENGTSU_WORK_STEALING_POOL_H
@@ -0,0 +1,180 @@
+#include "faz/faz_async_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <google/protobuf/arena.h>
+#include <grpcpp/grpcpp.h>
+
+using faz::EventReply;
+using faz::EventRequest;
+using faz::EventStatusReply;
+using faz::EventStatusRequest;
+using faz::EventsReply;
+using faz::EventsRequest;
+using faz::HookReply;
+using faz::HookRequest;
+using faz::UnhookReply;
+using faz::UnhookRequest;
+using google::protobuf::Arena;
+using google::protobuf::ArenaOptions;
+using grpc::ServerAsyncResponseWriter;
+using grpc::ServerCompletionQueue;
+using grpc::ServerContext;
+using grpc::Status;
+using std::string;
+using std::vector;
+
+class FazAsyncServer::Call {
+ public:
+  virtual ~Call() = default;
+
+  // Handles the completion of the pending operation of the call, `ok`
+  // as given by the completion queue.
+  virtual void Proceed(bool ok) = 0;
+};
+
+// A call of a unary method, which goes from being requested to being
+// run by a worker to being finished, then deletes itself. Its request
+// and reply, and the messages its handler builds on their arena, live on
+// an arena of the call, starting with a block inside the call itself.
+template <typename Request, typename Reply>
+class FazAsyncServer::MethodCall : public FazAsyncServer::Call {
+ public:
+  // Asks for the next call of the method.
+  using RequestMethod = void (faz::FazService::AsyncService::*)(
+      ServerContext*, Request*, ServerAsyncResponseWriter<Reply>*,
+      grpc::CompletionQueue*, ServerCompletionQueue*, void*);
+  // Serves a call of the method.
+  using Handler = Status (FazService::*)(ServerContext*, const Request*,
+                                         Reply*);
+
+  MethodCall(FazAsyncServer* server, ServerCompletionQueue* cq,
+             RequestMethod request_method, Handler handler)
+      : server_(server), cq_(cq), request_method_(request_method),
+        handler_(handler), context_(), arena_(ArenaOptionsFor(arena_block_)),
+        request_(Arena::CreateMessage<Request>(&arena_)),
+        reply_(Arena::CreateMessage<Reply>(&arena_)),
+        responder_(&context_), finishing_(false) {
+    (server_->async_service_.*request_method_)(
+        &context_, request_, &responder_, cq_, cq_, this);
+  }
+
+  void Proceed(bool ok) override {
+    if (finishing_ || !ok) {
+      // Either finished, or not started because the server shuts down.
+      delete this;
+      return;
+    }
+    // Take the next call while this one is being served.
+    new MethodCall(server_, cq_, request_method_, handler_);
+    auto submitted = std::chrono::steady_clock::now();
+    server_->workers_->Submit([this, submitted]() {
+      server_->queue_wait_.RecordSince(submitted);
+      Status status = (server_->service_->*handler_)(
+          &context_, request_, reply_);
+      finishing_ = true;
+      responder_.Finish(*reply_, status, this);
+    });
+  }
+
+ private:
+  // Size of the block the arena of a call starts with.
+  static const size_t kArenaBlockSize = 4096;
+
+  static ArenaOptions ArenaOptionsFor(char* block) {
+    ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = kArenaBlockSize;
+    return options;
+  }
+
+  FazAsyncServer* server_;
+  ServerCompletionQueue* cq_;
+  RequestMethod request_method_;
+  Handler handler_;
+  ServerContext context_;
+  alignas(8) char arena_block_[kArenaBlockSize];
+  Arena arena_;
+  Request* request_;
+  Reply* reply_;
+  ServerAsyncResponseWriter<Reply> responder_;
+  // Whether the reply is being sent.
+  bool finishing_;
+};
+
+FazAsyncServer::FazAsyncServer(FazService* service,
+                               size_t num_network_threads, size_t num_workers)
+    : service_(service), num_network_threads_(num_network_threads),
+      async_service_(), server_(), cqs_(), network_threads_(),
+      workers_(new WorkStealingPool(num_workers)), queue_wait_() {}
+
+FazAsyncServer::~FazAsyncServer() {
+  Shutdown();
+}
+
+void FazAsyncServer::Start(const vector<string>& addresses) {
+  grpc::ServerBuilder builder;
+  for (const string& address : addresses) {
+    builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+  }
+  builder.RegisterService(&async_service_);
+  for (size_t i = 0; i < std::max<size_t>(num_network_threads_, 1); ++i) {
+    cqs_.push_back(builder.AddCompletionQueue());
+  }
+  server_ = builder.BuildAndStart();
+  for (auto& cq : cqs_) {
+    RequestCalls(cq.get());
+    network_threads_.emplace_back(&FazAsyncServer::Poll, this, cq.get());
+  }
+}
+
+void FazAsyncServer::Shutdown() {
+  if (!server_) {
+    return;
+  }
+  // Waits for the calls being served, whose workers and network threads
+  // must keep running until they are finished.
+  server_->Shutdown();
+  for (auto& cq : cqs_) {
+    cq->Shutdown();
+  }
+  for (std::thread& thread : network_threads_) {
+    thread.join();
+  }
+  workers_.reset();
+  server_.reset();
+}
+
+FazAsyncServer::Stats FazAsyncServer::GetStats() const {
+  return {workers_ ? workers_->QueueDepth() : 0, queue_wait_.Snapshot()};
+}
+
+void FazAsyncServer::RequestCalls(ServerCompletionQueue* cq) {
+  new MethodCall<HookRequest, HookReply>(
+      this, cq, &faz::FazService::AsyncService::Requesthook,
+      &FazService::hook);
+  new MethodCall<UnhookRequest, UnhookReply>(
+      this, cq, &faz::FazService::AsyncService::Requestunhook,
+      &FazService::unhook);
+  new MethodCall<EventRequest, EventReply>(
+      this, cq, &faz::FazService::AsyncService::Requestevent,
+      &FazService::event);
+  new MethodCall<EventsRequest, EventsReply>(
+      this, cq, &faz::FazService::AsyncService::Requestevents,
+      &FazService::events);
+  new MethodCall<EventStatusRequest, EventStatusReply>(
+      this, cq, &faz::FazService::AsyncService::Requestevent_status,
+      &FazService::event_status);
+}
+
+void FazAsyncServer::Poll(ServerCompletionQueue* cq) {
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    static_cast<Call*>(tag)->Proceed(ok);
+  }
+}
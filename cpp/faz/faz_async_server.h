@@ -0,0 +1,77 @@
+#ifndef CSCI499_CHENGTSU_FAZ_ASYNC_SERVER_H
+#define CSCI499_CHENGTSU_FAZ_ASYNC_SERVER_H
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "common/histogram.h"
+#include "common/work_stealing_pool.h"
+#include "faz.grpc.pb.h"
+#include "faz/faz_service.h"
+
+// Serves a FazService through the asynchronous gRPC API, keeping network
+// threads apart from the execution of handlers. Network threads only
+// take calls off completion queues and hand them over to a pool of
+// workers, which run the handlers of the service (blocking on the
+// KVStore as long as they need) and send the replies. A call thus only
+// holds a worker while its handler runs, and calls beyond the number of
+// workers wait in the queues of the pool instead of in gRPC.
+class FazAsyncServer {
+ public:
+  // Counters of the server.
+  struct Stats {
+    // Number of calls waiting for a worker.
+    size_t queue_depth;
+    // Time calls waited for a worker, in nanoseconds.
+    HistogramSnapshot queue_wait;
+  };
+
+  // Creates a server serving `service`, which must outlive it, with the
+  // given numbers of network threads and workers.
+  FazAsyncServer(FazService* service, size_t num_network_threads,
+                 size_t num_workers);
+
+  // Shuts the server down if started.
+  ~FazAsyncServer();
+
+  // Starts serving at the given addresses.
+  void Start(const std::vector<std::string>& addresses);
+
+  // Blocks until another thread shuts the server down.
+  void Wait() { server_->Wait(); }
+
+  // Stops taking calls, waits for those being served, and stops the
+  // threads.
+  void Shutdown();
+
+  // Returns the counters of the server.
+  Stats GetStats() const;
+
+ private:
+  // A call of a method, and the kinds of them.
+  class Call;
+  template <typename Request, typename Reply>
+  class MethodCall;
+
+  // Asks for the next call of each method on the completion queue.
+  void RequestCalls(grpc::ServerCompletionQueue* cq);
+
+  // Takes calls off the completion queue until it shuts down.
+  void Poll(grpc::ServerCompletionQueue* cq);
+
+  FazService* service_;
+  size_t num_network_threads_;
+  faz::FazService::AsyncService async_service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+  std::vector<std::thread> network_threads_;
+  std::unique_ptr<WorkStealingPool> workers_;
+  // Time calls waited for a worker.
+  Histogram queue_wait_;
+};
+
+#endif //CSCI499_CHENGTSU_FAZ_ASYNC_SERVER_H
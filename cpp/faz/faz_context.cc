@@ -0,0 +1,179 @@
+#include "faz/faz_context.h"
+
+#include <algorithm>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Applies the mutation to the values of its key.
+void Apply(const KVMutation& mutation, vector<string>& values) {
+  if (mutation.type == KVMutation::kPut) {
+    values.push_back(mutation.value);
+  } else {
+    values.clear();
+  }
+}
+
+}  // namespace
+
+FazContext::FazContext(KVStoreInterface* kvstore, const Options& options)
+    : kvstore_(kvstore), options_(options), values_(), buffer_(), stats_(),
+      read_keys_(), written_keys_() {}
+
+bool FazContext::Put(const string& key, const string& value) {
+  if (options_.track_keys) {
+    written_keys_.push_back(key);
+  }
+  KVMutation mutation = {KVMutation::kPut, key, value};
+  auto iter = values_.find(key);
+  if (options_.buffer_writes) {
+    if (iter != values_.end()) {
+      Apply(mutation, iter->second);
+    }
+    buffer_.push_back(std::move(mutation));
+    return true;
+  }
+  ++stats_.remote_calls;
+  bool success = kvstore_->Put(key, value);
+  if (iter != values_.end()) {
+    if (success) {
+      Apply(mutation, iter->second);
+    } else {
+      // The value may or may not have been added.
+      values_.erase(iter);
+    }
+  }
+  return success;
+}
+
+vector<string> FazContext::Get(const string& key) const {
+  if (options_.memoize_reads) {
+    auto iter = values_.find(key);
+    if (iter != values_.end()) {
+      ++stats_.saved_calls;
+      return iter->second;
+    }
+  }
+  ++stats_.remote_calls;
+  vector<string> values = kvstore_->Get(key);
+  Remember(key, values);
+  return values;
+}
+
+vector<vector<string>> FazContext::MultiGet(const vector<string>& keys) const {
+  vector<vector<string>> values(keys.size());
+  // Keys to get from the KVStore, and where their values go.
+  vector<string> missing;
+  vector<size_t> indices;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (options_.memoize_reads) {
+      auto iter = values_.find(keys[i]);
+      if (iter != values_.end()) {
+        ++stats_.saved_calls;
+        values[i] = iter->second;
+        continue;
+      }
+    }
+    missing.push_back(keys[i]);
+    indices.push_back(i);
+  }
+  size_t max_keys = options_.max_multi_get_keys > 0 ?
+      options_.max_multi_get_keys : missing.size();
+  vector<string> chunk;
+  for (size_t begin = 0; begin < missing.size(); begin += max_keys) {
+    size_t end = std::min(missing.size(), begin + max_keys);
+    bool whole = begin == 0 && end == missing.size();
+    if (!whole) {
+      chunk.assign(missing.begin() + begin, missing.begin() + end);
+    }
+    ++stats_.remote_calls;
+    stats_.saved_calls += end - begin - 1;
+    vector<vector<string>> fetched = kvstore_->MultiGet(
+        whole ? missing : chunk);
+    for (size_t j = 0; j < fetched.size(); ++j) {
+      Remember(missing[begin + j], fetched[j]);
+      values[indices[begin + j]] = std::move(fetched[j]);
+    }
+  }
+  return values;
+}
+
+bool FazContext::Remove(const string& key) {
+  if (options_.track_keys) {
+    written_keys_.push_back(key);
+  }
+  KVMutation mutation = {KVMutation::kRemove, key, ""};
+  if (options_.buffer_writes) {
+    // Whether the key exists is part of the result, and removing a key
+    // that does not exist has no effect.
+    if (Get(key).empty()) {
+      return false;
+    }
+    auto iter = values_.find(key);
+    if (iter != values_.end()) {
+      Apply(mutation, iter->second);
+    }
+    buffer_.push_back(std::move(mutation));
+    return true;
+  }
+  ++stats_.remote_calls;
+  bool success = kvstore_->Remove(key);
+  if (success && options_.memoize_reads) {
+    values_[key].clear();
+  } else {
+    values_.erase(key);
+  }
+  return success;
+}
+
+vector<bool> FazContext::Write(const vector<KVMutation>& mutations) {
+  vector<bool> results;
+  results.reserve(mutations.size());
+  if (options_.buffer_writes) {
+    for (const KVMutation& mutation : mutations) {
+      results.push_back(mutation.type == KVMutation::kPut ?
+                        Put(mutation.key, mutation.value) :
+                        Remove(mutation.key));
+    }
+    return results;
+  }
+  ++stats_.remote_calls;
+  results = kvstore_->Write(mutations);
+  for (const KVMutation& mutation : mutations) {
+    values_.erase(mutation.key);
+    if (options_.track_keys) {
+      written_keys_.push_back(mutation.key);
+    }
+  }
+  return results;
+}
+
+bool FazContext::Flush() {
+  if (buffer_.empty()) {
+    return true;
+  }
+  ++stats_.remote_calls;
+  stats_.saved_calls += buffer_.size() - 1;
+  vector<bool> results = kvstore_->Write(buffer_);
+  buffer_.clear();
+  return results.size() > 0 &&
+      std::all_of(results.begin(), results.end(),
+                  [](bool result) { return result; });
+}
+
+void FazContext::Remember(const string& key, vector<string>& values) const {
+  if (options_.track_keys) {
+    read_keys_.push_back(key);
+  }
+  // Let the invocation read its own writes.
+  for (const KVMutation& mutation : buffer_) {
+    if (mutation.key == key) {
+      Apply(mutation, values);
+    }
+  }
+  if (options_.memoize_reads) {
+    values_[key] = values;
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef CSCI499_CHENGTSU_FAZ_CONTEXT_H
+#define CSCI499_CHENGTSU_FAZ_CONTEXT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kvstore/kvstore_interface.h"
+
+// The view of the KVStore a single invocation of a Faz function has. It
+// remembers the values of the keys read (and written) by the invocation,
+// so that reading a key again costs no call to the KVStore, and may hold
+// writes back to apply them all in a single batch once the function is
+// done. Either way the invocation reads its own writes. Values written
+// by others meanwhile are not seen, as if the invocation ran against a
+// snapshot taken at its first read of each key.
+//
+// Not thread-safe: each invocation gets its own.
+class FazContext : public KVStoreInterface {
+ public:
+  struct Options {
+    // Whether to remember the values of keys across reads. Otherwise
+    // every read goes to the KVStore, though still sees buffered writes.
+    bool memoize_reads = true;
+    // Whether to hold writes back until `Flush()`. Buffered puts always
+    // report success, and buffered removes whether the key exists;
+    // whether they were applied is only known from `Flush()`.
+    bool buffer_writes = false;
+    // Whether to keep the keys read from and written to the KVStore,
+    // see `ReadKeys()` and `WrittenKeys()`.
+    bool track_keys = false;
+    // Maximum number of keys a multi-get gets from the KVStore in a
+    // single call, 0 for no limit. Beyond that, it takes several calls
+    // one after another.
+    size_t max_multi_get_keys = 0;
+  };
+
+  // Counters of the calls of an invocation.
+  struct Stats {
+    // Number of calls made to the KVStore.
+    uint64_t remote_calls = 0;
+    // Number of calls to the context that needed no call of their own
+    // to the KVStore, either answered from memory or batched with others.
+    uint64_t saved_calls = 0;
+  };
+
+  // Creates a context over the KVStore, which must outlive it.
+  FazContext(KVStoreInterface* kvstore, const Options& options);
+
+  bool Put(const std::string& key, const std::string& value) override;
+
+  std::vector<std::string> Get(const std::string& key) const override;
+
+  // Gets the keys not remembered yet from the KVStore in a single call,
+  // or as few as `max_multi_get_keys` allows.
+  std::vector<std::vector<std::string>> MultiGet(
+      const std::vector<std::string>& keys) const override;
+
+  bool Remove(const std::string& key) override;
+
+  std::vector<bool> Write(const std::vector<KVMutation>& mutations) override;
+
+  // Applies the buffered writes in a single batch, and returns true if
+  // all of them were successful. Buffered writes are dropped without
+  // being applied if the context is destroyed first.
+  bool Flush();
+
+  // Returns the counters of the invocation so far.
+  const Stats& GetStats() const { return stats_; }
+
+  // Returns the keys read from the KVStore so far (possibly more than
+  // once), if tracking keys.
+  const std::vector<std::string>& ReadKeys() const { return read_keys_; }
+
+  // Returns the keys written (or meant to be) so far, if tracking keys.
+  const std::vector<std::string>& WrittenKeys() const {
+    return written_keys_;
+  }
+
+ private:
+  // Applies the buffered writes to the values just read from the
+  // KVStore under the key, and remembers them if memoizing.
+  void Remember(const std::string& key,
+                std::vector<std::string>& values) const;
+
+  KVStoreInterface* kvstore_;
+  const Options options_;
+  // Values of the keys read or written so far, buffered writes included.
+  mutable std::unordered_map<std::string, std::vector<std::string>> values_;
+  // Writes held back, in order.
+  std::vector<KVMutation> buffer_;
+  mutable Stats stats_;
+  mutable std::vector<std::string> read_keys_;
+  std::vector<std::string> written_keys_;
+};
+
+#endif //CSCI499_CHENGTSU_FAZ_CONTEXT_H
@@ -0,0 +1,286 @@
+#include "faz/faz_event_queue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+using faz::EventRequest;
+using faz::EventResult;
+using faz::EventStatusReply;
+using google::protobuf::Any;
+using grpc::Status;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Appends the length of the string as 4 bytes, little-endian, then the
+// string itself.
+void AppendField(const string& field, string* record) {
+  uint32_t size = field.size();
+  for (int i = 0; i < 4; ++i) {
+    record->push_back(static_cast<char>((size >> (8 * i)) & 0xff));
+  }
+  record->append(field);
+}
+
+// Reads a field appended by `AppendField()`, and returns true on success.
+bool ReadField(std::istream& in, string* field) {
+  unsigned char bytes[4];
+  if (!in.read(reinterpret_cast<char*>(bytes), 4)) {
+    return false;
+  }
+  uint32_t size = bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
+      static_cast<uint32_t>(bytes[3]) << 24;
+  field->resize(size);
+  return size == 0 || static_cast<bool>(in.read(&(*field)[0], size));
+}
+
+}  // namespace
+
+FazEventQueue::FazEventQueue(const string& filename, size_t max_results)
+    : filename_(filename), max_results_(max_results), mutex_(), cv_(),
+      log_(), log_size_(0), id_prefix_(), next_id_(0), pending_(), ready_(),
+      keys_(), results_(), result_order_(), executor_(), workers_(),
+      stopping_(false), enqueued_(0), executed_(0), enqueue_latency_(),
+      queue_wait_() {}
+
+FazEventQueue::~FazEventQueue() {
+  Stop();
+}
+
+bool FazEventQueue::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Replay the file, up to the first incomplete record if any.
+  vector<string> order;
+  std::ifstream infile(filename_, std::ifstream::binary);
+  size_t num_records = 0;
+  while (infile && infile.peek() != EOF) {
+    char type = infile.get();
+    string event_id;
+    if (!ReadField(infile, &event_id)) {
+      break;
+    }
+    if (type == kEnqueue) {
+      string function_name;
+      string request;
+      Pending pending;
+      if (!ReadField(infile, &function_name) ||
+          !ReadField(infile, &request) ||
+          !pending.request.ParseFromString(request)) {
+        break;
+      }
+      pending.function_name = std::move(function_name);
+      pending.enqueued = std::chrono::steady_clock::now();
+      pending_[event_id] = std::move(pending);
+      order.push_back(event_id);
+    } else if (type == kDone) {
+      string result;
+      EventResult parsed;
+      if (!ReadField(infile, &result) || !parsed.ParseFromString(result)) {
+        break;
+      }
+      pending_.erase(event_id);
+      KeepResult(event_id, std::move(parsed));
+    } else {
+      break;
+    }
+    ++num_records;
+  }
+  infile.close();
+  LOG(INFO) << num_records << " records loaded from event queue file "
+            << filename_ << ", " << pending_.size() << " events pending.";
+
+  // Rewrite the file with only the kept outcomes and pending events, and
+  // swap it in at once.
+  string tmp_filename = filename_ + ".tmp";
+  std::ofstream outfile(tmp_filename,
+                        std::ofstream::binary | std::ofstream::trunc);
+  for (const string& event_id : result_order_) {
+    string result = results_[event_id].SerializeAsString();
+    outfile << Record(kDone, {event_id, result});
+  }
+  for (const string& event_id : order) {
+    auto iter = pending_.find(event_id);
+    if (iter == pending_.end()) {
+      continue;
+    }
+    const Pending& pending = iter->second;
+    outfile << Record(kEnqueue, {event_id, pending.function_name,
+                                 pending.request.SerializeAsString()});
+    Schedule(event_id, pending.request.ordering_key());
+  }
+  bool written = static_cast<bool>(outfile.flush());
+  outfile.close();
+  std::error_code error;
+  if (written) {
+    std::filesystem::rename(tmp_filename, filename_, error);
+  }
+  if (!written || error) {
+    LOG(ERROR) << "Failed to rewrite event queue file " << filename_;
+    return false;
+  }
+  log_.open(filename_, std::ofstream::binary | std::ofstream::app);
+  log_size_ = std::filesystem::file_size(filename_, error);
+  if (!log_.is_open()) {
+    LOG(ERROR) << "Failed to open event queue file " << filename_;
+    return false;
+  }
+  id_prefix_ = std::to_string(std::chrono::duration_cast<
+      std::chrono::microseconds>(std::chrono::system_clock::now()
+                                     .time_since_epoch()).count()) + "-";
+  return true;
+}
+
+void FazEventQueue::Start(size_t num_workers, Executor executor) {
+  executor_ = std::move(executor);
+  for (size_t i = 0; i < std::max<size_t>(num_workers, 1); ++i) {
+    workers_.emplace_back(&FazEventQueue::Work, this);
+  }
+}
+
+void FazEventQueue::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+bool FazEventQueue::Enqueue(const string& function_name,
+                            const EventRequest& request, string* event_id) {
+  ScopedLatencyTimer timer(enqueue_latency_);
+  // Serialize the request out of the lock.
+  string serialized = request.SerializeAsString();
+  std::lock_guard<std::mutex> lock(mutex_);
+  string id = id_prefix_ + std::to_string(next_id_);
+  if (!Append(kEnqueue, {id, function_name, serialized})) {
+    LOG(ERROR) << "Failed to persist a queued event to file.";
+    return false;
+  }
+  ++next_id_;
+  ++enqueued_;
+  pending_[id] = {function_name, request, std::chrono::steady_clock::now()};
+  Schedule(id, request.ordering_key());
+  *event_id = std::move(id);
+  return true;
+}
+
+EventStatusReply::State FazEventQueue::Lookup(const string& event_id,
+                                              EventResult* result) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_.count(event_id) > 0) {
+    return EventStatusReply::PENDING;
+  }
+  auto iter = results_.find(event_id);
+  if (iter == results_.end()) {
+    return EventStatusReply::UNKNOWN;
+  }
+  *result = iter->second;
+  return EventStatusReply::DONE;
+}
+
+FazEventQueue::Stats FazEventQueue::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return {enqueued_, executed_, pending_.size(), enqueue_latency_.Snapshot(),
+          queue_wait_.Snapshot()};
+}
+
+void FazEventQueue::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return stopping_ || !ready_.empty(); });
+    if (stopping_) {
+      return;
+    }
+    string event_id = std::move(ready_.front());
+    ready_.pop_front();
+    // Only this worker erases the event, so it stays in place meanwhile.
+    const Pending& pending = pending_[event_id];
+    queue_wait_.RecordSince(pending.enqueued);
+    lock.unlock();
+    Any out;
+    Status status = executor_(pending.function_name, pending.request, &out);
+    EventResult result;
+    result.set_code(status.error_code());
+    result.set_message(status.error_message());
+    if (status.ok()) {
+      *result.mutable_payload() = std::move(out);
+    }
+    result.set_event_id(event_id);
+    lock.lock();
+    if (!Append(kDone, {event_id, result.SerializeAsString()})) {
+      // The event will be executed again when the file is replayed.
+      LOG(ERROR) << "Failed to persist the outcome of event " << event_id;
+    }
+    ++executed_;
+    // Let the next event of the same key go.
+    const string& key = pending.request.ordering_key();
+    if (!key.empty()) {
+      auto queue = keys_.find(key);
+      queue->second.pop_front();
+      if (queue->second.empty()) {
+        keys_.erase(queue);
+      } else {
+        ready_.push_back(queue->second.front());
+        cv_.notify_one();
+      }
+    }
+    pending_.erase(event_id);
+    KeepResult(event_id, std::move(result));
+  }
+}
+
+void FazEventQueue::Schedule(const string& event_id, const string& key) {
+  if (!key.empty()) {
+    std::deque<string>& queue = keys_[key];
+    queue.push_back(event_id);
+    if (queue.size() > 1) {
+      return;
+    }
+  }
+  ready_.push_back(event_id);
+  cv_.notify_one();
+}
+
+string FazEventQueue::Record(RecordType type, const vector<string>& fields) {
+  string record(1, type);
+  for (const string& field : fields) {
+    AppendField(field, &record);
+  }
+  return record;
+}
+
+bool FazEventQueue::Append(RecordType type, const vector<string>& fields) {
+  string record = Record(type, fields);
+  if (log_.write(record.data(), record.size()) && log_.flush()) {
+    log_size_ += record.size();
+    return true;
+  }
+  // Drop whatever part of the record made it to the file, so that the
+  // records appended next are still replayed.
+  log_.close();
+  std::error_code error;
+  std::filesystem::resize_file(filename_, log_size_, error);
+  log_.open(filename_, std::ofstream::binary | std::ofstream::app);
+  return false;
+}
+
+void FazEventQueue::KeepResult(const string& event_id, EventResult result) {
+  if (results_.emplace(event_id, std::move(result)).second) {
+    result_order_.push_back(event_id);
+  }
+  while (result_order_.size() > max_results_) {
+    results_.erase(result_order_.front());
+    result_order_.pop_front();
+  }
+}
@@ -0,0 +1,151 @@
+#ifndef CSCI499_CHENGTSU_FAZ_EVENT_QUEUE_H
+#define CSCI499_CHENGTSU_FAZ_EVENT_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <google/protobuf/any.pb.h>
+#include <grpcpp/grpcpp.h>
+
+#include "common/histogram.h"
+#include "faz.pb.h"
+
+// A durable queue of events to execute in the background, so that their
+// callers only wait for them to be appended to a file.
+//
+// Each queued event is appended to the file, along with the name of the
+// function to execute it with, before it is acknowledged with an ID.
+// Workers then execute the queued events, those with the same ordering
+// key one after another in the order they were queued and the others in
+// any order, and append the outcome of each to the file. Outcomes are
+// kept for lookups, up to a number of the latest ones. When the queue is
+// opened again (e.g. after a crash), the file is replayed: events queued
+// without an outcome are queued again in order, so an event may be
+// executed more than once. The file is then rewritten with only those
+// and the kept outcomes. Like the KVStore file, it is flushed to the
+// operating system after each record, but not synced to the disk.
+class FazEventQueue {
+ public:
+  // Executes a queued event with the function of the given name, and
+  // returns its status with its reply payload in `out`.
+  using Executor = std::function<grpc::Status(
+      const std::string& function_name, const faz::EventRequest& request,
+      google::protobuf::Any* out)>;
+
+  // Counters of the queue.
+  struct Stats {
+    // Number of events queued, and of those executed, since opened.
+    uint64_t enqueued;
+    uint64_t executed;
+    // Number of events queued or being executed.
+    size_t pending;
+    // Time taken to queue events, and time queued events waited for a
+    // worker, in nanoseconds.
+    HistogramSnapshot enqueue_latency;
+    HistogramSnapshot queue_wait;
+  };
+
+  // Number of outcomes kept for lookups by default.
+  static const size_t kDefaultMaxResults = 100000;
+
+  // Creates a queue persisted to the file, keeping up to `max_results`
+  // outcomes of events. Must be opened before use.
+  explicit FazEventQueue(const std::string& filename,
+                         size_t max_results = kDefaultMaxResults);
+
+  // Stops the workers, if started.
+  ~FazEventQueue();
+
+  // Replays and rewrites the file, and returns true on success.
+  bool Open();
+
+  // Starts `num_workers` threads executing queued events through the
+  // executor, starting with those replayed.
+  void Start(size_t num_workers, Executor executor);
+
+  // Waits for the events being executed and stops the workers. Events
+  // still queued stay in the file.
+  void Stop();
+
+  // Appends the event to execute with the function to the file, and
+  // returns true with its ID in `event_id`, or false if it could not be
+  // persisted.
+  bool Enqueue(const std::string& function_name,
+               const faz::EventRequest& request, std::string* event_id);
+
+  // Returns the state of the event, with its outcome in `result` if done.
+  faz::EventStatusReply::State Lookup(const std::string& event_id,
+                                      faz::EventResult* result) const;
+
+  Stats GetStats() const;
+
+ private:
+  // An event queued or being executed.
+  struct Pending {
+    std::string function_name;
+    faz::EventRequest request;
+    std::chrono::steady_clock::time_point enqueued;
+  };
+
+  // Kinds of records in the file.
+  enum RecordType : char { kEnqueue = 'Q', kDone = 'D' };
+
+  // Takes events off `ready_` and executes them until stopped.
+  void Work();
+
+  // Makes the event executable now, or after the events queued before it
+  // with the same ordering key. Assume the caller always holds `mutex_`.
+  void Schedule(const std::string& event_id, const std::string& key);
+
+  // Returns the record of the given type and fields as written to the
+  // file.
+  static std::string Record(RecordType type,
+                            const std::vector<std::string>& fields);
+
+  // Appends a record of the given fields to the file and flushes it, or
+  // rolls the file back and returns false on failure. Assume the caller
+  // always holds `mutex_`.
+  bool Append(RecordType type, const std::vector<std::string>& fields);
+
+  // Keeps the outcome of the event, dropping the oldest one beyond
+  // `max_results_`. Assume the caller always holds `mutex_`.
+  void KeepResult(const std::string& event_id, faz::EventResult result);
+
+  const std::string filename_;
+  const size_t max_results_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::ofstream log_;
+  size_t log_size_;
+  // Prefix of the IDs of events queued since opened, unique to each
+  // time the queue is opened, and the number of those events.
+  std::string id_prefix_;
+  uint64_t next_id_;
+  std::unordered_map<std::string, Pending> pending_;
+  // IDs of the events that may be executed now, in the order queued.
+  std::deque<std::string> ready_;
+  // IDs of the queued events of each ordering key with some, the first
+  // of which is ready or being executed.
+  std::unordered_map<std::string, std::deque<std::string>> keys_;
+  std::unordered_map<std::string, faz::EventResult> results_;
+  // IDs of the kept outcomes, oldest first.
+  std::deque<std::string> result_order_;
+  Executor executor_;
+  std::vector<std::thread> workers_;
+  bool stopping_;
+  uint64_t enqueued_;
+  uint64_t executed_;
+  Histogram enqueue_latency_;
+  Histogram queue_wait_;
+};
+
+#endif //CSCI499_CHENGTSU_FAZ_EVENT_QUEUE_H
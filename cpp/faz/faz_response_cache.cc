@@ -0,0 +1,163 @@
+#include "faz/faz_response_cache.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using google::protobuf::Any;
+using std::string;
+using std::vector;
+
+FazResponseCache::FazResponseCache(size_t max_bytes,
+                                   std::chrono::milliseconds max_age)
+    : max_bytes_(max_bytes), max_age_(max_age), mutex_(), lru_(),
+      entries_(), dependents_(), bytes_(0), sequence_(0), recent_writes_(),
+      horizon_(0), stats_() {}
+
+string FazResponseCache::Key(int event_type, const Any& payload) {
+  string key(reinterpret_cast<const char*>(&event_type), sizeof(event_type));
+  key += payload.type_url();
+  // Type URLs never contain a newline.
+  key += '\n';
+  key += payload.value();
+  return key;
+}
+
+bool FazResponseCache::Lookup(const string& key, Any* out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = entries_.find(key);
+  if (iter == entries_.end()) {
+    return false;
+  }
+  if (max_age_.count() > 0 &&
+      std::chrono::steady_clock::now() - iter->second.inserted > max_age_) {
+    ++stats_.evictions;
+    Erase(iter);
+    return false;
+  }
+  // Move the key to the front as the most recently used.
+  lru_.splice(lru_.begin(), lru_, iter->second.lru_iter);
+  out->set_type_url(iter->second.type_url);
+  out->set_value(iter->second.value);
+  return true;
+}
+
+uint64_t FazResponseCache::Sequence() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sequence_;
+}
+
+bool FazResponseCache::Insert(uint64_t sequence, const string& key,
+                              const Any& payload,
+                              const vector<string>& read_keys) {
+  Entry entry;
+  entry.read_keys = read_keys;
+  std::sort(entry.read_keys.begin(), entry.read_keys.end());
+  entry.read_keys.erase(
+      std::unique(entry.read_keys.begin(), entry.read_keys.end()),
+      entry.read_keys.end());
+  // The key is held once by the entry, once by the LRU list, and once
+  // per KVStore key it depends on.
+  entry.bytes = kEntryOverhead + payload.type_url().size() +
+      payload.value().size() + key.size() * (2 + entry.read_keys.size());
+  for (const string& read_key : entry.read_keys) {
+    entry.bytes += read_key.size();
+  }
+  if (entry.bytes > max_bytes_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool stale = sequence < horizon_;
+  for (size_t i = 0; i < entry.read_keys.size() && !stale; ++i) {
+    auto write = recent_writes_.find(entry.read_keys[i]);
+    stale = write != recent_writes_.end() && write->second > sequence;
+  }
+  if (stale) {
+    ++stats_.stale_inserts;
+    return false;
+  }
+  auto iter = entries_.find(key);
+  if (iter != entries_.end()) {
+    Erase(iter);
+  }
+  while (bytes_ + entry.bytes > max_bytes_) {
+    // Evict the least recently used reply.
+    ++stats_.evictions;
+    Erase(entries_.find(lru_.back()));
+  }
+  entry.type_url = payload.type_url();
+  entry.value = payload.value();
+  entry.inserted = std::chrono::steady_clock::now();
+  lru_.push_front(key);
+  entry.lru_iter = lru_.begin();
+  for (const string& read_key : entry.read_keys) {
+    dependents_[read_key].insert(key);
+  }
+  bytes_ += entry.bytes;
+  entries_.emplace(key, std::move(entry));
+  ++stats_.inserts;
+  return true;
+}
+
+void FazResponseCache::Invalidate(const vector<string>& kvstore_keys) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++sequence_;
+  if (recent_writes_.size() + kvstore_keys.size() > kMaxRecentWrites) {
+    // Forget the writes, and rather reject all replies computed before.
+    recent_writes_.clear();
+    horizon_ = sequence_;
+  }
+  for (const string& kvstore_key : kvstore_keys) {
+    recent_writes_[kvstore_key] = sequence_;
+    auto dependents = dependents_.find(kvstore_key);
+    if (dependents == dependents_.end()) {
+      continue;
+    }
+    // Erasing entries changes the dependents, so take them first.
+    std::unordered_set<string> keys = std::move(dependents->second);
+    dependents_.erase(dependents);
+    for (const string& key : keys) {
+      auto iter = entries_.find(key);
+      if (iter != entries_.end()) {
+        ++stats_.invalidations;
+        Erase(iter);
+      }
+    }
+  }
+}
+
+void FazResponseCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  lru_.clear();
+  entries_.clear();
+  dependents_.clear();
+  bytes_ = 0;
+  ++sequence_;
+  recent_writes_.clear();
+  horizon_ = sequence_;
+}
+
+FazResponseCache::Stats FazResponseCache::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats = stats_;
+  stats.size = entries_.size();
+  stats.bytes = bytes_;
+  return stats;
+}
+
+void FazResponseCache::Erase(EntryMap::iterator iter) {
+  for (const string& read_key : iter->second.read_keys) {
+    auto dependents = dependents_.find(read_key);
+    if (dependents != dependents_.end()) {
+      dependents->second.erase(iter->first);
+      if (dependents->second.empty()) {
+        dependents_.erase(dependents);
+      }
+    }
+  }
+  bytes_ -= iter->second.bytes;
+  lru_.erase(iter->second.lru_iter);
+  entries_.erase(iter);
+}
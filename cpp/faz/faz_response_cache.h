@@ -0,0 +1,123 @@
+#ifndef CSCI499_CHENGTSU_FAZ_RESPONSE_CACHE_H
+#define CSCI499_CHENGTSU_FAZ_RESPONSE_CACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <google/protobuf/any.pb.h>
+
+// A bounded, thread-safe cache of the reply payloads of events of
+// read-only functions, keyed by event type and request payload, evicting
+// the least recently used replies when over its size in bytes.
+//
+// Each reply is cached along with the KVStore keys read to compute it,
+// and dropped as soon as one of them is written through `Invalidate()`.
+// A reply being computed while one of its keys is written may be stale,
+// so it is only cached if none of its keys was written since the
+// sequence number taken before computing it. Writes made elsewhere
+// (e.g. through another Faz server) are not seen, which `max_age`
+// bounds.
+class FazResponseCache {
+ public:
+  // Counters of the cache.
+  struct Stats {
+    // Number of replies cached.
+    uint64_t inserts;
+    // Number of replies not cached because keys they read were written
+    // while they were computed.
+    uint64_t stale_inserts;
+    // Number of replies dropped because keys they read were written.
+    uint64_t invalidations;
+    // Number of replies dropped to make room, or for being too old.
+    uint64_t evictions;
+    // Number of cached replies, and their approximate size in bytes.
+    size_t size;
+    size_t bytes;
+  };
+
+  // Creates a cache holding up to about `max_bytes` of replies, each for
+  // at most `max_age`, or with no age limit if 0.
+  explicit FazResponseCache(
+      size_t max_bytes,
+      std::chrono::milliseconds max_age = std::chrono::milliseconds(0));
+
+  // Returns the key of the reply to an event.
+  static std::string Key(int event_type,
+                         const google::protobuf::Any& payload);
+
+  // Copies the cached reply under the key into `out` and returns true,
+  // or returns false if it is not cached.
+  bool Lookup(const std::string& key, google::protobuf::Any* out);
+
+  // Returns the sequence number to cache a reply computed from now on
+  // with.
+  uint64_t Sequence() const;
+
+  // Caches the reply under the key, computed from the values of the
+  // KVStore keys since `sequence`, and returns true, or returns false if
+  // some of them may have been written meanwhile or it is too large.
+  bool Insert(uint64_t sequence, const std::string& key,
+              const google::protobuf::Any& payload,
+              const std::vector<std::string>& read_keys);
+
+  // Drops the replies computed from the KVStore keys, which were just
+  // written.
+  void Invalidate(const std::vector<std::string>& kvstore_keys);
+
+  // Drops all replies, e.g. when an event type is hooked with another
+  // function, including those being computed.
+  void Clear();
+
+  Stats GetStats() const;
+
+ private:
+  struct Entry {
+    std::string type_url;
+    std::string value;
+    // Distinct KVStore keys read to compute the reply.
+    std::vector<std::string> read_keys;
+    size_t bytes;
+    std::chrono::steady_clock::time_point inserted;
+    // Position of the key in `lru_`.
+    std::list<std::string>::iterator lru_iter;
+  };
+
+  using EntryMap = std::unordered_map<std::string, Entry>;
+
+  // Removes the entry and its dependencies. Assume the caller always
+  // holds `mutex_`.
+  void Erase(EntryMap::iterator iter);
+
+  // Maximum number of recently written keys remembered to check inserts
+  // against, beyond which inserts of replies computed before are
+  // rejected altogether.
+  static const size_t kMaxRecentWrites = 4096;
+  // Approximate bytes taken by an entry besides its strings.
+  static const size_t kEntryOverhead = 128;
+
+  const size_t max_bytes_;
+  const std::chrono::milliseconds max_age_;
+  mutable std::mutex mutex_;
+  // Cached keys, most recently used first.
+  std::list<std::string> lru_;
+  EntryMap entries_;
+  // Keys of the cached replies read from each KVStore key.
+  std::unordered_map<std::string, std::unordered_set<std::string>>
+      dependents_;
+  size_t bytes_;
+  // Number of writes so far, the number of writes when each recently
+  // written KVStore key was last written, and the number of writes when
+  // `recent_writes_` was last cleared.
+  uint64_t sequence_;
+  std::unordered_map<std::string, uint64_t> recent_writes_;
+  uint64_t horizon_;
+  Stats stats_;
+};
+
+#endif //CSCI499_CHENGTSU_FAZ_RESPONSE_CACHE_H
@@ -1,12 +1,27 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <grpcpp/grpcpp.h>
 
+#include "common/admission_controller.h"
+#include "common/tracing.h"
+#include "faz/faz_async_server.h"
 #include "faz/faz_service.h"
+#include "kvstore/kvstore.h"
+#include "kvstore/kvstore_client.h"
+#include "kvstore/kvstore_client_pool.h"
+#include "kvstore/kvstore_interface.h"
+#include "kvstore/kvstore_service.h"
+#include "kvstore/kvstore_sharded_client.h"
 
 static bool ValidatePort(const char* flagname, int32_t value) {
   if (value > 0 && value < 65536) { return true; }
@@ -17,37 +32,421 @@ static bool ValidatePort(const char* flagname, int32_t value) {
 
 DEFINE_int32(faz_port, 50000, "Port number for the Faz GRPC interface to use.");
 DEFINE_int32(kvstore_port, 50001, "Port number for the kvstore GRPC interface to use.");
+DEFINE_string(kvstore_address, "", "Address of the kvstore service, either "
+              "host:port or unix:<path> for a Unix domain socket. If given, "
+              "--kvstore_port is ignored.");
+DEFINE_string(kvstore_replicas, "", "Comma-separated addresses (host:port or "
+              "unix:<path>) of read-only kvstore replicas to send reads to.");
+DEFINE_string(kvstore_shards, "", "Comma-separated addresses (host:port or "
+              "unix:<path>) of kvstore services to spread keys over. If "
+              "given, --kvstore_port, --kvstore_address and "
+              "--kvstore_replicas are ignored.");
+DEFINE_bool(inprocess_kvstore, false, "Run the kvstore service inside the Faz "
+            "server and reach it through an in-process channel, instead of "
+            "connecting to a kvstore server. If given, all other --kvstore_* "
+            "flags except --kvstore_store, --kvstore_get_streams and "
+            "--kvstore_cache_* are ignored.");
+DEFINE_string(kvstore_store, "", "File for the in-process kvstore service to "
+              "use for persistence.");
+DEFINE_string(embedded_store, "", "File of a kvstore for the Faz service to "
+              "read and write directly in its own process, persisted the "
+              "same way as by a kvstore server, instead of going through a "
+              "kvstore service. If given, --inprocess_kvstore and all "
+              "--kvstore_* flags are ignored.");
+DEFINE_string(unix_socket, "", "Path of a Unix domain socket for the Faz GRPC "
+              "interface to also listen on.");
+DEFINE_uint32(kvstore_pool_size, 1, "Number of connections to open to each "
+              "kvstore server (and replica), each call going through the one "
+              "with the fewest calls in flight.");
+DEFINE_uint32(kvstore_get_streams, 0, "Number of long-lived get streams to "
+              "keep open to each kvstore server (and replica) per connection, "
+              "over which the gets of all handlers are pipelined, 0 to open "
+              "a stream per get.");
+DEFINE_uint32(kvstore_cache_size, 0, "Maximum number of keys whose values "
+              "each kvstore client keeps, revalidating them with the kvstore "
+              "service upon reads, 0 to disable the cache.");
+DEFINE_string(kvstore_cache_immutable_prefixes, "caw.", "Comma-separated key "
+              "prefixes of keys never changed once they have values, whose "
+              "cached values are used without revalidation.");
+DEFINE_uint32(max_in_flight, 0, "Maximum number of events executed at once, "
+              "0 for no limit.");
+DEFINE_uint32(max_in_flight_per_method, 0, "Maximum number of events of each "
+              "type executed at once, 0 for no limit.");
+DEFINE_string(event_lanes, "", "Comma-separated <function>:<max in flight>"
+              "[:<weight>] limits of the event types hooked with each "
+              "function, e.g. \"Read:8,Caw:0:4\". A max in flight of 0 "
+              "stands for --max_in_flight_per_method, and the weight (1 by "
+              "default) is the share of the slots of --max_in_flight the "
+              "events get while events of several types wait.");
+DEFINE_int32(queue_budget_ms, 100, "Maximum number of milliseconds an event "
+             "waits to be executed before it is rejected.");
+DEFINE_int32(shed_queue_delay_ms, 0, "Reject events right away while events "
+             "waited longer than this on average lately, 0 to always let "
+             "them wait.");
+DEFINE_string(admission_priority, "none", "Which events are executed first "
+              "when there are too many: none, reads or writes.");
+DEFINE_int32(stats_interval_s, 0, "Number of seconds between two dumps of "
+             "the admission, cache and worker counters to the log, 0 to never "
+             "dump them.");
+DEFINE_bool(async_server, false, "Serve through the asynchronous gRPC API, "
+            "running events on a pool of --worker_threads workers apart from "
+            "the --network_threads threads taking calls, instead of on the "
+            "gRPC threads.");
+DEFINE_uint32(network_threads, 2, "Number of threads taking calls off the "
+              "completion queues with --async_server.");
+DEFINE_uint32(worker_threads, 16, "Number of threads running events with "
+              "--async_server.");
+DEFINE_uint32(batch_concurrency, FazService::kDefaultBatchConcurrency,
+              "Maximum number of independent events of a batch executed at "
+              "once, 1 to execute them one after another.");
+DEFINE_bool(memoize_reads, true, "Let each event read a key from the kvstore "
+            "only once, remembering its values for later reads of the same "
+            "event.");
+DEFINE_bool(buffer_writes, false, "Hold the writes of each event back until "
+            "it is done, and apply them to the kvstore in a single batch. "
+            "Writes of failed events are dropped.");
+DEFINE_uint32(caw_read_concurrency, 32,
+              "Maximum number of caws of a level of a thread a Read event "
+              "fetches from the kvstore at once, 1 to fetch them one after "
+              "another.");
+DEFINE_uint64(response_cache_bytes, 0, "Approximate number of bytes of "
+              "replies of read-only events (such as Profile and Read) to "
+              "cache until a key they read is written, 0 to disable the "
+              "cache.");
+DEFINE_int32(response_cache_max_age_ms, 0, "Maximum number of milliseconds a "
+             "reply stays cached, bounding how stale it gets when the "
+             "kvstore is written by others, 0 for no limit.");
+DEFINE_bool(collapse_reads, false, "Have identical read-only events (same "
+            "type and payload) arriving while one is executed share its "
+            "reply instead of executing. They may miss writes made after "
+            "the shared execution started.");
+DEFINE_string(event_queue, "", "File of the queue of events of types hooked "
+              "as async, which are acknowledged once appended to it and "
+              "executed in the background. Event types cannot be hooked as "
+              "async if empty.");
+DEFINE_uint32(event_queue_workers, 4, "Number of threads executing queued "
+              "events.");
+DEFINE_double(trace_sample_rate, 0, "Fraction (0 to 1) of events not traced "
+              "by their caller to trace.");
+DEFINE_string(trace_file, "", "File to export the spans of traced events to, "
+              "in the Chrome trace event format. Nothing is exported if "
+              "empty.");
 DEFINE_validator(faz_port, &ValidatePort);
 DEFINE_validator(kvstore_port, &ValidatePort);
 
+// Splits a comma-separated list (e.g. of addresses), skipping empty items.
+std::vector<std::string> SplitAddresses(const std::string& addresses) {
+  std::vector<std::string> result;
+  size_t start = 0;
+  while (start <= addresses.length()) {
+    size_t pos = addresses.find(',', start);
+    if (pos == std::string::npos) { pos = addresses.length(); }
+    if (pos > start) {
+      result.push_back(addresses.substr(start, pos - start));
+    }
+    start = pos + 1;
+  }
+  return result;
+}
+
+// Getters of the counters of the caches of the KVStore clients.
+using CacheStatsGetters = std::vector<std::function<KVStoreCache::Stats()>>;
+
+// Enables the pipelining of gets and the cache given by the command line
+// flags on the client (or pool), if any, and adds the getter of the
+// counters of its cache to `cache_stats`.
+template <typename Client>
+void SetUpClient(Client& client, CacheStatsGetters& cache_stats) {
+  if (FLAGS_kvstore_get_streams > 0) {
+    client.EnablePipelining(FLAGS_kvstore_get_streams);
+  }
+  if (FLAGS_kvstore_cache_size == 0) {
+    return;
+  }
+  client.EnableCache(FLAGS_kvstore_cache_size,
+                     SplitAddresses(FLAGS_kvstore_cache_immutable_prefixes));
+  cache_stats.push_back([&client]() { return client.GetCacheStats(); });
+}
+
+// Returns a client of the KVStore gRPC service at `target` that spreads
+// reads over its replicas at `read_targets`, over `--kvstore_pool_size`
+// connections to each, and set up as given by the other command line
+// flags.
+std::unique_ptr<KVStoreInterface> NewKVStoreClient(
+    const std::string& target, const std::vector<std::string>& read_targets,
+    CacheStatsGetters& cache_stats) {
+  if (FLAGS_kvstore_pool_size <= 1) {
+    std::vector<std::shared_ptr<grpc::Channel>> read_channels;
+    for (const std::string& read_target : read_targets) {
+      read_channels.push_back(grpc::CreateChannel(
+          read_target, grpc::InsecureChannelCredentials()));
+    }
+    std::unique_ptr<KVStoreClient> client(new KVStoreClient(
+        grpc::CreateChannel(target, grpc::InsecureChannelCredentials()),
+        read_channels));
+    SetUpClient(*client, cache_stats);
+    return client;
+  }
+  std::vector<std::unique_ptr<KVStoreClient>> clients;
+  for (size_t i = 0; i < FLAGS_kvstore_pool_size; ++i) {
+    std::vector<std::shared_ptr<grpc::Channel>> read_channels;
+    for (const std::string& read_target : read_targets) {
+      read_channels.push_back(
+          KVStoreClientPool::CreateChannel(read_target, i));
+    }
+    clients.emplace_back(new KVStoreClient(
+        KVStoreClientPool::CreateChannel(target, i), read_channels));
+  }
+  std::unique_ptr<KVStoreClientPool> pool(
+      new KVStoreClientPool(std::move(clients)));
+  SetUpClient(*pool, cache_stats);
+  return pool;
+}
+
+// Returns a KVStore abstraction to interact with the KVStore gRPC
+// service(s) given by the command line flags: the shards listed in
+// `--kvstore_shards` if any, otherwise the one at `--kvstore_address`
+// (or `--kvstore_port`) along with its replicas listed in
+// `--kvstore_replicas`. The getters of the counters of the caches of
+// the underlying clients are added to `cache_stats`.
+std::unique_ptr<KVStoreInterface> ConnectKVStore(
+    CacheStatsGetters& cache_stats) {
+  auto shard_addresses = SplitAddresses(FLAGS_kvstore_shards);
+  if (!shard_addresses.empty()) {
+    std::unique_ptr<ShardedKVStoreClient> kvstore(new ShardedKVStoreClient);
+    for (const std::string& address : shard_addresses) {
+      kvstore->AddShard(address, NewKVStoreClient(address, {}, cache_stats));
+    }
+    LOG(INFO) << "Using " << kvstore->NumShards() << " kvstore shards.";
+    return kvstore;
+  }
+  std::string target_str = FLAGS_kvstore_address.empty() ?
+      "localhost:" + std::to_string(FLAGS_kvstore_port) :
+      FLAGS_kvstore_address;
+  return NewKVStoreClient(target_str, SplitAddresses(FLAGS_kvstore_replicas),
+                          cache_stats);
+}
+
+// Returns the admission control options given by the command line flags.
+AdmissionController::Options AdmissionOptionsFromFlags() {
+  AdmissionController::Options options;
+  options.max_in_flight = FLAGS_max_in_flight;
+  options.max_in_flight_per_method = FLAGS_max_in_flight_per_method;
+  options.queue_budget = std::chrono::milliseconds(FLAGS_queue_budget_ms);
+  options.shed_queue_delay =
+      std::chrono::milliseconds(FLAGS_shed_queue_delay_ms);
+  if (!AdmissionController::ParsePriority(FLAGS_admission_priority,
+                                          &options.priority)) {
+    LOG(FATAL) << "Invalid admission priority: " << FLAGS_admission_priority
+               << ".";
+  }
+  return options;
+}
+
+// Sets the lane options given by `--event_lanes` on the service.
+void SetLaneOptionsFromFlags(FazService& service) {
+  for (const std::string& lane : SplitAddresses(FLAGS_event_lanes)) {
+    std::istringstream in(lane);
+    std::string function_name;
+    AdmissionController::MethodOptions options;
+    char separator;
+    if (!std::getline(in, function_name, ':') ||
+        !(in >> options.max_in_flight) ||
+        (!in.eof() && !(in >> separator >> options.weight &&
+                        separator == ':' && in.eof()))) {
+      LOG(FATAL) << "Invalid event lane: " << lane << ".";
+    }
+    service.SetLaneOptions(function_name, options);
+  }
+}
+
+// Logs the admission and KVStore call counters of the service, the cache
+// counters of the KVStore clients and the queue of the asynchronous
+// server, if any, every `interval_s` seconds. Never returns.
+void DumpStatsPeriodically(const FazService& service,
+                           CacheStatsGetters cache_stats,
+                           const FazAsyncServer* async_server,
+                           int interval_s) {
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::seconds(interval_s));
+    std::ostringstream out;
+    out << "Stats:";
+    for (const auto& method : service.GetAdmissionStats()) {
+      out << "\n  admission." << method.name
+          << ": max_in_flight=" << method.options.max_in_flight
+          << " weight=" << method.options.weight
+          << " admitted=" << method.admitted
+          << " shed_overloaded=" << method.shed_overloaded
+          << " shed_timed_out=" << method.shed_timed_out
+          << " in_flight=" << method.in_flight
+          << " waiting=" << method.waiting
+          << " queue_wait_p50_us=" << method.queue_wait.Percentile(50) / 1000
+          << " queue_wait_p99_us=" << method.queue_wait.Percentile(99) / 1000;
+    }
+    for (const auto& event : service.GetEventStats()) {
+      out << "\n  event(" << event.event_type << "): events=" << event.events
+          << " kvstore_calls=" << event.remote_calls
+          << " saved_kvstore_calls=" << event.saved_calls;
+      if (event.cache_hits + event.cache_misses > 0) {
+        out << " cache_hits=" << event.cache_hits
+            << " cache_misses=" << event.cache_misses
+            << " cache_hit_rate=" << static_cast<double>(event.cache_hits) /
+                   (event.cache_hits + event.cache_misses);
+      }
+      if (event.collapsed > 0) {
+        out << " collapsed=" << event.collapsed
+            << " collapse_ratio=" << static_cast<double>(event.collapsed) /
+                   (event.events + event.collapsed);
+      }
+    }
+    FazResponseCache::Stats response_cache = service.GetResponseCacheStats();
+    out << "\n  response_cache: inserts=" << response_cache.inserts
+        << " stale_inserts=" << response_cache.stale_inserts
+        << " invalidations=" << response_cache.invalidations
+        << " evictions=" << response_cache.evictions
+        << " size=" << response_cache.size
+        << " bytes=" << response_cache.bytes;
+    FazEventQueue::Stats event_queue = service.GetEventQueueStats();
+    if (event_queue.enqueued + event_queue.pending > 0) {
+      out << "\n  event_queue: enqueued=" << event_queue.enqueued
+          << " executed=" << event_queue.executed
+          << " pending=" << event_queue.pending
+          << " enqueue_p50_us="
+          << event_queue.enqueue_latency.Percentile(50) / 1000
+          << " enqueue_p99_us="
+          << event_queue.enqueue_latency.Percentile(99) / 1000
+          << " queue_wait_p99_us="
+          << event_queue.queue_wait.Percentile(99) / 1000;
+    }
+    KVStoreCache::Stats total = {0, 0, 0, 0};
+    for (const auto& get_stats : cache_stats) {
+      KVStoreCache::Stats stats = get_stats();
+      total.hits += stats.hits;
+      total.revalidations += stats.revalidations;
+      total.misses += stats.misses;
+      total.size += stats.size;
+    }
+    out << "\n  kvstore_cache: hits=" << total.hits
+        << " revalidations=" << total.revalidations
+        << " misses=" << total.misses
+        << " size=" << total.size;
+    if (async_server) {
+      FazAsyncServer::Stats server_stats = async_server->GetStats();
+      out << "\n  workers: queue_depth=" << server_stats.queue_depth
+          << " queue_wait_p50_us="
+          << server_stats.queue_wait.Percentile(50) / 1000
+          << " queue_wait_p99_us="
+          << server_stats.queue_wait.Percentile(99) / 1000;
+    }
+    LOG(INFO) << out.str();
+  }
+}
+
 // Runs the Faz gRPC service at a given port, with an abstraction to
-// interact with a KVStore gRPC service running at another given port.
-void RunServer(int faz_port, int kvstore_port) {
-  // Create a FazService who uses the KVStore running at `kvstore_port`.
-  std::string target_str = "localhost:" + std::to_string(kvstore_port);
-  auto channel = grpc::CreateChannel(
-      target_str, grpc::InsecureChannelCredentials());
-  FazService service(channel);
-
-  std::string server_address("0.0.0.0:" + std::to_string(faz_port));
-  grpc::ServerBuilder builder;
-  // Listen on the given address without any authentication mechanism.
-  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
-  // Register `service` as the instance through which we'll communicate with
-  // clients. In this case, it corresponds to an *synchronous* service.
-  builder.RegisterService(&service);
-  // Finally assemble the server.
-  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
-  LOG(INFO) << "Server listening on " << server_address << std::endl;
+// interact with the KVStore, and the getters of the counters of its
+// caches.
+void RunServer(int faz_port, std::unique_ptr<KVStoreInterface> kvstore,
+               const CacheStatsGetters& cache_stats) {
+  FazService service(std::move(kvstore));
+  service.SetAdmissionOptions(AdmissionOptionsFromFlags());
+  SetLaneOptionsFromFlags(service);
+  service.SetBatchConcurrency(FLAGS_batch_concurrency);
+  FazContext::Options context_options;
+  context_options.memoize_reads = FLAGS_memoize_reads;
+  context_options.buffer_writes = FLAGS_buffer_writes;
+  // Each caw of a Read takes two keys: its body and its reply ids.
+  context_options.max_multi_get_keys =
+      2 * std::max<uint32_t>(FLAGS_caw_read_concurrency, 1);
+  service.SetContextOptions(context_options);
+  service.SetCollapseReads(FLAGS_collapse_reads);
+  if (FLAGS_response_cache_bytes > 0) {
+    service.EnableResponseCache(
+        FLAGS_response_cache_bytes,
+        std::chrono::milliseconds(FLAGS_response_cache_max_age_ms));
+  }
+  // Queued events left in the file start executing right away, so set
+  // the service up first.
+  if (!FLAGS_event_queue.empty() &&
+      !service.EnableEventQueue(FLAGS_event_queue,
+                                FLAGS_event_queue_workers)) {
+    LOG(FATAL) << "Failed to open the event queue " << FLAGS_event_queue;
+  }
+
+  std::vector<std::string> addresses = {
+      "0.0.0.0:" + std::to_string(faz_port)};
+  if (!FLAGS_unix_socket.empty()) {
+    addresses.push_back("unix:" + FLAGS_unix_socket);
+  }
+  std::unique_ptr<grpc::Server> server;
+  std::unique_ptr<FazAsyncServer> async_server;
+  if (FLAGS_async_server) {
+    async_server.reset(new FazAsyncServer(
+        &service, FLAGS_network_threads, FLAGS_worker_threads));
+    async_server->Start(addresses);
+  } else {
+    grpc::ServerBuilder builder;
+    // Listen on the given addresses without any authentication mechanism.
+    for (const std::string& address : addresses) {
+      builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+    }
+    // Register `service` as the instance through which we'll communicate
+    // with clients. In this case, it corresponds to an *synchronous*
+    // service.
+    builder.RegisterService(&service);
+    // Finally assemble the server.
+    server = builder.BuildAndStart();
+  }
+  for (const std::string& address : addresses) {
+    LOG(INFO) << "Server listening on " << address;
+  }
+  if (FLAGS_stats_interval_s > 0) {
+    std::thread(DumpStatsPeriodically, std::cref(service), cache_stats,
+                async_server.get(), FLAGS_stats_interval_s).detach();
+  }
 
   // Wait for the server to shutdown. Note that some other thread must be
   // responsible for shutting down the server for this call to ever return.
-  server->Wait();
+  if (async_server) {
+    async_server->Wait();
+  } else {
+    server->Wait();
+  }
 }
 
 int main(int argc, char** argv) {
   google::InitGoogleLogging(argv[0]);
   gflags::ParseCommandLineFlags(&argc, &argv, true);
-  RunServer(FLAGS_faz_port, FLAGS_kvstore_port);
+  Tracer::Get().SetSampleRate(FLAGS_trace_sample_rate);
+  if (!FLAGS_trace_file.empty() &&
+      !Tracer::Get().StartExport(FLAGS_trace_file)) {
+    LOG(FATAL) << "Failed to open the trace file " << FLAGS_trace_file;
+  }
+  CacheStatsGetters cache_stats;
+  if (!FLAGS_embedded_store.empty()) {
+    // Events call the KVStore directly, so their reads and writes are
+    // neither serialized nor sent through gRPC at all.
+    LOG(INFO) << "Using the embedded kvstore at " << FLAGS_embedded_store;
+    RunServer(FLAGS_faz_port, std::unique_ptr<KVStoreInterface>(
+        new KVStore(FLAGS_embedded_store)), cache_stats);
+    return 0;
+  }
+  if (!FLAGS_inprocess_kvstore) {
+    auto kvstore = ConnectKVStore(cache_stats);
+    RunServer(FLAGS_faz_port, std::move(kvstore), cache_stats);
+    return 0;
+  }
+  // Serve the kvstore service without listening on any port, so that it
+  // is only reachable through in-process channels, which skip the network
+  // stack entirely (messages are still serialized though).
+  KVStoreService kvstore_service = FLAGS_kvstore_store.empty() ?
+      KVStoreService() : KVStoreService(FLAGS_kvstore_store);
+  grpc::ServerBuilder builder;
+  builder.RegisterService(&kvstore_service);
+  std::unique_ptr<grpc::Server> kvstore_server(builder.BuildAndStart());
+  LOG(INFO) << "Using an in-process kvstore service.";
+  std::unique_ptr<KVStoreClient> kvstore(new KVStoreClient(
+      kvstore_server->InProcessChannel(grpc::ChannelArguments())));
+  SetUpClient(*kvstore, cache_stats);
+  RunServer(FLAGS_faz_port, std::move(kvstore), cache_stats);
   return 0;
 }
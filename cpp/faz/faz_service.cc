@@ -1,17 +1,31 @@
 #include "faz/faz_service.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 #include <grpcpp/grpcpp.h>
 
 #include "caw/caw_handler.h"
+#include "common/tracing.h"
 
 using faz::EventReply;
 using faz::EventRequest;
+using faz::EventResult;
+using faz::EventStatusReply;
+using faz::EventStatusRequest;
+using faz::EventsReply;
+using faz::EventsRequest;
 using faz::HookReply;
 using faz::HookRequest;
 using faz::UnhookReply;
 using faz::UnhookRequest;
 using google::protobuf::Any;
+using google::protobuf::Arena;
+using google::protobuf::ArenaOptions;
 using grpc::ServerContext;
 using grpc::Status;
 using grpc::StatusCode;
@@ -19,18 +33,64 @@ using std::string;
 using std::unordered_map;
 
 // Initialize the predefined table of known functions.
-const unordered_map<string, FazFunc> FazServiceImpl::kPredefinedFuncs = {
-    {"RegisterUser", caw::handler::RegisterUser},
-    {"Follow", caw::handler::Follow},
-    {"Profile", caw::handler::Profile},
-    {"Caw", caw::handler::Caw},
-    {"Read", caw::handler::Read}};
+const unordered_map<string, RegisteredFunc>
+    FazServiceImpl::kPredefinedFuncs = {
+    {"RegisterUser", {caw::handler::RegisterUser, false}},
+    {"Follow", {caw::handler::Follow, false}},
+    {"Profile", {caw::handler::Profile, true}},
+    {"Caw", {caw::handler::Caw, false}},
+    {"Read", {caw::handler::Read, true}}};
+
+void FazServiceImpl::SetBatchConcurrency(size_t concurrency) {
+  batch_workers_.reset(
+      concurrency > 1 ? new WorkStealingPool(concurrency - 1) : nullptr);
+}
+
+bool FazServiceImpl::EnableEventQueue(const string& filename,
+                                      size_t num_workers) {
+  std::unique_ptr<FazEventQueue> event_queue(new FazEventQueue(filename));
+  if (!event_queue->Open()) {
+    return false;
+  }
+  event_queue->Start(num_workers, [this](const string& function_name,
+                                         const EventRequest& request,
+                                         Any* out) {
+    return ExecuteQueued(function_name, request, out);
+  });
+  event_queue_ = std::move(event_queue);
+  return true;
+}
+
+std::vector<FazServiceImpl::EventStats> FazServiceImpl::GetEventStats() const {
+  std::vector<EventStats> stats;
+  for (int event_type = 0; event_type < kMaxEventTypes; ++event_type) {
+    const EventCounters& counters = event_stats_[event_type];
+    uint64_t events = counters.events.load(std::memory_order_relaxed);
+    uint64_t cache_hits = counters.cache_hits.load(std::memory_order_relaxed);
+    uint64_t collapsed = counters.collapsed.load(std::memory_order_relaxed);
+    if (events > 0 || cache_hits > 0 || collapsed > 0) {
+      stats.push_back({event_type, events,
+                       counters.remote_calls.load(std::memory_order_relaxed),
+                       counters.saved_calls.load(std::memory_order_relaxed),
+                       cache_hits,
+                       counters.cache_misses.load(std::memory_order_relaxed),
+                       collapsed});
+    }
+  }
+  return stats;
+}
 
 Status FazServiceImpl::hook(
     ServerContext* context,
     const HookRequest* request, HookReply* response) {
   int event_type = request->event_type();
   string function_name = request->event_function();
+  if (event_type < 0 || event_type >= kMaxEventTypes) {
+    LOG(ERROR) << "Failed to hook function " << function_name
+               << ": event type " << event_type << " out of range.";
+    return Status(StatusCode::INVALID_ARGUMENT,
+                  "Event type out of range.");
+  }
   auto iter = kPredefinedFuncs.find(function_name);
   if (iter == kPredefinedFuncs.end()) {
     LOG(ERROR) << "Failed to hook function " << function_name
@@ -38,7 +98,36 @@ Status FazServiceImpl::hook(
     return Status(StatusCode::NOT_FOUND,
                   "Function not found in predefined functions.");
   }
-  registered_funcs_[event_type] = iter->second;
+  if (request->async() && !event_queue_) {
+    LOG(ERROR) << "Failed to hook function " << function_name
+               << " as async: no event queue.";
+    return Status(StatusCode::FAILED_PRECONDITION,
+                  "Faz has no event queue for async events.");
+  }
+  const RegisteredFunc* registered_func = &iter->second;
+  AdmissionController::MethodOptions lane_options;
+  auto options_iter = lane_options_.find(function_name);
+  if (options_iter != lane_options_.end()) {
+    lane_options = options_iter->second;
+  }
+  if (request->max_concurrency() > 0) {
+    lane_options.max_in_flight = request->max_concurrency();
+  }
+  if (request->weight() > 0) {
+    lane_options.weight = request->weight();
+  }
+  SetUpLane(event_type,
+            registered_func->read_only ? AdmissionController::kRead :
+                                         AdmissionController::kWrite,
+            lane_options, false);
+  async_functions_[event_type].store(
+      request->async() ? &iter->first : nullptr, std::memory_order_release);
+  registered_funcs_[event_type].store(registered_func,
+                                     std::memory_order_release);
+  if (response_cache_) {
+    // Cached replies of the event type may come from another function.
+    response_cache_->Clear();
+  }
   LOG(INFO) << "Successfully hooked function " << function_name
             << " with event type " << event_type;
   return Status::OK;
@@ -48,14 +137,18 @@ Status FazServiceImpl::unhook(
     ServerContext* context,
     const UnhookRequest* request, UnhookReply* response) {
   int event_type = request->event_type();
-  auto iter = registered_funcs_.find(event_type);
-  if (iter == registered_funcs_.end()) {
+  if (event_type < 0 || event_type >= kMaxEventTypes ||
+      !registered_funcs_[event_type].exchange(nullptr,
+                                              std::memory_order_acq_rel)) {
     LOG(ERROR) << "Failed to unhook event type " << event_type
                << ": not found in the registered table.";
     return Status(StatusCode::NOT_FOUND,
                   "Function not found in registered functions.");
   }
-  registered_funcs_.erase(iter);
+  async_functions_[event_type].store(nullptr, std::memory_order_release);
+  if (response_cache_) {
+    response_cache_->Clear();
+  }
   LOG(INFO) << "Successfully unhooked function from event type " << event_type;
   return Status::OK;
 }
@@ -63,17 +156,276 @@ Status FazServiceImpl::unhook(
 Status FazServiceImpl::event(
     ServerContext* context,
     const EventRequest* request, EventReply* response) {
-  int event_type = request->event_type();
-  Any payload = request->payload();
-  auto iter = registered_funcs_.find(event_type);
-  if (iter == registered_funcs_.end()) {
+  return Submit(context, *request, response->mutable_payload(),
+                response->mutable_event_id());
+}
+
+Status FazServiceImpl::events(
+    ServerContext* context,
+    const EventsRequest* request, EventsReply* response) {
+  int num_events = request->events_size();
+  ScopedSpan span("faz.events", ExtractTraceContext(context),
+                  std::to_string(num_events) + " events");
+  for (int i = 0; i < num_events; ++i) {
+    response->add_results();
+  }
+  // Executes the event of the given index into its own result, so that
+  // events can be executed concurrently, within the span of the batch.
+  TraceContext trace_context = span.context();
+  auto execute = [this, context, request, response, trace_context](int i) {
+    ScopedTraceContext scoped_trace_context(trace_context);
+    EventResult* result = response->mutable_results(i);
+    Status status = Submit(context, request->events(i),
+                           result->mutable_payload(),
+                           result->mutable_event_id());
+    result->set_code(status.error_code());
+    result->set_message(status.error_message());
+    if (!status.ok()) {
+      result->clear_payload();
+    }
+  };
+  if (request->sequential() || !batch_workers_ || num_events <= 1) {
+    for (int i = 0; i < num_events; ++i) {
+      execute(i);
+    }
+    return Status::OK;
+  }
+
+  // The serving thread and as many workers as available take events off
+  // the batch one at a time until none is left. Workers may only start
+  // once the batch is done, so they share its progress rather than the
+  // batch itself, and never execute an event after the last one is done.
+  struct Progress {
+    std::function<void(int)> execute;
+    int num_events;
+    std::atomic<int> next{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    int num_done = 0;
+  };
+  auto progress = std::make_shared<Progress>();
+  progress->execute = execute;
+  progress->num_events = num_events;
+  auto take_events = [progress]() {
+    int i;
+    while ((i = progress->next++) < progress->num_events) {
+      progress->execute(i);
+      std::lock_guard<std::mutex> lock(progress->mutex);
+      if (++progress->num_done == progress->num_events) {
+        progress->cv.notify_all();
+      }
+    }
+  };
+  size_t num_helpers = std::min<size_t>(num_events - 1,
+                                        batch_workers_->NumThreads());
+  for (size_t i = 0; i < num_helpers; ++i) {
+    batch_workers_->Submit(take_events);
+  }
+  take_events();
+  std::unique_lock<std::mutex> lock(progress->mutex);
+  progress->cv.wait(lock, [&progress]() {
+    return progress->num_done == progress->num_events;
+  });
+  return Status::OK;
+}
+
+Status FazServiceImpl::event_status(
+    ServerContext* context,
+    const EventStatusRequest* request, EventStatusReply* response) {
+  if (!event_queue_) {
+    return Status(StatusCode::FAILED_PRECONDITION,
+                  "Faz has no event queue for async events.");
+  }
+  response->set_state(event_queue_->Lookup(request->event_id(),
+                                           response->mutable_result()));
+  return Status::OK;
+}
+
+Status FazServiceImpl::Submit(
+    ServerContext* context, const EventRequest& request, Any* out,
+    string* event_id) {
+  int event_type = request.event_type();
+  const string* async_function = nullptr;
+  if (event_type >= 0 && event_type < kMaxEventTypes) {
+    async_function =
+        async_functions_[event_type].load(std::memory_order_acquire);
+  }
+  if (!async_function) {
+    return Execute(context, request, out);
+  }
+  ScopedSpan span("faz.enqueue", ExtractTraceContext(context),
+                  std::to_string(event_type));
+  if (!event_queue_->Enqueue(*async_function, request, event_id)) {
+    return Status(StatusCode::UNAVAILABLE, "Failed to queue the event.");
+  }
+  return Status::OK;
+}
+
+Status FazServiceImpl::ExecuteQueued(
+    const string& function_name, const EventRequest& request, Any* out) {
+  int event_type = request.event_type();
+  auto iter = kPredefinedFuncs.find(function_name);
+  if (iter == kPredefinedFuncs.end() || event_type < 0 ||
+      event_type >= kMaxEventTypes) {
+    return Status(StatusCode::NOT_FOUND,
+                  "Function not found in predefined functions.");
+  }
+  ScopedSpan span("faz.queued_event", std::to_string(event_type));
+  const RegisteredFunc& registered_func = iter->second;
+  if (lanes_[event_type].load(std::memory_order_relaxed) < 0) {
+    // Queued before a restart, and not hooked since.
+    SetUpLane(event_type,
+              registered_func.read_only ? AdmissionController::kRead :
+                                          AdmissionController::kWrite,
+              lane_options_.count(function_name) > 0 ?
+                  lane_options_.at(function_name) :
+                  AdmissionController::MethodOptions(),
+              true);
+  }
+  AdmissionController::Ticket ticket;
+  {
+    ScopedSpan admission_span("faz.admission");
+    // The event was acknowledged already, so it waits for a slot as long
+    // as it takes rather than being shed.
+    admission_.AdmitAccepted(
+        lanes_[event_type].load(std::memory_order_relaxed), &ticket);
+  }
+  return RunAdmitted(registered_func, request, out, string(), 0);
+}
+
+void FazServiceImpl::SetUpLane(
+    int event_type, AdmissionController::Class lane_class,
+    const AdmissionController::MethodOptions& options, bool keep_options) {
+  std::lock_guard<std::mutex> lock(lanes_mutex_);
+  int lane = lanes_[event_type].load(std::memory_order_relaxed);
+  if (lane < 0) {
+    lane = admission_.AddMethod("event(" + std::to_string(event_type) + ")",
+                                lane_class, options);
+    lanes_[event_type].store(lane, std::memory_order_relaxed);
+  } else if (!keep_options) {
+    admission_.SetMethodOptions(lane, lane_class, options);
+  }
+}
+
+Status FazServiceImpl::Execute(
+    ServerContext* context,
+    const EventRequest& request, Any* out) {
+  int event_type = request.event_type();
+  // Events of a batch are traced within the span of the batch.
+  TraceContext parent = CurrentTraceContext();
+  ScopedSpan span("faz.event",
+                  parent.IsValid() ? parent : ExtractTraceContext(context),
+                  std::to_string(event_type));
+  const RegisteredFunc* registered_func = nullptr;
+  if (event_type >= 0 && event_type < kMaxEventTypes) {
+    registered_func =
+        registered_funcs_[event_type].load(std::memory_order_acquire);
+  }
+  if (!registered_func) {
     LOG(ERROR) << "Failed to execute event(" << event_type
                << "): not found in the registered table.";
     return Status(StatusCode::NOT_FOUND,
                   "Function not found in registered functions.");
   }
-  FazFunc func = iter->second;
-  Status status = func(&payload, response->mutable_payload(), kvstore_.get());
-  LOG(ERROR) << "Successfully executed event(" << event_type << ")";
+  EventCounters& counters = event_stats_[event_type];
+  // Replies of read-only events may be answered from the cache, without
+  // going through admission control.
+  bool cacheable = response_cache_ && registered_func->read_only;
+  bool collapsible = collapse_reads_ && registered_func->read_only;
+  string key;
+  uint64_t cache_sequence = 0;
+  if (cacheable || collapsible) {
+    key = FazResponseCache::Key(event_type, request.payload());
+  }
+  if (cacheable) {
+    if (response_cache_->Lookup(key, out)) {
+      counters.cache_hits.fetch_add(1, std::memory_order_relaxed);
+      return Status::OK;
+    }
+    counters.cache_misses.fetch_add(1, std::memory_order_relaxed);
+    cache_sequence = response_cache_->Sequence();
+  }
+  if (!collapsible) {
+    return Run(context, *registered_func, request, out,
+               cacheable ? key : string(), cache_sequence);
+  }
+  // Identical events in flight share the execution of the first one.
+  bool leader;
+  auto flight = single_flight_.Join(key, &leader);
+  if (!leader) {
+    counters.collapsed.fetch_add(1, std::memory_order_relaxed);
+    ScopedSpan collapsed_span("faz.collapsed");
+    return single_flight_.Wait(flight, out);
+  }
+  Status status = Run(context, *registered_func, request, out,
+                      cacheable ? key : string(), cache_sequence);
+  single_flight_.Land(key, flight, status, *out);
+  return status;
+}
+
+Status FazServiceImpl::Run(
+    ServerContext* context, const RegisteredFunc& registered_func,
+    const EventRequest& request, Any* out,
+    const string& cache_key, uint64_t cache_sequence) {
+  int event_type = request.event_type();
+  AdmissionController::Ticket ticket;
+  Status admission;
+  {
+    ScopedSpan admission_span("faz.admission");
+    admission = admission_.Admit(
+        lanes_[event_type].load(std::memory_order_relaxed), context, &ticket);
+  }
+  if (!admission.ok()) {
+    return admission;
+  }
+  return RunAdmitted(registered_func, request, out, cache_key,
+                     cache_sequence);
+}
+
+Status FazServiceImpl::RunAdmitted(
+    const RegisteredFunc& registered_func, const EventRequest& request,
+    Any* out, const string& cache_key, uint64_t cache_sequence) {
+  int event_type = request.event_type();
+  ScopedSpan function_span("faz.function");
+  FazContext faz_context(kvstore_.get(), context_options_);
+  Status status;
+  if (out->GetArena()) {
+    status = registered_func.func(&request.payload(), out, &faz_context);
+  } else {
+    // Have the function build its messages on an arena starting on the
+    // stack, and only move the packed reply out of it.
+    alignas(8) char block[kArenaBlockSize];
+    ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = sizeof(block);
+    Arena arena(options);
+    Any* arena_out = Arena::CreateMessage<Any>(&arena);
+    status = registered_func.func(&request.payload(), arena_out,
+                                  &faz_context);
+    out->set_type_url(std::move(*arena_out->mutable_type_url()));
+    out->set_value(std::move(*arena_out->mutable_value()));
+  }
+  // Writes of failed events are dropped, if buffered.
+  if (status.ok() && !faz_context.Flush()) {
+    status = Status(StatusCode::UNAVAILABLE,
+                    "Failed to apply the writes to the kvstore.");
+  }
+  if (!cache_key.empty() && status.ok()) {
+    response_cache_->Insert(cache_sequence, cache_key, *out,
+                            faz_context.ReadKeys());
+  }
+  if (response_cache_ && !faz_context.WrittenKeys().empty()) {
+    // Whether or not the event failed, some of its writes may have been
+    // applied.
+    response_cache_->Invalidate(faz_context.WrittenKeys());
+  }
+  EventCounters& counters = event_stats_[event_type];
+  counters.events.fetch_add(1, std::memory_order_relaxed);
+  counters.remote_calls.fetch_add(faz_context.GetStats().remote_calls,
+                                  std::memory_order_relaxed);
+  counters.saved_calls.fetch_add(faz_context.GetStats().saved_calls,
+                                 std::memory_order_relaxed);
+  VLOG(1) << "Executed event(" << event_type << "): "
+          << (status.ok() ? "OK" : status.error_message());
   return status;
 }
@@ -1,12 +1,24 @@
 #ifndef CSCI499_CHENGTSU_FAZ_SERVICE_H
 #define CSCI499_CHENGTSU_FAZ_SERVICE_H
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <grpcpp/grpcpp.h>
 
+#include "common/admission_controller.h"
+#include "common/work_stealing_pool.h"
 #include "faz.grpc.pb.h"
+#include "faz/faz_context.h"
+#include "faz/faz_event_queue.h"
+#include "faz/faz_response_cache.h"
+#include "faz/faz_single_flight.h"
 #include "kvstore/kvstore.h"
 #include "kvstore/kvstore_client.h"
 #include "kvstore/kvstore_interface.h"
@@ -28,16 +40,143 @@ using FazFunc =  std::function<grpc::Status(
     const google::protobuf::Any* in, google::protobuf::Any* out,
     KVStoreInterface* kvstore)>;
 
+// A function known to Faz.
+struct RegisteredFunc {
+  FazFunc func;
+  // True if the function never changes the KVStore.
+  bool read_only;
+};
+
 // A Function-as-a-Service (FaaS) service who executes a registered
 // function f when receiving an event that matches an event type e
 // hooked with f.
 class FazServiceImpl final : public faz::FazService::Service {
  public:
+  // Event types must be in [0, kMaxEventTypes) to be hooked.
+  static const int kMaxEventTypes = 1024;
+  // Size of the block on the stack each event starts its arena with,
+  // unless its reply is on an arena already.
+  static const size_t kArenaBlockSize = 4096;
+  // Number of events of a batch executed at once by default.
+  static const size_t kDefaultBatchConcurrency = 8;
+
+  // Counters of the calls to the KVStore made by the events of a type.
+  struct EventStats {
+    int event_type;
+    // Number of events executed.
+    uint64_t events;
+    // Number of calls made to the KVStore.
+    uint64_t remote_calls;
+    // Number of calls to the KVStore the functions would have made
+    // without memoized reads and buffered writes.
+    uint64_t saved_calls;
+    // Number of events answered from the response cache, and of those
+    // looked up in it in vain.
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    // Number of events which shared the execution of an identical event
+    // in flight instead of executing.
+    uint64_t collapsed;
+  };
+
   FazServiceImpl(std::shared_ptr<grpc::Channel> channel)
-      : registered_funcs_(), kvstore_(new KVStoreClient(channel)) {}
+      : FazServiceImpl(std::unique_ptr<KVStoreInterface>(
+            new KVStoreClient(channel))) {}
+
+  // Creates a FazService whose functions interact with the given KVStore.
+  FazServiceImpl(std::unique_ptr<KVStoreInterface> kvstore)
+      : registered_funcs_(), kvstore_(std::move(kvstore)), admission_(),
+        lanes_mutex_(), lane_options_(), lanes_(), batch_workers_(),
+        context_options_(), response_cache_(), collapse_reads_(false),
+        single_flight_(), event_stats_(), async_functions_(),
+        event_queue_() {
+    for (auto& lane : lanes_) {
+      lane.store(-1, std::memory_order_relaxed);
+    }
+    for (auto& async_function : async_functions_) {
+      async_function.store(nullptr, std::memory_order_relaxed);
+    }
+    SetBatchConcurrency(kDefaultBatchConcurrency);
+  }
+
+  // Sets how many events are executed at once and how the rest wait or
+  // get rejected. Each event type is a lane (an admission method) of its
+  // own, whose events count as reads if its function is read-only, and
+  // as writes otherwise. By default, all events are executed right away.
+  void SetAdmissionOptions(const AdmissionController::Options& options) {
+    admission_.SetOptions(options);
+  }
+
+  // Sets the limit and weight of the lanes of event types hooked with
+  // the function from now on, unless given by the hook request itself.
+  // Must be called before serving.
+  void SetLaneOptions(const std::string& function_name,
+                      const AdmissionController::MethodOptions& options) {
+    lane_options_[function_name] = options;
+  }
+
+  // Sets how many independent events of a batch are executed at once,
+  // counting the thread serving the batch. Must be called before serving.
+  void SetBatchConcurrency(size_t concurrency);
+
+  // Sets how each event sees the KVStore through its FazContext: whether
+  // its reads are memoized and its writes buffered. By default reads are
+  // memoized and writes are not buffered. Must be called before serving.
+  void SetContextOptions(const FazContext::Options& options) {
+    context_options_ = options;
+    context_options_.track_keys = response_cache_ != nullptr;
+  }
+
+  // Makes events of read-only functions answered from a cache of up to
+  // about `max_bytes` of replies, each kept for at most `max_age` (0 for
+  // no limit) or until a key it read is written through this service.
+  // Must be called before serving.
+  void EnableResponseCache(
+      size_t max_bytes,
+      std::chrono::milliseconds max_age = std::chrono::milliseconds(0)) {
+    response_cache_.reset(new FazResponseCache(max_bytes, max_age));
+    context_options_.track_keys = true;
+  }
+
+  // Makes identical events of read-only functions (same type and
+  // payload) executed at the same time share a single execution. Off by
+  // default. Must be called before serving.
+  void SetCollapseReads(bool collapse_reads) {
+    collapse_reads_ = collapse_reads;
+  }
+
+  // Lets event types be hooked as async: their events are appended to a
+  // queue persisted to the file and acknowledged with an event ID, then
+  // executed by `num_workers` threads in the background, starting with
+  // those left in the file. Returns false if the file cannot be used.
+  // Must be called before serving.
+  bool EnableEventQueue(const std::string& filename, size_t num_workers);
+
+  // Returns the counters of the event queue, all 0 if none.
+  FazEventQueue::Stats GetEventQueueStats() const {
+    return event_queue_ ? event_queue_->GetStats() : FazEventQueue::Stats();
+  }
+
+  // Returns the counters of the response cache, all 0 if none.
+  FazResponseCache::Stats GetResponseCacheStats() const {
+    return response_cache_ ? response_cache_->GetStats() :
+                             FazResponseCache::Stats();
+  }
+
+  // Returns the KVStore call and response cache counters of each event
+  // type with events.
+  std::vector<EventStats> GetEventStats() const;
+
+  // Returns the admission counters of the lane of each event type
+  // hooked so far, in the order they were first hooked.
+  std::vector<AdmissionController::MethodStats> GetAdmissionStats() const {
+    return admission_.GetStats();
+  }
 
   // gRPC interface to register a function with an associated event
-  // type for future execution by Faz.
+  // type for future execution by Faz. The lane of the event type takes
+  // the limit and weight of the request, if any, or else those set for
+  // the function. Event types hooked as async need the event queue.
   grpc::Status hook(grpc::ServerContext* context,
                     const faz::HookRequest* request,
                     faz::HookReply* response);
@@ -48,20 +187,118 @@ class FazServiceImpl final : public faz::FazService::Service {
                       faz::UnhookReply* response);
 
   // gRPC interface to process an arriving event with an arbitrary
-  // message payload.
+  // message payload. The function of the event allocates its messages
+  // on the arena of the reply if any (e.g. served by FazAsyncServer), or
+  // on an arena of the event otherwise. Events of types hooked as async
+  // are only queued, and replied with their ID.
   grpc::Status event(grpc::ServerContext* context,
                      const faz::EventRequest* request,
                      faz::EventReply* response);
+
+  // gRPC interface to process a batch of events, each of which goes
+  // through admission control and succeeds or fails on its own. Unless
+  // the batch is sequential, its events are executed concurrently.
+  grpc::Status events(grpc::ServerContext* context,
+                      const faz::EventsRequest* request,
+                      faz::EventsReply* response);
+
+  // gRPC interface to look up the outcome of a queued event.
+  grpc::Status event_status(grpc::ServerContext* context,
+                            const faz::EventStatusRequest* request,
+                            faz::EventStatusReply* response);
  private:
+  // Queues the event, setting its ID, if its type is hooked as async, or
+  // else executes it into the reply payload, and returns the status.
+  grpc::Status Submit(grpc::ServerContext* context,
+                      const faz::EventRequest& request,
+                      google::protobuf::Any* out, std::string* event_id);
+
+  // Executes a queued event with the function it was queued for, even
+  // if its type has been unhooked or hooked again since.
+  grpc::Status ExecuteQueued(const std::string& function_name,
+                             const faz::EventRequest& request,
+                             google::protobuf::Any* out);
+
+  // Adds the lane of the event type with the options if it has none, or
+  // else sets its options, unless `keep_options`.
+  void SetUpLane(int event_type, AdmissionController::Class lane_class,
+                 const AdmissionController::MethodOptions& options,
+                 bool keep_options);
+
+  // Executes the event into the reply payload and returns its status,
+  // unless answered from the response cache or by an identical event.
+  grpc::Status Execute(grpc::ServerContext* context,
+                       const faz::EventRequest& request,
+                       google::protobuf::Any* out);
+
+  // Runs the function of the event through admission control, and
+  // caches its reply under `cache_key` unless empty.
+  grpc::Status Run(grpc::ServerContext* context,
+                   const RegisteredFunc& registered_func,
+                   const faz::EventRequest& request,
+                   google::protobuf::Any* out,
+                   const std::string& cache_key, uint64_t cache_sequence);
+
+  // Runs the function of the event once admitted, and caches its reply
+  // under `cache_key` unless empty.
+  grpc::Status RunAdmitted(const RegisteredFunc& registered_func,
+                           const faz::EventRequest& request,
+                           google::protobuf::Any* out,
+                           const std::string& cache_key,
+                           uint64_t cache_sequence);
+
   // Predefined table of known functions that maps a function name
   // to the actual function.
-  static const std::unordered_map<std::string, FazFunc> kPredefinedFuncs;
-  // Table of registered functions that maps an event type to the
-  // function registered with that event type.
-  std::unordered_map<int, FazFunc> registered_funcs_;
+  static const std::unordered_map<std::string, RegisteredFunc>
+      kPredefinedFuncs;
+  // Table of registered functions indexed by event type, each pointing
+  // to the entry of `kPredefinedFuncs` hooked with that event type, if
+  // any. `hook` and `unhook` swap single pointers, so `event` looks
+  // functions up without any lock, and never copies nor frees them.
+  std::array<std::atomic<const RegisteredFunc*>, kMaxEventTypes>
+      registered_funcs_;
   // key-value store abstraction that enables storage and retrieval of data
   // for functions that are being executed.
   std::unique_ptr<KVStoreInterface> kvstore_;
+  // Admission control of events. `hook` and `unhook` are never held back.
+  AdmissionController admission_;
+  // Guards adding lanes, so that each event type gets a single one.
+  std::mutex lanes_mutex_;
+  // Lane options per function name, see `SetLaneOptions()`.
+  std::unordered_map<std::string, AdmissionController::MethodOptions>
+      lane_options_;
+  // Index of the admission method of each event type, -1 until the
+  // event type is first hooked. Set before the function is registered,
+  // so a registered function always has its lane.
+  std::array<std::atomic<int>, kMaxEventTypes> lanes_;
+  // Threads helping the threads serving batches to execute their events,
+  // if batches are executed concurrently.
+  std::unique_ptr<WorkStealingPool> batch_workers_;
+  FazContext::Options context_options_;
+  // Cache of the replies of read-only events, if enabled.
+  std::unique_ptr<FazResponseCache> response_cache_;
+  // Whether identical read-only events in flight are collapsed, and the
+  // flights of those being executed.
+  bool collapse_reads_;
+  FazSingleFlight single_flight_;
+  // KVStore call and response cache counters indexed by event type.
+  struct EventCounters {
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> remote_calls{0};
+    std::atomic<uint64_t> saved_calls{0};
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> cache_misses{0};
+    std::atomic<uint64_t> collapsed{0};
+  };
+  std::array<EventCounters, kMaxEventTypes> event_stats_;
+  // Name of the function each event type is hooked with if hooked as
+  // async, pointing to the key of its entry in `kPredefinedFuncs`.
+  std::array<std::atomic<const std::string*>, kMaxEventTypes>
+      async_functions_;
+  // Queue of the events of event types hooked as async, if enabled.
+  // Declared last, so that its workers stop before anything they use is
+  // destroyed.
+  std::unique_ptr<FazEventQueue> event_queue_;
 };
 
 typedef FazServiceImpl FazService;
@@ -0,0 +1,50 @@
+#include "faz/faz_single_flight.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+using google::protobuf::Any;
+using grpc::Status;
+using std::string;
+
+std::shared_ptr<FazSingleFlight::Flight> FazSingleFlight::Join(
+    const string& key, bool* leader) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_ptr<Flight>& flight = flights_[key];
+  *leader = !flight;
+  if (*leader) {
+    flight = std::make_shared<Flight>();
+  }
+  return flight;
+}
+
+void FazSingleFlight::Land(const string& key,
+                           const std::shared_ptr<Flight>& flight,
+                           const Status& status, const Any& out) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flights_.erase(key);
+  }
+  {
+    std::lock_guard<std::mutex> lock(flight->mutex);
+    flight->done = true;
+    flight->status = status;
+    if (status.ok()) {
+      flight->type_url = out.type_url();
+      flight->value = out.value();
+    }
+  }
+  flight->cv.notify_all();
+}
+
+Status FazSingleFlight::Wait(const std::shared_ptr<Flight>& flight,
+                             Any* out) {
+  std::unique_lock<std::mutex> lock(flight->mutex);
+  flight->cv.wait(lock, [&flight]() { return flight->done; });
+  if (flight->status.ok()) {
+    out->set_type_url(flight->type_url);
+    out->set_value(flight->value);
+  }
+  return flight->status;
+}
@@ -0,0 +1,58 @@
+#ifndef CSCI499_CHENGTSU_FAZ_SINGLE_FLIGHT_H
+#define CSCI499_CHENGTSU_FAZ_SINGLE_FLIGHT_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <google/protobuf/any.pb.h>
+#include <grpcpp/grpcpp.h>
+
+// Collapses identical events executed at the same time into a single
+// execution: the first event of a key (e.g. from
+// `FazResponseCache::Key()`) executes as the leader of a flight, and the
+// events of the same key arriving before it is done join the flight and
+// wait for its outcome instead of executing themselves. Only meant for
+// events of read-only functions, whose outcome does not depend on which
+// of them executes.
+class FazSingleFlight {
+ public:
+  // An execution in flight.
+  class Flight {
+   private:
+    friend class FazSingleFlight;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    grpc::Status status;
+    std::string type_url;
+    std::string value;
+  };
+
+  FazSingleFlight() : mutex_(), flights_() {}
+
+  // Joins the flight of the key, or starts one if none, in which case
+  // `leader` is set to true and the caller must execute the event and
+  // then `Land()` the flight.
+  std::shared_ptr<Flight> Join(const std::string& key, bool* leader);
+
+  // Hands the outcome of the leader to the events of the flight, and
+  // lets later events of the key start a new flight.
+  void Land(const std::string& key, const std::shared_ptr<Flight>& flight,
+            const grpc::Status& status, const google::protobuf::Any& out);
+
+  // Waits for the leader of the flight, and returns its status with its
+  // reply payload copied into `out`.
+  grpc::Status Wait(const std::shared_ptr<Flight>& flight,
+                    google::protobuf::Any* out);
+
+ private:
+  std::mutex mutex_;
+  // Flights in the air by key.
+  std::unordered_map<std::string, std::shared_ptr<Flight>> flights_;
+};
+
+#endif //CSCI499_CHENGTSU_FAZ_SINGLE_FLIGHT_H
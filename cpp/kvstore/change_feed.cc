@@ -0,0 +1,109 @@
+#include "kvstore/change_feed.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+using std::string;
+
+ChangeFeed::Subscription::~Subscription() {
+  std::lock_guard<std::mutex> lock(feed_->mutex_);
+  feed_->subscriptions_.erase(this);
+}
+
+bool ChangeFeed::Subscription::Matches(const KVChange& change) const {
+  if (change.seq < start_seq_) {
+    return false;
+  }
+  if (change.type == KVChange::kClear) {
+    return true;
+  }
+  return prefix_ ? change.key.compare(0, key_.size(), key_) == 0 :
+      change.key == key_;
+}
+
+void ChangeFeed::Subscription::Push(
+    const std::shared_ptr<const KVChange>& change) {
+  if (queue_.size() >= feed_->max_queue_size_) {
+    // The subscriber is too slow, drop what it has not read yet rather
+    // than holding back the writer or growing without bound.
+    queue_.clear();
+    resync_ = true;
+    resync_seq_ = change->seq;
+  } else {
+    queue_.push_back(change);
+  }
+  cv_.notify_one();
+}
+
+ChangeFeed::Subscription::Result ChangeFeed::Subscription::Next(
+    std::chrono::milliseconds timeout,
+    std::shared_ptr<const KVChange>* change, uint64_t* seq) {
+  std::unique_lock<std::mutex> lock(feed_->mutex_);
+  cv_.wait_for(lock, timeout,
+               [this]() { return resync_ || !queue_.empty(); });
+  if (resync_) {
+    resync_ = false;
+    *seq = resync_seq_;
+    return kResync;
+  }
+  if (queue_.empty()) {
+    return kTimeout;
+  }
+  *change = std::move(queue_.front());
+  queue_.pop_front();
+  *seq = (*change)->seq;
+  return kChange;
+}
+
+void ChangeFeed::Publish(KVChange change) {
+  // Share a single copy of the change among the history and all queues.
+  auto shared_change = std::make_shared<const KVChange>(std::move(change));
+  std::lock_guard<std::mutex> lock(mutex_);
+  last_seq_ = shared_change->seq;
+  for (Subscription* subscription : subscriptions_) {
+    if (subscription->Matches(*shared_change)) {
+      subscription->Push(shared_change);
+    }
+  }
+  if (history_size_ > 0) {
+    if (history_.size() >= history_size_) {
+      history_.pop_front();
+    }
+    history_.push_back(std::move(shared_change));
+  }
+}
+
+std::unique_ptr<ChangeFeed::Subscription> ChangeFeed::Subscribe(
+    const string& key, bool prefix, uint64_t start_seq) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (start_seq == 0) {
+    start_seq = last_seq_ + 1;
+  }
+  std::unique_ptr<Subscription> subscription(
+      new Subscription(this, key, prefix, start_seq));
+  if (start_seq <= last_seq_) {
+    // Catch up from the history, unless it no longer goes back that far.
+    uint64_t oldest_seq = history_.empty() ?
+        last_seq_ + 1 : history_.front()->seq;
+    if (start_seq < oldest_seq) {
+      subscription->resync_ = true;
+      subscription->resync_seq_ = last_seq_;
+    } else {
+      for (const auto& change : history_) {
+        if (subscription->Matches(*change)) {
+          subscription->Push(change);
+        }
+      }
+    }
+  }
+  subscriptions_.insert(subscription.get());
+  return subscription;
+}
+
+uint64_t ChangeFeed::LastSequence() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return last_seq_;
+}
@@ -0,0 +1,122 @@
+#ifndef CSCI499_CHENGTSU_CHANGE_FEED_H
+#define CSCI499_CHENGTSU_CHANGE_FEED_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+// A change committed to a KVStore, as seen by watchers.
+struct KVChange {
+  enum Type { kPut, kRemove, kClear };
+
+  // Position of the change in the commit order of the KVStore,
+  // starting from 1.
+  uint64_t seq;
+  Type type;
+  // Key of the change, unused by `kClear`.
+  std::string key;
+  // Value added under the key, only used by `kPut`.
+  std::string value;
+};
+
+// Fans changes committed to a KVStore out to subscribers, in commit order.
+//
+// Publishing never blocks: every subscriber has a bounded queue, and a
+// subscriber whose queue is full loses its queued changes and gets a
+// resync signal instead, telling it to read the current values again.
+// The feed also keeps a bounded history of recent changes, so that a
+// subscriber can resume from a sequence number it has seen before.
+class ChangeFeed {
+ public:
+  // A subscriber to the changes of a key or of all keys with a prefix.
+  // `kClear` changes match every subscriber. Unsubscribes upon
+  // destruction.
+  class Subscription {
+   public:
+    enum Result { kChange, kResync, kTimeout };
+
+    Subscription(const Subscription&) = delete;
+    Subscription& operator=(const Subscription&) = delete;
+
+    ~Subscription();
+
+    // Waits up to `timeout` for the next matching change. Returns
+    // `kChange` with the change in `change`, or `kResync` with `seq` set
+    // to the sequence number of the latest change the subscriber may have
+    // missed, in which case reading the values after this call catches
+    // up with all changes up to `seq`, and the changes after that are
+    // still delivered.
+    Result Next(std::chrono::milliseconds timeout,
+                std::shared_ptr<const KVChange>* change, uint64_t* seq);
+
+   private:
+    friend class ChangeFeed;
+
+    Subscription(ChangeFeed* feed, const std::string& key, bool prefix,
+                 uint64_t start_seq)
+        : feed_(feed), key_(key), prefix_(prefix), start_seq_(start_seq),
+          queue_(), resync_(false), resync_seq_(0), cv_() {}
+
+    // Returns true if the subscriber wants the change.
+    bool Matches(const KVChange& change) const;
+
+    // Queues the change, or turns the queued changes into a resync
+    // signal if the queue is full. Assume the caller always holds the
+    // mutex of the feed.
+    void Push(const std::shared_ptr<const KVChange>& change);
+
+    ChangeFeed* feed_;
+    std::string key_;
+    bool prefix_;
+    // Changes with lower sequence numbers are never delivered.
+    uint64_t start_seq_;
+    // The fields below are guarded by the mutex of the feed.
+    std::deque<std::shared_ptr<const KVChange>> queue_;
+    bool resync_;
+    uint64_t resync_seq_;
+    // Signaled whenever a change is queued or a resync is needed.
+    std::condition_variable cv_;
+  };
+
+  // Creates a feed keeping the latest `history_size` changes, and
+  // queueing up to `max_queue_size` changes per subscriber.
+  ChangeFeed(size_t history_size = kDefaultHistorySize,
+             size_t max_queue_size = kDefaultMaxQueueSize)
+      : history_size_(history_size), max_queue_size_(max_queue_size),
+        mutex_(), history_(), subscriptions_(), last_seq_(0) {}
+
+  // Delivers a change to all matching subscribers. Changes must be
+  // published in the order of their sequence numbers.
+  void Publish(KVChange change);
+
+  // Subscribes to the changes of `key`, or of all keys starting with
+  // `key` if `prefix` is true, starting from the change numbered
+  // `start_seq`, or from the next change if `start_seq` is 0. Changes
+  // older than the history are missed, which the subscription signals
+  // with a resync.
+  std::unique_ptr<Subscription> Subscribe(const std::string& key,
+                                          bool prefix, uint64_t start_seq);
+
+  // Returns the sequence number of the latest published change,
+  // 0 if there is none.
+  uint64_t LastSequence() const;
+
+  static const size_t kDefaultHistorySize = 4096;
+  static const size_t kDefaultMaxQueueSize = 4096;
+
+ private:
+  const size_t history_size_;
+  const size_t max_queue_size_;
+  mutable std::mutex mutex_;
+  // Latest changes, oldest first.
+  std::deque<std::shared_ptr<const KVChange>> history_;
+  std::unordered_set<Subscription*> subscriptions_;
+  uint64_t last_seq_;
+};
+
+#endif //CSCI499_CHENGTSU_CHANGE_FEED_H
@@ -0,0 +1,45 @@
+#include "kvstore/hash_ring.h"
+
+#include <algorithm>
+#include <string>
+
+using std::string;
+
+size_t HashRing::AddNode(const string& name) {
+  size_t node = num_nodes_++;
+  for (size_t i = 0; i < num_virtual_nodes_; ++i) {
+    points_.push_back({Hash(name + "#" + std::to_string(i)), node});
+  }
+  std::sort(points_.begin(), points_.end());
+  return node;
+}
+
+size_t HashRing::NodeFor(const string& key) const {
+  // Find the first point at or after the hash of the key,
+  // wrapping around to the first point of the ring.
+  auto iter = std::lower_bound(points_.begin(), points_.end(),
+                               std::make_pair(Hash(key), size_t{0}));
+  if (iter == points_.end()) {
+    iter = points_.begin();
+  }
+  return iter->second;
+}
+
+uint64_t HashRing::Hash(const string& str) {
+  // 64-bit FNV-1a.
+  // Reference: http://www.isthe.com/chongo/tech/comp/fnv/
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : str) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  // FNV-1a does not mix the last bytes well, which matters since the
+  // names of virtual nodes only differ in their last characters. Finish
+  // with the 64-bit finalizer of MurmurHash3 to spread them over the ring.
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
@@ -0,0 +1,52 @@
+#ifndef CSCI499_CHENGTSU_HASH_RING_H
+#define CSCI499_CHENGTSU_HASH_RING_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A consistent hash ring that maps keys to nodes.
+//
+// Each node is placed on the ring at `num_virtual_nodes` points derived
+// from its name, and a key belongs to the node owning the first point
+// at or after the hash of the key (wrapping around). Placing many points
+// per node spreads keys evenly, and adding a node only moves the keys
+// that now fall right before one of its points, all of them to the new
+// node, which is about 1/(n+1) of the keys for n existing nodes.
+//
+// Since the points only depend on node names and a fixed hash function,
+// every process building a ring with the same names agrees on where
+// each key belongs.
+class HashRing {
+ public:
+  explicit HashRing(size_t num_virtual_nodes = kDefaultNumVirtualNodes)
+      : num_virtual_nodes_(num_virtual_nodes), points_(), num_nodes_(0) {}
+
+  // Adds a node with the given name (which should be unique) to the
+  // ring, and returns its index, i.e. the number of nodes added before.
+  size_t AddNode(const std::string& name);
+
+  // Returns the index of the node the key belongs to.
+  // Assume the caller always guarantees the ring is not empty.
+  size_t NodeFor(const std::string& key) const;
+
+  // Returns the number of nodes in the ring.
+  size_t Size() const noexcept { return num_nodes_; }
+
+  // Returns a 64-bit hash of the given string, which is the same
+  // across processes and platforms.
+  static uint64_t Hash(const std::string& str);
+
+  static const size_t kDefaultNumVirtualNodes = 128;
+
+ private:
+  // Number of points each node is placed at.
+  size_t num_virtual_nodes_;
+  // Points on the ring as (hash, node index), sorted by hash.
+  std::vector<std::pair<uint64_t, size_t>> points_;
+  // Number of nodes added.
+  size_t num_nodes_;
+};
+
+#endif //CSCI499_CHENGTSU_HASH_RING_H
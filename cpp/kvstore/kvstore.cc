@@ -2,11 +2,14 @@
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <mutex>
 #include <shared_mutex>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -14,6 +17,8 @@
 
 using std::ifstream;
 using std::initializer_list;
+using std::istream;
+using std::istringstream;
 using std::ofstream;
 using std::pair;
 using std::string;
@@ -22,17 +27,25 @@ using std::vector;
 // Change types that will be persisted to file.
 enum ChangeType : char { kPut, kRemove, kClear };
 
-KVStore::KVStore() : map_(), mutex_(), log_(), filename_() {}
+KVStore::KVStore()
+    : map_(), mutex_(), log_(), filename_(), log_size_(0), log_cv_(),
+      bytes_stored_(0), metrics_(), seq_(0), change_feed_() {}
 
 KVStore::KVStore(initializer_list<pair<string, vector<string>>> args)
-    : map_(), mutex_(), log_(), filename_() {
+    : map_(), mutex_(), log_(), filename_(), log_size_(0), log_cv_(),
+      bytes_stored_(0), metrics_(), seq_(0), change_feed_() {
   for (const auto& p : args) {
-    map_[p.first] = p.second;
+    RemoveKey(p.first);
+    for (const string& value : p.second) {
+      PutValue(p.first, value);
+    }
   }
 }
 
 KVStore::KVStore(const string& filename)
-    : map_(), mutex_(), log_(ofstream()), filename_(filename) {
+    : map_(), mutex_(), log_(ofstream()), filename_(filename),
+      log_size_(0), log_cv_(), bytes_stored_(0), metrics_(), seq_(0),
+      change_feed_() {
   // Open the file in read mode to load changes.
   ifstream infile(filename, ifstream::binary);
   if (infile) {
@@ -98,57 +111,139 @@ void KVStore::ReopenFile() {
   if (!log_->is_open()) {
     LOG(FATAL) << "Failed to reopen file " << filename_ << " in write mode.";
   }
+  // Everything left in the file is either loaded or just written
+  // and flushed, so it is all fully persisted.
+  log_size_ = log_->tellp();
   LOG(INFO) << "Successfully reopened file " << filename_ << " in write mode.";
 }
 
+void KVStore::CommitLog() {
+  log_size_ = log_->tellp();
+  log_cv_.notify_all();
+}
+
+std::shared_lock<std::shared_mutex> KVStore::ReadLock() const {
+  auto start = std::chrono::steady_clock::now();
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  metrics_.read_lock_wait.RecordSince(start);
+  return lock;
+}
+
+std::unique_lock<std::shared_mutex> KVStore::WriteLock() const {
+  auto start = std::chrono::steady_clock::now();
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  metrics_.write_lock_wait.RecordSince(start);
+  return lock;
+}
+
+void KVStore::PublishChange(uint64_t seq, KVChange::Type type,
+                            const string& key, const string& value) {
+  change_feed_.Publish({seq, type, key, value});
+}
+
+void KVStore::PutValue(const string& key, const string& value) {
+  Entry& entry = map_[key];
+  if (entry.values.empty()) {
+    bytes_stored_ += key.size();
+  }
+  entry.values.push_back(value);
+  entry.version = ++seq_;
+  bytes_stored_ += value.size();
+}
+
+bool KVStore::RemoveKey(const string& key) {
+  ++seq_;
+  auto iter = map_.find(key);
+  if (iter == map_.end()) {
+    return false;
+  }
+  bytes_stored_ -= key.size();
+  for (const string& value : iter->second.values) {
+    bytes_stored_ -= value.size();
+  }
+  map_.erase(iter);
+  return true;
+}
+
+void KVStore::RemoveAll() {
+  ++seq_;
+  map_.clear();
+  bytes_stored_ = 0;
+}
+
 vector<string> KVStore::Get(const string& key) const {
   // A read-write lock is needed here to avoid deleted
   // or changed iterator.
-  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto lock = ReadLock();
   auto iter = map_.find(key);
   if (iter != map_.end()) {
-    return iter->second;
+    return iter->second.values;
   }
   return {};
 }
 
+bool KVStore::GetIfModified(const string& key, uint64_t known_version,
+                            vector<string>& values, uint64_t& version) const {
+  auto lock = ReadLock();
+  auto iter = map_.find(key);
+  version = iter != map_.end() ? iter->second.version : 0;
+  if (version == known_version) {
+    return false;
+  }
+  values = iter != map_.end() ? iter->second.values : vector<string>();
+  return true;
+}
+
 bool KVStore::Put(const string& key, const string& value) {
-  std::unique_lock<std::shared_mutex> lock(mutex_);
-  map_[key].push_back(value);
+  auto lock = WriteLock();
+  PutValue(key, value);
   // Persist the put operation to the associated file if applicable.
+  bool persisted = true;
   if (log_.has_value()) {
-    char c = ChangeType::kPut;
     // Get the position of the current character in the output stream.
     int cur_pos = log_->tellp();
-    if (!log_->write(&c, sizeof c) ||
-        !DumpString(key) || !DumpString(value) || !log_->flush()) {
+    if (!DumpChange(ChangeType::kPut, &key, &value) || !FlushLog()) {
       LOG(ERROR) << "Failed to persist operation Put("
                  << key << ", " << value << ") to file.";
       // Delete all content starting from position `cur_pos` from the file.
       TruncateTrailingContent(cur_pos);
-      return false;
+      persisted = false;
+    } else {
+      CommitLog();
     }
   }
+  // The map keeps the change even if not persisted, so watchers see it
+  // either way.
+  PublishChange(seq_, KVChange::kPut, key, value);
+  if (!persisted) {
+    return false;
+  }
   LOG(INFO) << "Successfully Put(" << key << ", " << value << ") to kvstore.";
   return true;
 }
 
 bool KVStore::Remove(const string& key, bool& key_existed) {
-  std::unique_lock<std::shared_mutex> lock(mutex_);
-  key_existed = map_.erase(key);
+  auto lock = WriteLock();
+  key_existed = RemoveKey(key);
   // Persist the remove operation to the associated file if applicable.
+  bool persisted = true;
   if (log_.has_value()) {
-    char c = ChangeType::kRemove;
     // Get the position of the current character in the output stream.
     int cur_pos = log_->tellp();
-    if (!log_->write(&c, sizeof c) || !DumpString(key) || !log_->flush()) {
+    if (!DumpChange(ChangeType::kRemove, &key, nullptr) || !FlushLog()) {
       LOG(ERROR) << "Failed to persist operation Remove("
                  << key << ") to file.";
       // Delete all content starting from position `cur_pos` from the file.
       TruncateTrailingContent(cur_pos);
-      return false;
+      persisted = false;
+    } else {
+      CommitLog();
     }
   }
+  PublishChange(seq_, KVChange::kRemove, key, "");
+  if (!persisted) {
+    return false;
+  }
   LOG(INFO) << "Successfully Remove(" << key << ") from kvstore.";
   return key_existed;
 }
@@ -158,47 +253,224 @@ bool KVStore::Remove(const string& key) {
   return Remove(key, key_existed);
 }
 
+vector<bool> KVStore::Write(const vector<KVMutation>& mutations) {
+  vector<bool> keys_existed;
+  return Write(mutations, keys_existed);
+}
+
+vector<bool> KVStore::Write(const vector<KVMutation>& mutations,
+                            vector<bool>& keys_existed) {
+  vector<bool> results(mutations.size(), false);
+  keys_existed.assign(mutations.size(), false);
+  auto lock = WriteLock();
+  // Get the position of the current character in the output stream,
+  // which is where the whole batch starts in the file.
+  int start_pos = log_.has_value() ? static_cast<int>(log_->tellp()) : 0;
+  bool persisted = true;
+  for (size_t i = 0; i < mutations.size(); ++i) {
+    const KVMutation& mutation = mutations[i];
+    if (mutation.type == KVMutation::kPut) {
+      PutValue(mutation.key, mutation.value);
+      results[i] = true;
+    } else {
+      keys_existed[i] = RemoveKey(mutation.key);
+      results[i] = keys_existed[i];
+    }
+    // Persist the change without flushing, so that the whole batch
+    // only pays for one flush.
+    if (log_.has_value() && persisted) {
+      persisted = mutation.type == KVMutation::kPut ?
+          DumpChange(ChangeType::kPut, &mutation.key, &mutation.value) :
+          DumpChange(ChangeType::kRemove, &mutation.key, nullptr);
+    }
+  }
+  if (log_.has_value()) {
+    persisted = persisted && FlushLog();
+    if (!persisted) {
+      LOG(ERROR) << "Failed to persist a batch of " << mutations.size()
+                 << " operations to file.";
+      // Delete all content starting from position `start_pos` from the
+      // file.
+      TruncateTrailingContent(start_pos);
+      results.assign(mutations.size(), false);
+    } else {
+      CommitLog();
+    }
+  }
+  // Each mutation took the next sequence number when applied, and the
+  // map keeps it even if not persisted.
+  uint64_t seq = seq_ - mutations.size();
+  for (const KVMutation& mutation : mutations) {
+    if (mutation.type == KVMutation::kPut) {
+      PublishChange(++seq, KVChange::kPut, mutation.key, mutation.value);
+    } else {
+      PublishChange(++seq, KVChange::kRemove, mutation.key, "");
+    }
+  }
+  if (!persisted) {
+    return results;
+  }
+  LOG(INFO) << "Successfully Write(" << mutations.size()
+            << " operations) to kvstore.";
+  return results;
+}
+
 bool KVStore::Clear() {
-  std::unique_lock<std::shared_mutex> lock(mutex_);
-  map_.clear();
+  auto lock = WriteLock();
+  RemoveAll();
   // Persist the clear operation to the associated file if applicable.
+  bool persisted = true;
   if (log_.has_value()) {
-    char c = ChangeType::kClear;
     // Get the position of the current character in the output stream.
     int cur_pos = log_->tellp();
-    if (!log_->write(&c, sizeof c) || !log_->flush()) {
+    if (!DumpChange(ChangeType::kClear, nullptr, nullptr) || !FlushLog()) {
       LOG(ERROR) << "Failed to persist operation Clear() to file.";
       // Delete all content starting from position `cur_pos` from the file.
       TruncateTrailingContent(cur_pos);
-      return false;
+      persisted = false;
+    } else {
+      CommitLog();
     }
   }
+  PublishChange(seq_, KVChange::kClear, "", "");
+  if (!persisted) {
+    return false;
+  }
   LOG(INFO) << "Successfully Clear() kvstore.";
   return true;
 }
 
-size_t KVStore::Size() const noexcept {
+size_t KVStore::Size() const {
+  auto lock = ReadLock();
   return map_.size();
 }
 
-bool KVStore::Empty() const noexcept {
+bool KVStore::Empty() const {
+  auto lock = ReadLock();
   return map_.empty();
 }
 
 void KVStore::Print() const {
   // A read-write lock is needed here to avoid deleted
   // or changed iterator.
-  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto lock = ReadLock();
   for (auto iter = map_.begin(); iter != map_.end(); ++iter) {
     std::cout << iter->first << ": [ ";
-    for (auto value : iter->second) {
+    for (auto value : iter->second.values) {
       std::cout << value << " ";
     }
     std::cout << "]" << std::endl;
   }
 }
 
-bool KVStore::LoadChange(ifstream& infile) {
+size_t KVStore::BytesStored() const {
+  auto lock = ReadLock();
+  return bytes_stored_;
+}
+
+uint64_t KVStore::LastSequence() const {
+  auto lock = ReadLock();
+  return seq_;
+}
+
+std::unique_ptr<ChangeFeed::Subscription> KVStore::Watch(
+    const string& key, bool prefix, uint64_t start_seq) const {
+  return change_feed_.Subscribe(key, prefix, start_seq);
+}
+
+size_t KVStore::LogSize() const {
+  auto lock = ReadLock();
+  return log_size_;
+}
+
+size_t KVStore::WaitForLog(size_t offset,
+                           std::chrono::milliseconds timeout) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  log_cv_.wait_for(lock, timeout, [&]() { return log_size_ > offset; });
+  return log_size_;
+}
+
+bool KVStore::ReadLog(size_t offset, size_t max_bytes, string& data) const {
+  size_t log_size;
+  {
+    auto lock = ReadLock();
+    if (!log_.has_value()) {
+      return false;
+    }
+    log_size = log_size_;
+  }
+  data.clear();
+  if (offset >= log_size) {
+    return true;
+  }
+  // Content before `log_size` is never truncated, so it is safe to
+  // read it without holding the lock while new changes are appended.
+  ifstream infile(filename_, ifstream::binary);
+  if (!infile) {
+    LOG(ERROR) << "Failed to open file " << filename_ << " in read mode.";
+    return false;
+  }
+  data.resize(std::min(max_bytes, log_size - offset));
+  infile.seekg(offset);
+  infile.read(&data[0], data.size());
+  if (static_cast<size_t>(infile.gcount()) != data.size()) {
+    LOG(ERROR) << "Failed to read " << data.size() << " bytes from position "
+               << offset << " of file " << filename_;
+    return false;
+  }
+  return true;
+}
+
+size_t KVStore::ApplyLog(const string& data) {
+  bool failed;
+  return ApplyLog(data, failed);
+}
+
+size_t KVStore::ApplyLog(const string& data, bool& failed) {
+  auto lock = WriteLock();
+  // Find where the complete changes end, without applying them yet.
+  istringstream in(data);
+  size_t complete = 0;
+  while (in.peek() != EOF && LoadChange(in, false)) {
+    complete = in.tellg();
+  }
+  // An incomplete change runs out of data, while a corrupted one stops
+  // loading with data left.
+  failed = in.good();
+  if (failed) {
+    LOG(ERROR) << "Found a corrupted change at position " << complete
+               << " of the replicated changes.";
+  }
+  if (complete == 0) {
+    return 0;
+  }
+  // Persist the changes as they are before applying them, so that the
+  // associated file stays a copy of the beginning of the log they were
+  // read from, and none is applied without being persisted.
+  if (log_.has_value()) {
+    int cur_pos = log_->tellp();
+    bool appended;
+    {
+      auto start = std::chrono::steady_clock::now();
+      appended = static_cast<bool>(log_->write(data.data(), complete));
+      metrics_.log_append.RecordSince(start);
+    }
+    if (!appended || !FlushLog()) {
+      LOG(ERROR) << "Failed to persist " << complete
+                 << " bytes of replicated changes to file.";
+      // Delete all content starting from position `cur_pos` from the file.
+      TruncateTrailingContent(cur_pos);
+      failed = true;
+      return 0;
+    }
+    CommitLog();
+  }
+  istringstream changes(data.substr(0, complete));
+  while (changes.peek() != EOF && LoadChange(changes)) {}
+  return complete;
+}
+
+bool KVStore::LoadChange(istream& infile, bool apply) {
   // Get the type of the next change.
   char type;
   infile.get(type);
@@ -210,17 +482,23 @@ bool KVStore::LoadChange(ifstream& infile) {
       string key, value;
       if (!LoadString(infile, key)) { return false; }
       if (!LoadString(infile, value)) { return false; }
-      map_[key].push_back(value);
+      if (!apply) { break; }
+      PutValue(key, value);
+      PublishChange(seq_, KVChange::kPut, key, value);
       break;
     }
     case ChangeType::kRemove: {
       string key;
       if (!LoadString(infile, key)) { return false; }
-      map_.erase(key);
+      if (!apply) { break; }
+      RemoveKey(key);
+      PublishChange(seq_, KVChange::kRemove, key, "");
       break;
     }
     case ChangeType::kClear: {
-      map_.clear();
+      if (!apply) { break; }
+      RemoveAll();
+      PublishChange(seq_, KVChange::kClear, "", "");
       break;
     }
     default: {
@@ -231,7 +509,7 @@ bool KVStore::LoadChange(ifstream& infile) {
   return true;
 }
 
-bool KVStore::LoadString(ifstream& infile, string& str) {
+bool KVStore::LoadString(istream& infile, string& str) {
   // Decode the length of the string first.
   size_t len = 0;
   bool len_end = false;
@@ -264,6 +542,22 @@ bool KVStore::LoadString(ifstream& infile, string& str) {
   return true;
 }
 
+bool KVStore::DumpChange(char type, const string* key, const string* value) {
+  auto start = std::chrono::steady_clock::now();
+  bool dumped = log_->write(&type, sizeof type) &&
+      (key == nullptr || DumpString(*key)) &&
+      (value == nullptr || DumpString(*value));
+  metrics_.log_append.RecordSince(start);
+  return dumped;
+}
+
+bool KVStore::FlushLog() {
+  auto start = std::chrono::steady_clock::now();
+  bool flushed = static_cast<bool>(log_->flush());
+  metrics_.log_flush.RecordSince(start);
+  return flushed;
+}
+
 bool KVStore::DumpString(const string& str) {
   // Dump the length of the string with varint encoding.
   // With varint encoding, we encode integers with one or more bytes.
@@ -1,10 +1,17 @@
 #ifndef CSCI499_CHENGTSU_KVSTORE_H
 #define CSCI499_CHENGTSU_KVSTORE_H
 
+#include "common/histogram.h"
+#include "kvstore/change_feed.h"
 #include "kvstore/kvstore_interface.h"
 
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <initializer_list>
+#include <istream>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
 #include <string>
@@ -16,6 +23,18 @@
 // for each unique string key.
 class KVStore : public KVStoreInterface {
  public:
+  // Latency histograms (in nanoseconds) of the KVStore internals.
+  struct Metrics {
+    // Time spent waiting for the lock by reads.
+    Histogram read_lock_wait;
+    // Time spent waiting for the lock by changes.
+    Histogram write_lock_wait;
+    // Time spent appending a change to the associated file.
+    Histogram log_append;
+    // Time spent flushing the associated file.
+    Histogram log_flush;
+  };
+
   KVStore();
 
   // Constructs a KVStore with given key-value pairs.
@@ -43,6 +62,16 @@ class KVStore : public KVStoreInterface {
   // guaranteed to be thread-safe.
   std::vector<std::string> Get(const std::string& key) const;
 
+  // Every key has a version, which is the sequence number (see
+  // `LastSequence()`) of the latest change to it, or 0 if the key does
+  // not exist. Gets all values under the key into `values` and returns
+  // true, unless the version of the key is still `known_version`, in which
+  // case `values` is left untouched and false is returned. Either way,
+  // `version` is set to the version of the key.
+  bool GetIfModified(const std::string& key, uint64_t known_version,
+                     std::vector<std::string>& values,
+                     uint64_t& version) const;
+
   // Note that if an interruption occurs when writing to the file, we don't
   // handle it immediately, so will end up with a corrupted file. However,
   // in the constructor, when reloading the file, the KVStore will
@@ -64,19 +93,86 @@ class KVStore : public KVStoreInterface {
   // if the key existed and the delete was successful.
   bool Remove(const std::string& key, bool& key_existed);
 
+  // Applies the mutations in order under a single lock acquisition,
+  // and returns for each of them whether it was successful. All
+  // changes of the batch are appended to the associated file (if any)
+  // and flushed at once; if persisting fails, the whole batch is
+  // discarded from the file and reported as failed.
+  std::vector<bool> Write(const std::vector<KVMutation>& mutations);
+
+  // Same as above, but also sets `keys_existed[i]` to true if the
+  // i-th mutation is a remove whose key existed.
+  std::vector<bool> Write(const std::vector<KVMutation>& mutations,
+                          std::vector<bool>& keys_existed);
+
   // Deletes all keys and values, and returns true if the
   // clear was successful.
   bool Clear();
 
   // Returns the number of keys in the KVStore.
-  size_t Size() const noexcept;
+  size_t Size() const;
 
   // Returns true if the KVStore is empty;
-  bool Empty() const noexcept;
+  bool Empty() const;
 
   // Prints all keys and values stored the KVStore.
   void Print()  const;
 
+  // Returns the total number of bytes of all keys and values.
+  size_t BytesStored() const;
+
+  // Returns the latency histograms of the KVStore internals.
+  const Metrics& GetMetrics() const { return metrics_; }
+
+  // Every change committed to the KVStore (including the ones loaded
+  // from the associated file or applied from another KVStore's log) is
+  // numbered in commit order, starting from 1. With an associated file,
+  // the numbers carry over restarts, since the file is replayed in order.
+  // A change that failed to persist stays in the map and is numbered and
+  // published as well, though it is missing from the file, so the numbers
+  // after it differ from the ones a restart or a replica gives.
+
+  // Returns the sequence number of the latest change, 0 if there is none.
+  uint64_t LastSequence() const;
+
+  // Subscribes to the changes of `key`, or of all keys starting with
+  // `key` if `prefix` is true, starting from the change numbered
+  // `start_seq`, or from the next change if `start_seq` is 0.
+  // See `ChangeFeed` for how slow subscribers are handled.
+  std::unique_ptr<ChangeFeed::Subscription> Watch(
+      const std::string& key, bool prefix, uint64_t start_seq) const;
+
+  // The associated file is an append-only log of all changes, so a
+  // replica can rebuild the same content by applying the bytes of the
+  // log in order. The functions below let a primary KVStore ship its
+  // log and a replica KVStore apply it.
+
+  // Returns the number of bytes in the associated file that hold fully
+  // persisted changes, or 0 if there is no associated file.
+  size_t LogSize() const;
+
+  // Blocks until `LogSize()` grows beyond `offset` or `timeout` passes,
+  // and returns the latest `LogSize()`.
+  size_t WaitForLog(size_t offset, std::chrono::milliseconds timeout) const;
+
+  // Reads up to `max_bytes` bytes of fully persisted changes from the
+  // associated file starting at `offset` into `data`, and returns true
+  // on success. `data` may end in the middle of a change.
+  // Returns false if there is no associated file.
+  bool ReadLog(size_t offset, size_t max_bytes, std::string& data) const;
+
+  // Applies all complete changes at the beginning of `data`, which holds
+  // bytes read from the log of another KVStore, also appending them to
+  // the associated file if any, and returns the number of bytes applied.
+  // A trailing incomplete change is left for the caller to complete.
+  // Returns 0, applying nothing, if the changes could not be persisted.
+  size_t ApplyLog(const std::string& data);
+
+  // Applies changes as above, and sets `failed` to true if the changes
+  // could not be persisted, or if the complete ones are followed by a
+  // corrupted change rather than an incomplete one.
+  size_t ApplyLog(const std::string& data, bool& failed);
+
  private:
   // Loads the next change from the given file stream and
   // returns true on success.
@@ -84,16 +180,51 @@ class KVStore : public KVStoreInterface {
   // been reached before calling this function, we consider
   // all failures are caused by corrupted data and will
   // truncate all trailing content from that point afterwards.
-  bool LoadChange(std::ifstream& infile);
+  // Only checks that a complete change is there unless `apply` is true.
+  bool LoadChange(std::istream& infile, bool apply = true);
 
   // Loads a string from the given file stream into `str`,
   // and returns true on success.
-  bool LoadString(std::ifstream& infile, std::string& str);
+  bool LoadString(std::istream& infile, std::string& str);
 
   // Dumps the given string to the associated file stream
   // `log_`, and returns true on success.
   bool DumpString(const std::string& str);
 
+  // Dumps a change of the given `ChangeType` with its key and value (if
+  // not null) to the associated file stream `log_` without flushing it,
+  // and returns true on success.
+  bool DumpChange(char type, const std::string* key,
+                  const std::string* value);
+
+  // Flushes the associated file stream `log_`, and returns true
+  // on success.
+  bool FlushLog();
+
+  // Publishes a change numbered `seq` to watchers, whether persisted or
+  // not. Assume the caller always holds the write lock, so that changes
+  // are published in commit order.
+  void PublishChange(uint64_t seq, KVChange::Type type,
+                     const std::string& key, const std::string& value);
+
+  // The functions below apply a change to `map_`, giving it the next
+  // sequence number. Assume the caller always holds the write lock.
+
+  // Adds a value under the key.
+  void PutValue(const std::string& key, const std::string& value);
+
+  // Deletes all values under the key and returns true if the key existed.
+  bool RemoveKey(const std::string& key);
+
+  // Deletes all keys and values.
+  void RemoveAll();
+
+  // Acquires the lock for reads, recording the time spent waiting.
+  std::shared_lock<std::shared_mutex> ReadLock() const;
+
+  // Acquires the lock for changes, recording the time spent waiting.
+  std::unique_lock<std::shared_mutex> WriteLock() const;
+
   // Deletes all content starting from position `start_pos` from
   // the associated file. Assume the caller always guarantees
   // there is an associated file when calling this function.
@@ -104,14 +235,39 @@ class KVStore : public KVStoreInterface {
   // when calling this function.
   void ReopenFile();
 
+  // Marks everything written to `log_` so far as fully persisted and
+  // wakes up callers of `WaitForLog()`. Assume the caller always holds
+  // the write lock and guarantees there is an associated file.
+  void CommitLog();
+
+  // Values stored under a key.
+  struct Entry {
+    std::vector<std::string> values;
+    // Sequence number of the latest change to the key.
+    uint64_t version;
+  };
+
   // Hash map that stores the actual data.
-  std::unordered_map<std::string, std::vector<std::string>> map_;
+  std::unordered_map<std::string, Entry> map_;
   // Associated file stream to dump all changes into.
   std::optional<std::ofstream> log_;
   // Associated file name to dump all changes into.
   std::string filename_;
   // Read-write lock to enforce thread-safety.
   mutable std::shared_mutex mutex_;
+  // Number of bytes in the associated file holding fully persisted changes.
+  size_t log_size_;
+  // Signaled whenever `log_size_` grows.
+  mutable std::condition_variable_any log_cv_;
+  // Total number of bytes of all keys and values in `map_`.
+  size_t bytes_stored_;
+  // Latency histograms of the KVStore internals.
+  mutable Metrics metrics_;
+  // Sequence number given to the latest change, including a change that
+  // failed to persist.
+  uint64_t seq_;
+  // Publisher of the changes applied to `map_` to watchers.
+  mutable ChangeFeed change_feed_;
 };
 
 #endif //CSCI499_CHENGTSU_KVSTORE_H
@@ -0,0 +1,62 @@
+#include "kvstore/kvstore_cache.h"
+
+#include <mutex>
+#include <string>
+#include <utility>
+
+using std::string;
+
+bool KVStoreCache::Lookup(const string& key, Entry& entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = entries_.find(key);
+  if (iter == entries_.end()) {
+    return false;
+  }
+  // Move the key to the front as the most recently used.
+  lru_.splice(lru_.begin(), lru_, iter->second.lru_iter);
+  entry = iter->second.entry;
+  return true;
+}
+
+void KVStoreCache::Insert(const string& key, Entry entry) {
+  if (max_size_ == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = entries_.find(key);
+  if (iter != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, iter->second.lru_iter);
+    iter->second.entry = std::move(entry);
+    return;
+  }
+  if (entries_.size() >= max_size_) {
+    // Evict the least recently used key.
+    entries_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  lru_.push_front(key);
+  entries_[key] = {std::move(entry), lru_.begin()};
+}
+
+void KVStoreCache::Erase(const string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = entries_.find(key);
+  if (iter != entries_.end()) {
+    lru_.erase(iter->second.lru_iter);
+    entries_.erase(iter);
+  }
+}
+
+bool KVStoreCache::IsImmutable(const string& key) const {
+  for (const string& prefix : immutable_prefixes_) {
+    if (key.compare(0, prefix.size(), prefix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+KVStoreCache::Stats KVStoreCache::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return {hits_, revalidations_, misses_, entries_.size()};
+}
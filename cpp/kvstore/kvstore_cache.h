@@ -0,0 +1,86 @@
+#ifndef CSCI499_CHENGTSU_KVSTORE_CACHE_H
+#define CSCI499_CHENGTSU_KVSTORE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A bounded, thread-safe cache of the values under recently read keys,
+// along with the version they were read at, evicting the least recently
+// used key when full.
+//
+// Keys starting with one of the immutable prefixes are assumed never to
+// change once they have values, so their cached values can be used
+// without asking the server whether they are still current.
+class KVStoreCache {
+ public:
+  // Values under a key as read from the server.
+  struct Entry {
+    std::vector<std::string> values;
+    // Epoch and version of the key given by the server, see `GetReply`.
+    uint64_t epoch;
+    uint64_t version;
+  };
+
+  // Counters of the cache.
+  struct Stats {
+    // Number of reads served from the cache without asking the server.
+    uint64_t hits;
+    // Number of reads served from the cache after the server confirmed
+    // the cached values are still current.
+    uint64_t revalidations;
+    // Number of reads whose values had to be sent by the server.
+    uint64_t misses;
+    // Number of keys in the cache.
+    size_t size;
+  };
+
+  // Creates a cache holding up to `max_size` keys.
+  KVStoreCache(size_t max_size,
+               const std::vector<std::string>& immutable_prefixes = {})
+      : max_size_(max_size), immutable_prefixes_(immutable_prefixes),
+        mutex_(), lru_(), entries_(), hits_(0), revalidations_(0),
+        misses_(0) {}
+
+  // Copies the cached entry of the key into `entry` and returns true,
+  // or returns false if the key is not cached.
+  bool Lookup(const std::string& key, Entry& entry);
+
+  // Caches the entry of the key, replacing the previous one if any.
+  void Insert(const std::string& key, Entry entry);
+
+  // Removes the key from the cache.
+  void Erase(const std::string& key);
+
+  // Returns true if the key starts with one of the immutable prefixes.
+  bool IsImmutable(const std::string& key) const;
+
+  void RecordHit() { ++hits_; }
+  void RecordRevalidation() { ++revalidations_; }
+  void RecordMiss() { ++misses_; }
+
+  Stats GetStats() const;
+
+ private:
+  struct Node {
+    Entry entry;
+    // Position of the key in `lru_`.
+    std::list<std::string>::iterator lru_iter;
+  };
+
+  const size_t max_size_;
+  const std::vector<std::string> immutable_prefixes_;
+  mutable std::mutex mutex_;
+  // Cached keys, most recently used first.
+  std::list<std::string> lru_;
+  std::unordered_map<std::string, Node> entries_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> revalidations_;
+  std::atomic<uint64_t> misses_;
+};
+
+#endif //CSCI499_CHENGTSU_KVSTORE_CACHE_H
@@ -1,13 +1,19 @@
 #include "kvstore/kvstore_client.h"
 
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <grpcpp/grpcpp.h>
 
+#include "common/tracing.h"
 #include "kvstore.grpc.pb.h"
 
+using grpc::ClientAsyncReaderWriter;
+using grpc::ClientAsyncResponseReader;
 using grpc::ClientContext;
+using grpc::StatusCode;
 using grpc::Status;
 using kvstore::GetReply;
 using kvstore::GetRequest;
@@ -15,43 +21,569 @@ using kvstore::PutReply;
 using kvstore::PutRequest;
 using kvstore::RemoveReply;
 using kvstore::RemoveRequest;
+using kvstore::WriteReply;
+using kvstore::WriteRequest;
 using std::string;
 using std::vector;
 
+namespace {
+
+// Handles a reply of a `get` RPC: the first one carries the version
+// into `version_reply` if `expect_version` (which is then cleared),
+// and the others carry values, which are appended to `values`.
+void HandleGetReply(GetReply& response, bool& expect_version,
+                    vector<string>& values, GetReply& version_reply) {
+  if (expect_version) {
+    version_reply = std::move(response);
+    expect_version = false;
+  } else if (response.values_size() > 0) {
+    // A chunked reply always carries at least one value in `values`,
+    // otherwise it is a single value in `value` (e.g. from a service
+    // that does not support chunks).
+    for (string& value : *response.mutable_values()) {
+      values.push_back(std::move(value));
+    }
+  } else {
+    values.push_back(std::move(*response.mutable_value()));
+  }
+}
+
+}  // namespace
+
+class KVStoreClient::AsyncCall {
+ public:
+  virtual ~AsyncCall() = default;
+
+  // Handles the completion of the pending operation of the call, `ok`
+  // as given by the completion queue, and returns whether another
+  // operation is now pending. Otherwise the call is done.
+  virtual bool Proceed(bool ok) = 0;
+
+  // Fails the call before it starts.
+  virtual void Fail(const Status& status) = 0;
+
+  ClientContext context;
+  std::shared_ptr<KVCancellation> cancellation;
+};
+
+// A `put` or `remove` RPC.
+template <typename Reply>
+class KVStoreClient::UnaryCall : public KVStoreClient::AsyncCall {
+ public:
+  explicit UnaryCall(KVDoneCallback done)
+      : done_(std::move(done)), reader_(), reply_(), status_() {}
+
+  void Start(std::unique_ptr<ClientAsyncResponseReader<Reply>> reader) {
+    reader_ = std::move(reader);
+    reader_->StartCall();
+    reader_->Finish(&reply_, &status_, this);
+  }
+
+  bool Proceed(bool ok) override {
+    done_(status_);
+    return false;
+  }
+
+  void Fail(const Status& status) override {
+    done_(status);
+  }
+
+ private:
+  KVDoneCallback done_;
+  std::unique_ptr<ClientAsyncResponseReader<Reply>> reader_;
+  Reply reply_;
+  Status status_;
+};
+
+// A `get` RPC of a single key, which writes the request along with
+// closing its side of the stream, and reads replies until the end of it.
+class KVStoreClient::GetCall : public KVStoreClient::AsyncCall {
+ public:
+  GetCall(const GetRequest& request, GetReplyCallback done)
+      : request_(request), done_(std::move(done)), stream_(),
+        state_(kStarting), reply_(), expect_version_(request.with_version()),
+        values_(), version_reply_(), status_() {}
+
+  void Start(
+      std::unique_ptr<ClientAsyncReaderWriter<GetRequest, GetReply>> stream) {
+    stream_ = std::move(stream);
+    stream_->StartCall(this);
+  }
+
+  bool Proceed(bool ok) override {
+    if (state_ == kFinishing) {
+      done_(status_, std::move(values_), std::move(version_reply_));
+      return false;
+    }
+    if (ok) {
+      switch (state_) {
+        case kStarting:
+          // Closing our side of the stream along with the only request.
+          state_ = kWriting;
+          stream_->WriteLast(request_, grpc::WriteOptions(), this);
+          return true;
+        case kReading:
+          HandleGetReply(reply_, expect_version_, values_, version_reply_);
+          // Read the next reply.
+          [[fallthrough]];
+        case kWriting:
+          state_ = kReading;
+          stream_->Read(&reply_, this);
+          return true;
+        case kFinishing:
+          break;
+      }
+    }
+    // The stream is broken or fully read, the status tells which.
+    state_ = kFinishing;
+    stream_->Finish(&status_, this);
+    return true;
+  }
+
+  void Fail(const Status& status) override {
+    done_(status, {}, GetReply());
+  }
+
+ private:
+  enum State { kStarting, kWriting, kReading, kFinishing };
+
+  GetRequest request_;
+  GetReplyCallback done_;
+  std::unique_ptr<ClientAsyncReaderWriter<GetRequest, GetReply>> stream_;
+  // The operation pending.
+  State state_;
+  GetReply reply_;
+  bool expect_version_;
+  vector<string> values_;
+  GetReply version_reply_;
+  Status status_;
+};
+
+void KVCancellation::Cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cancelled_ = true;
+  for (ClientContext* context : contexts_) {
+    context->TryCancel();
+  }
+}
+
+bool KVCancellation::IsCancelled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cancelled_;
+}
+
+void KVCancellation::Add(ClientContext* context) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cancelled_) {
+    context->TryCancel();
+  }
+  contexts_.insert(context);
+}
+
+void KVCancellation::Remove(ClientContext* context) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  contexts_.erase(context);
+}
+
 bool KVStoreClient::Put(const string& key, const string& value) {
   PutRequest request;
   request.set_key(key);
   request.set_value(value);
 
+  ScopedSpan span("kvstore_client.put", key);
   ClientContext context;
+  InjectTraceContext(&context);
   PutReply response;
   Status status = stub_->put(&context, request, &response);
+  if (cache_) {
+    cache_->Erase(key);
+  }
   return status.ok();
 }
 
+KVStoreClient::KVStoreClient(
+    std::shared_ptr<grpc::Channel> channel,
+    const vector<std::shared_ptr<grpc::Channel>>& read_channels,
+    uint32_t max_chunk_bytes)
+    : KVStoreClient(channel, max_chunk_bytes) {
+  for (const auto& read_channel : read_channels) {
+    read_stubs_.push_back(kvstore::KeyValueStore::NewStub(read_channel));
+  }
+}
+
+KVStoreClient::~KVStoreClient() {
+  {
+    std::unique_lock<std::mutex> lock(calls_mutex_);
+    shutting_down_ = true;
+    for (AsyncCall* call : calls_) {
+      call->context.TryCancel();
+    }
+    // No operation may be started once the queue shuts down.
+    calls_cv_.wait(lock, [this]() { return calls_.empty(); });
+  }
+  cq_.Shutdown();
+  if (cq_thread_.joinable()) {
+    cq_thread_.join();
+  }
+}
+
 vector<string> KVStoreClient::Get(const string& key) const {
-  ClientContext context;
-  auto stream = stub_->get(&context);
+  ScopedSpan span("kvstore_client.get", key);
+  if (cache_) {
+    return CachedGet(key);
+  }
+  GetRequest request;
+  request.set_key(key);
+  request.set_max_chunk_bytes(max_chunk_bytes_);
+  vector<string> values;
+  GetReply version_reply;
+  Get(request, values, version_reply);
+  return values;
+}
+
+vector<vector<string>> KVStoreClient::MultiGet(
+    const vector<string>& keys) const {
+  if (keys.size() == 1) {
+    return {Get(keys[0])};
+  }
+  ScopedSpan span("kvstore_client.multi_get", std::to_string(keys.size()));
+  // Start all gets before waiting for any of them, so that they take a
+  // single round trip time.
+  vector<std::future<vector<string>>> futures;
+  futures.reserve(keys.size());
+  for (const string& key : keys) {
+    futures.push_back(GetAsync(key));
+  }
+  vector<vector<string>> values;
+  values.reserve(keys.size());
+  for (auto& future : futures) {
+    values.push_back(future.get());
+  }
+  return values;
+}
 
+vector<string> KVStoreClient::CachedGet(const string& key) const {
   GetRequest request;
   request.set_key(key);
+  request.set_max_chunk_bytes(max_chunk_bytes_);
+  KVStoreCache::Entry entry;
+  vector<string> values;
+  if (LookupCache(request, entry, values)) {
+    return values;
+  }
+  GetReply version_reply;
+  Status status = Get(request, values, version_reply);
+  return UpdateCache(key, entry, status, std::move(values), version_reply);
+}
+
+bool KVStoreClient::LookupCache(GetRequest& request, KVStoreCache::Entry& entry,
+                                vector<string>& values) const {
+  bool cached = cache_->Lookup(request.key(), entry);
+  // A key without values may still get some, even if immutable.
+  if (cached && !entry.values.empty() && cache_->IsImmutable(request.key())) {
+    cache_->RecordHit();
+    values = entry.values;
+    return true;
+  }
+  request.set_with_version(true);
+  if (cached) {
+    request.set_if_epoch(entry.epoch);
+    request.set_if_version(entry.version);
+  }
+  return false;
+}
+
+vector<string> KVStoreClient::UpdateCache(
+    const string& key, const KVStoreCache::Entry& entry, const Status& status,
+    vector<string> values, const GetReply& version_reply) const {
+  if (!status.ok()) {
+    return values;
+  }
+  if (version_reply.not_modified()) {
+    cache_->RecordRevalidation();
+    return entry.values;
+  }
+  cache_->RecordMiss();
+  // A service without versions leaves the epoch unset.
+  if (version_reply.epoch() != 0) {
+    cache_->Insert(key, {values, version_reply.epoch(),
+                         version_reply.version()});
+  }
+  return values;
+}
+
+Status KVStoreClient::Get(const GetRequest& request, vector<string>& values,
+                          GetReply& version_reply) const {
+  if (!read_stubs_.empty()) {
+    // Spread reads over the read stubs in a round-robin manner.
+    size_t index = next_read_stub_++ % read_stubs_.size();
+    Status status = read_pipelines_.empty() ?
+        Get(read_stubs_[index].get(), request, values, version_reply) :
+        read_pipelines_[index]->Get(request, values, version_reply);
+    if (status.ok()) {
+      return Status::OK;
+    }
+    values.clear();
+  }
+  if (pipeline_) {
+    return pipeline_->Get(request, values, version_reply);
+  }
+  return Get(stub_.get(), request, values, version_reply);
+}
+
+Status KVStoreClient::Get(kvstore::KeyValueStore::Stub* stub,
+                          const GetRequest& request, vector<string>& values,
+                          GetReply& version_reply) const {
+  ClientContext context;
+  InjectTraceContext(&context);
+  auto stream = stub->get(&context);
   stream->Write(request);
   stream->WritesDone();
 
-  vector<string> values;
   GetReply response;
+  bool expect_version = request.with_version();
   while (stream->Read(&response)) {
-    values.push_back(response.value());
+    HandleGetReply(response, expect_version, values, version_reply);
   }
-  return values;
+  return stream->Finish();
+}
+
+void KVStoreClient::PutAsync(const string& key, const string& value,
+                             KVDoneCallback done,
+                             const KVCallOptions& options) {
+  PutRequest request;
+  request.set_key(key);
+  request.set_value(value);
+
+  auto call = new UnaryCall<PutReply>(
+      [this, key, done](const Status& status) {
+        if (cache_) {
+          cache_->Erase(key);
+        }
+        done(status);
+      });
+  if (AddCall(call, options)) {
+    call->Start(stub_->PrepareAsyncput(&call->context, request, &cq_));
+  }
+}
+
+void KVStoreClient::GetAsync(const string& key, KVGetCallback done,
+                             const KVCallOptions& options) const {
+  GetRequest request;
+  request.set_key(key);
+  request.set_max_chunk_bytes(max_chunk_bytes_);
+  KVStoreCache::Entry entry;
+  if (cache_) {
+    vector<string> values;
+    if (LookupCache(request, entry, values)) {
+      done(Status::OK, std::move(values));
+      return;
+    }
+  }
+  GetReplyCallback finish = [this, key, entry, done](
+      const Status& status, vector<string> values, GetReply version_reply) {
+    if (cache_) {
+      values = UpdateCache(key, entry, status, std::move(values),
+                           version_reply);
+    }
+    done(status, std::move(values));
+  };
+  if (read_stubs_.empty()) {
+    StartGet(stub_.get(), request, finish, options);
+    return;
+  }
+  // Spread reads over the read stubs in a round-robin manner, falling
+  // back to the main stub as `Get()` does.
+  size_t index = next_read_stub_++ % read_stubs_.size();
+  StartGet(read_stubs_[index].get(), request,
+           [this, request, finish, options](
+               const Status& status, vector<string> values,
+               GetReply version_reply) {
+             if (status.ok()) {
+               finish(status, std::move(values), std::move(version_reply));
+             } else {
+               StartGet(stub_.get(), request, finish, options);
+             }
+           },
+           options);
+}
+
+void KVStoreClient::RemoveAsync(const string& key, KVDoneCallback done,
+                                const KVCallOptions& options) {
+  RemoveRequest request;
+  request.set_key(key);
+
+  auto call = new UnaryCall<RemoveReply>(
+      [this, key, done](const Status& status) {
+        if (cache_) {
+          cache_->Erase(key);
+        }
+        done(status);
+      });
+  if (AddCall(call, options)) {
+    call->Start(stub_->PrepareAsyncremove(&call->context, request, &cq_));
+  }
+}
+
+std::future<bool> KVStoreClient::PutAsync(const string& key,
+                                          const string& value,
+                                          const KVCallOptions& options) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  std::future<bool> future = promise->get_future();
+  PutAsync(key, value, [promise](const Status& status) {
+    promise->set_value(status.ok());
+  }, options);
+  return future;
+}
+
+std::future<vector<string>> KVStoreClient::GetAsync(
+    const string& key, const KVCallOptions& options) const {
+  auto promise = std::make_shared<std::promise<vector<string>>>();
+  std::future<vector<string>> future = promise->get_future();
+  GetAsync(key, [promise](const Status& status, vector<string> values) {
+    promise->set_value(std::move(values));
+  }, options);
+  return future;
+}
+
+std::future<bool> KVStoreClient::RemoveAsync(const string& key,
+                                             const KVCallOptions& options) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  std::future<bool> future = promise->get_future();
+  RemoveAsync(key, [promise](const Status& status) {
+    promise->set_value(status.ok());
+  }, options);
+  return future;
+}
+
+void KVStoreClient::StartGet(kvstore::KeyValueStore::Stub* stub,
+                             const GetRequest& request, GetReplyCallback done,
+                             const KVCallOptions& options) const {
+  auto call = new GetCall(request, std::move(done));
+  if (AddCall(call, options)) {
+    call->Start(stub->PrepareAsyncget(&call->context, &cq_));
+  }
+}
+
+bool KVStoreClient::AddCall(AsyncCall* call,
+                            const KVCallOptions& options) const {
+  {
+    std::lock_guard<std::mutex> lock(calls_mutex_);
+    if (!shutting_down_) {
+      std::call_once(cq_thread_started_, [this]() {
+        cq_thread_ = std::thread(&KVStoreClient::DriveCalls, this);
+      });
+      if (options.deadline != std::chrono::system_clock::time_point::max()) {
+        call->context.set_deadline(options.deadline);
+      }
+      // Async calls are not timed as spans, but still carry the trace
+      // of their caller.
+      InjectTraceContext(&call->context);
+      call->cancellation = options.cancellation;
+      if (call->cancellation) {
+        call->cancellation->Add(&call->context);
+      }
+      calls_.insert(call);
+      return true;
+    }
+  }
+  call->Fail(Status(StatusCode::CANCELLED, "The client is shutting down"));
+  delete call;
+  return false;
+}
+
+void KVStoreClient::DriveCalls() const {
+  void* tag;
+  bool ok;
+  while (cq_.Next(&tag, &ok)) {
+    auto call = static_cast<AsyncCall*>(tag);
+    if (call->Proceed(ok)) {
+      continue;
+    }
+    if (call->cancellation) {
+      call->cancellation->Remove(&call->context);
+    }
+    {
+      std::lock_guard<std::mutex> lock(calls_mutex_);
+      calls_.erase(call);
+    }
+    calls_cv_.notify_all();
+    delete call;
+  }
+}
+
+void KVStoreClient::EnableCache(size_t max_size,
+                                const vector<string>& immutable_prefixes) {
+  cache_ = std::make_shared<KVStoreCache>(max_size, immutable_prefixes);
+}
+
+void KVStoreClient::EnablePipelining(size_t num_streams) {
+  pipeline_.reset(new KVStoreGetPipeline(stub_.get(), num_streams));
+  for (const auto& read_stub : read_stubs_) {
+    read_pipelines_.emplace_back(
+        new KVStoreGetPipeline(read_stub.get(), num_streams));
+  }
+}
+
+void KVStoreClient::ShareCache(const KVStoreClient& other) {
+  cache_ = other.cache_;
+}
+
+KVStoreCache::Stats KVStoreClient::GetCacheStats() const {
+  return cache_ ? cache_->GetStats() : KVStoreCache::Stats{0, 0, 0, 0};
 }
 
 bool KVStoreClient::Remove(const string& key) {
   RemoveRequest request;
   request.set_key(key);
 
+  ScopedSpan span("kvstore_client.remove", key);
   ClientContext context;
+  InjectTraceContext(&context);
   RemoveReply response;
   Status status = stub_->remove(&context, request, &response);
+  if (cache_) {
+    cache_->Erase(key);
+  }
   return status.ok();
 }
+
+vector<bool> KVStoreClient::Write(const vector<KVMutation>& mutations) {
+  ScopedSpan span("kvstore_client.write",
+                  std::to_string(mutations.size()) + " mutations");
+  ClientContext context;
+  InjectTraceContext(&context);
+  WriteReply response;
+  auto stream = stub_->write(&context, &response);
+
+  for (const KVMutation& mutation : mutations) {
+    WriteRequest request;
+    if (mutation.type == KVMutation::kPut) {
+      request.mutable_put()->set_key(mutation.key);
+      request.mutable_put()->set_value(mutation.value);
+    } else {
+      request.mutable_remove()->set_key(mutation.key);
+    }
+    // Stop writing if the stream is broken, the status
+    // will tell what happened.
+    if (!stream->Write(request)) {
+      break;
+    }
+  }
+  stream->WritesDone();
+  Status status = stream->Finish();
+  if (cache_) {
+    for (const KVMutation& mutation : mutations) {
+      cache_->Erase(mutation.key);
+    }
+  }
+
+  vector<bool> results(mutations.size(), false);
+  if (!status.ok() || static_cast<size_t>(response.results_size()) != mutations.size()) {
+    return results;
+  }
+  for (size_t i = 0; i < mutations.size(); ++i) {
+    results[i] = response.results(i).code() == StatusCode::OK;
+  }
+  return results;
+}
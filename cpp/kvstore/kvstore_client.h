@@ -3,19 +3,99 @@
 
 #include "kvstore/kvstore_interface.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include <grpcpp/grpcpp.h>
 
 #include "kvstore.grpc.pb.h"
+#include "kvstore/kvstore_cache.h"
+#include "kvstore/kvstore_get_pipeline.h"
+
+// Cancels a group of asynchronous calls of `KVStoreClient` sharing it
+// through `KVCallOptions`, e.g. all gets made for a request that has
+// been abandoned. Calls still in flight fail with CANCELLED, and so do
+// calls made with it after `Cancel()`.
+class KVCancellation {
+ public:
+  KVCancellation() : mutex_(), cancelled_(false), contexts_() {}
+
+  // Cancels all calls sharing this object.
+  void Cancel();
+
+  // Returns whether `Cancel()` was called.
+  bool IsCancelled() const;
+
+ private:
+  friend class KVStoreClient;
+
+  // Tracks the context of a call in flight, cancelling it right away if
+  // `Cancel()` was already called.
+  void Add(grpc::ClientContext* context);
+
+  // Stops tracking the context of a completed call.
+  void Remove(grpc::ClientContext* context);
+
+  mutable std::mutex mutex_;
+  bool cancelled_;
+  std::unordered_set<grpc::ClientContext*> contexts_;
+};
+
+// Options of an asynchronous call of `KVStoreClient`.
+struct KVCallOptions {
+  // Time by which the call fails with DEADLINE_EXCEEDED if not completed,
+  // no deadline by default.
+  std::chrono::system_clock::time_point deadline =
+      std::chrono::system_clock::time_point::max();
+  // Cancels the call if set and cancelled.
+  std::shared_ptr<KVCancellation> cancellation;
+};
+
+// Called with the status of an asynchronous put or remove.
+using KVDoneCallback = std::function<void(const grpc::Status&)>;
+
+// Called with the status of an asynchronous get and the values it got.
+using KVGetCallback =
+    std::function<void(const grpc::Status&, std::vector<std::string>)>;
 
 // A client to make RPC to the remote key-value store gRPC service.
 class KVStoreClient : public KVStoreInterface {
  public:
-  KVStoreClient(std::shared_ptr<grpc::Channel> channel)
-      : stub_(kvstore::KeyValueStore::NewStub(channel)) {}
+  // Default maximum number of bytes of values to receive per `get` reply.
+  static const uint32_t kDefaultMaxChunkBytes = 64 << 10;
+
+  // Creates a client using the given channel, which asks the service to
+  // pack up to `max_chunk_bytes` bytes of values into each `get` reply.
+  // Setting `max_chunk_bytes` to 0 asks for one value per reply.
+  KVStoreClient(std::shared_ptr<grpc::Channel> channel,
+                uint32_t max_chunk_bytes = kDefaultMaxChunkBytes)
+      : stub_(kvstore::KeyValueStore::NewStub(channel)),
+        read_stubs_(), next_read_stub_(0), pipeline_(), read_pipelines_(),
+        max_chunk_bytes_(max_chunk_bytes), cache_(), cq_(),
+        cq_thread_started_(), cq_thread_(), calls_mutex_(), calls_cv_(),
+        calls_(), shutting_down_(false) {}
+
+  // Creates a client that writes through `channel` and spreads reads
+  // over `read_channels`, which usually lead to read-only replicas of
+  // the service behind `channel`. A read falls back to `channel` if the
+  // replica it was sent to fails. Note that reads from a replica may
+  // not reflect the latest writes yet.
+  KVStoreClient(std::shared_ptr<grpc::Channel> channel,
+                const std::vector<std::shared_ptr<grpc::Channel>>& read_channels,
+                uint32_t max_chunk_bytes = kDefaultMaxChunkBytes);
+
+  // Cancels the asynchronous calls still in flight and waits for them.
+  ~KVStoreClient();
 
   // Adds a value under the key, and returns true
   // if the put was successful.
@@ -24,13 +104,165 @@ class KVStoreClient : public KVStoreInterface {
   // Returns all previously stored values under the key.
   std::vector<std::string> Get(const std::string& key) const;
 
+  // Gets all the keys at once through `GetAsync()`, and returns the
+  // values of each of them, in the same order.
+  std::vector<std::vector<std::string>> MultiGet(
+      const std::vector<std::string>& keys) const;
+
   // Deletes all previously stored values under the key and
   // returns true if the key existed and the delete was successful.
   bool Remove(const std::string& key);
 
+  // Asynchronous versions of `Put()`, `Get()` and `Remove()`, which
+  // return right away. The calls are driven by a thread of the client
+  // shared by all of them, so any number of them can be in flight at
+  // once, e.g. to get many keys in a single round trip time. Each call
+  // fails with DEADLINE_EXCEEDED or CANCELLED as given by `options`.
+  //
+  // The callbacks run on the thread of the client (or on the calling
+  // thread, for a get served by the cache), so they must not block,
+  // in particular not on another asynchronous call of the client.
+  void PutAsync(const std::string& key, const std::string& value,
+                KVDoneCallback done,
+                const KVCallOptions& options = KVCallOptions());
+  void GetAsync(const std::string& key, KVGetCallback done,
+                const KVCallOptions& options = KVCallOptions()) const;
+  void RemoveAsync(const std::string& key, KVDoneCallback done,
+                   const KVCallOptions& options = KVCallOptions());
+
+  // Same as above, but the results are those `Put()`, `Get()` and
+  // `Remove()` would return, given through futures instead.
+  std::future<bool> PutAsync(const std::string& key, const std::string& value,
+                             const KVCallOptions& options = KVCallOptions());
+  std::future<std::vector<std::string>> GetAsync(
+      const std::string& key,
+      const KVCallOptions& options = KVCallOptions()) const;
+  std::future<bool> RemoveAsync(
+      const std::string& key, const KVCallOptions& options = KVCallOptions());
+
+  // Makes `Get()` keep the values of up to `max_size` recently read keys,
+  // and only fetch them again once the service says they changed, which
+  // costs a round trip but no values. Keys starting with one of
+  // `immutable_prefixes` are assumed never to change once they have
+  // values, and are served from the cache without asking the service.
+  // Writes through this client remove the keys they touch from the cache,
+  // while writes through other clients are only seen upon revalidation
+  // (never for immutable keys). Note that reads spread over replicas
+  // revalidate poorly, since each service has its own versions.
+  // Must be called before the client is used.
+  void EnableCache(size_t max_size,
+                   const std::vector<std::string>& immutable_prefixes = {});
+
+  // Makes the client use the same cache as `other` (none if `other` has
+  // not enabled it), e.g. for clients to the same service over separate
+  // channels. Must be called before the client is used.
+  void ShareCache(const KVStoreClient& other);
+
+  // Returns the counters of the cache, all zero if it is not enabled.
+  KVStoreCache::Stats GetCacheStats() const;
+
+  // Makes `Get()` pipeline the requests of all threads over `num_streams`
+  // long-lived `get` streams to the service (and to each replica), rather
+  // than opening a stream per call. This saves setting up a stream per
+  // call when many threads read at once. Asynchronous gets still open
+  // their own streams. Must be called before the client is used.
+  void EnablePipelining(size_t num_streams);
+
+  // Streams the mutations to the store over a single RPC, which applies
+  // them in order, and returns for each of them whether it was successful.
+  // If the RPC itself fails, all mutations are reported as failed, though
+  // some of them may already have been applied.
+  std::vector<bool> Write(const std::vector<KVMutation>& mutations);
+
  private:
+  // An RPC driven by the completion queue, and the kinds of them.
+  class AsyncCall;
+  template <typename Reply>
+  class UnaryCall;
+  class GetCall;
+
+  // Called with the status of an asynchronous get, the values it got
+  // and the reply carrying the version if it asked for it.
+  using GetReplyCallback = std::function<void(
+      const grpc::Status&, std::vector<std::string>, kvstore::GetReply)>;
+
+  // Sends the request through a read stub if any (falling back to the
+  // main stub), collects all values it gets into `values`, and returns the
+  // status of the RPC. If the request asks for the version, the reply
+  // carrying it is put into `version_reply`.
+  grpc::Status Get(const kvstore::GetRequest& request,
+                   std::vector<std::string>& values,
+                   kvstore::GetReply& version_reply) const;
+
+  // Same as above, but through the given stub.
+  grpc::Status Get(kvstore::KeyValueStore::Stub* stub,
+                   const kvstore::GetRequest& request,
+                   std::vector<std::string>& values,
+                   kvstore::GetReply& version_reply) const;
+
+  // Starts sending the request through the given stub, and calls `done`
+  // once the RPC completes.
+  void StartGet(kvstore::KeyValueStore::Stub* stub,
+                const kvstore::GetRequest& request, GetReplyCallback done,
+                const KVCallOptions& options) const;
+
+  // Gets all values under the key through the cache.
+  std::vector<std::string> CachedGet(const std::string& key) const;
+
+  // Looks up the key of the request in the cache, and returns true if
+  // its cached `entry` can be used without asking the service, in which
+  // case its values are put into `values`. Otherwise, makes the request
+  // ask for the version, and only for the values if the cached ones are
+  // outdated.
+  bool LookupCache(kvstore::GetRequest& request, KVStoreCache::Entry& entry,
+                   std::vector<std::string>& values) const;
+
+  // Updates the cache given the result of a request made after
+  // `LookupCache()` returned false with `entry`, and returns the values
+  // under the key.
+  std::vector<std::string> UpdateCache(
+      const std::string& key, const KVStoreCache::Entry& entry,
+      const grpc::Status& status, std::vector<std::string> values,
+      const kvstore::GetReply& version_reply) const;
+
+  // Sets the call up as given by the options and tracks it until it
+  // completes, starting the thread driving the completion queue if not
+  // done yet. Returns false if the client is being destroyed, in which
+  // case the call has failed and been deleted.
+  bool AddCall(AsyncCall* call, const KVCallOptions& options) const;
+
+  // Handles the completion of the operations of the calls until the
+  // completion queue shuts down.
+  void DriveCalls() const;
+
   // Stub to make the actual RPC.
   mutable std::unique_ptr<kvstore::KeyValueStore::Stub> stub_;
+  // Stubs to make reads through, if any.
+  std::vector<std::unique_ptr<kvstore::KeyValueStore::Stub>> read_stubs_;
+  // Index (modulo the number of read stubs) of the read stub to use next.
+  mutable std::atomic<size_t> next_read_stub_;
+  // Pipelines of gets through the stub and each read stub, null and
+  // empty if not enabled.
+  std::unique_ptr<KVStoreGetPipeline> pipeline_;
+  std::vector<std::unique_ptr<KVStoreGetPipeline>> read_pipelines_;
+  // Maximum number of bytes of values to ask for per `get` reply.
+  uint32_t max_chunk_bytes_;
+  // Cache of recently read keys, null if not enabled.
+  std::shared_ptr<KVStoreCache> cache_;
+  // Completion queue of the asynchronous calls.
+  mutable grpc::CompletionQueue cq_;
+  // Thread driving the completion queue, started by the first
+  // asynchronous call.
+  mutable std::once_flag cq_thread_started_;
+  mutable std::thread cq_thread_;
+  // Guards the calls in flight and `shutting_down_`.
+  mutable std::mutex calls_mutex_;
+  // Notified when a call completes.
+  mutable std::condition_variable calls_cv_;
+  // Asynchronous calls in flight.
+  mutable std::unordered_set<AsyncCall*> calls_;
+  // Whether the client is being destroyed, failing new calls.
+  bool shutting_down_;
 };
 
 #endif //CSCI499_CHENGTSU_KVSTORE_CLIENT_H
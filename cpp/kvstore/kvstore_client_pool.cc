@@ -0,0 +1,94 @@
+#include "kvstore/kvstore_client_pool.h"
+
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+using std::string;
+using std::vector;
+
+KVStoreClientPool::KVStoreClientPool(
+    vector<std::unique_ptr<KVStoreClient>> clients)
+    : members_(), next_(0) {
+  for (auto& client : clients) {
+    members_.emplace_back(new Member{std::move(client), {0}, {0}});
+  }
+}
+
+std::shared_ptr<grpc::Channel> KVStoreClientPool::CreateChannel(
+    const string& target, size_t index) {
+  grpc::ChannelArguments args;
+  // Channels only share a connection if they share a subchannel, which
+  // a local subchannel pool rules out. The index also tells the channels
+  // apart in the channel args, for debugging.
+  args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+  args.SetInt("kvstore.pool_index", static_cast<int>(index));
+  return grpc::CreateCustomChannel(
+      target, grpc::InsecureChannelCredentials(), args);
+}
+
+KVStoreClientPool::Lease KVStoreClientPool::Acquire() const {
+  // Not atomic as a whole, so concurrent calls may pick the same member,
+  // which only makes the load slightly less even.
+  size_t start = next_++;
+  size_t best = start % members_.size();
+  for (size_t i = 1; i < members_.size(); ++i) {
+    size_t index = (start + i) % members_.size();
+    if (members_[index]->outstanding < members_[best]->outstanding) {
+      best = index;
+    }
+  }
+  Member& member = *members_[best];
+  ++member.calls;
+  ++member.outstanding;
+  return Lease(member);
+}
+
+bool KVStoreClientPool::Put(const string& key, const string& value) {
+  return Acquire().client().Put(key, value);
+}
+
+vector<string> KVStoreClientPool::Get(const string& key) const {
+  return Acquire().client().Get(key);
+}
+
+vector<vector<string>> KVStoreClientPool::MultiGet(
+    const vector<string>& keys) const {
+  return Acquire().client().MultiGet(keys);
+}
+
+bool KVStoreClientPool::Remove(const string& key) {
+  return Acquire().client().Remove(key);
+}
+
+vector<bool> KVStoreClientPool::Write(const vector<KVMutation>& mutations) {
+  return Acquire().client().Write(mutations);
+}
+
+void KVStoreClientPool::EnableCache(size_t max_size,
+                                    const vector<string>& immutable_prefixes) {
+  members_[0]->client->EnableCache(max_size, immutable_prefixes);
+  for (size_t i = 1; i < members_.size(); ++i) {
+    members_[i]->client->ShareCache(*members_[0]->client);
+  }
+}
+
+void KVStoreClientPool::EnablePipelining(size_t num_streams) {
+  for (const auto& member : members_) {
+    member->client->EnablePipelining(num_streams);
+  }
+}
+
+KVStoreCache::Stats KVStoreClientPool::GetCacheStats() const {
+  return members_[0]->client->GetCacheStats();
+}
+
+vector<KVStoreClientPool::ClientStats>
+KVStoreClientPool::GetClientStats() const {
+  vector<ClientStats> stats;
+  for (const auto& member : members_) {
+    stats.push_back({member->calls, member->outstanding});
+  }
+  return stats;
+}
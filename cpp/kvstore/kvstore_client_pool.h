@@ -0,0 +1,110 @@
+#ifndef CSCI499_CHENGTSU_KVSTORE_CLIENT_POOL_H
+#define CSCI499_CHENGTSU_KVSTORE_CLIENT_POOL_H
+
+#include "kvstore/kvstore_interface.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "kvstore/kvstore_cache.h"
+#include "kvstore/kvstore_client.h"
+
+// A key-value store spreading calls over a pool of `KVStoreClient`s to
+// the same KVStore service, each over its own channel and thus its own
+// connection, so that concurrent calls are not all multiplexed over a
+// single HTTP/2 connection (sharing its flow control window and I/O).
+//
+// Each call goes to the client with the fewest calls in flight, ties
+// being broken in a round-robin manner.
+class KVStoreClientPool : public KVStoreInterface {
+ public:
+  // Counters of a client of the pool.
+  struct ClientStats {
+    // Number of calls made through the client.
+    uint64_t calls;
+    // Number of calls in flight through the client.
+    int64_t outstanding;
+  };
+
+  // Creates a pool of the given clients, which must not be empty.
+  explicit KVStoreClientPool(
+      std::vector<std::unique_ptr<KVStoreClient>> clients);
+
+  // Returns a channel to the target which opens its own connection,
+  // rather than sharing one with the channels of other indices.
+  static std::shared_ptr<grpc::Channel> CreateChannel(
+      const std::string& target, size_t index);
+
+  // Returns the number of clients in the pool.
+  size_t Size() const noexcept { return members_.size(); }
+
+  // Adds a value under the key, and returns true
+  // if the put was successful.
+  bool Put(const std::string& key, const std::string& value);
+
+  // Returns all previously stored values under the key.
+  std::vector<std::string> Get(const std::string& key) const;
+
+  // Gets all the keys at once through one client.
+  std::vector<std::vector<std::string>> MultiGet(
+      const std::vector<std::string>& keys) const;
+
+  // Deletes all previously stored values under the key and
+  // returns true if the key existed and the delete was successful.
+  bool Remove(const std::string& key);
+
+  // Sends the mutations as a single batch through one client.
+  std::vector<bool> Write(const std::vector<KVMutation>& mutations);
+
+  // Makes all clients share a single cache, see
+  // `KVStoreClient::EnableCache()`.
+  void EnableCache(size_t max_size,
+                   const std::vector<std::string>& immutable_prefixes = {});
+
+  // Makes every client pipeline its gets, see
+  // `KVStoreClient::EnablePipelining()`.
+  void EnablePipelining(size_t num_streams);
+
+  // Returns the counters of the shared cache.
+  KVStoreCache::Stats GetCacheStats() const;
+
+  // Returns the counters of each client, in the order they were given.
+  std::vector<ClientStats> GetClientStats() const;
+
+ private:
+  // A client of the pool and its counters.
+  struct Member {
+    std::unique_ptr<KVStoreClient> client;
+    std::atomic<uint64_t> calls;
+    std::atomic<int64_t> outstanding;
+  };
+
+  // Counts a call in flight through a member for as long as it lives.
+  class Lease {
+   public:
+    explicit Lease(Member& member) : member_(member) {}
+    ~Lease() { --member_.outstanding; }
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    KVStoreClient& client() { return *member_.client; }
+
+   private:
+    Member& member_;
+  };
+
+  // Picks the member with the fewest calls in flight, and counts
+  // a call through it until the returned lease is destroyed.
+  Lease Acquire() const;
+
+  std::vector<std::unique_ptr<Member>> members_;
+  // Member to start looking from on the next call.
+  mutable std::atomic<size_t> next_;
+};
+
+#endif //CSCI499_CHENGTSU_KVSTORE_CLIENT_POOL_H
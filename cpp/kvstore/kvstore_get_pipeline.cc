@@ -0,0 +1,139 @@
+#include "kvstore/kvstore_get_pipeline.h"
+
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "common/tracing.h"
+
+using grpc::Status;
+using grpc::StatusCode;
+using kvstore::GetReply;
+using kvstore::GetRequest;
+using std::string;
+using std::vector;
+
+KVStoreGetPipeline::KVStoreGetPipeline(kvstore::KeyValueStore::Stub* stub,
+                                       size_t num_streams)
+    : stub_(stub), mutex_(), streams_(num_streams), next_stream_(0) {}
+
+KVStoreGetPipeline::~KVStoreGetPipeline() = default;
+
+Status KVStoreGetPipeline::Get(GetRequest request, vector<string>& values,
+                               GetReply& version_reply) {
+  TraceContext trace_context = CurrentTraceContext();
+  if (trace_context.sampled) {
+    request.set_traceparent(trace_context.ToTraceparent());
+  }
+  std::shared_ptr<Stream> stream;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& slot = streams_[next_stream_++ % streams_.size()];
+    if (!slot || slot->IsBroken()) {
+      slot = std::make_shared<Stream>(stub_);
+    }
+    stream = slot;
+  }
+  Call call;
+  if (!stream->Start(request, &call)) {
+    return Status(StatusCode::UNAVAILABLE, "The get stream is broken.");
+  }
+  stream->Wait(&call);
+  for (string& value : call.values) {
+    values.push_back(std::move(value));
+  }
+  version_reply = std::move(call.version_reply);
+  return call.status;
+}
+
+KVStoreGetPipeline::Stream::Stream(kvstore::KeyValueStore::Stub* stub)
+    : context_(), stream_(stub->get(&context_)), mutex_(), calls_(),
+      next_id_(0), broken_(false), write_mutex_(), finished_(false),
+      reader_(&Stream::ReadReplies, this) {}
+
+KVStoreGetPipeline::Stream::~Stream() {
+  context_.TryCancel();
+  reader_.join();
+}
+
+bool KVStoreGetPipeline::Stream::Start(GetRequest& request, Call* call) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (broken_) {
+      return false;
+    }
+    request.set_id(++next_id_);
+    call->expect_version = request.with_version();
+    call->done = false;
+    calls_[request.id()] = call;
+  }
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  // A failed write (or a finished stream) means the stream is broken,
+  // in which case the call is failed by the thread reading the replies.
+  if (!finished_) {
+    stream_->Write(request);
+  }
+  return true;
+}
+
+void KVStoreGetPipeline::Stream::Wait(Call* call) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  call->cv.wait(lock, [call]() { return call->done; });
+}
+
+bool KVStoreGetPipeline::Stream::IsBroken() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return broken_;
+}
+
+void KVStoreGetPipeline::Stream::ReadReplies() {
+  GetReply reply;
+  while (stream_->Read(&reply)) {
+    Call* call;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = calls_.find(reply.id());
+      if (it == calls_.end()) {
+        continue;
+      }
+      call = it->second;
+    }
+    // Only this thread touches the call until it is done.
+    uint64_t id = reply.id();
+    bool last = reply.last();
+    if (call->expect_version) {
+      call->version_reply = std::move(reply);
+      call->expect_version = false;
+    } else {
+      for (string& value : *reply.mutable_values()) {
+        call->values.push_back(std::move(value));
+      }
+    }
+    if (last) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      calls_.erase(id);
+      call->done = true;
+      call->cv.notify_one();
+    }
+  }
+  Status status;
+  {
+    // No more writes once finished.
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    finished_ = true;
+    status = stream_->Finish();
+  }
+  if (status.ok()) {
+    status = Status(StatusCode::UNAVAILABLE, "The get stream ended.");
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  broken_ = true;
+  for (auto& id_and_call : calls_) {
+    Call* call = id_and_call.second;
+    call->status = status;
+    call->done = true;
+    call->cv.notify_one();
+  }
+  calls_.clear();
+}
@@ -0,0 +1,109 @@
+#ifndef CSCI499_CHENGTSU_KVSTORE_GET_PIPELINE_H
+#define CSCI499_CHENGTSU_KVSTORE_GET_PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "kvstore.grpc.pb.h"
+
+// Long-lived `get` streams to the KVStore service, over which the `Get()`
+// calls of any number of threads are pipelined instead of each opening
+// a stream of its own. Each request carries an id, which its replies
+// carry back, so that a thread per stream can hand them over to the
+// caller waiting for them.
+//
+// The service answers the requests on a stream one after another, so
+// calls are spread over a few streams in a round-robin manner. A broken
+// stream fails the calls in flight over it, and is opened again upon
+// the next call. Note that the service admits each stream once, as a
+// single `get` in flight, for as long as it stays open.
+class KVStoreGetPipeline {
+ public:
+  // Creates a pipeline of `num_streams` streams through the stub, which
+  // must outlive it. The streams are opened upon the first calls.
+  KVStoreGetPipeline(kvstore::KeyValueStore::Stub* stub, size_t num_streams);
+
+  // Cancels the streams and waits for their threads.
+  ~KVStoreGetPipeline();
+
+  // Sends the request (whose id is set by the pipeline) over one of the
+  // streams, waits for its replies, and returns the status of the stream
+  // if it broke before the last reply. The values are put into `values`,
+  // and the reply carrying the version, if asked for, into `version_reply`.
+  grpc::Status Get(kvstore::GetRequest request,
+                   std::vector<std::string>& values,
+                   kvstore::GetReply& version_reply);
+
+ private:
+  // A call waiting for its replies.
+  struct Call {
+    std::vector<std::string> values;
+    kvstore::GetReply version_reply;
+    // Whether the next reply carries the version.
+    bool expect_version;
+    // Whether the last reply was received or the stream broke, in which
+    // case `status` tells why.
+    bool done;
+    grpc::Status status;
+    // Notified once done.
+    std::condition_variable cv;
+  };
+
+  // A single `get` stream and the calls in flight over it.
+  class Stream {
+   public:
+    explicit Stream(kvstore::KeyValueStore::Stub* stub);
+
+    // Cancels the stream if still open, and waits for its thread.
+    ~Stream();
+
+    // Sends the request on behalf of the call, and returns false if the
+    // stream is broken, in which case the call is not done.
+    bool Start(kvstore::GetRequest& request, Call* call);
+
+    // Waits until the call is done.
+    void Wait(Call* call);
+
+    // Returns whether the stream is broken.
+    bool IsBroken();
+
+   private:
+    // Reads the replies and hands them over to their calls until the
+    // stream breaks, then fails the calls still in flight.
+    void ReadReplies();
+
+    grpc::ClientContext context_;
+    std::unique_ptr<grpc::ClientReaderWriter<kvstore::GetRequest,
+                                             kvstore::GetReply>> stream_;
+    // Guards `calls_`, `next_id_` and `broken_`.
+    std::mutex mutex_;
+    // Calls in flight by the id of their request.
+    std::unordered_map<uint64_t, Call*> calls_;
+    uint64_t next_id_;
+    bool broken_;
+    // Serializes the writes of the requests and guards `finished_`.
+    std::mutex write_mutex_;
+    // Whether the stream was finished, after which it takes no writes.
+    bool finished_;
+    std::thread reader_;
+  };
+
+  kvstore::KeyValueStore::Stub* stub_;
+  // Guards `streams_`.
+  std::mutex mutex_;
+  // Streams, null until opened.
+  std::vector<std::shared_ptr<Stream>> streams_;
+  // Index (modulo the number of streams) of the stream to use next.
+  std::atomic<size_t> next_stream_;
+};
+
+#endif //CSCI499_CHENGTSU_KVSTORE_GET_PIPELINE_H
@@ -4,6 +4,16 @@
 #include <string>
 #include <vector>
 
+// A single change to be applied through `KVStoreInterface::Write()`.
+struct KVMutation {
+  enum Type { kPut, kRemove };
+
+  Type type;
+  std::string key;
+  // Value to add under the key, only used by `kPut`.
+  std::string value;
+};
+
 class KVStoreInterface {
  public:
   virtual ~KVStoreInterface() {};
@@ -17,6 +27,39 @@ class KVStoreInterface {
   // Deletes all previously stored values under the key and
   // returns true if the key existed and the delete was successful.
   virtual bool Remove(const std::string& key) = 0;
+
+  // Returns the values of each of the keys, in the same order, as
+  // `Get()` would. Implementations are encouraged to override this to
+  // get the keys concurrently; the default one simply gets them one
+  // by one.
+  virtual std::vector<std::vector<std::string>> MultiGet(
+      const std::vector<std::string>& keys) const {
+    std::vector<std::vector<std::string>> values;
+    values.reserve(keys.size());
+    for (const std::string& key : keys) {
+      values.push_back(Get(key));
+    }
+    return values;
+  }
+
+  // Applies the mutations in order, and returns for each of them
+  // whether it was successful, with the same meaning as the return
+  // value of the corresponding `Put()` or `Remove()`.
+  // Implementations are encouraged to override this to apply the
+  // whole batch at once; the default one simply applies the
+  // mutations one by one.
+  virtual std::vector<bool> Write(const std::vector<KVMutation>& mutations) {
+    std::vector<bool> results;
+    results.reserve(mutations.size());
+    for (const KVMutation& mutation : mutations) {
+      if (mutation.type == KVMutation::kPut) {
+        results.push_back(Put(mutation.key, mutation.value));
+      } else {
+        results.push_back(Remove(mutation.key));
+      }
+    }
+    return results;
+  }
 };
 
 #endif //CSCI499_CHENGTSU_KVSTORE_INTERFACE_H
@@ -0,0 +1,106 @@
+#include "kvstore/kvstore_replica.h"
+
+#include <chrono>
+#include <string>
+
+#include <glog/logging.h>
+
+using grpc::ClientContext;
+using grpc::Status;
+using kvstore::ReplicateReply;
+using kvstore::ReplicateRequest;
+using std::string;
+
+const std::chrono::milliseconds KVStoreReplica::kHeartbeatInterval(200);
+
+// How long to wait before reconnecting to the primary after a failure.
+const std::chrono::seconds kRetryInterval(1);
+
+// Number of bytes received but not applied beyond which the replica
+// takes them as corrupted rather than an incomplete change, far more
+// than any change is expected to take.
+const size_t kMaxPendingBytes = 64 << 20;
+
+// Returns number of milliseconds passed since epoch of the steady clock.
+int64_t GetSteadyMilliseconds() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+KVStoreReplica::KVStoreReplica(std::shared_ptr<grpc::Channel> channel,
+                               KVStore* store)
+    : stub_(kvstore::KeyValueStore::NewStub(channel)), store_(store),
+      applied_offset_(store->LogSize()), primary_log_size_(0),
+      last_caught_up_ms_(0), mutex_(), cv_(), context_(), stopped_(false),
+      thread_(&KVStoreReplica::Run, this) {}
+
+KVStoreReplica::~KVStoreReplica() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    if (context_) {
+      context_->TryCancel();
+    }
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+uint64_t KVStoreReplica::LagBytes() const {
+  uint64_t applied = applied_offset_;
+  uint64_t primary = primary_log_size_;
+  return primary > applied ? primary - applied : 0;
+}
+
+int64_t KVStoreReplica::StalenessMs() const {
+  return GetSteadyMilliseconds() - last_caught_up_ms_;
+}
+
+void KVStoreReplica::Run() {
+  while (true) {
+    ClientContext* context;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopped_) {
+        return;
+      }
+      context_.reset(new ClientContext);
+      context = context_.get();
+    }
+    ReplicateRequest request;
+    request.set_offset(applied_offset_);
+    auto stream = stub_->replicate(context, request);
+    LOG(INFO) << "Following the primary from offset " << request.offset();
+
+    // Log bytes received but not applied yet, which happens when
+    // a reply ends in the middle of a change.
+    string pending;
+    ReplicateReply response;
+    while (stream->Read(&response)) {
+      pending.append(response.data());
+      bool failed;
+      size_t applied = store_->ApplyLog(pending, failed);
+      pending.erase(0, applied);
+      applied_offset_ += applied;
+      if (failed || pending.size() > kMaxPendingBytes) {
+        // Start over from the last change applied, rather than keep
+        // piling up what follows it.
+        LOG(ERROR) << "Failed to apply the log of the primary at offset "
+                   << applied_offset_;
+        context->TryCancel();
+        break;
+      }
+      primary_log_size_ = response.log_size();
+      if (applied_offset_ >= primary_log_size_) {
+        last_caught_up_ms_ = GetSteadyMilliseconds();
+      }
+    }
+    Status status = stream->Finish();
+    LOG(ERROR) << "Lost the primary at offset " << applied_offset_ << ": "
+               << status.error_message();
+
+    // Wait a moment before reconnecting, unless stopped.
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, kRetryInterval, [this]() { return stopped_; });
+  }
+}
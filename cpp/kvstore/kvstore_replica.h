@@ -0,0 +1,70 @@
+#ifndef CSCI499_CHENGTSU_KVSTORE_REPLICA_H
+#define CSCI499_CHENGTSU_KVSTORE_REPLICA_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <grpcpp/grpcpp.h>
+
+#include "kvstore.grpc.pb.h"
+#include "kvstore/kvstore.h"
+
+// A follower that tails the log of a primary key-value store gRPC service
+// and applies it in order to a local KVStore, so that the local KVStore
+// can serve reads on behalf of the primary.
+//
+// The replica starts from `LogSize()` of the local KVStore, which means
+// a local KVStore associated with a file must only ever have been filled
+// by following the same primary.
+class KVStoreReplica {
+ public:
+  // Starts following the primary reachable through `channel` in a
+  // background thread, applying its log to `store`.
+  KVStoreReplica(std::shared_ptr<grpc::Channel> channel, KVStore* store);
+
+  // Stops following the primary.
+  ~KVStoreReplica();
+
+  // Returns the number of bytes of the primary's log not applied yet,
+  // as of the last message received from the primary.
+  uint64_t LagBytes() const;
+
+  // Returns the number of milliseconds passed since the replica was
+  // last known to have applied the entire log of the primary. Since the
+  // primary sends a heartbeat every `kHeartbeatInterval` even when idle,
+  // this stays below that interval as long as the replica keeps up.
+  int64_t StalenessMs() const;
+
+  // How long the primary waits for new changes before sending a heartbeat.
+  static const std::chrono::milliseconds kHeartbeatInterval;
+
+ private:
+  // Keeps following the primary until stopped, reconnecting on failures.
+  void Run();
+
+  // Stub to make the actual RPC.
+  std::unique_ptr<kvstore::KeyValueStore::Stub> stub_;
+  // Local KVStore to apply the primary's log to.
+  KVStore* store_;
+  // Number of bytes of the primary's log applied to `store_`.
+  std::atomic<uint64_t> applied_offset_;
+  // Number of bytes of the primary's log as of the last message.
+  std::atomic<uint64_t> primary_log_size_;
+  // Time (in milliseconds since epoch of the steady clock) when the
+  // entire log of the primary was last known to be applied.
+  std::atomic<int64_t> last_caught_up_ms_;
+  // Guards `context_` and `stopped_`, and wakes up the retry backoff.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Context of the ongoing `replicate` call, used to cancel it.
+  std::unique_ptr<grpc::ClientContext> context_;
+  bool stopped_;
+  // Background thread running `Run()`.
+  std::thread thread_;
+};
+
+#endif //CSCI499_CHENGTSU_KVSTORE_REPLICA_H
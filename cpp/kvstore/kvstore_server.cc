@@ -1,31 +1,144 @@
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <string>
 #include <memory>
+#include <thread>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <grpcpp/grpcpp.h>
 
+#include "common/admission_controller.h"
+#include "common/tracing.h"
 #include "kvstore/kvstore_service.h"
 
 DEFINE_int32(port, 50001, "Port number for the kvstore GRPC interface to use.");
 DEFINE_string(store, "", "File for the kvstore service to use for persistence.");
+DEFINE_string(unix_socket, "", "Path of a Unix domain socket for the kvstore "
+              "GRPC interface to also listen on, which is faster than TCP "
+              "for clients on the same host.");
+DEFINE_uint32(max_chunk_bytes, 1 << 20, "Maximum number of bytes of values to "
+              "pack into a single get reply, 0 to send one value per reply.");
+DEFINE_string(replica_of, "", "Address (host:port) of the primary kvstore "
+              "service to follow. If given, the service runs as a read-only "
+              "replica of it.");
+DEFINE_int32(stats_interval_s, 0, "Number of seconds between two dumps of "
+             "the service stats to the log, 0 to never dump them.");
+DEFINE_uint32(max_in_flight, 0, "Maximum number of requests served at once, "
+              "0 for no limit.");
+DEFINE_uint32(max_in_flight_per_method, 0, "Maximum number of requests of an "
+              "RPC method served at once, 0 for no limit.");
+DEFINE_int32(queue_budget_ms, 100, "Maximum number of milliseconds a request "
+             "waits to be served before it is rejected.");
+DEFINE_int32(shed_queue_delay_ms, 0, "Reject requests right away while "
+             "requests waited longer than this on average lately, 0 to "
+             "always let them wait.");
+DEFINE_string(admission_priority, "none", "Which requests are served first "
+              "when there are too many: none, reads or writes.");
+DEFINE_double(trace_sample_rate, 0, "Fraction (0 to 1) of requests not "
+              "traced by their caller to trace.");
+DEFINE_string(trace_file, "", "File to export the spans of traced requests "
+              "to, in the Chrome trace event format. Nothing is exported if "
+              "empty.");
 
-// Runs the key-value store gRPC service at a given port.
-void RunServer(int port, const std::string& filename = "") {
+// Returns the admission control options given by the command line flags.
+AdmissionController::Options AdmissionOptionsFromFlags() {
+  AdmissionController::Options options;
+  options.max_in_flight = FLAGS_max_in_flight;
+  options.max_in_flight_per_method = FLAGS_max_in_flight_per_method;
+  options.queue_budget = std::chrono::milliseconds(FLAGS_queue_budget_ms);
+  options.shed_queue_delay =
+      std::chrono::milliseconds(FLAGS_shed_queue_delay_ms);
+  if (!AdmissionController::ParsePriority(FLAGS_admission_priority,
+                                          &options.priority)) {
+    LOG(FATAL) << "Invalid admission priority: " << FLAGS_admission_priority
+               << ".";
+  }
+  return options;
+}
+
+// Logs the stats of the service every `interval_s` seconds, along with
+// the QPS of each operation over the last interval. Never returns.
+void DumpStatsPeriodically(const KVStoreService& service, int interval_s) {
+  // Number of operations of each name at the last dump.
+  std::map<std::string, uint64_t> last_counts;
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::seconds(interval_s));
+    kvstore::StatsReply stats;
+    service.GetStats(&stats);
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1)
+        << "Stats: uptime=" << stats.uptime_seconds() << "s"
+        << " keys=" << stats.key_count()
+        << " bytes=" << stats.bytes_stored();
+    for (const auto& latency : stats.latencies()) {
+      uint64_t& last_count = last_counts[latency.name()];
+      out << "\n  " << latency.name()
+          << ": count=" << latency.count()
+          << " qps=" << double(latency.count() - last_count) / interval_s
+          << " mean=" << latency.mean_us() << "us"
+          << " p50=" << latency.p50_us() << "us"
+          << " p90=" << latency.p90_us() << "us"
+          << " p99=" << latency.p99_us() << "us"
+          << " p99.9=" << latency.p999_us() << "us"
+          << " max=" << latency.max_us() << "us";
+      last_count = latency.count();
+    }
+    for (const auto& admission : stats.admissions()) {
+      out << "\n  admission." << admission.method()
+          << ": admitted=" << admission.admitted()
+          << " shed_overloaded=" << admission.shed_overloaded()
+          << " shed_timed_out=" << admission.shed_timed_out()
+          << " in_flight=" << admission.in_flight();
+    }
+    LOG(INFO) << out.str();
+  }
+}
+
+// Runs the key-value store gRPC service at a given port (and at a given
+// Unix domain socket if not empty), as a read-only replica of the primary
+// at `primary_address` if it is not empty, and dumps its stats every
+// `stats_interval_s` seconds if it is positive.
+void RunServer(int port, const std::string& filename = "",
+               uint32_t max_chunk_bytes = 1 << 20,
+               const std::string& primary_address = "",
+               int stats_interval_s = 0,
+               const AdmissionController::Options& admission_options = {},
+               const std::string& unix_socket = "") {
   std::string server_address("0.0.0.0:" + std::to_string(port));
   KVStoreService service = filename.empty()?
       KVStoreService():KVStoreService(filename);
+  service.SetMaxChunkBytes(max_chunk_bytes);
+  service.SetAdmissionOptions(admission_options);
+  if (!primary_address.empty()) {
+    service.FollowPrimary(grpc::CreateChannel(
+        primary_address, grpc::InsecureChannelCredentials()));
+    LOG(INFO) << "Running as a replica of " << primary_address;
+  }
 
   grpc::ServerBuilder builder;
   // Listen on the given address without any authentication mechanism.
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  if (!unix_socket.empty()) {
+    builder.AddListeningPort("unix:" + unix_socket,
+                             grpc::InsecureServerCredentials());
+  }
   // Register `service` as the instance through which we'll communicate with
   // clients. In this case, it corresponds to an *synchronous* service.
   builder.RegisterService(&service);
   // Finally assemble the server.
   std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
   LOG(INFO) << "Server listening on " << server_address << std::endl;
+  if (!unix_socket.empty()) {
+    LOG(INFO) << "Server listening on unix:" << unix_socket;
+  }
+  if (stats_interval_s > 0) {
+    std::thread(DumpStatsPeriodically, std::cref(service),
+                stats_interval_s).detach();
+  }
 
   // Wait for the server to shutdown. Note that some other thread must be
   // responsible for shutting down the server for this call to ever return.
@@ -39,6 +152,16 @@ int main(int argc, char** argv) {
   if (FLAGS_port < 0 or FLAGS_port > 65535) {
     LOG(FATAL) << "Invalid port number: " << FLAGS_port << "." << std::endl;
   }
-  RunServer(FLAGS_port, FLAGS_store);
+  if (FLAGS_stats_interval_s < 0) {
+    LOG(FATAL) << "Invalid stats interval: " << FLAGS_stats_interval_s << ".";
+  }
+  Tracer::Get().SetSampleRate(FLAGS_trace_sample_rate);
+  if (!FLAGS_trace_file.empty() &&
+      !Tracer::Get().StartExport(FLAGS_trace_file)) {
+    LOG(FATAL) << "Failed to open the trace file " << FLAGS_trace_file;
+  }
+  RunServer(FLAGS_port, FLAGS_store, FLAGS_max_chunk_bytes, FLAGS_replica_of,
+            FLAGS_stats_interval_s, AdmissionOptionsFromFlags(),
+            FLAGS_unix_socket);
   return 0;
 }
@@ -1,24 +1,117 @@
 #include "kvstore/kvstore_service.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <limits>
+#include <random>
 #include <string>
+#include <vector>
 
 #include <grpcpp/grpcpp.h>
 
+#include "common/tracing.h"
+
 using grpc::ServerContext;
+using grpc::ServerReader;
 using grpc::ServerReaderWriter;
+using grpc::ServerWriter;
 using grpc::Status;
 using grpc::StatusCode;
+using kvstore::AdmissionStats;
 using kvstore::GetReply;
 using kvstore::GetRequest;
+using kvstore::LatencyStats;
 using kvstore::PutReply;
 using kvstore::PutRequest;
 using kvstore::RemoveReply;
 using kvstore::RemoveRequest;
+using kvstore::ReplicateReply;
+using kvstore::ReplicateRequest;
+using kvstore::StatsReply;
+using kvstore::StatsRequest;
+using kvstore::WatchReply;
+using kvstore::WatchRequest;
+using kvstore::WriteReply;
+using kvstore::WriteRequest;
+using kvstore::WriteResult;
 using std::string;
+using std::vector;
+
+const size_t KeyValueStoreServiceImpl::kMaxWriteBatchSize = 1024;
+
+const size_t KeyValueStoreServiceImpl::kMaxReplicateChunkBytes = 1 << 20;
+
+const std::chrono::milliseconds
+    KeyValueStoreServiceImpl::kWatchPollInterval(200);
+
+const Status KeyValueStoreServiceImpl::kReadOnlyStatus(
+    StatusCode::FAILED_PRECONDITION, "The kvstore is a read-only replica.");
+
+namespace {
+
+// Writes the replies to a single `get` request. If the request has an id,
+// each reply is held back until the next one (or `Finish()`), so that
+// all of them carry the id and the last one is marked as such.
+class GetReplyWriter {
+ public:
+  GetReplyWriter(ServerReaderWriter<GetReply, GetRequest>* stream,
+                 uint64_t id)
+      : stream_(stream), id_(id), pending_(), has_pending_(false) {}
+
+  void Write(GetReply& reply) {
+    if (id_ == 0) {
+      stream_->Write(reply);
+      return;
+    }
+    if (has_pending_) {
+      stream_->Write(pending_);
+    }
+    pending_ = std::move(reply);
+    pending_.set_id(id_);
+    has_pending_ = true;
+  }
+
+  // Writes the last reply, which is empty if there was none.
+  void Finish() {
+    if (id_ == 0) {
+      return;
+    }
+    pending_.set_id(id_);
+    pending_.set_last(true);
+    stream_->Write(pending_);
+  }
+
+ private:
+  ServerReaderWriter<GetReply, GetRequest>* stream_;
+  uint64_t id_;
+  GetReply pending_;
+  bool has_pending_;
+};
+
+}  // namespace
+
+uint64_t KeyValueStoreServiceImpl::NewEpoch() {
+  std::random_device random_device;
+  std::mt19937_64 generator(
+      (uint64_t{random_device()} << 32) | random_device());
+  std::uniform_int_distribution<uint64_t> distribution(
+      1, std::numeric_limits<uint64_t>::max());
+  return distribution(generator);
+}
 
 Status KeyValueStoreServiceImpl::put(
     ServerContext* context, const PutRequest* request, PutReply* response) {
+  if (replica_) {
+    return kReadOnlyStatus;
+  }
+  ScopedSpan span("kvstore.put", ExtractTraceContext(context), request->key());
+  AdmissionController::Ticket ticket;
+  Status admission = admission_.Admit(put_method_, context, &ticket);
+  if (!admission.ok()) {
+    return admission;
+  }
+  ScopedLatencyTimer timer(put_latency_);
   if (!store_.Put(request->key(), request->value())) {
     return Status(StatusCode::UNAVAILABLE,
                   "Failed to add the value to the key.");
@@ -28,13 +121,82 @@ Status KeyValueStoreServiceImpl::put(
 
 Status KeyValueStoreServiceImpl::get(
     ServerContext* context, ServerReaderWriter<GetReply, GetRequest>* stream) {
+  if (replica_) {
+    // Let the caller know how far behind the primary the values may be.
+    context->AddTrailingMetadata("replication-lag-bytes",
+                                 std::to_string(replica_->LagBytes()));
+    context->AddTrailingMetadata("replication-staleness-ms",
+                                 std::to_string(replica_->StalenessMs()));
+  }
+  TraceContext stream_trace_context = ExtractTraceContext(context);
   GetRequest request;
   while (stream->Read(&request)) {
-    for (string& value : store_.Get(request.key())) {
-      GetReply response;
-      response.set_value(value);
-      stream->Write(response);
+    // Pipelined requests carry their own trace context, if any.
+    TraceContext trace_context = stream_trace_context;
+    if (!request.traceparent().empty()) {
+      TraceContext::Parse(request.traceparent(), trace_context);
+    }
+    ScopedSpan span("kvstore.get", trace_context, request.key());
+    // Each key read from the stream is a request of its own, so that an
+    // idle pipelined stream holds no slot. A rejected key ends the stream,
+    // as there is no way to fail it alone.
+    AdmissionController::Ticket ticket;
+    Status admission = admission_.Admit(get_method_, context, &ticket);
+    if (!admission.ok()) {
+      return admission;
+    }
+    ScopedLatencyTimer timer(get_latency_);
+    GetReplyWriter writer(stream, request.id());
+    vector<string> values;
+    if (request.with_version()) {
+      // Versions from another epoch say nothing about the values here.
+      uint64_t known_version = request.if_epoch() == epoch_ ?
+          request.if_version() : std::numeric_limits<uint64_t>::max();
+      GetReply version_reply;
+      uint64_t version;
+      version_reply.set_epoch(epoch_);
+      version_reply.set_not_modified(!store_.GetIfModified(
+          request.key(), known_version, values, version));
+      version_reply.set_version(version);
+      writer.Write(version_reply);
+    } else {
+      values = store_.Get(request.key());
+    }
+    size_t chunk_bytes = std::min<size_t>(request.max_chunk_bytes(),
+                                          max_chunk_bytes_);
+    if (chunk_bytes == 0) {
+      // The client does not understand (or the service does not allow)
+      // chunks, send one reply per value.
+      for (string& value : values) {
+        GetReply response;
+        if (request.id() != 0) {
+          response.add_values(std::move(value));
+        } else {
+          response.set_value(std::move(value));
+        }
+        writer.Write(response);
+      }
+      writer.Finish();
+      continue;
+    }
+    // Pack as many values as `chunk_bytes` allows into each reply,
+    // though a single value larger than that still gets its own reply.
+    GetReply response;
+    size_t response_bytes = 0;
+    for (string& value : values) {
+      if (response.values_size() > 0 &&
+          response_bytes + value.size() > chunk_bytes) {
+        writer.Write(response);
+        response.Clear();
+        response_bytes = 0;
+      }
+      response_bytes += value.size();
+      response.add_values(std::move(value));
     }
+    if (response.values_size() > 0) {
+      writer.Write(response);
+    }
+    writer.Finish();
   }
   return Status::OK;
 }
@@ -42,6 +204,17 @@ Status KeyValueStoreServiceImpl::get(
 Status KeyValueStoreServiceImpl::remove(
     ServerContext* context, const RemoveRequest* request,
     RemoveReply* response) {
+  if (replica_) {
+    return kReadOnlyStatus;
+  }
+  ScopedSpan span("kvstore.remove", ExtractTraceContext(context),
+                  request->key());
+  AdmissionController::Ticket ticket;
+  Status admission = admission_.Admit(remove_method_, context, &ticket);
+  if (!admission.ok()) {
+    return admission;
+  }
+  ScopedLatencyTimer timer(remove_latency_);
   bool found;
   bool success = store_.Remove(request->key(), found);
   if (!success) {
@@ -55,3 +228,187 @@ Status KeyValueStoreServiceImpl::remove(
   }
   return Status::OK;
 }
+
+Status KeyValueStoreServiceImpl::write(
+    ServerContext* context, ServerReader<WriteRequest>* reader,
+    WriteReply* response) {
+  if (replica_) {
+    return kReadOnlyStatus;
+  }
+  ScopedSpan span("kvstore.write", ExtractTraceContext(context));
+  AdmissionController::Ticket ticket;
+  Status admission = admission_.Admit(write_method_, context, &ticket);
+  if (!admission.ok()) {
+    return admission;
+  }
+  ScopedLatencyTimer timer(write_latency_);
+  // Apply mutations in batches of bounded size, so that a long stream
+  // neither holds all its mutations in memory nor pays one flush per
+  // mutation.
+  vector<KVMutation> batch;
+  WriteRequest request;
+  while (reader->Read(&request)) {
+    if (request.has_put()) {
+      batch.push_back({KVMutation::kPut, request.put().key(),
+                       request.put().value()});
+    } else if (request.has_remove()) {
+      batch.push_back({KVMutation::kRemove, request.remove().key(), ""});
+    } else {
+      // Apply the pending mutations first to keep results in order.
+      ApplyBatch(batch, response);
+      batch.clear();
+      WriteResult* result = response->add_results();
+      result->set_code(StatusCode::INVALID_ARGUMENT);
+      result->set_error_message("Mutation without a put or a remove.");
+      continue;
+    }
+    if (batch.size() >= kMaxWriteBatchSize) {
+      ApplyBatch(batch, response);
+      batch.clear();
+    }
+  }
+  ApplyBatch(batch, response);
+  return Status::OK;
+}
+
+void KeyValueStoreServiceImpl::ApplyBatch(const vector<KVMutation>& batch,
+                                          WriteReply* response) {
+  if (batch.empty()) {
+    return;
+  }
+  vector<bool> keys_existed;
+  vector<bool> successes = store_.Write(batch, keys_existed);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    WriteResult* result = response->add_results();
+    if (successes[i]) {
+      result->set_code(StatusCode::OK);
+    } else if (batch[i].type == KVMutation::kRemove && !keys_existed[i]) {
+      result->set_code(StatusCode::NOT_FOUND);
+      result->set_error_message("Key not found in the kvstore.");
+    } else {
+      result->set_code(StatusCode::UNAVAILABLE);
+      result->set_error_message("Failed to persist the change.");
+    }
+  }
+}
+
+Status KeyValueStoreServiceImpl::replicate(
+    ServerContext* context, const ReplicateRequest* request,
+    ServerWriter<ReplicateReply>* writer) {
+  size_t offset = request->offset();
+  if (offset > store_.LogSize()) {
+    return Status(StatusCode::FAILED_PRECONDITION,
+                  "The replica is ahead of the log.");
+  }
+  while (!context->IsCancelled()) {
+    // Wait for new changes, or send a heartbeat if there are none
+    // so that the replica knows it is still up to date.
+    size_t log_size = store_.WaitForLog(offset,
+                                        KVStoreReplica::kHeartbeatInterval);
+    ReplicateReply response;
+    if (!store_.ReadLog(offset, kMaxReplicateChunkBytes,
+                        *response.mutable_data())) {
+      return Status(StatusCode::FAILED_PRECONDITION,
+                    "The kvstore has no log to replicate.");
+    }
+    offset += response.data().size();
+    response.set_log_size(std::max(log_size, offset));
+    if (!writer->Write(response)) {
+      break;
+    }
+  }
+  return Status::OK;
+}
+
+Status KeyValueStoreServiceImpl::watch(
+    ServerContext* context, const WatchRequest* request,
+    ServerWriter<WatchReply>* writer) {
+  auto subscription = store_.Watch(request->key(), request->prefix(),
+                                   request->start_seq());
+  std::shared_ptr<const KVChange> change;
+  uint64_t seq;
+  while (!context->IsCancelled()) {
+    auto result = subscription->Next(kWatchPollInterval, &change, &seq);
+    if (result == ChangeFeed::Subscription::kTimeout) {
+      continue;
+    }
+    WatchReply response;
+    response.set_seq(seq);
+    if (result == ChangeFeed::Subscription::kResync) {
+      response.set_type(WatchReply::RESYNC);
+    } else {
+      switch (change->type) {
+        case KVChange::kPut:
+          response.set_type(WatchReply::PUT);
+          response.set_key(change->key);
+          response.set_value(change->value);
+          break;
+        case KVChange::kRemove:
+          response.set_type(WatchReply::REMOVE);
+          response.set_key(change->key);
+          break;
+        case KVChange::kClear:
+          response.set_type(WatchReply::CLEAR);
+          break;
+      }
+    }
+    if (!writer->Write(response)) {
+      break;
+    }
+  }
+  return Status::OK;
+}
+
+// Fills `stats` with the distribution of latencies (in nanoseconds)
+// recorded in `histogram` over `uptime_seconds`.
+void FillLatencyStats(const string& name, const Histogram& histogram,
+                      double uptime_seconds, LatencyStats* stats) {
+  HistogramSnapshot snapshot = histogram.Snapshot();
+  stats->set_name(name);
+  stats->set_count(snapshot.count);
+  stats->set_qps(uptime_seconds > 0 ? snapshot.count / uptime_seconds : 0);
+  stats->set_mean_us(snapshot.Mean() / 1000);
+  stats->set_p50_us(snapshot.Percentile(50) / 1000.0);
+  stats->set_p90_us(snapshot.Percentile(90) / 1000.0);
+  stats->set_p99_us(snapshot.Percentile(99) / 1000.0);
+  stats->set_p999_us(snapshot.Percentile(99.9) / 1000.0);
+  stats->set_max_us(snapshot.max / 1000.0);
+}
+
+Status KeyValueStoreServiceImpl::stats(
+    ServerContext* context, const StatsRequest* request,
+    StatsReply* response) {
+  GetStats(response);
+  return Status::OK;
+}
+
+void KeyValueStoreServiceImpl::GetStats(StatsReply* response) const {
+  double uptime_seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_time_).count();
+  response->set_uptime_seconds(uptime_seconds);
+  response->set_key_count(store_.Size());
+  response->set_bytes_stored(store_.BytesStored());
+  const KVStore::Metrics& metrics = store_.GetMetrics();
+  const vector<std::pair<string, const Histogram*>> histograms = {
+      {"rpc.put", &put_latency_},
+      {"rpc.get", &get_latency_},
+      {"rpc.remove", &remove_latency_},
+      {"rpc.write", &write_latency_},
+      {"store.read_lock_wait", &metrics.read_lock_wait},
+      {"store.write_lock_wait", &metrics.write_lock_wait},
+      {"store.log_append", &metrics.log_append},
+      {"store.log_flush", &metrics.log_flush},
+  };
+  for (const auto& p : histograms) {
+    FillLatencyStats(p.first, *p.second, uptime_seconds,
+                     response->add_latencies());
+  }
+  for (const auto& method : admission_.GetStats()) {
+    AdmissionStats* stats = response->add_admissions();
+    stats->set_method(method.name);
+    stats->set_admitted(method.admitted);
+    stats->set_shed_overloaded(method.shed_overloaded);
+    stats->set_shed_timed_out(method.shed_timed_out);
+    stats->set_in_flight(method.in_flight);
+  }
+}
@@ -1,20 +1,66 @@
 #ifndef CSCI499_CHENGTSU_KVSTORE_SERVICE_H
 #define CSCI499_CHENGTSU_KVSTORE_SERVICE_H
 
+#include <chrono>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <grpcpp/grpcpp.h>
 
+#include "common/admission_controller.h"
+#include "common/histogram.h"
 #include "kvstore.grpc.pb.h"
 #include "kvstore/kvstore.h"
+#include "kvstore/kvstore_replica.h"
 
 // A key-value store gRPC service who accepts incoming requests, interacts
 // with the backend storage system, and responds to the remote callers.
 class KeyValueStoreServiceImpl final : public kvstore::KeyValueStore::Service {
  public:
-  KeyValueStoreServiceImpl(): store_() {}
+  KeyValueStoreServiceImpl()
+      : store_(), max_chunk_bytes_(kDefaultMaxChunkBytes), replica_(),
+        start_time_(std::chrono::steady_clock::now()), epoch_(NewEpoch()),
+        admission_(),
+        put_method_(admission_.AddMethod("put", AdmissionController::kWrite)),
+        get_method_(admission_.AddMethod("get", AdmissionController::kRead)),
+        remove_method_(admission_.AddMethod(
+            "remove", AdmissionController::kWrite)),
+        write_method_(admission_.AddMethod(
+            "write", AdmissionController::kWrite)) {}
 
-  KeyValueStoreServiceImpl(const std::string& filename) : store_(filename) {}
+  KeyValueStoreServiceImpl(const std::string& filename)
+      : store_(filename), max_chunk_bytes_(kDefaultMaxChunkBytes),
+        replica_(), start_time_(std::chrono::steady_clock::now()),
+        epoch_(NewEpoch()), admission_(),
+        put_method_(admission_.AddMethod("put", AdmissionController::kWrite)),
+        get_method_(admission_.AddMethod("get", AdmissionController::kRead)),
+        remove_method_(admission_.AddMethod(
+            "remove", AdmissionController::kWrite)),
+        write_method_(admission_.AddMethod(
+            "write", AdmissionController::kWrite)) {}
+
+  // Sets the maximum number of bytes of values the service packs into
+  // a single `get` reply, regardless of what the client asks for.
+  // Setting it to 0 makes the service always reply one value per message.
+  void SetMaxChunkBytes(size_t max_chunk_bytes) {
+    max_chunk_bytes_ = max_chunk_bytes;
+  }
+
+  // Sets how many `put`, `get`, `remove` and `write` requests are served
+  // at once and how the rest wait or get rejected. By default, all
+  // requests are served right away.
+  void SetAdmissionOptions(const AdmissionController::Options& options) {
+    admission_.SetOptions(options);
+  }
+
+  // Turns the service into a read-only replica of the primary service
+  // reachable through `channel`. From then on, the service applies the
+  // primary's log to its store, rejects all writes, and reports its
+  // replication lag along with every `get` reply.
+  void FollowPrimary(std::shared_ptr<grpc::Channel> channel) {
+    replica_.reset(new KVStoreReplica(channel, &store_));
+  }
 
   // gRPC interface to add a value under a key.
   grpc::Status put(grpc::ServerContext* context,
@@ -30,8 +76,84 @@ class KeyValueStoreServiceImpl final : public kvstore::KeyValueStore::Service {
   grpc::Status remove(grpc::ServerContext* context,
                       const kvstore::RemoveRequest* request,
                       kvstore::RemoveReply* response);
+
+  // gRPC interface to apply a stream of puts and removes in order, and
+  // reply the result of each of them when the stream finishes.
+  grpc::Status write(grpc::ServerContext* context,
+                     grpc::ServerReader<kvstore::WriteRequest>* reader,
+                     kvstore::WriteReply* response);
+
+  // gRPC interface to ship the log of the store to a replica, starting
+  // from a given offset and continuing as new changes are made.
+  grpc::Status replicate(
+      grpc::ServerContext* context, const kvstore::ReplicateRequest* request,
+      grpc::ServerWriter<kvstore::ReplicateReply>* writer);
+
+  // gRPC interface to report the size of the store and the latency
+  // of each RPC and of the store internals.
+  grpc::Status stats(grpc::ServerContext* context,
+                     const kvstore::StatsRequest* request,
+                     kvstore::StatsReply* response);
+
+  // gRPC interface to stream the changes of a key or key prefix in
+  // commit order, starting from a given sequence number.
+  grpc::Status watch(grpc::ServerContext* context,
+                     const kvstore::WatchRequest* request,
+                     grpc::ServerWriter<kvstore::WatchReply>* writer);
+
+  // Fills `response` with the same stats as the `stats` RPC.
+  void GetStats(kvstore::StatsReply* response) const;
  private:
+  // Returns a random nonzero number to identify the service by in
+  // versioned `get` replies.
+  static uint64_t NewEpoch();
+
+  // Applies a batch of mutations to the store and appends their
+  // results to the response.
+  void ApplyBatch(const std::vector<KVMutation>& batch,
+                  kvstore::WriteReply* response);
+
+  // Maximum number of mutations to apply to the store at once when
+  // serving a `write` stream.
+  static const size_t kMaxWriteBatchSize;
+
+  // Maximum number of bytes of log to ship in a single `replicate` reply.
+  static const size_t kMaxReplicateChunkBytes;
+
+  // How often a `watch` handler checks whether its caller is gone
+  // while there are no changes.
+  static const std::chrono::milliseconds kWatchPollInterval;
+
+  // Status returned to writes when the service is a replica.
+  static const grpc::Status kReadOnlyStatus;
+
+  // Default value of `max_chunk_bytes_`.
+  static const size_t kDefaultMaxChunkBytes = 1 << 20;
+
   KVStore store_;
+  // Maximum number of bytes of values to pack into a single `get` reply.
+  size_t max_chunk_bytes_;
+  // Follower of the primary if the service is a replica, null otherwise.
+  std::unique_ptr<KVStoreReplica> replica_;
+  // Time the service was created, which the QPS is computed against.
+  std::chrono::steady_clock::time_point start_time_;
+  // Identifies the service in versioned `get` replies. Versions of keys
+  // are only meaningful within the same epoch, since a KVStore without
+  // an associated file numbers its changes from scratch upon restart.
+  const uint64_t epoch_;
+  // Latency histograms (in nanoseconds) of each RPC. For `get`,
+  // each key read from the stream counts as an operation.
+  Histogram put_latency_;
+  Histogram get_latency_;
+  Histogram remove_latency_;
+  Histogram write_latency_;
+  // Admission control of requests, and the index of each method in it.
+  // `replicate`, `stats` and `watch` are never held back.
+  AdmissionController admission_;
+  const size_t put_method_;
+  const size_t get_method_;
+  const size_t remove_method_;
+  const size_t write_method_;
 };
 
 typedef KeyValueStoreServiceImpl KVStoreService;
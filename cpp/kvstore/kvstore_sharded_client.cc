@@ -0,0 +1,114 @@
+#include "kvstore/kvstore_sharded_client.h"
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include "common/tracing.h"
+
+using std::string;
+using std::vector;
+
+void ShardedKVStoreClient::AddShard(const string& name,
+                                    std::unique_ptr<KVStoreInterface> shard) {
+  ring_.AddNode(name);
+  shards_.push_back(std::move(shard));
+}
+
+size_t ShardedKVStoreClient::ShardFor(const string& key) const {
+  return ring_.NodeFor(key);
+}
+
+bool ShardedKVStoreClient::Put(const string& key, const string& value) {
+  return shards_[ShardFor(key)]->Put(key, value);
+}
+
+vector<string> ShardedKVStoreClient::Get(const string& key) const {
+  return shards_[ShardFor(key)]->Get(key);
+}
+
+vector<vector<string>> ShardedKVStoreClient::MultiGet(
+    const vector<string>& keys) const {
+  // Group the keys by shard as `Write()` does its mutations.
+  vector<vector<string>> groups(shards_.size());
+  vector<vector<size_t>> indices(shards_.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    size_t shard = ShardFor(keys[i]);
+    groups[shard].push_back(keys[i]);
+    indices[shard].push_back(i);
+  }
+  size_t num_groups = 0;
+  for (const auto& group : groups) {
+    num_groups += !group.empty();
+  }
+  auto policy = num_groups > 1 ? std::launch::async : std::launch::deferred;
+  // The shards are called from other threads, which have no trace
+  // context of their own.
+  TraceContext trace_context = CurrentTraceContext();
+  vector<std::future<vector<vector<string>>>> futures(shards_.size());
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    if (!groups[shard].empty()) {
+      futures[shard] = std::async(
+          policy, [this, shard, &groups, trace_context]() {
+            ScopedTraceContext scoped_trace_context(trace_context);
+            return shards_[shard]->MultiGet(groups[shard]);
+          });
+    }
+  }
+  vector<vector<string>> values(keys.size());
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    if (!futures[shard].valid()) {
+      continue;
+    }
+    vector<vector<string>> shard_values = futures[shard].get();
+    for (size_t j = 0; j < shard_values.size(); ++j) {
+      values[indices[shard][j]] = std::move(shard_values[j]);
+    }
+  }
+  return values;
+}
+
+bool ShardedKVStoreClient::Remove(const string& key) {
+  return shards_[ShardFor(key)]->Remove(key);
+}
+
+vector<bool> ShardedKVStoreClient::Write(const vector<KVMutation>& mutations) {
+  // Group the mutations by shard, remembering where each of them
+  // came from to put the results back in the original order.
+  vector<vector<KVMutation>> batches(shards_.size());
+  vector<vector<size_t>> indices(shards_.size());
+  for (size_t i = 0; i < mutations.size(); ++i) {
+    size_t shard = ShardFor(mutations[i].key);
+    batches[shard].push_back(mutations[i]);
+    indices[shard].push_back(i);
+  }
+  // Send each non-empty batch to its shard in parallel, unless there is
+  // only one, which is then simply sent from this thread.
+  size_t num_batches = 0;
+  for (const auto& batch : batches) {
+    num_batches += !batch.empty();
+  }
+  auto policy = num_batches > 1 ? std::launch::async : std::launch::deferred;
+  TraceContext trace_context = CurrentTraceContext();
+  vector<std::future<vector<bool>>> futures(shards_.size());
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    if (!batches[shard].empty()) {
+      futures[shard] = std::async(
+          policy, [this, shard, &batches, trace_context]() {
+            ScopedTraceContext scoped_trace_context(trace_context);
+            return shards_[shard]->Write(batches[shard]);
+          });
+    }
+  }
+  vector<bool> results(mutations.size(), false);
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    if (!futures[shard].valid()) {
+      continue;
+    }
+    vector<bool> shard_results = futures[shard].get();
+    for (size_t j = 0; j < shard_results.size(); ++j) {
+      results[indices[shard][j]] = shard_results[j];
+    }
+  }
+  return results;
+}
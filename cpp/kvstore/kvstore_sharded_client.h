@@ -0,0 +1,69 @@
+#ifndef CSCI499_CHENGTSU_KVSTORE_SHARDED_CLIENT_H
+#define CSCI499_CHENGTSU_KVSTORE_SHARDED_CLIENT_H
+
+#include "kvstore/kvstore_interface.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kvstore/hash_ring.h"
+
+// A key-value store spreading keys over multiple shards, each of which
+// is another key-value store (usually a `KVStoreClient` to a separate
+// KVStore service), using consistent hashing.
+//
+// All values under a key live on a single shard, chosen by the name the
+// shard was added with (e.g. its address), so shards should be added
+// with the same names in every process sharing them, regardless of order.
+class ShardedKVStoreClient : public KVStoreInterface {
+ public:
+  explicit ShardedKVStoreClient(
+      size_t num_virtual_nodes = HashRing::kDefaultNumVirtualNodes)
+      : ring_(num_virtual_nodes), shards_() {}
+
+  // Adds a shard with a unique name. Adding a shard moves the keys that
+  // now belong to it away from the existing shards, which is up to the
+  // caller to migrate. Not thread-safe, so all shards should be added
+  // before the client is used.
+  void AddShard(const std::string& name,
+                std::unique_ptr<KVStoreInterface> shard);
+
+  // Returns the index (in the order of `AddShard()`) of the shard
+  // the key belongs to.
+  size_t ShardFor(const std::string& key) const;
+
+  // Returns the number of shards.
+  size_t NumShards() const noexcept { return shards_.size(); }
+
+  // Adds a value under the key, and returns true
+  // if the put was successful.
+  bool Put(const std::string& key, const std::string& value);
+
+  // Returns all previously stored values under the key.
+  std::vector<std::string> Get(const std::string& key) const;
+
+  // Groups the keys by shard, gets each group from its shard at once
+  // (all shards in parallel), and returns the values of each key, in
+  // the same order.
+  std::vector<std::vector<std::string>> MultiGet(
+      const std::vector<std::string>& keys) const;
+
+  // Deletes all previously stored values under the key and
+  // returns true if the key existed and the delete was successful.
+  bool Remove(const std::string& key);
+
+  // Groups the mutations by shard, sends each group to its shard as a
+  // single batch (all shards in parallel), and returns for each mutation
+  // whether it was successful. Mutations to the same shard are applied
+  // in order, but there is no ordering across shards.
+  std::vector<bool> Write(const std::vector<KVMutation>& mutations);
+
+ private:
+  // Ring deciding which shard each key belongs to.
+  HashRing ring_;
+  // Shards indexed by their index in the ring.
+  std::vector<std::unique_ptr<KVStoreInterface>> shards_;
+};
+
+#endif //CSCI499_CHENGTSU_KVSTORE_SHARDED_CLIENT_H
@@ -0,0 +1,281 @@
+#include "common/admission_controller.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <gtest/gtest.h>
+
+using std::string;
+using std::thread;
+using std::vector;
+
+// Returns options allowing `max_in_flight` requests at once, which
+// wait for at most `queue_budget_ms` milliseconds.
+AdmissionController::Options MakeOptions(size_t max_in_flight,
+                                         int queue_budget_ms) {
+  AdmissionController::Options options;
+  options.max_in_flight = max_in_flight;
+  options.queue_budget = std::chrono::milliseconds(queue_budget_ms);
+  return options;
+}
+
+// Tests whether requests are all admitted when there are no limits.
+TEST(AdmissionControllerTest, NoLimitTest) {
+  AdmissionController controller;
+  size_t method = controller.AddMethod("get", AdmissionController::kRead);
+  vector<std::unique_ptr<AdmissionController::Ticket>> tickets;
+  for (int i = 0; i < 100; ++i) {
+    tickets.emplace_back(new AdmissionController::Ticket);
+    EXPECT_TRUE(controller.Admit(method, nullptr, tickets.back().get()).ok());
+  }
+  auto stats = controller.GetStats();
+  ASSERT_EQ(1, stats.size());
+  EXPECT_EQ("get", stats[0].name);
+  EXPECT_EQ(100, stats[0].admitted);
+  EXPECT_EQ(100, stats[0].in_flight);
+  tickets.clear();
+  EXPECT_EQ(0, controller.GetStats()[0].in_flight);
+}
+
+// Tests whether requests beyond the limits wait for their budget and
+// are then rejected.
+TEST(AdmissionControllerTest, TimeoutTest) {
+  AdmissionController controller;
+  auto options = MakeOptions(3, 20);
+  options.max_in_flight_per_method = 2;
+  controller.SetOptions(options);
+  size_t get = controller.AddMethod("get", AdmissionController::kRead);
+  size_t put = controller.AddMethod("put", AdmissionController::kWrite);
+  AdmissionController::Ticket tickets[4];
+  EXPECT_TRUE(controller.Admit(get, nullptr, &tickets[0]).ok());
+  EXPECT_TRUE(controller.Admit(get, nullptr, &tickets[1]).ok());
+  // The method is full, though the controller is not.
+  auto start = std::chrono::steady_clock::now();
+  grpc::Status status = controller.Admit(get, nullptr, &tickets[2]);
+  EXPECT_EQ(grpc::StatusCode::RESOURCE_EXHAUSTED, status.error_code());
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(20));
+  EXPECT_TRUE(controller.Admit(put, nullptr, &tickets[2]).ok());
+  // The controller is full.
+  status = controller.Admit(put, nullptr, &tickets[3]);
+  EXPECT_EQ(grpc::StatusCode::RESOURCE_EXHAUSTED, status.error_code());
+  auto stats = controller.GetStats();
+  EXPECT_EQ(2, stats[0].admitted);
+  EXPECT_EQ(1, stats[0].shed_timed_out);
+  EXPECT_EQ(1, stats[1].admitted);
+  EXPECT_EQ(1, stats[1].shed_timed_out);
+}
+
+// Tests whether a waiting request is admitted once a slot is released.
+TEST(AdmissionControllerTest, WaitTest) {
+  AdmissionController controller;
+  controller.SetOptions(MakeOptions(1, 5000));
+  size_t method = controller.AddMethod("put", AdmissionController::kWrite);
+  std::unique_ptr<AdmissionController::Ticket> ticket(
+      new AdmissionController::Ticket);
+  ASSERT_TRUE(controller.Admit(method, nullptr, ticket.get()).ok());
+  grpc::Status status;
+  thread waiter([&]() {
+    AdmissionController::Ticket waiter_ticket;
+    status = controller.Admit(method, nullptr, &waiter_ticket);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ticket.reset();
+  waiter.join();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(2, controller.GetStats()[0].admitted);
+}
+
+// Tests whether waiting requests of the prioritized class take
+// freed slots first.
+TEST(AdmissionControllerTest, PriorityTest) {
+  AdmissionController controller;
+  auto options = MakeOptions(1, 5000);
+  options.priority = AdmissionController::kWritesFirst;
+  controller.SetOptions(options);
+  size_t get = controller.AddMethod("get", AdmissionController::kRead);
+  size_t put = controller.AddMethod("put", AdmissionController::kWrite);
+  std::unique_ptr<AdmissionController::Ticket> ticket(
+      new AdmissionController::Ticket);
+  ASSERT_TRUE(controller.Admit(get, nullptr, ticket.get()).ok());
+
+  std::mutex mutex;
+  vector<string> order;
+  auto wait = [&](size_t method, const string& name) {
+    AdmissionController::Ticket waiter_ticket;
+    EXPECT_TRUE(controller.Admit(method, nullptr, &waiter_ticket).ok());
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(name);
+  };
+  // The read starts waiting before the write, but goes after it.
+  thread reader(wait, get, "get");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  thread writer(wait, put, "put");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ticket.reset();
+  reader.join();
+  writer.join();
+  EXPECT_EQ((vector<string>{"put", "get"}), order);
+}
+
+// Tests whether requests are rejected right away after requests waited
+// too long, and admitted again once there are free slots.
+TEST(AdmissionControllerTest, ShedTest) {
+  AdmissionController controller;
+  auto options = MakeOptions(1, 20);
+  options.shed_queue_delay = std::chrono::milliseconds(1);
+  controller.SetOptions(options);
+  size_t method = controller.AddMethod("get", AdmissionController::kRead);
+  std::unique_ptr<AdmissionController::Ticket> ticket(
+      new AdmissionController::Ticket);
+  ASSERT_TRUE(controller.Admit(method, nullptr, ticket.get()).ok());
+  AdmissionController::Ticket rejected_ticket;
+  // The first request waits out its budget, pushing the average
+  // queueing delay over the threshold.
+  EXPECT_FALSE(controller.Admit(method, nullptr, &rejected_ticket).ok());
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(controller.Admit(method, nullptr, &rejected_ticket).ok());
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(20));
+  auto stats = controller.GetStats();
+  EXPECT_EQ(1, stats[0].shed_timed_out);
+  EXPECT_EQ(1, stats[0].shed_overloaded);
+  ticket.reset();
+  AdmissionController::Ticket admitted_ticket;
+  EXPECT_TRUE(controller.Admit(method, nullptr, &admitted_ticket).ok());
+}
+
+// Tests whether accepted requests wait past the budget instead of being
+// rejected, even while requests are being shed.
+TEST(AdmissionControllerTest, AdmitAcceptedTest) {
+  AdmissionController controller;
+  auto options = MakeOptions(1, 5);
+  options.shed_queue_delay = std::chrono::milliseconds(1);
+  controller.SetOptions(options);
+  size_t method = controller.AddMethod("put", AdmissionController::kWrite);
+  std::unique_ptr<AdmissionController::Ticket> ticket(
+      new AdmissionController::Ticket);
+  ASSERT_TRUE(controller.Admit(method, nullptr, ticket.get()).ok());
+  AdmissionController::Ticket rejected_ticket;
+  EXPECT_FALSE(controller.Admit(method, nullptr, &rejected_ticket).ok());
+  bool admitted = false;
+  thread waiter([&]() {
+    AdmissionController::Ticket waiter_ticket;
+    controller.AdmitAccepted(method, &waiter_ticket);
+    admitted = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ticket.reset();
+  waiter.join();
+  EXPECT_TRUE(admitted);
+  auto stats = controller.GetStats();
+  EXPECT_EQ(2, stats[0].admitted);
+  EXPECT_EQ(1, stats[0].shed_timed_out);
+  EXPECT_EQ(0, stats[0].shed_overloaded);
+}
+
+// Tests whether a method is held to its own limit while the others are
+// still admitted, and whether its waiting requests go once it is raised.
+TEST(AdmissionControllerTest, MethodLimitTest) {
+  AdmissionController controller;
+  controller.SetOptions(MakeOptions(4, 5000));
+  AdmissionController::MethodOptions read_options;
+  read_options.max_in_flight = 2;
+  size_t read = controller.AddMethod("read", AdmissionController::kRead,
+                                     read_options);
+  size_t write = controller.AddMethod("write", AdmissionController::kWrite);
+  AdmissionController::Ticket tickets[4];
+  EXPECT_TRUE(controller.Admit(read, nullptr, &tickets[0]).ok());
+  EXPECT_TRUE(controller.Admit(read, nullptr, &tickets[1]).ok());
+  grpc::Status status;
+  thread waiter([&]() {
+    status = controller.Admit(read, nullptr, &tickets[2]);
+  });
+  while (controller.GetStats()[read].waiting == 0) {
+    std::this_thread::yield();
+  }
+  // The full method leaves the slots of the controller to the others.
+  EXPECT_TRUE(controller.Admit(write, nullptr, &tickets[3]).ok());
+  read_options.max_in_flight = 3;
+  controller.SetMethodOptions(read, AdmissionController::kRead, read_options);
+  waiter.join();
+  EXPECT_TRUE(status.ok());
+  auto stats = controller.GetStats();
+  EXPECT_EQ(3, stats[read].options.max_in_flight);
+  EXPECT_EQ(3, stats[read].in_flight);
+  EXPECT_EQ(0, stats[read].waiting);
+  EXPECT_EQ(3, stats[read].queue_wait.count);
+  EXPECT_LT(0, stats[read].queue_wait.max);
+}
+
+// Tests whether methods whose requests wait for slots share them in
+// proportion to their weights.
+TEST(AdmissionControllerTest, WeightedFairnessTest) {
+  AdmissionController controller;
+  controller.SetOptions(MakeOptions(1, 5000));
+  size_t holder = controller.AddMethod("holder", AdmissionController::kRead);
+  size_t light = controller.AddMethod("light", AdmissionController::kRead);
+  AdmissionController::MethodOptions heavy_options;
+  heavy_options.weight = 2;
+  size_t heavy = controller.AddMethod("heavy", AdmissionController::kRead,
+                                      heavy_options);
+  std::unique_ptr<AdmissionController::Ticket> ticket(
+      new AdmissionController::Ticket);
+  ASSERT_TRUE(controller.Admit(holder, nullptr, ticket.get()).ok());
+
+  const int kNumWaiters = 12;
+  std::mutex mutex;
+  vector<size_t> order;
+  vector<thread> waiters;
+  for (int i = 0; i < kNumWaiters; ++i) {
+    for (size_t method : {light, heavy}) {
+      waiters.emplace_back([&, method]() {
+        AdmissionController::Ticket waiter_ticket;
+        EXPECT_TRUE(controller.Admit(method, nullptr, &waiter_ticket).ok());
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(method);
+      });
+    }
+  }
+  while (true) {
+    auto stats = controller.GetStats();
+    if (stats[light].waiting + stats[heavy].waiting == 2 * kNumWaiters) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  ticket.reset();
+  for (auto& waiter : waiters) {
+    waiter.join();
+  }
+  ASSERT_EQ(2 * kNumWaiters, order.size());
+  // Two heavy requests go for each light one, give or take a tie.
+  int num_heavy = 0;
+  for (int i = 0; i < 9; ++i) {
+    num_heavy += order[i] == heavy;
+  }
+  EXPECT_LE(5, num_heavy);
+  EXPECT_GE(7, num_heavy);
+}
+
+// Tests the parsing of priority names.
+TEST(AdmissionControllerTest, ParsePriorityTest) {
+  AdmissionController::Priority priority;
+  EXPECT_TRUE(AdmissionController::ParsePriority("reads", &priority));
+  EXPECT_EQ(AdmissionController::kReadsFirst, priority);
+  EXPECT_TRUE(AdmissionController::ParsePriority("writes", &priority));
+  EXPECT_EQ(AdmissionController::kWritesFirst, priority);
+  EXPECT_TRUE(AdmissionController::ParsePriority("none", &priority));
+  EXPECT_EQ(AdmissionController::kNoPriority, priority);
+  EXPECT_FALSE(AdmissionController::ParsePriority("both", &priority));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
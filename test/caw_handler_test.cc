@@ -371,6 +371,52 @@ TEST_F(CawHandlerTest, CawFuncsTest) {
   EXPECT_TRUE(cawIdsEq({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, caws));
 }
 
+// Tests whether `caw::handler::Read()` returns the caws of a thread
+// level by level, each level in the order of the replies of the level
+// above, and fetches each level of a thread at once.
+TEST_F(CawHandlerTest, ReadOrderTest) {
+  // An in-memory KVStore counting the calls to `MultiGet()`.
+  class CountingKVStore : public KVStore {
+   public:
+    vector<vector<string>> MultiGet(const vector<string>& keys) const {
+      ++multi_gets;
+      return KVStore::MultiGet(keys);
+    }
+
+    mutable int multi_gets = 0;
+  };
+  auto kvstore = new CountingKVStore;
+  kvstore_.reset(kvstore);
+  RegisterUser("levi");
+
+  // Make a thread with a wide level (caws 1 to 6, under caw 0), and a
+  // deep branch (caws 7 to 10, under caw 1), that is 6 levels.
+  vector<string> caw_ids;
+  auto addCaw = [&caw_ids, this](int parent) {
+    caw::Caw caw;
+    Caw("levi", "caw", parent < 0 ? "" : caw_ids[parent], &caw);
+    caw_ids.push_back(caw.id());
+  };
+  addCaw(-1);
+  for (int i = 1; i <= 6; ++i) {
+    addCaw(0);
+  }
+  for (int i = 7; i <= 10; ++i) {
+    addCaw(i == 7 ? 1 : i - 1);
+  }
+  addCaw(6);  // caw 11.
+  vector<int> expected_order = {0, 1, 2, 3, 4, 5, 6, 7, 11, 8, 9, 10};
+
+  kvstore->multi_gets = 0;
+  vector<caw::Caw> caws;
+  ASSERT_TRUE(Read(caw_ids[0], caws).ok());
+  ASSERT_EQ(expected_order.size(), caws.size());
+  for (size_t i = 0; i < caws.size(); ++i) {
+    EXPECT_EQ(caw_ids[expected_order[i]], caws[i].id()) << "caw " << i;
+  }
+  EXPECT_EQ(6, kvstore->multi_gets);
+}
+
 int main(int argc, char **argv) {
   // Use a self-defined main function here to call InitGoogleLogging(),
   // otherwise, all glog messages (including INFO) will be directed to
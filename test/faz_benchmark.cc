@@ -0,0 +1,698 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <google/protobuf/arena.h>
+#include <grpcpp/grpcpp.h>
+
+#include "caw.pb.h"
+#include "caw/caw_client.h"
+#include "caw/caw_handler.h"
+#include "common/histogram.h"
+#include "faz/faz_async_server.h"
+#include "faz/faz_context.h"
+#include "faz/faz_service.h"
+#include "kvstore/kvstore.h"
+#include "kvstore/kvstore_client.h"
+#include "kvstore/kvstore_interface.h"
+#include "kvstore/kvstore_service.h"
+
+DEFINE_int32(sync_port, 50021, "Port number for the benchmarked sync server.");
+DEFINE_int32(async_port, 50022, "Port number for the benchmarked async "
+             "server.");
+DEFINE_int32(threads, 32, "Number of client threads sending events at once.");
+DEFINE_int32(calls, 2000, "Number of events to send to each server.");
+DEFINE_int32(batch_size, 1, "Number of events sent per call, in batches if "
+             "more than 1.");
+DEFINE_int32(kvstore_delay_us, 500, "Time each call to the KVStore takes, "
+             "standing for the round trip to a kvstore server.");
+DEFINE_int32(sync_max_threads, 0, "Maximum number of threads of the sync "
+             "server, 0 for the gRPC default (no limit).");
+DEFINE_uint32(network_threads, 2, "Number of network threads of the async "
+              "server.");
+DEFINE_uint32(worker_threads, 16, "Number of workers of the async server.");
+DEFINE_uint64(response_cache_bytes, 0, "Size of the response cache of the "
+              "benchmarked service, 0 to disable it.");
+DEFINE_int32(thread_size, 500, "Number of caws of the threads read by the "
+             "Read benchmark.");
+DEFINE_int32(read_calls, 3, "Number of reads of each thread of the Read "
+             "benchmark.");
+DEFINE_int32(collapse_calls, 2000, "Number of reads of the same thread sent "
+             "from `--threads` threads to measure collapsing.");
+DEFINE_int32(kvstore_port, 50023, "Port number for the kvstore service the "
+             "remote mode is compared against.");
+DEFINE_string(store_file, "/tmp/faz_benchmark.store", "File the KVStores "
+              "compared in embedded and remote modes persist to, with "
+              "suffixes. Removed before and after.");
+DEFINE_int32(store_calls, 500, "Number of events of each type to time in "
+             "embedded and remote modes.");
+DEFINE_int32(queue_events, 2000, "Number of Caw events sent from `--threads` "
+             "threads, executed at once or through the event queue.");
+DEFINE_uint32(queue_workers, 16, "Number of workers of the event queue.");
+DEFINE_string(queue_file, "/tmp/faz_benchmark.queue", "File of the event "
+              "queue. Removed before and after.");
+DEFINE_int32(allocation_calls, 1000, "Number of events of each type to count "
+             "heap allocations over.");
+
+using google::protobuf::Arena;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// Number of heap allocations made by the process so far.
+std::atomic<uint64_t> num_allocations(0);
+
+void* operator new(size_t size) {
+  ++num_allocations;
+  if (void* p = malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t size) noexcept {
+  free(p);
+}
+
+// An in-memory KVStore whose calls take `FLAGS_kvstore_delay_us` longer.
+class DelayedKVStore : public KVStoreInterface {
+ public:
+  bool Put(const string& key, const string& value) {
+    Delay();
+    return store_.Put(key, value);
+  }
+
+  vector<string> Get(const string& key) const {
+    Delay();
+    return store_.Get(key);
+  }
+
+  bool Remove(const string& key) {
+    Delay();
+    return store_.Remove(key);
+  }
+
+  // Takes a single delay for all the keys, as their gets would be in
+  // flight at once.
+  vector<vector<string>> MultiGet(const vector<string>& keys) const {
+    Delay();
+    return store_.MultiGet(keys);
+  }
+
+  // Returns the underlying store, e.g. to set up data without delay.
+  KVStore& store() { return store_; }
+
+ private:
+  static void Delay() {
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(FLAGS_kvstore_delay_us));
+  }
+
+  KVStore store_;
+};
+
+// Executes the event on the service, and returns the number of heap
+// allocations made meanwhile. The request and reply are on the arena if
+// given, as with the async server, or on the heap otherwise, as with the
+// sync server.
+uint64_t CountEventAllocations(FazService& service, int event_type,
+                               const google::protobuf::Message& payload,
+                               Arena* arena) {
+  faz::EventRequest* request = Arena::CreateMessage<faz::EventRequest>(arena);
+  faz::EventReply* reply = Arena::CreateMessage<faz::EventReply>(arena);
+  request->set_event_type(event_type);
+  request->mutable_payload()->PackFrom(payload);
+  grpc::ServerContext context;
+  uint64_t start = num_allocations;
+  grpc::Status status = service.event(&context, request, reply);
+  uint64_t count = num_allocations - start;
+  if (!status.ok()) {
+    LOG(FATAL) << "Failed to execute event(" << event_type << "): "
+               << status.error_message();
+  }
+  if (!arena) {
+    delete request;
+    delete reply;
+  }
+  return count;
+}
+
+// Names of the Caw functions, indexed by event type.
+const vector<string> kFunctions = {"RegisterUser", "Follow", "Profile",
+                                   "Caw", "Read"};
+
+// Hooks the Caw functions to their event types on the service.
+void HookAll(FazService& service) {
+  for (size_t i = 0; i < kFunctions.size(); ++i) {
+    grpc::ServerContext context;
+    faz::HookRequest request;
+    request.set_event_type(i);
+    request.set_event_function(kFunctions[i]);
+    faz::HookReply reply;
+    service.hook(&context, &request, &reply);
+  }
+}
+
+// Prints the number of heap allocations per event of each Caw type,
+// executing them directly on a FazService over an in-memory KVStore.
+void CountAllocations() {
+  FazService service(std::unique_ptr<KVStoreInterface>(new KVStore));
+  const vector<string>& functions = kFunctions;
+  HookAll(service);
+  int n = FLAGS_allocation_calls;
+  cout << std::left << std::setw(14) << "event"
+       << std::setw(14) << "heap" << std::setw(14) << "arena" << endl;
+  vector<vector<double>> counts(functions.size());
+  for (bool on_arena : {false, true}) {
+    string prefix = on_arena ? "arena" : "heap";
+    vector<uint64_t> totals(functions.size(), 0);
+    auto count = [&](int event_type, const google::protobuf::Message& payload) {
+      Arena arena;
+      totals[event_type] += CountEventAllocations(
+          service, event_type, payload, on_arena ? &arena : nullptr);
+    };
+    for (int i = 0; i < n; ++i) {
+      caw::RegisteruserRequest request;
+      request.set_username(prefix + std::to_string(i));
+      count(CawClient::kRegisterUser, request);
+    }
+    for (int i = 0; i < n; ++i) {
+      caw::FollowRequest request;
+      request.set_username(prefix + std::to_string(i));
+      request.set_to_follow(prefix + std::to_string((i + 1) % n));
+      count(CawClient::kFollow, request);
+    }
+    for (int i = 0; i < n; ++i) {
+      caw::ProfileRequest request;
+      request.set_username(prefix + std::to_string(i));
+      count(CawClient::kProfile, request);
+    }
+    for (int i = 0; i < n; ++i) {
+      caw::CawRequest request;
+      request.set_username(prefix + std::to_string(i));
+      request.set_text("Caw number " + std::to_string(i));
+      count(CawClient::kCaw, request);
+    }
+    // Read a thread of a caw with three replies.
+    caw::CawRequest caw_request;
+    caw_request.set_username(prefix + "0");
+    caw_request.set_text("A thread");
+    faz::EventRequest root_request;
+    root_request.set_event_type(CawClient::kCaw);
+    root_request.mutable_payload()->PackFrom(caw_request);
+    faz::EventReply root_reply;
+    grpc::ServerContext context;
+    service.event(&context, &root_request, &root_reply);
+    caw::CawReply root;
+    root_reply.payload().UnpackTo(&root);
+    for (int i = 0; i < 3; ++i) {
+      caw_request.set_parent_id(root.caw().id());
+      root_request.mutable_payload()->PackFrom(caw_request);
+      grpc::ServerContext reply_context;
+      service.event(&reply_context, &root_request, &root_reply);
+    }
+    for (int i = 0; i < n; ++i) {
+      caw::ReadRequest request;
+      request.set_caw_id(root.caw().id());
+      count(CawClient::kRead, request);
+    }
+    for (size_t i = 0; i < functions.size(); ++i) {
+      counts[i].push_back(static_cast<double>(totals[i]) / n);
+    }
+  }
+  for (size_t i = 0; i < functions.size(); ++i) {
+    cout << std::left << std::setw(14) << functions[i]
+         << std::setw(14) << counts[i][0] << std::setw(14) << counts[i][1]
+         << endl;
+  }
+  cout << endl;
+}
+
+// Posts a caw through the handler, replying to the parent if not empty,
+// and returns its ID.
+string PostCaw(KVStoreInterface* kvstore, const string& parent_id) {
+  caw::CawRequest request;
+  request.set_username("user");
+  request.set_text("A caw");
+  request.set_parent_id(parent_id);
+  google::protobuf::Any in;
+  in.PackFrom(request);
+  google::protobuf::Any out;
+  if (!caw::handler::Caw(&in, &out, kvstore).ok()) {
+    LOG(FATAL) << "Failed to post a caw.";
+  }
+  caw::CawReply reply;
+  out.UnpackTo(&reply);
+  return reply.caw().id();
+}
+
+// Prints the latency of Read on threads of `FLAGS_thread_size` caws of
+// different shapes, fetching one caw at a time against 32 caws of a
+// level at once (as faz_server does by default), over the delayed KVStore.
+void BenchmarkReads() {
+  DelayedKVStore kvstore;
+  KVStore& store = kvstore.store();
+  caw::RegisteruserRequest user;
+  user.set_username("user");
+  google::protobuf::Any in;
+  in.PackFrom(user);
+  google::protobuf::Any out;
+  caw::handler::RegisterUser(&in, &out, &store);
+  int n = std::max(FLAGS_thread_size, 1);
+  // Each caw replies to the previous one.
+  string deep = PostCaw(&store, "");
+  string parent = deep;
+  for (int i = 1; i < n; ++i) {
+    parent = PostCaw(&store, parent);
+  }
+  // Each caw replies to the first one.
+  string wide = PostCaw(&store, "");
+  for (int i = 1; i < n; ++i) {
+    PostCaw(&store, wide);
+  }
+  // Each caw has up to four replies.
+  vector<string> ids = {PostCaw(&store, "")};
+  for (int i = 1; i < n; ++i) {
+    ids.push_back(PostCaw(&store, ids[(i - 1) / 4]));
+  }
+  const string& bushy = ids[0];
+
+  cout << std::left << std::setw(10) << "thread"
+       << std::setw(18) << "one at a time"
+       << std::setw(18) << "level at once" << "(ms per read)" << endl;
+  for (const auto& thread : {std::make_pair("deep", deep),
+                             std::make_pair("wide", wide),
+                             std::make_pair("bushy", bushy)}) {
+    caw::ReadRequest request;
+    request.set_caw_id(thread.second);
+    in.PackFrom(request);
+    cout << std::left << std::setw(10) << thread.first;
+    // Each caw takes two keys: its body and its reply ids.
+    for (size_t max_caws : {1, 32}) {
+      FazContext::Options options;
+      options.max_multi_get_keys = 2 * max_caws;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < FLAGS_read_calls; ++i) {
+        FazContext context(&kvstore, options);
+        if (!caw::handler::Read(&in, &out, &context).ok()) {
+          LOG(FATAL) << "Failed to read the thread.";
+        }
+      }
+      double ms = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+      cout << std::setw(18) << ms / std::max(FLAGS_read_calls, 1);
+    }
+    cout << endl;
+  }
+  cout << endl;
+}
+
+// Prints the throughput and KVStore calls of `FLAGS_collapse_calls` Read
+// events of the same thread sent at once from `FLAGS_threads` threads,
+// each executed against identical events in flight sharing one
+// execution, on a FazService over the delayed KVStore.
+void BenchmarkCollapse() {
+  cout << std::left << std::setw(10) << "collapse"
+       << std::setw(14) << "events/s"
+       << std::setw(18) << "kvstore calls"
+       << std::setw(18) << "calls per event"
+       << std::setw(14) << "collapse ratio" << endl;
+  for (bool collapse : {false, true}) {
+    auto* kvstore = new DelayedKVStore;
+    FazService service{std::unique_ptr<KVStoreInterface>(kvstore)};
+    service.SetCollapseReads(collapse);
+    HookAll(service);
+    // A thread of 21 caws, each with up to four replies.
+    KVStore& store = kvstore->store();
+    caw::RegisteruserRequest user;
+    user.set_username("user");
+    google::protobuf::Any in;
+    in.PackFrom(user);
+    google::protobuf::Any out;
+    caw::handler::RegisterUser(&in, &out, &store);
+    vector<string> ids = {PostCaw(&store, "")};
+    for (int i = 1; i < 21; ++i) {
+      ids.push_back(PostCaw(&store, ids[(i - 1) / 4]));
+    }
+    caw::ReadRequest read;
+    read.set_caw_id(ids[0]);
+    faz::EventRequest request;
+    request.set_event_type(CawClient::kRead);
+    request.mutable_payload()->PackFrom(read);
+
+    int num_threads = std::max(FLAGS_threads, 1);
+    auto start = std::chrono::steady_clock::now();
+    vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&service, &request, num_threads]() {
+        for (int i = 0; i < FLAGS_collapse_calls / num_threads; ++i) {
+          grpc::ServerContext context;
+          faz::EventReply reply;
+          if (!service.event(&context, &request, &reply).ok()) {
+            LOG(FATAL) << "Failed to read the thread.";
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    for (const auto& stats : service.GetEventStats()) {
+      if (stats.event_type != CawClient::kRead) {
+        continue;
+      }
+      uint64_t events = stats.events + stats.collapsed;
+      cout << std::left << std::setw(10) << (collapse ? "on" : "off")
+           << std::setw(14) << events / seconds
+           << std::setw(18) << stats.remote_calls
+           << std::setw(18)
+           << static_cast<double>(stats.remote_calls) / events
+           << std::setw(14) << static_cast<double>(stats.collapsed) / events
+           << endl;
+    }
+  }
+  cout << endl;
+}
+
+// Executes `FLAGS_store_calls` events of each Caw type one after another
+// on a FazService over the KVStore, and returns the latency of the
+// events of each type.
+vector<HistogramSnapshot> TimeEvents(
+    std::unique_ptr<KVStoreInterface> kvstore) {
+  FazService service(std::move(kvstore));
+  HookAll(service);
+  vector<std::unique_ptr<Histogram>> latency;
+  for (size_t i = 0; i < kFunctions.size(); ++i) {
+    latency.emplace_back(new Histogram);
+  }
+  // Executes the event, timed, and returns its reply payload.
+  auto event = [&](int event_type, const google::protobuf::Message& payload) {
+    faz::EventRequest request;
+    request.set_event_type(event_type);
+    request.mutable_payload()->PackFrom(payload);
+    faz::EventReply reply;
+    grpc::ServerContext context;
+    grpc::Status status;
+    {
+      ScopedLatencyTimer timer(*latency[event_type]);
+      status = service.event(&context, &request, &reply);
+    }
+    if (!status.ok()) {
+      LOG(FATAL) << "Failed to execute event(" << event_type << "): "
+                 << status.error_message();
+    }
+    return reply.payload();
+  };
+  int n = std::max(FLAGS_store_calls, 1);
+  for (int i = 0; i < n; ++i) {
+    caw::RegisteruserRequest request;
+    request.set_username("user" + std::to_string(i));
+    event(CawClient::kRegisterUser, request);
+  }
+  for (int i = 0; i < n; ++i) {
+    caw::FollowRequest request;
+    request.set_username("user" + std::to_string(i));
+    request.set_to_follow("user" + std::to_string((i + 1) % n));
+    event(CawClient::kFollow, request);
+  }
+  for (int i = 0; i < n; ++i) {
+    caw::ProfileRequest request;
+    request.set_username("user" + std::to_string(i));
+    event(CawClient::kProfile, request);
+  }
+  // Each caw replies to the previous one of the same user, so that reads
+  // get threads of a few caws.
+  vector<string> caw_ids;
+  for (int i = 0; i < n; ++i) {
+    caw::CawRequest request;
+    request.set_username("user" + std::to_string(i % 10));
+    request.set_text("Caw number " + std::to_string(i));
+    if (i >= 10) {
+      request.set_parent_id(caw_ids[i - 10]);
+    }
+    caw::CawReply reply;
+    event(CawClient::kCaw, request).UnpackTo(&reply);
+    caw_ids.push_back(reply.caw().id());
+  }
+  for (int i = 0; i < n; ++i) {
+    caw::ReadRequest request;
+    request.set_caw_id(caw_ids[i]);
+    event(CawClient::kRead, request);
+  }
+  vector<HistogramSnapshot> snapshots;
+  for (const auto& histogram : latency) {
+    snapshots.push_back(histogram->Snapshot());
+  }
+  return snapshots;
+}
+
+// Prints the latency of each type of event executed on a FazService over
+// a KVStore embedded in the same process, against over a kvstore service
+// at a local port, both persisting to a file.
+void BenchmarkEmbeddedStore() {
+  string embedded_file = FLAGS_store_file + ".embedded";
+  string remote_file = FLAGS_store_file + ".remote";
+  std::remove(embedded_file.c_str());
+  std::remove(remote_file.c_str());
+  vector<HistogramSnapshot> embedded = TimeEvents(
+      std::unique_ptr<KVStoreInterface>(new KVStore(embedded_file)));
+
+  KVStoreService kvstore_service(remote_file);
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("localhost:" + std::to_string(FLAGS_kvstore_port),
+                           grpc::InsecureServerCredentials());
+  builder.RegisterService(&kvstore_service);
+  std::unique_ptr<grpc::Server> kvstore_server(builder.BuildAndStart());
+  vector<HistogramSnapshot> remote = TimeEvents(
+      std::unique_ptr<KVStoreInterface>(new KVStoreClient(grpc::CreateChannel(
+          "localhost:" + std::to_string(FLAGS_kvstore_port),
+          grpc::InsecureChannelCredentials()))));
+  kvstore_server->Shutdown();
+  std::remove(embedded_file.c_str());
+  std::remove(remote_file.c_str());
+
+  cout << std::left << std::setw(14) << "event"
+       << std::setw(14) << "embedded p50" << std::setw(14) << "remote p50"
+       << std::setw(14) << "embedded p99" << std::setw(14) << "remote p99"
+       << "(us)" << endl;
+  for (size_t i = 0; i < kFunctions.size(); ++i) {
+    cout << std::left << std::setw(14) << kFunctions[i]
+         << std::setw(14) << embedded[i].Percentile(50) / 1000
+         << std::setw(14) << remote[i].Percentile(50) / 1000
+         << std::setw(14) << embedded[i].Percentile(99) / 1000
+         << std::setw(14) << remote[i].Percentile(99) / 1000 << endl;
+  }
+  cout << endl;
+}
+
+// Prints the rate and latency of acknowledging `FLAGS_queue_events` Caw
+// events sent from `FLAGS_threads` threads, one user each, on a
+// FazService over the delayed KVStore, executed at once or through the
+// event queue, along with the rate of executing them until all are done.
+void BenchmarkEventQueue() {
+  cout << std::left << std::setw(10) << "mode"
+       << std::setw(14) << "acks/s"
+       << std::setw(14) << "ack p50"
+       << std::setw(14) << "ack p99"
+       << std::setw(14) << "done/s"
+       << std::setw(14) << "wait p99" << "(us)" << endl;
+  for (bool async : {false, true}) {
+    std::remove(FLAGS_queue_file.c_str());
+    auto* kvstore = new DelayedKVStore;
+    FazService service{std::unique_ptr<KVStoreInterface>(kvstore)};
+    if (async && !service.EnableEventQueue(FLAGS_queue_file,
+                                           FLAGS_queue_workers)) {
+      LOG(FATAL) << "Failed to enable the event queue.";
+    }
+    grpc::ServerContext hook_context;
+    faz::HookRequest hook_request;
+    hook_request.set_event_type(CawClient::kCaw);
+    hook_request.set_event_function("Caw");
+    hook_request.set_async(async);
+    faz::HookReply hook_reply;
+    if (!service.hook(&hook_context, &hook_request, &hook_reply).ok()) {
+      LOG(FATAL) << "Failed to hook Caw.";
+    }
+    int num_threads = std::max(FLAGS_threads, 1);
+    KVStore& store = kvstore->store();
+    for (int t = 0; t < num_threads; ++t) {
+      caw::RegisteruserRequest user;
+      user.set_username("user" + std::to_string(t));
+      google::protobuf::Any in;
+      in.PackFrom(user);
+      google::protobuf::Any out;
+      caw::handler::RegisterUser(&in, &out, &store);
+    }
+
+    Histogram latency;
+    auto start = std::chrono::steady_clock::now();
+    vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&service, &latency, num_threads, t]() {
+        string username = "user" + std::to_string(t);
+        faz::EventRequest request;
+        request.set_event_type(CawClient::kCaw);
+        request.set_ordering_key(username);
+        for (int i = 0; i < FLAGS_queue_events / num_threads; ++i) {
+          caw::CawRequest caw;
+          caw.set_username(username);
+          caw.set_text("Caw number " + std::to_string(i));
+          request.mutable_payload()->PackFrom(caw);
+          grpc::ServerContext context;
+          faz::EventReply reply;
+          ScopedLatencyTimer timer(latency);
+          if (!service.event(&context, &request, &reply).ok()) {
+            LOG(FATAL) << "Failed to caw.";
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    double ack_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    while (async && service.GetEventQueueStats().pending > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double done_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    HistogramSnapshot snapshot = latency.Snapshot();
+    uint64_t wait_p99 = 0;
+    if (async) {
+      wait_p99 = service.GetEventQueueStats().queue_wait.Percentile(99);
+    }
+    cout << std::left << std::setw(10) << (async ? "queued" : "direct")
+         << std::setw(14) << snapshot.count / ack_seconds
+         << std::setw(14) << snapshot.Percentile(50) / 1000
+         << std::setw(14) << snapshot.Percentile(99) / 1000
+         << std::setw(14) << snapshot.count / done_seconds
+         << std::setw(14) << wait_p99 / 1000 << endl;
+  }
+  std::remove(FLAGS_queue_file.c_str());
+  cout << endl;
+}
+
+// Sends `FLAGS_calls` Profile events from `FLAGS_threads` threads to the
+// server at the port, `FLAGS_batch_size` per call, and prints the
+// throughput of events and the latency percentiles of calls.
+void Run(int port, const string& mode) {
+  auto channel = grpc::CreateChannel("localhost:" + std::to_string(port),
+                                     grpc::InsecureChannelCredentials());
+  CawClient client(channel);
+  Histogram latency;
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  vector<std::thread> threads;
+  for (int t = 0; t < FLAGS_threads; ++t) {
+    threads.emplace_back([&client, &latency]() {
+      int batch_size = std::max(FLAGS_batch_size, 1);
+      for (int i = 0; i < FLAGS_calls / FLAGS_threads / batch_size; ++i) {
+        ScopedLatencyTimer timer(latency);
+        if (batch_size == 1) {
+          if (!client.Profile("user")) {
+            LOG(FATAL) << "Failed to get the profile.";
+          }
+          continue;
+        }
+        for (const auto& profile :
+             client.Profiles(vector<string>(batch_size, "user"))) {
+          if (!profile) {
+            LOG(FATAL) << "Failed to get the profile.";
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  HistogramSnapshot snapshot = latency.Snapshot();
+  cout << std::left << std::setw(10) << mode
+       << std::setw(14)
+       << snapshot.count * std::max(FLAGS_batch_size, 1) / seconds
+       << std::setw(14) << snapshot.Percentile(50) / 1000
+       << std::setw(14) << snapshot.Percentile(99) / 1000 << endl;
+}
+
+// Benchmarks Profile events through the sync Faz server against the async
+// one, both serving the same FazService over an in-memory KVStore made
+// as slow as a remote one, after counting allocations per event, timing
+// reads of large threads, collapsing concurrent identical reads,
+// comparing an embedded KVStore with a remote one, and queueing writes.
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  cout << "Heap allocations per event:" << endl;
+  CountAllocations();
+
+  cout << "Read latency:" << endl;
+  BenchmarkReads();
+
+  cout << "Concurrent reads of the same thread:" << endl;
+  BenchmarkCollapse();
+
+  cout << "Event latency with an embedded against a remote KVStore:" << endl;
+  BenchmarkEmbeddedStore();
+
+  cout << "Caw events executed directly against through the event queue:"
+       << endl;
+  BenchmarkEventQueue();
+
+  FazService service(std::unique_ptr<KVStoreInterface>(new DelayedKVStore));
+  if (FLAGS_response_cache_bytes > 0) {
+    service.EnableResponseCache(FLAGS_response_cache_bytes);
+  }
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("localhost:" + std::to_string(FLAGS_sync_port),
+                           grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  if (FLAGS_sync_max_threads > 0) {
+    grpc::ResourceQuota quota;
+    quota.SetMaxThreads(FLAGS_sync_max_threads);
+    builder.SetResourceQuota(quota);
+  }
+  std::unique_ptr<grpc::Server> sync_server(builder.BuildAndStart());
+  FazAsyncServer async_server(&service, FLAGS_network_threads,
+                              FLAGS_worker_threads);
+  async_server.Start({"localhost:" + std::to_string(FLAGS_async_port)});
+
+  CawClient setup_client(grpc::CreateChannel(
+      "localhost:" + std::to_string(FLAGS_sync_port),
+      grpc::InsecureChannelCredentials()));
+  if (!setup_client.HookAll() || !setup_client.RegisterUser("user")) {
+    LOG(FATAL) << "Failed to set up the service.";
+  }
+
+  cout << std::left << std::setw(10) << "server"
+       << std::setw(14) << "events/s"
+       << std::setw(14) << "p50 (us)"
+       << std::setw(14) << "p99 (us)" << endl;
+  Run(FLAGS_sync_port, "sync");
+  Run(FLAGS_async_port, "async");
+  cout << "async queue wait p99 (us): "
+       << async_server.GetStats().queue_wait.Percentile(99) / 1000 << endl;
+
+  async_server.Shutdown();
+  sync_server->Shutdown();
+  return 0;
+}
@@ -0,0 +1,197 @@
+#include "faz/faz_context.h"
+
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kvstore/kvstore.h"
+
+using std::string;
+using std::vector;
+
+// An in-memory KVStore counting the calls made to it.
+class CountingKVStore : public KVStoreInterface {
+ public:
+  bool Put(const string& key, const string& value) override {
+    ++calls;
+    return store.Put(key, value);
+  }
+
+  vector<string> Get(const string& key) const override {
+    ++calls;
+    return store.Get(key);
+  }
+
+  vector<vector<string>> MultiGet(
+      const vector<string>& keys) const override {
+    ++calls;
+    vector<vector<string>> values;
+    for (const string& key : keys) {
+      values.push_back(store.Get(key));
+    }
+    return values;
+  }
+
+  bool Remove(const string& key) override {
+    ++calls;
+    return store.Remove(key);
+  }
+
+  vector<bool> Write(const vector<KVMutation>& mutations) override {
+    ++calls;
+    return store.Write(mutations);
+  }
+
+  KVStore store;
+  mutable int calls = 0;
+};
+
+// A test fixture running FazContexts over a counting KVStore.
+class FazContextTest : public ::testing::Test {
+ protected:
+  FazContext::Options Options(bool memoize_reads, bool buffer_writes) {
+    FazContext::Options options;
+    options.memoize_reads = memoize_reads;
+    options.buffer_writes = buffer_writes;
+    return options;
+  }
+
+  CountingKVStore kvstore_;
+};
+
+// Tests whether reads of the same key are answered from memory, and see
+// the writes of the invocation but not those of others.
+TEST_F(FazContextTest, MemoizeReadsTest) {
+  kvstore_.Put("key", "a");
+  kvstore_.calls = 0;
+  FazContext context(&kvstore_, Options(true, false));
+  EXPECT_EQ(vector<string>({"a"}), context.Get("key"));
+  EXPECT_EQ(vector<string>({"a"}), context.Get("key"));
+  EXPECT_EQ(1, kvstore_.calls);
+
+  EXPECT_TRUE(context.Put("key", "b"));
+  EXPECT_EQ(vector<string>({"a", "b"}), context.Get("key"));
+  // Written by another invocation.
+  kvstore_.store.Put("key", "c");
+  EXPECT_EQ(vector<string>({"a", "b"}), context.Get("key"));
+  EXPECT_TRUE(context.Remove("key"));
+  EXPECT_TRUE(context.Get("key").empty());
+  EXPECT_TRUE(context.Get("other").empty());
+  EXPECT_EQ(4, kvstore_.calls);
+  EXPECT_EQ(4, context.GetStats().remote_calls);
+  EXPECT_EQ(4, context.GetStats().saved_calls);
+  EXPECT_TRUE(context.Flush());
+  EXPECT_EQ(4, kvstore_.calls);
+}
+
+// Tests whether a multi-get only gets the keys not remembered yet, in a
+// single call, and sees the buffered writes.
+TEST_F(FazContextTest, MultiGetTest) {
+  kvstore_.Put("a", "1");
+  kvstore_.Put("b", "2");
+  kvstore_.Put("c", "3");
+  kvstore_.calls = 0;
+  FazContext context(&kvstore_, Options(true, true));
+  EXPECT_EQ(vector<string>({"1"}), context.Get("a"));
+  EXPECT_TRUE(context.Put("c", "4"));
+  EXPECT_EQ(vector<vector<string>>({{"1"}, {"2"}, {"3", "4"}, {}}),
+            context.MultiGet({"a", "b", "c", "d"}));
+  EXPECT_EQ(2, kvstore_.calls);
+  // All of them are remembered now.
+  EXPECT_EQ(vector<vector<string>>({{"3", "4"}, {"2"}}),
+            context.MultiGet({"c", "b"}));
+  EXPECT_EQ(2, kvstore_.calls);
+  EXPECT_EQ(2, context.GetStats().remote_calls);
+  EXPECT_EQ(5, context.GetStats().saved_calls);
+}
+
+// Tests whether a multi-get of more keys than allowed at once takes
+// several calls, still returning the values in order.
+TEST_F(FazContextTest, MaxMultiGetKeysTest) {
+  for (const char* key : {"a", "b", "c", "d", "e"}) {
+    kvstore_.Put(key, key);
+  }
+  kvstore_.calls = 0;
+  FazContext::Options options = Options(true, false);
+  options.max_multi_get_keys = 2;
+  FazContext context(&kvstore_, options);
+  EXPECT_EQ(vector<string>({"b"}), context.Get("b"));
+  EXPECT_EQ(vector<vector<string>>({{"a"}, {"b"}, {"c"}, {"d"}, {"e"}, {}}),
+            context.MultiGet({"a", "b", "c", "d", "e", "f"}));
+  // The five keys not remembered take three calls.
+  EXPECT_EQ(4, kvstore_.calls);
+  EXPECT_EQ(4, context.GetStats().remote_calls);
+  EXPECT_EQ(3, context.GetStats().saved_calls);
+}
+
+// Tests whether reads go to the KVStore each time without memoization.
+TEST_F(FazContextTest, NoMemoizationTest) {
+  FazContext context(&kvstore_, Options(false, false));
+  EXPECT_TRUE(context.Put("key", "a"));
+  EXPECT_EQ(vector<string>({"a"}), context.Get("key"));
+  kvstore_.store.Put("key", "b");
+  EXPECT_EQ(vector<string>({"a", "b"}), context.Get("key"));
+  EXPECT_EQ(3, kvstore_.calls);
+  EXPECT_EQ(0, context.GetStats().saved_calls);
+}
+
+// Tests whether buffered writes are only applied on flush, in a single
+// call and in order, while the invocation reads them right away.
+TEST_F(FazContextTest, BufferWritesTest) {
+  kvstore_.Put("removed", "a");
+  kvstore_.calls = 0;
+  for (bool memoize_reads : {true, false}) {
+    FazContext context(&kvstore_, Options(memoize_reads, true));
+    EXPECT_TRUE(context.Put("key", "a"));
+    EXPECT_TRUE(context.Put("key", "b"));
+    EXPECT_EQ(0, kvstore_.calls);
+    EXPECT_EQ(vector<string>({"a", "b"}), context.Get("key"));
+    EXPECT_TRUE(context.Remove("key"));
+    EXPECT_TRUE(context.Put("key", "c"));
+    EXPECT_EQ(vector<string>({"c"}), context.Get("key"));
+    EXPECT_TRUE(kvstore_.store.Get("key").empty());
+
+    int calls = kvstore_.calls;
+    EXPECT_TRUE(context.Flush());
+    EXPECT_EQ(calls + 1, kvstore_.calls);
+    EXPECT_EQ(vector<string>({"c"}), kvstore_.store.Get("key"));
+    // Four writes in a single call.
+    EXPECT_LE(3, context.GetStats().saved_calls);
+    EXPECT_TRUE(kvstore_.store.Remove("key"));
+    kvstore_.calls = 0;
+  }
+
+  FazContext context(&kvstore_, Options(true, true));
+  EXPECT_TRUE(context.Remove("removed"));
+  EXPECT_FALSE(context.Remove("removed"));
+  EXPECT_FALSE(context.Remove("unknown"));
+}
+
+// Tests whether writes of a context destroyed without a flush are
+// dropped, and a failed batch is reported.
+TEST_F(FazContextTest, FlushTest) {
+  {
+    FazContext context(&kvstore_, Options(true, true));
+    context.Put("dropped", "a");
+  }
+  EXPECT_TRUE(kvstore_.store.Get("dropped").empty());
+
+  kvstore_.store.Put("removed", "a");
+  FazContext context(&kvstore_, Options(true, true));
+  EXPECT_TRUE(context.Remove("removed"));
+  context.Put("key", "a");
+  // Removed by another invocation meanwhile.
+  kvstore_.store.Remove("removed");
+  EXPECT_FALSE(context.Flush());
+  EXPECT_EQ(vector<string>({"a"}), kvstore_.store.Get("key"));
+  // Nothing is left to flush.
+  EXPECT_TRUE(context.Flush());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
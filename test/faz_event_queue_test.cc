@@ -0,0 +1,190 @@
+#include "faz/faz_event_queue.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+#include <google/protobuf/any.pb.h>
+#include <gtest/gtest.h>
+
+#include "faz.pb.h"
+
+namespace fs = std::filesystem;
+
+using faz::EventRequest;
+using faz::EventResult;
+using faz::EventStatusReply;
+using google::protobuf::Any;
+using grpc::Status;
+using grpc::StatusCode;
+using std::string;
+using std::vector;
+
+// A test fixture handling the temporary file of the queue.
+class FazEventQueueTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    filename_ = fs::temp_directory_path() / "faz_event_queue_test.queue";
+    remove(filename_.c_str());
+  }
+
+  void TearDown() override {
+    remove(filename_.c_str());
+  }
+
+  // Returns an event of type 0 with the ordering key, whose payload
+  // holds the value.
+  static EventRequest MakeEvent(const string& key, const string& value) {
+    EventRequest request;
+    request.set_ordering_key(key);
+    request.mutable_payload()->set_value(value);
+    return request;
+  }
+
+  // Waits until the queue has no pending event, or a few seconds pass.
+  static void Drain(const FazEventQueue& queue) {
+    for (int i = 0; i < 5000 && queue.GetStats().pending > 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  string filename_;
+};
+
+// Tests whether queued events are executed and their outcomes looked up
+// by their IDs.
+TEST_F(FazEventQueueTest, EnqueueLookupTest) {
+  FazEventQueue queue(filename_);
+  ASSERT_TRUE(queue.Open());
+  EventResult result;
+  string ok_id;
+  string failed_id;
+  ASSERT_TRUE(queue.Enqueue("Echo", MakeEvent("", "hello"), &ok_id));
+  ASSERT_TRUE(queue.Enqueue("Fail", MakeEvent("", "hello"), &failed_id));
+  EXPECT_NE(ok_id, failed_id);
+  EXPECT_EQ(EventStatusReply::PENDING, queue.Lookup(ok_id, &result));
+  EXPECT_EQ(2, queue.GetStats().pending);
+
+  queue.Start(2, [](const string& function_name,
+                    const EventRequest& request, Any* out) {
+    if (function_name == "Fail") {
+      return Status(StatusCode::NOT_FOUND, "Failed.");
+    }
+    out->set_value(request.payload().value() + " back");
+    return Status::OK;
+  });
+  Drain(queue);
+  ASSERT_EQ(EventStatusReply::DONE, queue.Lookup(ok_id, &result));
+  EXPECT_EQ(StatusCode::OK, result.code());
+  EXPECT_EQ("hello back", result.payload().value());
+  EXPECT_EQ(ok_id, result.event_id());
+  ASSERT_EQ(EventStatusReply::DONE, queue.Lookup(failed_id, &result));
+  EXPECT_EQ(StatusCode::NOT_FOUND, result.code());
+  EXPECT_EQ("Failed.", result.message());
+  EXPECT_FALSE(result.has_payload());
+  EXPECT_EQ(EventStatusReply::UNKNOWN, queue.Lookup("unknown", &result));
+
+  FazEventQueue::Stats stats = queue.GetStats();
+  EXPECT_EQ(2, stats.enqueued);
+  EXPECT_EQ(2, stats.executed);
+  EXPECT_EQ(2, stats.enqueue_latency.count);
+  EXPECT_EQ(2, stats.queue_wait.count);
+}
+
+// Tests whether events with the same ordering key are executed one after
+// another in the order queued, while other events are not held back.
+TEST_F(FazEventQueueTest, OrderingTest) {
+  const int kNumEvents = 20;
+  FazEventQueue queue(filename_);
+  ASSERT_TRUE(queue.Open());
+  std::mutex mutex;
+  vector<string> executed;
+  int running_a = 0;
+  int max_running_a = 0;
+  queue.Start(4, [&](const string& function_name,
+                     const EventRequest& request, Any* out) {
+    bool is_a = request.ordering_key() == "a";
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running_a += is_a;
+      max_running_a = std::max(max_running_a, running_a);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::lock_guard<std::mutex> lock(mutex);
+    running_a -= is_a;
+    executed.push_back(request.payload().value());
+    return Status::OK;
+  });
+  string event_id;
+  for (int i = 0; i < kNumEvents; ++i) {
+    ASSERT_TRUE(queue.Enqueue("F", MakeEvent(i % 2 ? "a" : "",
+                                             std::to_string(i)), &event_id));
+  }
+  Drain(queue);
+  ASSERT_EQ(kNumEvents, executed.size());
+  EXPECT_EQ(1, max_running_a);
+  vector<string> executed_a;
+  for (const string& value : executed) {
+    if (std::stoi(value) % 2) {
+      executed_a.push_back(value);
+    }
+  }
+  EXPECT_EQ(vector<string>({"1", "3", "5", "7", "9", "11", "13", "15", "17",
+                            "19"}),
+            executed_a);
+}
+
+// Tests whether events left in the file are executed in order when the
+// queue is opened again, and outcomes are kept across openings up to the
+// given number.
+TEST_F(FazEventQueueTest, ReplayTest) {
+  vector<string> ids(3);
+  {
+    FazEventQueue queue(filename_);
+    ASSERT_TRUE(queue.Open());
+    for (int i = 0; i < 3; ++i) {
+      ASSERT_TRUE(queue.Enqueue("F", MakeEvent("k", std::to_string(i)),
+                                &ids[i]));
+    }
+  }
+  // A record cut short, as if the server crashed while writing it.
+  std::ofstream(filename_, std::ofstream::binary | std::ofstream::app)
+      << "Q\x05";
+
+  vector<string> executed;
+  {
+    FazEventQueue queue(filename_, 2);
+    ASSERT_TRUE(queue.Open());
+    EXPECT_EQ(3, queue.GetStats().pending);
+    queue.Start(1, [&executed](const string& function_name,
+                               const EventRequest& request, Any* out) {
+      executed.push_back(request.payload().value());
+      return Status::OK;
+    });
+    Drain(queue);
+    string event_id;
+    ASSERT_TRUE(queue.Enqueue("F", MakeEvent("", "new"), &event_id));
+    EXPECT_NE(ids[0], event_id);
+    Drain(queue);
+  }
+  EXPECT_EQ(vector<string>({"0", "1", "2", "new"}), executed);
+
+  FazEventQueue queue(filename_, 2);
+  ASSERT_TRUE(queue.Open());
+  EXPECT_EQ(0, queue.GetStats().pending);
+  EventResult result;
+  EXPECT_EQ(EventStatusReply::UNKNOWN, queue.Lookup(ids[1], &result));
+  EXPECT_EQ(EventStatusReply::DONE, queue.Lookup(ids[2], &result));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+#include "faz/faz_response_cache.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/any.pb.h>
+#include <gtest/gtest.h>
+
+using google::protobuf::Any;
+using std::string;
+using std::vector;
+
+// Returns a payload of the given type and value.
+Any MakePayload(const string& type_url, const string& value) {
+  Any payload;
+  payload.set_type_url(type_url);
+  payload.set_value(value);
+  return payload;
+}
+
+// Tests whether replies are keyed by event type and request payload.
+TEST(FazResponseCacheTest, LookupTest) {
+  FazResponseCache cache(1 << 20);
+  Any request = MakePayload("type/Request", "a");
+  string key = FazResponseCache::Key(1, request);
+  EXPECT_NE(key, FazResponseCache::Key(2, request));
+  EXPECT_NE(key, FazResponseCache::Key(
+      1, MakePayload("type/Request", "b")));
+
+  Any out;
+  EXPECT_FALSE(cache.Lookup(key, &out));
+  EXPECT_TRUE(cache.Insert(cache.Sequence(), key,
+                           MakePayload("type/Reply", "reply"), {"k"}));
+  ASSERT_TRUE(cache.Lookup(key, &out));
+  EXPECT_EQ("type/Reply", out.type_url());
+  EXPECT_EQ("reply", out.value());
+  EXPECT_FALSE(cache.Lookup(FazResponseCache::Key(2, request), &out));
+  EXPECT_EQ(1, cache.GetStats().size);
+  EXPECT_EQ(1, cache.GetStats().inserts);
+}
+
+// Tests whether writing a key drops the replies that read it, and only
+// those.
+TEST(FazResponseCacheTest, InvalidateTest) {
+  FazResponseCache cache(1 << 20);
+  Any reply = MakePayload("type/Reply", "reply");
+  ASSERT_TRUE(cache.Insert(cache.Sequence(), "ab", reply, {"a", "b", "a"}));
+  ASSERT_TRUE(cache.Insert(cache.Sequence(), "b", reply, {"b"}));
+  ASSERT_TRUE(cache.Insert(cache.Sequence(), "c", reply, {"c"}));
+  cache.Invalidate({"b", "d"});
+  Any out;
+  EXPECT_FALSE(cache.Lookup("ab", &out));
+  EXPECT_FALSE(cache.Lookup("b", &out));
+  EXPECT_TRUE(cache.Lookup("c", &out));
+  EXPECT_EQ(2, cache.GetStats().invalidations);
+  // The reply no longer depends on the other key it read.
+  ASSERT_TRUE(cache.Insert(cache.Sequence(), "b", reply, {"b"}));
+  cache.Invalidate({"a"});
+  EXPECT_TRUE(cache.Lookup("b", &out));
+
+  cache.Clear();
+  EXPECT_FALSE(cache.Lookup("c", &out));
+  EXPECT_EQ(0, cache.GetStats().size);
+  EXPECT_EQ(0, cache.GetStats().bytes);
+}
+
+// Tests whether a reply computed while a key it read was written is not
+// cached, unlike one computed after.
+TEST(FazResponseCacheTest, StaleInsertTest) {
+  FazResponseCache cache(1 << 20);
+  Any reply = MakePayload("type/Reply", "reply");
+  uint64_t before = cache.Sequence();
+  cache.Invalidate({"a"});
+  EXPECT_FALSE(cache.Insert(before, "a", reply, {"a"}));
+  EXPECT_TRUE(cache.Insert(before, "b", reply, {"b"}));
+  EXPECT_TRUE(cache.Insert(cache.Sequence(), "a", reply, {"a"}));
+  EXPECT_EQ(1, cache.GetStats().stale_inserts);
+
+  // Replies being computed while the cache is cleared are not cached.
+  before = cache.Sequence();
+  cache.Clear();
+  EXPECT_FALSE(cache.Insert(before, "c", reply, {"c"}));
+}
+
+// Tests whether the least recently used replies are evicted to stay
+// within the size, and too old ones are not used.
+TEST(FazResponseCacheTest, EvictionTest) {
+  Any reply = MakePayload("type/Reply", string(1000, 'x'));
+  FazResponseCache cache(3500);
+  EXPECT_FALSE(cache.Insert(cache.Sequence(), "huge",
+                            MakePayload("type/Reply", string(4000, 'x')),
+                            {}));
+  for (const char* key : {"a", "b", "c"}) {
+    ASSERT_TRUE(cache.Insert(cache.Sequence(), key, reply, {key}));
+  }
+  Any out;
+  EXPECT_TRUE(cache.Lookup("a", &out));
+  ASSERT_TRUE(cache.Insert(cache.Sequence(), "d", reply, {"d"}));
+  EXPECT_TRUE(cache.Lookup("a", &out));
+  EXPECT_FALSE(cache.Lookup("b", &out));
+  EXPECT_EQ(3, cache.GetStats().size);
+  EXPECT_GE(3500, cache.GetStats().bytes);
+  EXPECT_EQ(1, cache.GetStats().evictions);
+
+  FazResponseCache aging_cache(1 << 20, std::chrono::milliseconds(20));
+  ASSERT_TRUE(aging_cache.Insert(aging_cache.Sequence(), "a", reply, {}));
+  EXPECT_TRUE(aging_cache.Lookup("a", &out));
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_FALSE(aging_cache.Lookup("a", &out));
+  EXPECT_EQ(0, aging_cache.GetStats().size);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
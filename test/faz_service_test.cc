@@ -0,0 +1,627 @@
+#include "faz/faz_service.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+#include <gtest/gtest.h>
+
+#include "caw.pb.h"
+#include "caw/caw_client.h"
+#include "faz.pb.h"
+#include "kvstore/kvstore.h"
+
+using grpc::ServerContext;
+using grpc::Status;
+using grpc::StatusCode;
+using std::string;
+
+// A test fixture calling the handlers of a FazService over
+// an in-memory KVStore directly.
+class FazServiceTest : public ::testing::Test {
+ protected:
+  FazServiceTest()
+      : service_(std::unique_ptr<KVStoreInterface>(new KVStore)) {}
+
+  // Hooks the function with the event type and returns the status.
+  Status Hook(int event_type, const string& function) {
+    ServerContext context;
+    faz::HookRequest request;
+    request.set_event_type(event_type);
+    request.set_event_function(function);
+    faz::HookReply response;
+    return service_.hook(&context, &request, &response);
+  }
+
+  // Unhooks the event type and returns the status.
+  Status Unhook(int event_type) {
+    ServerContext context;
+    faz::UnhookRequest request;
+    request.set_event_type(event_type);
+    faz::UnhookReply response;
+    return service_.unhook(&context, &request, &response);
+  }
+
+  // Sends an event of the given type with the payload and returns
+  // the status.
+  Status Event(int event_type, const google::protobuf::Message& payload) {
+    ServerContext context;
+    faz::EventRequest request;
+    request.set_event_type(event_type);
+    request.mutable_payload()->PackFrom(payload);
+    faz::EventReply response;
+    return service_.event(&context, &request, &response);
+  }
+
+  FazService service_;
+};
+
+// Tests whether events run the function hooked with their type,
+// until it is unhooked.
+TEST_F(FazServiceTest, HookEventTest) {
+  caw::RegisteruserRequest request;
+  request.set_username("user");
+  EXPECT_EQ(StatusCode::NOT_FOUND, Event(0, request).error_code());
+  EXPECT_TRUE(Hook(0, "RegisterUser").ok());
+  EXPECT_TRUE(Event(0, request).ok());
+  EXPECT_EQ(StatusCode::ALREADY_EXISTS, Event(0, request).error_code());
+  EXPECT_TRUE(Unhook(0).ok());
+  EXPECT_EQ(StatusCode::NOT_FOUND, Event(0, request).error_code());
+  EXPECT_EQ(StatusCode::NOT_FOUND, Unhook(0).error_code());
+
+  EXPECT_EQ(StatusCode::NOT_FOUND, Hook(0, "Unknown").error_code());
+  EXPECT_EQ(StatusCode::INVALID_ARGUMENT, Hook(-1, "Caw").error_code());
+  EXPECT_EQ(StatusCode::INVALID_ARGUMENT,
+            Hook(FazService::kMaxEventTypes, "Caw").error_code());
+  EXPECT_EQ(StatusCode::NOT_FOUND,
+            Event(FazService::kMaxEventTypes, request).error_code());
+  EXPECT_EQ(StatusCode::NOT_FOUND, Unhook(-1).error_code());
+}
+
+// Tests whether events keep running (or not finding) their function
+// while it is hooked and unhooked concurrently.
+TEST_F(FazServiceTest, ConcurrentHookEventTest) {
+  const int kNumRounds = 2000;
+  caw::RegisteruserRequest register_request;
+  register_request.set_username("user");
+  ASSERT_TRUE(Hook(0, "RegisterUser").ok());
+  ASSERT_TRUE(Event(0, register_request).ok());
+
+  caw::ProfileRequest request;
+  request.set_username("user");
+  std::atomic<bool> stopped(false);
+  std::atomic<int> num_ok(0);
+  std::atomic<int> num_not_found(0);
+  std::vector<std::thread> event_threads;
+  for (int t = 0; t < 4; ++t) {
+    event_threads.emplace_back([&]() {
+      while (!stopped) {
+        Status status = Event(1, request);
+        if (status.ok()) {
+          ++num_ok;
+        } else {
+          EXPECT_EQ(StatusCode::NOT_FOUND, status.error_code());
+          ++num_not_found;
+        }
+      }
+    });
+  }
+  std::vector<std::thread> hook_threads;
+  for (int t = 0; t < 2; ++t) {
+    hook_threads.emplace_back([&]() {
+      for (int i = 0; i < kNumRounds; ++i) {
+        EXPECT_TRUE(Hook(1, "Profile").ok());
+        Unhook(1);
+        // Also keep hooking other event types.
+        EXPECT_TRUE(Hook(2 + i % 10, "Read").ok());
+        std::this_thread::yield();
+      }
+    });
+  }
+  for (auto& thread : hook_threads) {
+    thread.join();
+  }
+  ASSERT_TRUE(Hook(1, "Profile").ok());
+  // Let the events run at least once more with the function hooked.
+  while (num_ok == 0) {
+    std::this_thread::yield();
+  }
+  stopped = true;
+  for (auto& thread : event_threads) {
+    thread.join();
+  }
+  EXPECT_LT(0, num_ok);
+  EXPECT_TRUE(Event(1, request).ok());
+}
+
+// Tests whether a batch of events gets the outcome of each event in
+// order, whether executed concurrently or one after another.
+TEST_F(FazServiceTest, EventsTest) {
+  ASSERT_TRUE(Hook(0, "RegisterUser").ok());
+  ASSERT_TRUE(Hook(1, "Profile").ok());
+  for (bool sequential : {false, true}) {
+    string prefix = sequential ? "sequential" : "concurrent";
+    faz::EventsRequest request;
+    request.set_sequential(sequential);
+    for (int i = 0; i < 20; ++i) {
+      caw::RegisteruserRequest inner_request;
+      inner_request.set_username(prefix + std::to_string(i % 10));
+      faz::EventRequest* event = request.add_events();
+      event->set_event_type(0);
+      event->mutable_payload()->PackFrom(inner_request);
+    }
+    caw::ProfileRequest profile_request;
+    profile_request.set_username("unknown");
+    faz::EventRequest* event = request.add_events();
+    event->set_event_type(1);
+    event->mutable_payload()->PackFrom(profile_request);
+    request.add_events()->set_event_type(FazService::kMaxEventTypes);
+
+    ServerContext context;
+    faz::EventsReply response;
+    ASSERT_TRUE(service_.events(&context, &request, &response).ok());
+    ASSERT_EQ(22, response.results_size());
+    // Each user is registered exactly once.
+    for (int i = 0; i < 10; ++i) {
+      int first = response.results(i).code();
+      int second = response.results(i + 10).code();
+      EXPECT_EQ(StatusCode::OK, std::min(first, second));
+      EXPECT_EQ(StatusCode::ALREADY_EXISTS, std::max(first, second));
+      if (sequential) {
+        EXPECT_EQ(StatusCode::OK, first);
+      }
+    }
+    EXPECT_EQ(StatusCode::NOT_FOUND, response.results(20).code());
+    EXPECT_EQ(StatusCode::NOT_FOUND, response.results(21).code());
+    EXPECT_FALSE(response.results(21).message().empty());
+  }
+
+  ServerContext context;
+  faz::EventsRequest request;
+  faz::EventsReply response;
+  EXPECT_TRUE(service_.events(&context, &request, &response).ok());
+  EXPECT_EQ(0, response.results_size());
+}
+
+// Tests whether the KVStore calls of each event type are counted, along
+// with those saved by buffering writes.
+TEST_F(FazServiceTest, EventStatsTest) {
+  FazContext::Options options;
+  options.buffer_writes = true;
+  service_.SetContextOptions(options);
+  ASSERT_TRUE(Hook(0, "RegisterUser").ok());
+  ASSERT_TRUE(Hook(1, "Follow").ok());
+  caw::RegisteruserRequest register_request;
+  for (const char* username : {"a", "b"}) {
+    register_request.set_username(username);
+    ASSERT_TRUE(Event(0, register_request).ok());
+  }
+  caw::FollowRequest follow_request;
+  follow_request.set_username("a");
+  follow_request.set_to_follow("b");
+  ASSERT_TRUE(Event(1, follow_request).ok());
+
+  std::vector<FazService::EventStats> stats = service_.GetEventStats();
+  ASSERT_EQ(2, stats.size());
+  // Each registration gets the user, then writes it.
+  EXPECT_EQ(0, stats[0].event_type);
+  EXPECT_EQ(2, stats[0].events);
+  EXPECT_EQ(4, stats[0].remote_calls);
+  EXPECT_EQ(0, stats[0].saved_calls);
+  // Following gets both users and the pair, then writes three keys at once.
+  EXPECT_EQ(1, stats[1].event_type);
+  EXPECT_EQ(1, stats[1].events);
+  EXPECT_EQ(4, stats[1].remote_calls);
+  EXPECT_EQ(2, stats[1].saved_calls);
+}
+
+// Tests whether replies of read-only events are cached until a key they
+// read is written through the service, with hits counted per type.
+TEST_F(FazServiceTest, ResponseCacheTest) {
+  service_.EnableResponseCache(1 << 20);
+  ASSERT_TRUE(Hook(0, "RegisterUser").ok());
+  ASSERT_TRUE(Hook(1, "Follow").ok());
+  ASSERT_TRUE(Hook(2, "Profile").ok());
+  caw::RegisteruserRequest register_request;
+  for (const char* username : {"a", "b"}) {
+    register_request.set_username(username);
+    ASSERT_TRUE(Event(0, register_request).ok());
+  }
+  // Returns the followings of the user, through a Profile event.
+  auto followings = [this](const string& username) {
+    ServerContext context;
+    faz::EventRequest request;
+    request.set_event_type(2);
+    caw::ProfileRequest profile_request;
+    profile_request.set_username(username);
+    request.mutable_payload()->PackFrom(profile_request);
+    faz::EventReply response;
+    EXPECT_TRUE(service_.event(&context, &request, &response).ok());
+    caw::ProfileReply profile;
+    response.payload().UnpackTo(&profile);
+    return profile.following_size();
+  };
+  EXPECT_EQ(0, followings("a"));
+  EXPECT_EQ(0, followings("a"));
+  EXPECT_EQ(0, followings("b"));
+  caw::FollowRequest follow_request;
+  follow_request.set_username("a");
+  follow_request.set_to_follow("b");
+  ASSERT_TRUE(Event(1, follow_request).ok());
+  EXPECT_EQ(1, followings("a"));
+  EXPECT_EQ(1, followings("a"));
+
+  std::vector<FazService::EventStats> stats = service_.GetEventStats();
+  ASSERT_EQ(3, stats.size());
+  EXPECT_EQ(0, stats[0].cache_hits + stats[0].cache_misses);
+  EXPECT_EQ(2, stats[2].event_type);
+  EXPECT_EQ(3, stats[2].events);
+  EXPECT_EQ(2, stats[2].cache_hits);
+  EXPECT_EQ(3, stats[2].cache_misses);
+  // Both profiles read keys written by the follow.
+  EXPECT_EQ(2, service_.GetResponseCacheStats().invalidations);
+  EXPECT_EQ(1, service_.GetResponseCacheStats().size);
+
+  // Hooking an event type again drops all replies.
+  ASSERT_TRUE(Hook(2, "Profile").ok());
+  EXPECT_EQ(0, service_.GetResponseCacheStats().size);
+}
+
+// Tests whether each event type gets a lane of its own, with the limits
+// of its hook request or else those set for its function, kept when the
+// event type is hooked again.
+TEST_F(FazServiceTest, LaneTest) {
+  AdmissionController::MethodOptions read_options;
+  read_options.max_in_flight = 4;
+  read_options.weight = 3;
+  service_.SetLaneOptions("Read", read_options);
+  ASSERT_TRUE(Hook(0, "RegisterUser").ok());
+  ASSERT_TRUE(Hook(1, "Read").ok());
+  ServerContext context;
+  faz::HookRequest request;
+  request.set_event_type(2);
+  request.set_event_function("Read");
+  request.set_max_concurrency(2);
+  faz::HookReply response;
+  ASSERT_TRUE(service_.hook(&context, &request, &response).ok());
+  caw::RegisteruserRequest register_request;
+  register_request.set_username("a");
+  ASSERT_TRUE(Event(0, register_request).ok());
+
+  auto stats = service_.GetAdmissionStats();
+  ASSERT_EQ(3, stats.size());
+  EXPECT_EQ("event(0)", stats[0].name);
+  EXPECT_EQ(0, stats[0].options.max_in_flight);
+  EXPECT_EQ(1, stats[0].options.weight);
+  EXPECT_EQ(1, stats[0].admitted);
+  EXPECT_EQ(1, stats[0].queue_wait.count);
+  EXPECT_EQ("event(1)", stats[1].name);
+  EXPECT_EQ(4, stats[1].options.max_in_flight);
+  EXPECT_EQ(3, stats[1].options.weight);
+  EXPECT_EQ(2, stats[2].options.max_in_flight);
+  EXPECT_EQ(3, stats[2].options.weight);
+
+  // Hooked again, the event type keeps its lane with new limits.
+  ASSERT_TRUE(Hook(0, "Read").ok());
+  stats = service_.GetAdmissionStats();
+  ASSERT_EQ(3, stats.size());
+  EXPECT_EQ(4, stats[0].options.max_in_flight);
+  EXPECT_EQ(1, stats[0].admitted);
+}
+
+// An in-memory KVStore whose reads wait while it is closed.
+class GatedKVStore : public KVStoreInterface {
+ public:
+  bool Put(const string& key, const string& value) {
+    return store_.Put(key, value);
+  }
+
+  std::vector<string> Get(const string& key) const {
+    Wait();
+    return store_.Get(key);
+  }
+
+  bool Remove(const string& key) { return store_.Remove(key); }
+
+  // Sets whether reads wait.
+  void SetClosed(bool closed) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = closed;
+    }
+    cv_.notify_all();
+  }
+
+  // Number of reads waiting or done so far.
+  int reads() const { return reads_; }
+
+ private:
+  void Wait() const {
+    ++reads_;
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !closed_; });
+  }
+
+  KVStore store_;
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cv_;
+  bool closed_ = false;
+  mutable std::atomic<int> reads_{0};
+};
+
+// Tests whether identical read-only events arriving while one is executed
+// share its reply, unlike other events.
+TEST(FazServiceCollapseTest, CollapseReadsTest) {
+  auto* kvstore = new GatedKVStore;
+  FazService service{std::unique_ptr<KVStoreInterface>(kvstore)};
+  service.SetCollapseReads(true);
+  for (const auto& hook : {std::make_pair(0, "RegisterUser"),
+                           std::make_pair(1, "Profile")}) {
+    ServerContext context;
+    faz::HookRequest request;
+    request.set_event_type(hook.first);
+    request.set_event_function(hook.second);
+    faz::HookReply response;
+    ASSERT_TRUE(service.hook(&context, &request, &response).ok());
+  }
+  auto event = [&service](int event_type,
+                          const google::protobuf::Message& payload,
+                          caw::ProfileReply* reply) {
+    ServerContext context;
+    faz::EventRequest request;
+    request.set_event_type(event_type);
+    request.mutable_payload()->PackFrom(payload);
+    faz::EventReply response;
+    Status status = service.event(&context, &request, &response);
+    if (reply) {
+      response.payload().UnpackTo(reply);
+    }
+    return status;
+  };
+  caw::RegisteruserRequest register_request;
+  register_request.set_username("user");
+  ASSERT_TRUE(event(0, register_request, nullptr).ok());
+
+  const int kNumEvents = 4;
+  caw::ProfileRequest request;
+  request.set_username("user");
+  kvstore->SetClosed(true);
+  int reads = kvstore->reads();
+  std::vector<caw::ProfileReply> replies(kNumEvents);
+  std::vector<std::thread> threads;
+  threads.emplace_back([&]() {
+    EXPECT_TRUE(event(1, request, &replies[0]).ok());
+  });
+  // Let the first event wait on the KVStore before sending the others.
+  while (kvstore->reads() == reads) {
+    std::this_thread::yield();
+  }
+  for (int i = 1; i < kNumEvents; ++i) {
+    threads.emplace_back([&, i]() {
+      EXPECT_TRUE(event(1, request, &replies[i]).ok());
+    });
+  }
+  auto profile_stats = [&service]() {
+    for (const auto& stats : service.GetEventStats()) {
+      if (stats.event_type == 1) {
+        return stats;
+      }
+    }
+    return FazService::EventStats{1, 0, 0, 0, 0, 0, 0};
+  };
+  while (profile_stats().collapsed < kNumEvents - 1) {
+    std::this_thread::yield();
+  }
+  kvstore->SetClosed(false);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& reply : replies) {
+    EXPECT_EQ(replies[0].SerializeAsString(), reply.SerializeAsString());
+  }
+  EXPECT_EQ(1, profile_stats().events);
+  EXPECT_EQ(kNumEvents - 1, profile_stats().collapsed);
+
+  // Once done, events execute again, failing or not.
+  reads = kvstore->reads();
+  EXPECT_TRUE(event(1, request, nullptr).ok());
+  EXPECT_LT(reads, kvstore->reads());
+  EXPECT_EQ(2, profile_stats().events);
+  request.set_username("unknown");
+  EXPECT_EQ(StatusCode::NOT_FOUND, event(1, request, nullptr).error_code());
+}
+
+// Tests whether events of types hooked asynchronously are acknowledged
+// with an ID, executed in the background, and their outcomes looked up.
+TEST_F(FazServiceTest, AsyncHookTest) {
+  auto hook_async = [this](int event_type, const string& function) {
+    ServerContext context;
+    faz::HookRequest request;
+    request.set_event_type(event_type);
+    request.set_event_function(function);
+    request.set_async(true);
+    faz::HookReply response;
+    return service_.hook(&context, &request, &response);
+  };
+  auto event_status = [this](const string& event_id,
+                             faz::EventStatusReply* response) {
+    ServerContext context;
+    faz::EventStatusRequest request;
+    request.set_event_id(event_id);
+    return service_.event_status(&context, &request, response);
+  };
+  faz::EventStatusReply status_reply;
+  EXPECT_EQ(StatusCode::FAILED_PRECONDITION,
+            hook_async(0, "RegisterUser").error_code());
+  EXPECT_EQ(StatusCode::FAILED_PRECONDITION,
+            event_status("0", &status_reply).error_code());
+
+  string filename = testing::TempDir() + "faz_service_test.queue";
+  remove(filename.c_str());
+  ASSERT_TRUE(service_.EnableEventQueue(filename, 2));
+  ASSERT_TRUE(hook_async(0, "RegisterUser").ok());
+  ASSERT_TRUE(Hook(1, "Profile").ok());
+
+  ServerContext context;
+  faz::EventRequest request;
+  request.set_event_type(0);
+  request.set_ordering_key("user");
+  caw::RegisteruserRequest register_request;
+  register_request.set_username("user");
+  request.mutable_payload()->PackFrom(register_request);
+  faz::EventReply response;
+  ASSERT_TRUE(service_.event(&context, &request, &response).ok());
+  EXPECT_FALSE(response.event_id().empty());
+  EXPECT_TRUE(response.payload().value().empty());
+  faz::EventReply second_response;
+  ASSERT_TRUE(service_.event(&context, &request, &second_response).ok());
+
+  // The second registration runs after the first and fails.
+  for (int i = 0; i < 5000; ++i) {
+    ASSERT_TRUE(event_status(second_response.event_id(),
+                             &status_reply).ok());
+    if (status_reply.state() == faz::EventStatusReply::DONE) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(faz::EventStatusReply::DONE, status_reply.state());
+  EXPECT_EQ(StatusCode::ALREADY_EXISTS, status_reply.result().code());
+  ASSERT_TRUE(event_status(response.event_id(), &status_reply).ok());
+  ASSERT_EQ(faz::EventStatusReply::DONE, status_reply.state());
+  EXPECT_EQ(StatusCode::OK, status_reply.result().code());
+  ASSERT_TRUE(event_status("unknown", &status_reply).ok());
+  EXPECT_EQ(faz::EventStatusReply::UNKNOWN, status_reply.state());
+
+  caw::ProfileRequest profile_request;
+  profile_request.set_username("user");
+  EXPECT_TRUE(Event(1, profile_request).ok());
+  EXPECT_EQ(2, service_.GetEventQueueStats().executed);
+
+  // Once unhooked, events of the type run synchronously again.
+  ASSERT_TRUE(Unhook(0).ok());
+  ASSERT_TRUE(Hook(0, "RegisterUser").ok());
+  register_request.set_username("other");
+  EXPECT_TRUE(Event(0, register_request).ok());
+  EXPECT_EQ(2, service_.GetEventQueueStats().enqueued);
+  remove(filename.c_str());
+}
+
+// Tests whether queued events wait for an admission slot however long it
+// takes, rather than being shed like the events callers wait for.
+TEST(FazServiceAsyncTest, AsyncAdmissionTest) {
+  auto* kvstore = new GatedKVStore;
+  FazService service{std::unique_ptr<KVStoreInterface>(kvstore)};
+  AdmissionController::Options admission_options;
+  admission_options.max_in_flight = 1;
+  admission_options.queue_budget = std::chrono::milliseconds(1);
+  service.SetAdmissionOptions(admission_options);
+  string filename = testing::TempDir() + "faz_service_test.queue";
+  remove(filename.c_str());
+  ASSERT_TRUE(service.EnableEventQueue(filename, 1));
+  for (int event_type : {0, 1}) {
+    ServerContext context;
+    faz::HookRequest request;
+    request.set_event_type(event_type);
+    request.set_event_function("RegisterUser");
+    request.set_async(event_type == 1);
+    faz::HookReply response;
+    ASSERT_TRUE(service.hook(&context, &request, &response).ok());
+  }
+  auto event = [&service](int event_type, const string& username,
+                          faz::EventReply* response) {
+    ServerContext context;
+    faz::EventRequest request;
+    request.set_event_type(event_type);
+    caw::RegisteruserRequest payload;
+    payload.set_username(username);
+    request.mutable_payload()->PackFrom(payload);
+    return service.event(&context, &request, response);
+  };
+
+  // Hold the only slot with an event waiting on the KVStore.
+  kvstore->SetClosed(true);
+  faz::EventReply response;
+  std::thread holder([&]() { EXPECT_TRUE(event(0, "a", &response).ok()); });
+  while (kvstore->reads() == 0) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(StatusCode::RESOURCE_EXHAUSTED,
+            event(0, "b", &response).error_code());
+  faz::EventReply queued_response;
+  ASSERT_TRUE(event(1, "c", &queued_response).ok());
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  kvstore->SetClosed(false);
+  holder.join();
+
+  faz::EventStatusReply status_reply;
+  for (int i = 0; i < 5000; ++i) {
+    ServerContext context;
+    faz::EventStatusRequest request;
+    request.set_event_id(queued_response.event_id());
+    ASSERT_TRUE(service.event_status(&context, &request,
+                                     &status_reply).ok());
+    if (status_reply.state() == faz::EventStatusReply::DONE) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(faz::EventStatusReply::DONE, status_reply.state());
+  EXPECT_EQ(StatusCode::OK, status_reply.result().code());
+  remove(filename.c_str());
+}
+
+// Tests the batch methods of the Caw client against a Faz server.
+TEST_F(FazServiceTest, CawClientBatchTest) {
+  grpc::ServerBuilder builder;
+  builder.RegisterService(&service_);
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+  CawClient client(server->InProcessChannel(grpc::ChannelArguments()));
+  ASSERT_TRUE(client.HookAll());
+
+  std::vector<string> usernames;
+  for (size_t i = 0; i < CawClient::kMaxBatchSize + 10; ++i) {
+    usernames.push_back("user" + std::to_string(i));
+  }
+  std::vector<bool> registered = client.RegisterUsers(usernames);
+  ASSERT_EQ(usernames.size(), registered.size());
+  EXPECT_EQ(usernames.size(),
+            std::count(registered.begin(), registered.end(), true));
+  EXPECT_EQ(std::vector<bool>({false, true}),
+            client.RegisterUsers({"user0", "other"}));
+
+  std::vector<bool> followed = client.FollowAll(
+      "other", {"user1", "user2", "unknown"});
+  EXPECT_EQ(std::vector<bool>({true, true, false}), followed);
+
+  auto caws = client.Caws("other", {"first", "second"});
+  ASSERT_EQ(2, caws.size());
+  ASSERT_TRUE(caws[0].has_value());
+  ASSERT_TRUE(caws[1].has_value());
+  EXPECT_EQ("first", caws[0]->text());
+  EXPECT_EQ("second", caws[1]->text());
+
+  auto profiles = client.Profiles({"other", "user1", "unknown"});
+  ASSERT_EQ(3, profiles.size());
+  ASSERT_TRUE(profiles[0].has_value());
+  EXPECT_EQ(2, profiles[0]->following_size());
+  ASSERT_TRUE(profiles[1].has_value());
+  EXPECT_EQ(1, profiles[1]->followers_size());
+  EXPECT_FALSE(profiles[2].has_value());
+  server->Shutdown();
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,71 @@
+#include "common/histogram.h"
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using std::thread;
+using std::vector;
+
+// Tests whether each value falls into a bucket whose lower bound is
+// at most the value and within 1/16 of it.
+TEST(HistogramTest, BucketTest) {
+  for (uint64_t value : {0, 1, 15, 16, 17, 31, 32, 100, 1000, 123456789}) {
+    size_t bucket = Histogram::BucketFor(value);
+    uint64_t lower = Histogram::BucketLowerBound(bucket);
+    EXPECT_LE(lower, value) << "value " << value;
+    EXPECT_LE(value - lower, value / 16) << "value " << value;
+    EXPECT_GT(Histogram::BucketLowerBound(bucket + 1), value)
+        << "value " << value;
+  }
+  // Values too large are counted in the last bucket.
+  EXPECT_EQ(Histogram::kNumBuckets - 1, Histogram::BucketFor(UINT64_MAX));
+}
+
+// Tests the count, mean, maximum and percentiles of recorded values.
+TEST(HistogramTest, PercentileTest) {
+  Histogram histogram;
+  EXPECT_EQ(0, histogram.Snapshot().Percentile(50));
+  for (uint64_t value = 1; value <= 10000; ++value) {
+    histogram.Record(value);
+  }
+  HistogramSnapshot snapshot = histogram.Snapshot();
+  EXPECT_EQ(10000, snapshot.count);
+  EXPECT_DOUBLE_EQ(5000.5, snapshot.Mean());
+  EXPECT_EQ(10000, snapshot.max);
+  for (double percentile : {50.0, 90.0, 99.0, 99.9}) {
+    double expected = percentile * 100;
+    EXPECT_NEAR(expected, snapshot.Percentile(percentile), expected / 16)
+        << "percentile " << percentile;
+  }
+  EXPECT_EQ(10000, snapshot.Percentile(100));
+}
+
+// Tests whether values recorded concurrently are all counted.
+TEST(HistogramTest, ConcurrentRecordTest) {
+  Histogram histogram;
+  int num_threads = 32;
+  int num_values = 10000;
+  vector<thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&histogram, num_values, i]() {
+      for (int j = 0; j < num_values; ++j) {
+        histogram.Record(i);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  HistogramSnapshot snapshot = histogram.Snapshot();
+  EXPECT_EQ(num_threads * num_values, snapshot.count);
+  EXPECT_EQ(num_values * (num_threads - 1) * num_threads / 2, snapshot.sum);
+  EXPECT_EQ(num_threads - 1, snapshot.max);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+
+#include "kvstore/kvstore_client.h"
+#include "kvstore/kvstore_service.h"
+
+DEFINE_int32(port, 50011, "Port number for the benchmarked kvstore service.");
+DEFINE_int32(iterations, 50, "Number of gets to time for each setting.");
+DEFINE_int32(value_size, 16, "Number of bytes of each stored value.");
+DEFINE_string(unix_socket, "/tmp/kvstore_benchmark.sock", "Path of the Unix "
+              "domain socket for the benchmarked kvstore service.");
+DEFINE_int32(calls, 2000, "Number of calls to time for each transport.");
+DEFINE_int32(threads, 16, "Number of threads getting keys concurrently, with "
+             "a stream per get against pipelined streams.");
+DEFINE_int32(fanout, 100, "Number of keys to get at once, one after another "
+             "against all in flight.");
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// Number of values stored under each benchmarked key.
+const vector<int> kListSizes = {1, 100, 100000};
+
+// Returns the key under which `list_size` values are stored.
+string ListKey(int list_size) {
+  return "list." + std::to_string(list_size);
+}
+
+// Stores `list_size` values under `ListKey(list_size)` for each list size.
+void Populate(KVStoreClient& client) {
+  for (int list_size : kListSizes) {
+    vector<KVMutation> mutations(
+        list_size, {KVMutation::kPut, ListKey(list_size),
+                    string(FLAGS_value_size, 'v')});
+    client.Write(mutations);
+  }
+}
+
+// Gets the list of the given size `FLAGS_iterations` times and
+// prints the mean and minimum latency.
+void Run(KVStoreClient& client, const string& mode, int list_size) {
+  using Clock = std::chrono::steady_clock;
+  double total_us = 0;
+  double min_us = 0;
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    auto start = Clock::now();
+    size_t num_values = client.Get(ListKey(list_size)).size();
+    double us = std::chrono::duration<double, std::micro>(
+        Clock::now() - start).count();
+    if (num_values != static_cast<size_t>(list_size)) {
+      LOG(FATAL) << "Got " << num_values << " values, expected " << list_size;
+    }
+    total_us += us;
+    min_us = i == 0 ? us : std::min(min_us, us);
+  }
+  cout << std::left << std::setw(10) << mode
+       << std::setw(10) << list_size
+       << std::setw(14) << total_us / FLAGS_iterations
+       << std::setw(14) << min_us << endl;
+}
+
+// Makes `FLAGS_calls` calls of `Put()` and of `Get()` of a single value
+// through the client, and prints the mean latency per call of each.
+void RunCalls(KVStoreClient& client, const string& transport) {
+  using Clock = std::chrono::steady_clock;
+  string value(FLAGS_value_size, 'v');
+  auto start = Clock::now();
+  for (int i = 0; i < FLAGS_calls; ++i) {
+    if (!client.Put("transport." + transport, value)) {
+      LOG(FATAL) << "Failed to put over " << transport;
+    }
+  }
+  double put_us = std::chrono::duration<double, std::micro>(
+      Clock::now() - start).count() / FLAGS_calls;
+  start = Clock::now();
+  for (int i = 0; i < FLAGS_calls; ++i) {
+    client.Get(ListKey(1));
+  }
+  double get_us = std::chrono::duration<double, std::micro>(
+      Clock::now() - start).count() / FLAGS_calls;
+  cout << std::left << std::setw(12) << transport
+       << std::setw(14) << put_us
+       << std::setw(14) << get_us << endl;
+}
+
+// Gets `FLAGS_fanout` keys one after another, and then all of them at
+// once through `GetAsync()`, `FLAGS_iterations` times each, and prints
+// the mean latency of getting all keys.
+void RunFanOut(KVStoreClient& client) {
+  using Clock = std::chrono::steady_clock;
+  vector<string> keys;
+  for (int i = 0; i < FLAGS_fanout; ++i) {
+    keys.push_back("fanout." + std::to_string(i));
+    client.Put(keys.back(), string(FLAGS_value_size, 'v'));
+  }
+  double sync_us = 0;
+  double async_us = 0;
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    auto start = Clock::now();
+    for (const string& key : keys) {
+      client.Get(key);
+    }
+    auto middle = Clock::now();
+    vector<std::future<vector<string>>> gets;
+    for (const string& key : keys) {
+      gets.push_back(client.GetAsync(key));
+    }
+    for (auto& get : gets) {
+      get.get();
+    }
+    sync_us += std::chrono::duration<double, std::micro>(
+        middle - start).count();
+    async_us += std::chrono::duration<double, std::micro>(
+        Clock::now() - middle).count();
+  }
+  cout << std::left << std::setw(12) << "sequential"
+       << std::setw(14) << sync_us / FLAGS_iterations << endl
+       << std::setw(12) << "async"
+       << std::setw(14) << async_us / FLAGS_iterations << endl;
+}
+
+// Makes `FLAGS_threads` threads share the client to make `FLAGS_calls`
+// calls of `Get()` of a single value in total, and prints the number of
+// calls per second.
+void RunConcurrentGets(KVStoreClient& client, const string& mode) {
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  vector<std::thread> threads;
+  for (int t = 0; t < FLAGS_threads; ++t) {
+    threads.emplace_back([&client]() {
+      for (int i = 0; i < FLAGS_calls / FLAGS_threads; ++i) {
+        client.Get(ListKey(1));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  cout << std::left << std::setw(12) << mode
+       << std::setw(14) << FLAGS_calls / FLAGS_threads * FLAGS_threads / seconds
+       << endl;
+}
+
+// Benchmarks `KVStoreClient::Get()` over a local kvstore service, with
+// one reply per value against replies packed into chunks, and the latency
+// of single calls over TCP, a Unix domain socket and an in-process channel,
+// of getting many keys one after another against all at once, and the
+// throughput of concurrent gets with a stream each against pipelined.
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::string server_address("localhost:" + std::to_string(FLAGS_port));
+  KVStoreService service;
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+  builder.AddListeningPort("unix:" + FLAGS_unix_socket,
+                           grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+
+  auto channel = grpc::CreateChannel(
+      server_address, grpc::InsecureChannelCredentials());
+  KVStoreClient unchunked_client(channel, 0);
+  KVStoreClient chunked_client(channel);
+  Populate(chunked_client);
+
+  cout << std::left << std::setw(10) << "mode"
+       << std::setw(10) << "values"
+       << std::setw(14) << "mean (us)"
+       << std::setw(14) << "min (us)" << endl;
+  for (int list_size : kListSizes) {
+    Run(unchunked_client, "single", list_size);
+    Run(chunked_client, "chunked", list_size);
+  }
+
+  KVStoreClient unix_client(grpc::CreateChannel(
+      "unix:" + FLAGS_unix_socket, grpc::InsecureChannelCredentials()));
+  KVStoreClient inprocess_client(
+      server->InProcessChannel(grpc::ChannelArguments()));
+  cout << endl << std::left << std::setw(12) << "transport"
+       << std::setw(14) << "put (us)"
+       << std::setw(14) << "get (us)" << endl;
+  RunCalls(chunked_client, "tcp");
+  RunCalls(unix_client, "unix");
+  RunCalls(inprocess_client, "inprocess");
+
+  cout << endl << std::left << std::setw(12) << "fanout"
+       << std::setw(14) << "mean (us)" << endl;
+  RunFanOut(chunked_client);
+
+  cout << endl << std::left << std::setw(12) << "concurrent"
+       << std::setw(14) << "gets/s" << endl;
+  RunConcurrentGets(chunked_client, "per-stream");
+  {
+    // Destroyed before the server shuts down, which waits for the
+    // streams of the client to be closed.
+    KVStoreClient pipelined_client(channel);
+    pipelined_client.EnablePipelining(4);
+    RunConcurrentGets(pipelined_client, "pipelined");
+  }
+
+  server->Shutdown();
+  return 0;
+}
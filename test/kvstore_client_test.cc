@@ -0,0 +1,342 @@
+#include "kvstore/kvstore_client.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+#include <gtest/gtest.h>
+
+#include "kvstore/kvstore_cache.h"
+#include "kvstore/kvstore_client_pool.h"
+#include "kvstore/kvstore_replica.h"
+#include "kvstore/kvstore_service.h"
+
+using std::string;
+using std::vector;
+
+// Test fixture running a KVStore service reachable through
+// in-process channels.
+class KVStoreClientTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    grpc::ServerBuilder builder;
+    builder.RegisterService(&service_);
+    server_ = builder.BuildAndStart();
+  }
+
+  void TearDown() override {
+    server_->Shutdown();
+  }
+
+  // Returns a new channel to the service.
+  std::shared_ptr<grpc::Channel> NewChannel() {
+    return server_->InProcessChannel(grpc::ChannelArguments());
+  }
+
+  KVStoreService service_;
+  std::unique_ptr<grpc::Server> server_;
+};
+
+// Tests whether the cache evicts the least recently used key.
+TEST(KVStoreCacheTest, EvictionTest) {
+  KVStoreCache cache(2);
+  KVStoreCache::Entry entry;
+  cache.Insert("k1", {{"v1"}, 1, 1});
+  cache.Insert("k2", {{"v2"}, 1, 2});
+  ASSERT_TRUE(cache.Lookup("k1", entry));
+  cache.Insert("k3", {{"v3"}, 1, 3});
+  EXPECT_TRUE(cache.Lookup("k1", entry));
+  EXPECT_EQ(vector<string>{"v1"}, entry.values);
+  EXPECT_FALSE(cache.Lookup("k2", entry));
+  EXPECT_TRUE(cache.Lookup("k3", entry));
+  cache.Erase("k3");
+  EXPECT_FALSE(cache.Lookup("k3", entry));
+  EXPECT_EQ(1, cache.GetStats().size);
+}
+
+// Tests whether a client without cache still works as before.
+TEST_F(KVStoreClientTest, NoCacheTest) {
+  KVStoreClient client(NewChannel());
+  EXPECT_TRUE(client.Put("k1", "v1"));
+  EXPECT_TRUE(client.Put("k1", "v2"));
+  EXPECT_EQ((vector<string>{"v1", "v2"}), client.Get("k1"));
+  EXPECT_TRUE(client.Get("k2").empty());
+  EXPECT_TRUE(client.Remove("k1"));
+  EXPECT_FALSE(client.Remove("k1"));
+  EXPECT_EQ(0, client.GetCacheStats().misses);
+}
+
+// Tests whether cached values are revalidated, and refetched once
+// another client changes them.
+TEST_F(KVStoreClientTest, RevalidationTest) {
+  KVStoreClient client(NewChannel());
+  KVStoreClient other_client(NewChannel());
+  client.EnableCache(16);
+  other_client.Put("k1", "v1");
+  EXPECT_EQ(vector<string>{"v1"}, client.Get("k1"));
+  EXPECT_EQ(vector<string>{"v1"}, client.Get("k1"));
+  EXPECT_TRUE(client.Get("k2").empty());
+  EXPECT_TRUE(client.Get("k2").empty());
+  other_client.Put("k1", "v2");
+  other_client.Put("k2", "v3");
+  EXPECT_EQ((vector<string>{"v1", "v2"}), client.Get("k1"));
+  EXPECT_EQ(vector<string>{"v3"}, client.Get("k2"));
+  auto stats = client.GetCacheStats();
+  EXPECT_EQ(0, stats.hits);
+  EXPECT_EQ(2, stats.revalidations);
+  EXPECT_EQ(4, stats.misses);
+  EXPECT_EQ(2, stats.size);
+}
+
+// Tests whether immutable keys are served without asking the service
+// once they have values, and writes through the client invalidate them.
+TEST_F(KVStoreClientTest, ImmutablePrefixTest) {
+  KVStoreClient client(NewChannel());
+  KVStoreClient other_client(NewChannel());
+  client.EnableCache(16, {"caw."});
+  EXPECT_TRUE(client.Get("caw.1").empty());
+  other_client.Put("caw.1", "v1");
+  EXPECT_EQ(vector<string>{"v1"}, client.Get("caw.1"));
+  // Not seen, since the key is assumed immutable.
+  other_client.Put("caw.1", "v2");
+  EXPECT_EQ(vector<string>{"v1"}, client.Get("caw.1"));
+  auto stats = client.GetCacheStats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+  // Seen, since the client changed the key itself.
+  client.Put("caw.1", "v3");
+  EXPECT_EQ((vector<string>{"v1", "v2", "v3"}), client.Get("caw.1"));
+  client.Write({{KVMutation::kRemove, "caw.1", ""}});
+  EXPECT_TRUE(client.Get("caw.1").empty());
+}
+
+// Tests whether many asynchronous calls can be in flight at once,
+// through both futures and callbacks.
+TEST_F(KVStoreClientTest, AsyncTest) {
+  KVStoreClient client(NewChannel());
+  const int kNumKeys = 100;
+  vector<std::future<bool>> puts;
+  for (int i = 0; i < kNumKeys; ++i) {
+    puts.push_back(client.PutAsync("k" + std::to_string(i), "v"));
+  }
+  for (auto& put : puts) {
+    EXPECT_TRUE(put.get());
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  int num_done = 0;
+  for (int i = 0; i < kNumKeys; ++i) {
+    client.GetAsync("k" + std::to_string(i),
+                    [&](const grpc::Status& status, vector<string> values) {
+      EXPECT_TRUE(status.ok());
+      EXPECT_EQ(vector<string>{"v"}, values);
+      std::lock_guard<std::mutex> lock(mutex);
+      ++num_done;
+      cv.notify_one();
+    });
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&]() { return num_done == kNumKeys; });
+  lock.unlock();
+
+  EXPECT_TRUE(client.RemoveAsync("k0").get());
+  EXPECT_FALSE(client.RemoveAsync("k0").get());
+  EXPECT_TRUE(client.GetAsync("k0").get().empty());
+
+  // Gets many keys at once, with their values in order.
+  vector<string> keys = {"k1", "k0", "k2", "k1"};
+  EXPECT_EQ(vector<vector<string>>({{"v"}, {}, {"v"}, {"v"}}),
+            client.MultiGet(keys));
+  EXPECT_EQ(vector<vector<string>>({{}}), client.MultiGet({"k0"}));
+}
+
+// Tests whether asynchronous calls fail once past their deadline
+// or cancelled.
+TEST_F(KVStoreClientTest, DeadlineAndCancellationTest) {
+  KVStoreClient client(NewChannel());
+  KVCallOptions options;
+  options.deadline = std::chrono::system_clock::now() - std::chrono::seconds(1);
+  std::promise<grpc::StatusCode> code;
+  client.GetAsync("k1", [&](const grpc::Status& status, vector<string>) {
+    code.set_value(status.error_code());
+  }, options);
+  EXPECT_EQ(grpc::StatusCode::DEADLINE_EXCEEDED, code.get_future().get());
+
+  options = KVCallOptions();
+  options.cancellation = std::make_shared<KVCancellation>();
+  options.cancellation->Cancel();
+  EXPECT_FALSE(client.PutAsync("k1", "v1", options).get());
+  EXPECT_TRUE(client.PutAsync("k1", "v1").get());
+  EXPECT_EQ(vector<string>{"v1"}, client.Get("k1"));
+}
+
+// Tests whether asynchronous gets go through the cache.
+TEST_F(KVStoreClientTest, AsyncCacheTest) {
+  KVStoreClient client(NewChannel());
+  client.EnableCache(16, {"caw."});
+  EXPECT_TRUE(client.PutAsync("caw.1", "v1").get());
+  EXPECT_EQ(vector<string>{"v1"}, client.GetAsync("caw.1").get());
+  EXPECT_EQ(vector<string>{"v1"}, client.GetAsync("caw.1").get());
+  EXPECT_TRUE(client.PutAsync("k1", "v1").get());
+  EXPECT_EQ(vector<string>{"v1"}, client.GetAsync("k1").get());
+  EXPECT_EQ(vector<string>{"v1"}, client.GetAsync("k1").get());
+  auto stats = client.GetCacheStats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(1, stats.revalidations);
+  EXPECT_EQ(2, stats.misses);
+}
+
+// Tests whether the pool spreads calls over its clients, which all
+// share a single cache.
+TEST_F(KVStoreClientTest, PoolTest) {
+  vector<std::unique_ptr<KVStoreClient>> clients;
+  clients.emplace_back(new KVStoreClient(NewChannel()));
+  clients.emplace_back(new KVStoreClient(NewChannel()));
+  KVStoreClientPool pool(std::move(clients));
+  pool.EnableCache(16);
+  EXPECT_TRUE(pool.Put("k1", "v1"));
+  EXPECT_EQ(vector<string>{"v1"}, pool.Get("k1"));
+  EXPECT_EQ(vector<string>{"v1"}, pool.Get("k1"));
+  EXPECT_EQ((vector<bool>{true, true}),
+            pool.Write({{KVMutation::kPut, "k2", "v2"},
+                        {KVMutation::kRemove, "k1", ""}}));
+  auto client_stats = pool.GetClientStats();
+  ASSERT_EQ(2, client_stats.size());
+  for (const auto& stats : client_stats) {
+    EXPECT_EQ(2, stats.calls);
+    EXPECT_EQ(0, stats.outstanding);
+  }
+  auto cache_stats = pool.GetCacheStats();
+  EXPECT_EQ(1, cache_stats.revalidations);
+  EXPECT_EQ(1, cache_stats.misses);
+  EXPECT_EQ(0, cache_stats.size);
+}
+
+// Tests whether gets from many threads pipelined over a few streams
+// each get their own values, with and without chunks and the cache.
+TEST_F(KVStoreClientTest, PipelineTest) {
+  KVStoreClient writer(NewChannel());
+  const int kNumKeys = 20;
+  for (int i = 0; i < kNumKeys; ++i) {
+    // Key i has i values.
+    for (int j = 0; j < i; ++j) {
+      writer.Put("k" + std::to_string(i), std::to_string(j));
+    }
+  }
+  KVStoreClient chunked_client(NewChannel());
+  KVStoreClient unchunked_client(NewChannel(), 0);
+  KVStoreClient cached_client(NewChannel());
+  chunked_client.EnablePipelining(2);
+  unchunked_client.EnablePipelining(2);
+  cached_client.EnablePipelining(2);
+  cached_client.EnableCache(kNumKeys);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&]() {
+      for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < kNumKeys; ++i) {
+          vector<string> expected;
+          for (int j = 0; j < i; ++j) {
+            expected.push_back(std::to_string(j));
+          }
+          string key = "k" + std::to_string(i);
+          EXPECT_EQ(expected, chunked_client.Get(key));
+          EXPECT_EQ(expected, unchunked_client.Get(key));
+          EXPECT_EQ(expected, cached_client.Get(key));
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_LT(0, cached_client.GetCacheStats().revalidations);
+}
+
+// Tests whether pipelined gets are admitted one by one rather than per
+// stream, so that more streams than the get limit all get served.
+TEST_F(KVStoreClientTest, PipelineAdmissionTest) {
+  AdmissionController::Options options;
+  options.max_in_flight_per_method = 1;
+  // Long enough for any get to find the slot free, but not a stream that
+  // holds the slot for as long as it is open.
+  options.queue_budget = std::chrono::seconds(5);
+  service_.SetAdmissionOptions(options);
+  KVStoreClient writer(NewChannel());
+  writer.Put("k", "v");
+  KVStoreClient client(NewChannel());
+  client.EnablePipelining(4);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&client]() {
+      for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ(vector<string>({"v"}), client.Get("k"));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// A primary whose log holds a complete change followed by a corrupted one,
+// counting how many times replicas connect to it.
+class CorruptedPrimary : public kvstore::KeyValueStore::Service {
+ public:
+  grpc::Status replicate(
+      grpc::ServerContext* context, const kvstore::ReplicateRequest* request,
+      grpc::ServerWriter<kvstore::ReplicateReply>* writer) override {
+    ++num_calls;
+    // A put of "k" to "v", then a change of an unknown type.
+    const string log("\x00\x01k\x01v\x07garbage", 13);
+    kvstore::ReplicateReply reply;
+    reply.set_data(log.substr(request->offset()));
+    reply.set_log_size(log.size());
+    writer->Write(reply);
+    // Keep the stream open until the replica gives up on it.
+    while (!context->IsCancelled()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return grpc::Status::CANCELLED;
+  }
+
+  std::atomic<int> num_calls{0};
+};
+
+// Tests whether a replica applies the changes before a corrupted one and
+// then reconnects from there, instead of waiting for the change to complete.
+TEST(KVStoreReplicaTest, CorruptedLogTest) {
+  CorruptedPrimary primary;
+  grpc::ServerBuilder builder;
+  builder.RegisterService(&primary);
+  auto server = builder.BuildAndStart();
+  KVStore store;
+  {
+    KVStoreReplica replica(
+        server->InProcessChannel(grpc::ChannelArguments()), &store);
+    for (int i = 0; i < 5000 && primary.num_calls < 2; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  server->Shutdown();
+  EXPECT_LE(2, primary.num_calls);
+  EXPECT_EQ(vector<string>({"v"}), store.Get("k"));
+  EXPECT_EQ(1, store.Size());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,213 @@
+#include "kvstore/kvstore_sharded_client.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "common/tracing.h"
+#include "kvstore/hash_ring.h"
+#include "kvstore/kvstore.h"
+
+using std::string;
+using std::vector;
+
+// Number of keys used to check how keys are spread over shards.
+const int kNumKeys = 10000;
+
+// Returns the i-th key used to check how keys are spread over shards.
+string Key(int i) {
+  return "user." + std::to_string(i);
+}
+
+// Returns a HashRing with the given number of nodes.
+HashRing MakeRing(size_t num_nodes) {
+  HashRing ring;
+  for (size_t node = 0; node < num_nodes; ++node) {
+    ring.AddNode("localhost:" + std::to_string(50001 + node));
+  }
+  return ring;
+}
+
+// Tests whether keys are spread evenly over nodes.
+TEST(HashRingTest, BalanceTest) {
+  size_t num_nodes = 4;
+  HashRing ring = MakeRing(num_nodes);
+  vector<int> counts(num_nodes, 0);
+  for (int i = 0; i < kNumKeys; ++i) {
+    ++counts[ring.NodeFor(Key(i))];
+  }
+  for (size_t node = 0; node < num_nodes; ++node) {
+    // Each node should get its fair share of keys, give or take 30%.
+    EXPECT_GT(counts[node], kNumKeys / num_nodes * 0.7) << "node " << node;
+    EXPECT_LT(counts[node], kNumKeys / num_nodes * 1.3) << "node " << node;
+  }
+}
+
+// Tests whether adding a node only moves a minimal set of keys,
+// all of them to the new node.
+TEST(HashRingTest, AddNodeTest) {
+  size_t num_nodes = 4;
+  HashRing old_ring = MakeRing(num_nodes);
+  HashRing new_ring = MakeRing(num_nodes + 1);
+  int num_moved = 0;
+  for (int i = 0; i < kNumKeys; ++i) {
+    size_t old_node = old_ring.NodeFor(Key(i));
+    size_t new_node = new_ring.NodeFor(Key(i));
+    if (old_node != new_node) {
+      EXPECT_EQ(num_nodes, new_node);
+      ++num_moved;
+    }
+  }
+  // About 1/5 of the keys should move, give or take 30%.
+  EXPECT_GT(num_moved, kNumKeys / (num_nodes + 1) * 0.7);
+  EXPECT_LT(num_moved, kNumKeys / (num_nodes + 1) * 1.3);
+}
+
+// Tests whether nodes are placed by name rather than by order.
+TEST(HashRingTest, NodeOrderTest) {
+  HashRing ring1, ring2;
+  ring1.AddNode("a");
+  ring1.AddNode("b");
+  ring2.AddNode("b");
+  ring2.AddNode("a");
+  for (int i = 0; i < kNumKeys; ++i) {
+    EXPECT_EQ(ring1.NodeFor(Key(i)), 1 - ring2.NodeFor(Key(i)));
+  }
+}
+
+// A test fixture holding a ShardedKVStoreClient over in-memory KVStores.
+class ShardedKVStoreClientTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (int i = 0; i < 3; ++i) {
+      shards_.push_back(new KVStore);
+      client_.AddShard("shard" + std::to_string(i),
+                       std::unique_ptr<KVStoreInterface>(shards_.back()));
+    }
+  }
+
+  ShardedKVStoreClient client_;
+  // Shards owned by `client_`.
+  vector<KVStore*> shards_;
+};
+
+// Tests whether each key is only stored on the shard it belongs to.
+TEST_F(ShardedKVStoreClientTest, PutGetRemoveTest) {
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(client_.Put(Key(i), "v1"));
+    EXPECT_TRUE(client_.Put(Key(i), "v2"));
+  }
+  size_t num_keys = 0;
+  for (KVStore* shard : shards_) {
+    EXPECT_GT(shard->Size(), 0);
+    num_keys += shard->Size();
+  }
+  EXPECT_EQ(100, num_keys);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(vector<string>({"v1", "v2"}), client_.Get(Key(i)));
+    EXPECT_EQ(2, shards_[client_.ShardFor(Key(i))]->Get(Key(i)).size());
+  }
+  EXPECT_TRUE(client_.Remove(Key(0)));
+  EXPECT_FALSE(client_.Remove(Key(0)));
+  EXPECT_TRUE(client_.Get(Key(0)).empty());
+
+  // Keys of all shards are got at once, with their values in order.
+  vector<string> keys;
+  for (int i = 0; i < 100; ++i) {
+    keys.push_back(Key(i));
+  }
+  vector<vector<string>> values = client_.MultiGet(keys);
+  ASSERT_EQ(keys.size(), values.size());
+  EXPECT_TRUE(values[0].empty());
+  for (int i = 1; i < 100; ++i) {
+    EXPECT_EQ(vector<string>({"v1", "v2"}), values[i]);
+  }
+}
+
+// Tests whether a batch spanning all shards is applied in order
+// per key, with results in the order of the mutations.
+TEST_F(ShardedKVStoreClientTest, WriteTest) {
+  vector<KVMutation> mutations;
+  for (int i = 0; i < 100; ++i) {
+    mutations.push_back({KVMutation::kPut, Key(i), "v1"});
+    mutations.push_back({KVMutation::kRemove, Key(i + 100), ""});
+    mutations.push_back({KVMutation::kPut, Key(i), "v2"});
+  }
+  vector<bool> results = client_.Write(mutations);
+  ASSERT_EQ(mutations.size(), results.size());
+  for (size_t i = 0; i < mutations.size(); ++i) {
+    // Only the removes fail, since their keys do not exist.
+    EXPECT_EQ(mutations[i].type == KVMutation::kPut, results[i]);
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(vector<string>({"v1", "v2"}), client_.Get(Key(i)));
+  }
+}
+
+// A KVStore recording the trace IDs current when called in batches.
+class TracedKVStore : public KVStore {
+ public:
+  vector<vector<string>> MultiGet(const vector<string>& keys) const override {
+    Record();
+    return KVStore::MultiGet(keys);
+  }
+
+  vector<bool> Write(const vector<KVMutation>& mutations) override {
+    Record();
+    return KVStore::Write(mutations);
+  }
+
+  // Trace IDs (the lower half) current in each call so far.
+  vector<uint64_t> TraceIds() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return trace_ids_;
+  }
+
+ private:
+  void Record() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trace_ids_.push_back(CurrentTraceContext().trace_id_low);
+  }
+
+  mutable std::mutex mutex_;
+  mutable vector<uint64_t> trace_ids_;
+};
+
+// Tests whether the shards are called in the trace context of the caller,
+// though from other threads.
+TEST(ShardedKVStoreClientTraceTest, TraceContextTest) {
+  ShardedKVStoreClient client;
+  vector<TracedKVStore*> shards;
+  for (int i = 0; i < 3; ++i) {
+    shards.push_back(new TracedKVStore);
+    client.AddShard("shard" + std::to_string(i),
+                    std::unique_ptr<KVStoreInterface>(shards.back()));
+  }
+  vector<string> keys;
+  vector<KVMutation> mutations;
+  for (int i = 0; i < 100; ++i) {
+    keys.push_back(Key(i));
+    mutations.push_back({KVMutation::kPut, Key(i), "v"});
+  }
+  TraceContext trace_context;
+  trace_context.trace_id_low = 42;
+  trace_context.span_id = 1;
+  {
+    ScopedTraceContext scoped_trace_context(trace_context);
+    client.Write(mutations);
+    client.MultiGet(keys);
+  }
+  for (TracedKVStore* shard : shards) {
+    EXPECT_EQ(vector<uint64_t>({42, 42}), shard->TraceIds());
+  }
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
@@ -1,10 +1,14 @@
 #include "kvstore/kvstore.h"
 
+#include <sys/resource.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <filesystem>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
@@ -49,6 +53,7 @@ class PersistenceTest : public ::testing::Test {
   }
 
   void TearDown() override {
+    UnlimitFileSize();
     // Delete the temporary file.
     remove(filename_.c_str());
   }
@@ -58,7 +63,31 @@ class PersistenceTest : public ::testing::Test {
     return fs::file_size(fs::path{filename_});
   }
 
+  // Makes writes to files fail beyond the given size, as if the disk was
+  // full, until `UnlimitFileSize()` is called.
+  void LimitFileSize(rlim_t bytes) {
+    // Get an error from writes rather than a signal.
+    signal(SIGXFSZ, SIG_IGN);
+    rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    if (!limited_) {
+      old_limit_ = limit;
+      limited_ = true;
+    }
+    limit.rlim_cur = bytes;
+    setrlimit(RLIMIT_FSIZE, &limit);
+  }
+
+  void UnlimitFileSize() {
+    if (limited_) {
+      setrlimit(RLIMIT_FSIZE, &old_limit_);
+      limited_ = false;
+    }
+  }
+
   string filename_;
+  bool limited_ = false;
+  rlimit old_limit_;
 };
 
 // Tests the basic functionality of each interface.
@@ -123,6 +152,119 @@ TEST(SideEffectTest, GetTest) {
   EXPECT_TRUE(store.Empty());
 }
 
+// Tests the results and effects of a batch of mutations.
+TEST(MapTest, WriteTest) {
+  KVStore store{ {"k1", {"v1"}} };
+  vector<bool> keys_existed;
+  auto results = store.Write({{KVMutation::kPut, "k1", "v2"},
+                              {KVMutation::kRemove, "k2", ""},
+                              {KVMutation::kPut, "k2", "v3"},
+                              {KVMutation::kRemove, "k1", ""},
+                              {KVMutation::kPut, "k1", "v4"}},
+                             keys_existed);
+  EXPECT_TRUE(VectorEq({true, false, true, true, true}, std::move(results)));
+  EXPECT_TRUE(VectorEq({false, false, false, true, false},
+                       std::move(keys_existed)));
+  EXPECT_TRUE(VectorEq({"v4"}, store.Get("k1")));
+  EXPECT_TRUE(VectorEq({"v3"}, store.Get("k2")));
+}
+
+// Tests whether the number of bytes stored follows every kind of change.
+TEST(MapTest, BytesStoredTest) {
+  KVStore store{ {"k1", {"v1", "v22"}} };
+  EXPECT_EQ(7, store.BytesStored());
+  store.Put("k1", "v333");
+  store.Put("k22", "v1");
+  EXPECT_EQ(16, store.BytesStored());
+  store.Remove("k1");
+  store.Remove("k3");
+  EXPECT_EQ(5, store.BytesStored());
+  store.Write({{KVMutation::kPut, "k1", "v1"},
+               {KVMutation::kRemove, "k22", ""}});
+  EXPECT_EQ(4, store.BytesStored());
+  store.Clear();
+  EXPECT_EQ(0, store.BytesStored());
+}
+
+// Waits briefly for the next change of the subscription, and returns
+// a description like "3 put k1 v1", "4 resync" or "timeout".
+string NextChange(ChangeFeed::Subscription& subscription) {
+  std::shared_ptr<const KVChange> change;
+  uint64_t seq;
+  switch (subscription.Next(std::chrono::milliseconds(100), &change, &seq)) {
+    case ChangeFeed::Subscription::kTimeout:
+      return "timeout";
+    case ChangeFeed::Subscription::kResync:
+      return std::to_string(seq) + " resync";
+    default:
+      break;
+  }
+  switch (change->type) {
+    case KVChange::kPut:
+      return std::to_string(seq) + " put " + change->key + " " +
+          change->value;
+    case KVChange::kRemove:
+      return std::to_string(seq) + " remove " + change->key;
+    default:
+      return std::to_string(seq) + " clear";
+  }
+}
+
+// Tests whether watchers get the changes of their key or prefix
+// in commit order.
+TEST(WatchTest, KeyAndPrefixTest) {
+  KVStore store;
+  auto key_watcher = store.Watch("user.1", false, 0);
+  auto prefix_watcher = store.Watch("user.", true, 0);
+  store.Put("user.1", "v1");
+  store.Put("caw.1", "v2");
+  store.Write({{KVMutation::kPut, "user.2", "v3"},
+               {KVMutation::kRemove, "user.1", ""}});
+  store.Clear();
+  EXPECT_EQ(5, store.LastSequence());
+  EXPECT_EQ("1 put user.1 v1", NextChange(*key_watcher));
+  EXPECT_EQ("4 remove user.1", NextChange(*key_watcher));
+  EXPECT_EQ("5 clear", NextChange(*key_watcher));
+  EXPECT_EQ("timeout", NextChange(*key_watcher));
+  EXPECT_EQ("1 put user.1 v1", NextChange(*prefix_watcher));
+  EXPECT_EQ("3 put user.2 v3", NextChange(*prefix_watcher));
+  EXPECT_EQ("4 remove user.1", NextChange(*prefix_watcher));
+  EXPECT_EQ("5 clear", NextChange(*prefix_watcher));
+}
+
+// Tests whether watchers can start from a past change, and get a resync
+// signal if it is no longer kept.
+TEST(WatchTest, StartSequenceTest) {
+  ChangeFeed feed(2);
+  for (uint64_t seq = 1; seq <= 3; ++seq) {
+    feed.Publish({seq, KVChange::kPut, "k", "v" + std::to_string(seq)});
+  }
+  auto watcher = feed.Subscribe("k", false, 2);
+  EXPECT_EQ("2 put k v2", NextChange(*watcher));
+  EXPECT_EQ("3 put k v3", NextChange(*watcher));
+  auto future_watcher = feed.Subscribe("k", false, 5);
+  auto old_watcher = feed.Subscribe("k", false, 1);
+  EXPECT_EQ("3 resync", NextChange(*old_watcher));
+  feed.Publish({4, KVChange::kRemove, "k", ""});
+  feed.Publish({5, KVChange::kRemove, "k", ""});
+  EXPECT_EQ("4 remove k", NextChange(*watcher));
+  EXPECT_EQ("4 remove k", NextChange(*old_watcher));
+  EXPECT_EQ("5 remove k", NextChange(*future_watcher));
+}
+
+// Tests whether a slow watcher gets a resync signal instead of
+// holding back writers.
+TEST(WatchTest, SlowWatcherTest) {
+  ChangeFeed feed(0, 2);
+  auto watcher = feed.Subscribe("k", false, 0);
+  for (uint64_t seq = 1; seq <= 4; ++seq) {
+    feed.Publish({seq, KVChange::kPut, "k", "v" + std::to_string(seq)});
+  }
+  EXPECT_EQ("3 resync", NextChange(*watcher));
+  EXPECT_EQ("4 put k v4", NextChange(*watcher));
+  EXPECT_EQ("timeout", NextChange(*watcher));
+}
+
 // Tests the thread-safety of concurrent writes.
 TEST(ConcurrencyTest, ConcurrentWriteTest) {
   KVStore store;
@@ -226,6 +368,95 @@ TEST_F(PersistenceTest, PersistenceTest) {
   }
 }
 
+// Tests whether a batch of mutations is persisted to the file.
+TEST_F(PersistenceTest, WriteTest) {
+  {
+    KVStore store(filename_);
+    store.Put("k1", "v1");
+    store.Write({{KVMutation::kPut, "k1", "v2"},
+                 {KVMutation::kPut, "k2", "v3"},
+                 {KVMutation::kRemove, "k1", ""},
+                 {KVMutation::kPut, "k3", "v4"}});
+    store.Write({});
+  }
+  {
+    KVStore store(filename_);
+    ASSERT_EQ(2, store.Size());
+    EXPECT_TRUE(VectorEq({"v3"}, store.Get("k2")));
+    EXPECT_TRUE(VectorEq({"v4"}, store.Get("k3")));
+  }
+}
+
+// Tests whether the latencies of locking and persisting are recorded,
+// and the number of bytes stored is restored from the file.
+TEST_F(PersistenceTest, MetricsTest) {
+  {
+    KVStore store(filename_);
+    store.Put("k1", "v1");
+    store.Write({{KVMutation::kPut, "k1", "v2"},
+                 {KVMutation::kPut, "k2", "v3"}});
+    store.Remove("k2");
+    store.Get("k1");
+    const KVStore::Metrics& metrics = store.GetMetrics();
+    EXPECT_EQ(3, metrics.write_lock_wait.Snapshot().count);
+    EXPECT_LE(1, metrics.read_lock_wait.Snapshot().count);
+    EXPECT_EQ(4, metrics.log_append.Snapshot().count);
+    EXPECT_EQ(3, metrics.log_flush.Snapshot().count);
+    EXPECT_EQ(6, store.BytesStored());
+  }
+  {
+    KVStore store(filename_);
+    EXPECT_EQ(6, store.BytesStored());
+  }
+}
+
+// Tests whether sequence numbers carry over restarts, so that a watcher
+// can resume from the history replayed from the file.
+TEST_F(PersistenceTest, WatchTest) {
+  {
+    KVStore store(filename_);
+    store.Put("k1", "v1");
+    store.Remove("k1");
+    store.Put("k2", "v2");
+  }
+  KVStore store(filename_);
+  EXPECT_EQ(3, store.LastSequence());
+  auto watcher = store.Watch("k", true, 2);
+  store.Put("k1", "v3");
+  EXPECT_EQ("2 remove k1", NextChange(*watcher));
+  EXPECT_EQ("3 put k2 v2", NextChange(*watcher));
+  EXPECT_EQ("4 put k1 v3", NextChange(*watcher));
+}
+
+// Tests whether watchers still see changes that could not be persisted,
+// as the map keeps them, though the file and a reload lack them.
+TEST_F(PersistenceTest, WatchFailedWriteTest) {
+  KVStore store(filename_);
+  auto watcher = store.Watch("k", true, 0);
+  ASSERT_TRUE(store.Put("k1", "v1"));
+  LimitFileSize(GetFileSize());
+  EXPECT_FALSE(store.Put("k2", "v2"));
+  EXPECT_TRUE(VectorEq({"v2"}, store.Get("k2")));
+  EXPECT_FALSE(store.Remove("k1"));
+  EXPECT_EQ(vector<bool>({false}),
+            store.Write({{KVMutation::kPut, "k3", "v3"}}));
+  EXPECT_FALSE(store.Clear());
+  EXPECT_EQ(5, store.LastSequence());
+  EXPECT_EQ("1 put k1 v1", NextChange(*watcher));
+  EXPECT_EQ("2 put k2 v2", NextChange(*watcher));
+  EXPECT_EQ("3 remove k1", NextChange(*watcher));
+  EXPECT_EQ("4 put k3 v3", NextChange(*watcher));
+  EXPECT_EQ("5 clear", NextChange(*watcher));
+  EXPECT_EQ("timeout", NextChange(*watcher));
+
+  // Only the persisted change is reloaded, so the numbers restart after it.
+  UnlimitFileSize();
+  KVStore reloaded(filename_);
+  EXPECT_TRUE(VectorEq({"v1"}, reloaded.Get("k1")));
+  EXPECT_EQ(1, reloaded.Size());
+  EXPECT_EQ(1, reloaded.LastSequence());
+}
+
 // Tests the functionality to deal with corrupted file.
 TEST_F(PersistenceTest, CorruptedFileTest) {
   {
@@ -253,6 +484,74 @@ TEST_F(PersistenceTest, CorruptedFileTest) {
   ASSERT_EQ(old_size, GetFileSize());
 }
 
+// Tests whether a KVStore can rebuild the content of another one by
+// applying its log, even when the log is shipped in arbitrary pieces.
+TEST_F(PersistenceTest, LogShippingTest) {
+  KVStore primary(filename_);
+  primary.Put("k1", "v1");
+  primary.Put("k2", "v2");
+  primary.Clear();
+  primary.Put("k3", "v3");
+  primary.Write({{KVMutation::kPut, "k3", "v4"},
+                 {KVMutation::kPut, "k4", "v5"},
+                 {KVMutation::kRemove, "k4", ""}});
+  ASSERT_EQ(GetFileSize(), primary.LogSize());
+
+  KVStore replica;
+  size_t offset = 0;
+  string pending;
+  while (offset < primary.LogSize()) {
+    string data;
+    ASSERT_TRUE(primary.ReadLog(offset, 3, data));
+    offset += data.size();
+    pending += data;
+    pending.erase(0, replica.ApplyLog(pending));
+  }
+  EXPECT_TRUE(pending.empty());
+  ASSERT_EQ(1, replica.Size());
+  EXPECT_TRUE(VectorEq({"v3", "v4"}, replica.Get("k3")));
+
+  // A KVStore without a file has no log to ship.
+  string data;
+  EXPECT_EQ(0, replica.LogSize());
+  EXPECT_FALSE(replica.ReadLog(0, 3, data));
+  // Waiting for changes beyond the end of the log times out.
+  EXPECT_EQ(primary.LogSize(),
+            primary.WaitForLog(primary.LogSize(),
+                               std::chrono::milliseconds(10)));
+}
+
+// Tests whether changes shipped from another log are neither applied nor
+// skipped when they cannot be persisted, so that the file stays a copy of
+// the beginning of that log.
+TEST_F(PersistenceTest, ApplyLogFailureTest) {
+  string primary_filename = filename_ + ".primary";
+  remove(primary_filename.c_str());
+  string data;
+  {
+    KVStore primary(primary_filename);
+    primary.Put("k1", "v1");
+    primary.Put("k2", string(100, 'x'));
+    ASSERT_TRUE(primary.ReadLog(0, primary.LogSize(), data));
+  }
+  remove(primary_filename.c_str());
+
+  KVStore replica(filename_);
+  LimitFileSize(10);
+  EXPECT_EQ(0, replica.ApplyLog(data));
+  EXPECT_EQ(0, replica.Size());
+  EXPECT_EQ(0, replica.LogSize());
+  EXPECT_EQ(0, GetFileSize());
+
+  // Once the disk has room again, the same changes are applied.
+  UnlimitFileSize();
+  EXPECT_EQ(data.size(), replica.ApplyLog(data));
+  EXPECT_EQ(2, replica.Size());
+  EXPECT_EQ(data.size(), GetFileSize());
+  KVStore reloaded(filename_);
+  EXPECT_TRUE(VectorEq({"v1"}, reloaded.Get("k1")));
+}
+
 // Tests whether the persistence works well with long keys and values.
 TEST_F(PersistenceTest, LongStringTest) {
   vector<int> lens = {100, 1000, 10000, 100000};
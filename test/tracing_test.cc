@@ -0,0 +1,177 @@
+#include "common/tracing.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using std::string;
+using std::vector;
+
+// Tests whether contexts go to and from the `traceparent` format, and
+// malformed ones are rejected.
+TEST(TracingTest, TraceparentTest) {
+  TraceContext context;
+  context.trace_id_high = 0x0123456789abcdef;
+  context.trace_id_low = 42;
+  context.span_id = 0xfedcba9876543210;
+  context.sampled = true;
+  string traceparent = context.ToTraceparent();
+  EXPECT_EQ("00-0123456789abcdef000000000000002a-fedcba9876543210-01",
+            traceparent);
+
+  TraceContext parsed;
+  ASSERT_TRUE(TraceContext::Parse(traceparent, parsed));
+  EXPECT_EQ(context.trace_id_high, parsed.trace_id_high);
+  EXPECT_EQ(context.trace_id_low, parsed.trace_id_low);
+  EXPECT_EQ(context.span_id, parsed.span_id);
+  EXPECT_TRUE(parsed.sampled);
+
+  context.sampled = false;
+  ASSERT_TRUE(TraceContext::Parse(context.ToTraceparent(), parsed));
+  EXPECT_FALSE(parsed.sampled);
+
+  for (const string& malformed : {
+           string(""), string("00-0123"),
+           string("01-0123456789abcdef000000000000002a-fedcba9876543210-01"),
+           string("00-0123456789ABCDEF000000000000002a-fedcba9876543210-01"),
+           string("00-00000000000000000000000000000000-fedcba9876543210-01"),
+           string("00-0123456789abcdef000000000000002a-0000000000000000-01"),
+           string("00-0123456789abcdef000000000000002a+fedcba9876543210-01")}) {
+    EXPECT_FALSE(TraceContext::Parse(malformed, parsed)) << malformed;
+  }
+}
+
+// Tests whether the buffer keeps spans in order, drops spans once full,
+// and takes spans again once drained.
+TEST(TracingTest, BufferTest) {
+  TraceBuffer buffer(5);  // Rounded up to 8.
+  SpanRecord record = {};
+  for (uint64_t i = 1; i <= 10; ++i) {
+    record.span_id = i;
+    EXPECT_EQ(i <= 8, buffer.Add(record)) << i;
+  }
+  EXPECT_EQ(2, buffer.Dropped());
+  vector<SpanRecord> records;
+  buffer.Drain(records);
+  ASSERT_EQ(8, records.size());
+  for (uint64_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(i + 1, records[i].span_id);
+  }
+  records.clear();
+  buffer.Drain(records);
+  EXPECT_TRUE(records.empty());
+  for (uint64_t i = 11; i <= 13; ++i) {
+    record.span_id = i;
+    EXPECT_TRUE(buffer.Add(record));
+  }
+  buffer.Drain(records);
+  ASSERT_EQ(3, records.size());
+  EXPECT_EQ(11, records[0].span_id);
+}
+
+// Tests whether no span is lost nor duplicated while many threads add
+// spans and another drains them.
+TEST(TracingTest, ConcurrentBufferTest) {
+  const int kNumThreads = 4;
+  const uint64_t kNumSpans = 20000;
+  TraceBuffer buffer(1024);
+  std::atomic<int> num_writing(kNumThreads);
+  vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&buffer, &num_writing, t]() {
+      SpanRecord record = {};
+      for (uint64_t i = 0; i < kNumSpans; ++i) {
+        record.span_id = t * kNumSpans + i;
+        record.parent_span_id = record.span_id;
+        buffer.Add(record);
+      }
+      --num_writing;
+    });
+  }
+  vector<SpanRecord> records;
+  while (num_writing > 0) {
+    buffer.Drain(records);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  buffer.Drain(records);
+  EXPECT_EQ(kNumThreads * kNumSpans, records.size() + buffer.Dropped());
+  vector<bool> seen(kNumThreads * kNumSpans, false);
+  for (const SpanRecord& record : records) {
+    ASSERT_EQ(record.span_id, record.parent_span_id);
+    ASSERT_FALSE(seen[record.span_id]);
+    seen[record.span_id] = true;
+  }
+}
+
+// Tests whether spans nest within the current span, are only recorded
+// when sampled, and are exported to the trace file.
+TEST(TracingTest, SpanTest) {
+  Tracer& tracer = Tracer::Get();
+  tracer.Drain();
+  tracer.SetSampleRate(0);
+  {
+    ScopedSpan root("root", TraceContext());
+    EXPECT_FALSE(CurrentTraceContext().IsValid());
+    ScopedSpan child("child");
+  }
+  EXPECT_TRUE(tracer.Drain().empty());
+
+  string path = testing::TempDir() + "tracing_test.json";
+  ASSERT_TRUE(tracer.StartExport(path, std::chrono::milliseconds(10)));
+  tracer.SetSampleRate(1);
+  TraceContext root_context;
+  {
+    ScopedSpan root("root", TraceContext(), "a \"quoted\" detail");
+    root_context = CurrentTraceContext();
+    EXPECT_TRUE(root_context.sampled);
+    {
+      ScopedSpan child("child");
+      EXPECT_NE(root_context.span_id, CurrentTraceContext().span_id);
+    }
+    // Spans on other threads join the trace through its context.
+    std::thread([root_context]() {
+      ScopedTraceContext scoped_context(root_context);
+      ScopedSpan other("other");
+    }).join();
+    EXPECT_EQ(root_context.span_id, CurrentTraceContext().span_id);
+  }
+  EXPECT_FALSE(CurrentTraceContext().IsValid());
+  // Remote callers decide whether their traces are recorded.
+  TraceContext unsampled = root_context;
+  unsampled.sampled = false;
+  { ScopedSpan remote("remote", unsampled); }
+  tracer.StopExport();
+  tracer.SetSampleRate(0);
+
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  string json = contents.str();
+  EXPECT_EQ(0, json.find("[\n"));
+  char root_span_id[17];
+  snprintf(root_span_id, sizeof(root_span_id), "%016llx",
+           static_cast<unsigned long long>(root_context.span_id));
+  EXPECT_NE(string::npos, json.find("\"name\":\"root\""));
+  EXPECT_NE(string::npos, json.find("a \\\"quoted\\\" detail"));
+  EXPECT_NE(string::npos, json.find("\"name\":\"child\""));
+  EXPECT_NE(string::npos, json.find("\"name\":\"other\""));
+  EXPECT_EQ(string::npos, json.find("\"name\":\"remote\""));
+  // Both the child and the other span name the root as their parent.
+  size_t parent = json.find(string("\"parent_span_id\":\"") + root_span_id);
+  ASSERT_NE(string::npos, parent);
+  EXPECT_NE(string::npos, json.find(
+      string("\"parent_span_id\":\"") + root_span_id, parent + 1));
+  std::remove(path.c_str());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
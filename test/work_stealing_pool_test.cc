@@ -0,0 +1,64 @@
+#include "common/work_stealing_pool.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+// Tests whether all tasks submitted from outside and inside the pool
+// run, including those still queued when the pool is destroyed.
+TEST(WorkStealingPoolTest, RunAllTest) {
+  std::atomic<int> num_run(0);
+  {
+    WorkStealingPool pool(4);
+    EXPECT_EQ(4, pool.NumThreads());
+    for (int i = 0; i < 1000; ++i) {
+      pool.Submit([&pool, &num_run]() {
+        ++num_run;
+        pool.Submit([&num_run]() { ++num_run; });
+      });
+    }
+  }
+  EXPECT_EQ(2000, num_run);
+}
+
+// Tests whether a task queued behind a blocked task of the same thread
+// gets stolen by another thread.
+TEST(WorkStealingPoolTest, StealTest) {
+  WorkStealingPool pool(2);
+  std::promise<void> stolen_done;
+  std::promise<void> blocker_done;
+  pool.Submit([&]() {
+    // Queued to the queue of this thread, which is busy until the
+    // task runs.
+    pool.Submit([&]() { stolen_done.set_value(); });
+    stolen_done.get_future().wait();
+    blocker_done.set_value();
+  });
+  blocker_done.get_future().wait();
+}
+
+// Tests whether the queue depth counts the tasks waiting for a thread.
+TEST(WorkStealingPoolTest, QueueDepthTest) {
+  WorkStealingPool pool(1);
+  std::promise<void> started;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  pool.Submit([&]() {
+    started.set_value();
+    released.wait();
+  });
+  started.get_future().wait();
+  EXPECT_EQ(0, pool.QueueDepth());
+  for (int i = 0; i < 3; ++i) {
+    pool.Submit([]() {});
+  }
+  EXPECT_EQ(3, pool.QueueDepth());
+  release.set_value();
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}